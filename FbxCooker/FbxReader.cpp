@@ -0,0 +1,208 @@
+#include "pch.h"
+#include "FbxReader.h"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <zlib.h>
+
+namespace
+{
+	const char Magic[] = "Kaydara FBX Binary  ";
+
+	struct Cursor
+	{
+		const unsigned char *data;
+		size_t size;
+		bool wide;	// 64 bit record offsets, from version 7500
+	};
+
+	template <typename T>
+	T Read(const Cursor& file, size_t offset)
+	{
+		if (offset + sizeof(T) > file.size)
+			throw runtime_error("Truncated FBX file");
+		T value;
+		memcpy(&value, file.data + offset, sizeof(T));
+		return value;
+	}
+
+	// An array property, inflated if it was stored compressed.
+	template <typename T>
+	vector<T> ReadArray(const Cursor& file, size_t offset, char type)
+	{
+		unsigned int count = Read<unsigned int>(file, offset);
+		unsigned int encoding = Read<unsigned int>(file, offset + 4);
+		unsigned int length = Read<unsigned int>(file, offset + 8);
+		if (offset + 12 + length > file.size)
+			throw runtime_error("Truncated FBX file");
+
+		size_t elementSize = (type == 'd' || type == 'l') ? 8 : type == 'b' ? 1 : 4;
+		vector<unsigned char> raw(count * elementSize);
+		if (encoding == 0)
+		{
+			if (length != raw.size())
+				throw runtime_error("Bad FBX array");
+			memcpy(raw.data(), file.data + offset + 12, raw.size());
+		}
+		else
+		{
+			uLongf size = (uLongf)raw.size();
+			if (uncompress(raw.data(), &size, file.data + offset + 12, length) != Z_OK || size != raw.size())
+				throw runtime_error("Bad compressed FBX array");
+		}
+
+		vector<T> values(count);
+		for (unsigned int i = 0; i < count; i++)
+		{
+			const unsigned char *element = raw.data() + i * elementSize;
+			switch (type)
+			{
+			case 'd': { double v; memcpy(&v, element, 8); values[i] = (T)v; break; }
+			case 'f': { float v; memcpy(&v, element, 4); values[i] = (T)v; break; }
+			case 'l': { long long v; memcpy(&v, element, 8); values[i] = (T)v; break; }
+			case 'i': { int v; memcpy(&v, element, 4); values[i] = (T)v; break; }
+			default: values[i] = (T)element[0]; break;
+			}
+		}
+		return values;
+	}
+
+	// Size of the property at offset, so the next one can be found.
+	size_t PropertySize(const Cursor& file, size_t offset)
+	{
+		switch (Read<char>(file, offset))
+		{
+		case 'Y': return 1 + 2;
+		case 'C': return 1 + 1;
+		case 'I': case 'F': return 1 + 4;
+		case 'D': case 'L': return 1 + 8;
+		case 'S': case 'R': return 1 + 4 + Read<unsigned int>(file, offset + 1);
+		case 'f': case 'd': case 'l': case 'i': case 'b': return 1 + 12 + Read<unsigned int>(file, offset + 9);
+		default: throw runtime_error("Unknown FBX property type");
+		}
+	}
+
+	struct Geometry
+	{
+		string name;
+		vector<double> vertices;
+		vector<int> polygonVertices;
+	};
+
+	// Walks the node records below [offset, end), collecting every Geometry
+	// node's vertices and polygons.
+	void ReadNodes(const Cursor& file, size_t offset, size_t end, Geometry *geometry, vector<Geometry>& geometries)
+	{
+		const size_t header = file.wide ? 25 : 13;
+		while (offset + header <= end)
+		{
+			size_t recordEnd, numProperties, propertiesLength;
+			if (file.wide)
+			{
+				recordEnd = (size_t)Read<unsigned long long>(file, offset);
+				numProperties = (size_t)Read<unsigned long long>(file, offset + 8);
+				propertiesLength = (size_t)Read<unsigned long long>(file, offset + 16);
+			}
+			else
+			{
+				recordEnd = Read<unsigned int>(file, offset);
+				numProperties = Read<unsigned int>(file, offset + 4);
+				propertiesLength = Read<unsigned int>(file, offset + 8);
+			}
+			if (recordEnd == 0)
+				return;
+			if (recordEnd > file.size || recordEnd <= offset)
+				throw runtime_error("Bad FBX node record");
+
+			size_t nameLength = Read<unsigned char>(file, offset + header - 1);
+			string name((const char *)file.data + offset + header, nameLength);
+			size_t properties = offset + header + nameLength;
+
+			if (name == "Geometry")
+			{
+				geometries.emplace_back();
+				if (numProperties > 1 && Read<char>(file, properties + PropertySize(file, properties)) == 'S')
+				{
+					size_t nameProperty = properties + PropertySize(file, properties);
+					unsigned int length = Read<unsigned int>(file, nameProperty + 1);
+					geometries.back().name = string((const char *)file.data + nameProperty + 5, length).c_str();
+				}
+				ReadNodes(file, properties + propertiesLength, recordEnd, &geometries.back(), geometries);
+			}
+			else if (geometry != nullptr && numProperties == 1 && name == "Vertices")
+			{
+				geometry->vertices = ReadArray<double>(file, properties + 1, Read<char>(file, properties));
+			}
+			else if (geometry != nullptr && numProperties == 1 && name == "PolygonVertexIndex")
+			{
+				geometry->polygonVertices = ReadArray<int>(file, properties + 1, Read<char>(file, properties));
+			}
+			else if (name == "Objects" || geometry == nullptr)
+			{
+				ReadNodes(file, properties + propertiesLength, recordEnd, nullptr, geometries);
+			}
+			offset = recordEnd;
+		}
+	}
+}
+
+vector<unique_ptr<MeshData>> FbxReader::ReadMeshes(const string& filename)
+{
+	ifstream in(filename, ios::binary | ios::ate);
+	if (!in)
+		throw runtime_error("Failed to open " + filename);
+	vector<unsigned char> contents((size_t)in.tellg());
+	in.seekg(0);
+	in.read((char *)contents.data(), contents.size());
+
+	if (contents.size() < 27 || memcmp(contents.data(), Magic, sizeof(Magic) - 1) != 0)
+		throw runtime_error(filename + " is not a binary FBX file");
+
+	Cursor file = { contents.data(), contents.size(), false };
+	file.wide = Read<unsigned int>(file, 23) >= 7500;
+
+	vector<Geometry> geometries;
+	ReadNodes(file, 27, file.size, nullptr, geometries);
+
+	vector<unique_ptr<MeshData>> meshes;
+	for (auto& geometry : geometries)
+	{
+		const int numVertices = (int)geometry.vertices.size() / 3;
+		if (numVertices == 0 || numVertices > 65536)
+			continue;
+
+		auto mesh = make_unique<MeshData>();
+		mesh->name = geometry.name;
+		for (int v = 0; v < numVertices; v++)
+		{
+			mesh->positions.insert(mesh->positions.end(), { (float)geometry.vertices[v * 3 + 0],
+				(float)geometry.vertices[v * 3 + 1], (float)geometry.vertices[v * 3 + 2], 1.0f });
+			mesh->normals.insert(mesh->normals.end(), { 0.0f, 0.0f, 0.0f });
+			mesh->colors.insert(mesh->colors.end(), { 1.0f, 1.0f, 1.0f, 1.0f });
+		}
+
+		// The last corner of each polygon is stored as ~index, fan them
+		// into triangles.
+		size_t first = 0;
+		for (size_t i = 0; i < geometry.polygonVertices.size(); i++)
+		{
+			if (geometry.polygonVertices[i] >= 0)
+				continue;
+			for (size_t corner = first + 1; corner + 1 <= i; corner++)
+			{
+				int a = geometry.polygonVertices[first];
+				int b = geometry.polygonVertices[corner];
+				int c = geometry.polygonVertices[corner + 1];
+				if (c < 0)
+					c = ~c;
+				if (a >= numVertices || b >= numVertices || c >= numVertices)
+					throw runtime_error("Bad FBX polygon index");
+				mesh->indices.insert(mesh->indices.end(), { (unsigned short)a, (unsigned short)b, (unsigned short)c });
+			}
+			first = i + 1;
+		}
+		meshes.push_back(std::move(mesh));
+	}
+	return meshes;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "MeshData.h"
+
+using namespace std;
+
+// Reads just the mesh geometry out of a binary FBX file, positions and
+// triangulated polygons with white vertices, without the FBX SDK. The
+// benchmarks use it to run on the sample assets wherever they are built;
+// real conversion goes through Importer.
+class FbxReader
+{
+public:
+	// Throws on anything it can't parse. Meshes too big for 16 bit indices
+	// are left out.
+	static vector<unique_ptr<MeshData>> ReadMeshes(const string& filename);
+};
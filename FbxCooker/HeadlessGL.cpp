@@ -0,0 +1,107 @@
+#include "pch.h"
+#include "HeadlessGL.h"
+#include "GlState.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+HeadlessGL::HeadlessGL(int width, int height) :
+	_display(EGL_NO_DISPLAY),
+	_context(EGL_NO_CONTEXT),
+	_surface(EGL_NO_SURFACE),
+	_width(width),
+	_height(height)
+{
+	auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay)
+		_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	if (_display == EGL_NO_DISPLAY)
+		_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	if (_display == EGL_NO_DISPLAY || !eglInitialize(_display, nullptr, nullptr))
+		throw runtime_error("Failed to initialize EGL");
+
+	const EGLint configAttributes[] =
+	{
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_ALPHA_SIZE, 8,
+		EGL_DEPTH_SIZE, 24,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint numConfigs = 0;
+	if (!eglChooseConfig(_display, configAttributes, &config, 1, &numConfigs) || numConfigs == 0)
+		throw runtime_error("Failed to choose an EGL config");
+
+	eglBindAPI(EGL_OPENGL_ES_API);
+	const EGLint contextAttributes[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+	_context = eglCreateContext(_display, config, EGL_NO_CONTEXT, contextAttributes);
+	if (_context == EGL_NO_CONTEXT)
+		throw runtime_error("Failed to create an EGL context");
+
+	const EGLint surfaceAttributes[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+	_surface = eglCreatePbufferSurface(_display, config, surfaceAttributes);
+	if (_surface == EGL_NO_SURFACE || !eglMakeCurrent(_display, _surface, _surface, _context))
+		throw runtime_error("Failed to make the EGL context current");
+
+	glViewport(0, 0, width, height);
+
+	// The cache may still hold the state of an earlier context.
+	GlState::Current().Invalidate();
+}
+
+HeadlessGL::~HeadlessGL()
+{
+	eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	if (_surface != EGL_NO_SURFACE)
+		eglDestroySurface(_display, _surface);
+	if (_context != EGL_NO_CONTEXT)
+		eglDestroyContext(_display, _context);
+	eglTerminate(_display);
+}
+
+static GLuint CompileShader(GLenum type, const string& source)
+{
+	GLuint shader = glCreateShader(type);
+	const char *sourceArray[1] = { source.c_str() };
+	glShaderSource(shader, 1, sourceArray, nullptr);
+	glCompileShader(shader);
+
+	GLint compileResult;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compileResult);
+	if (compileResult == 0)
+	{
+		GLint infoLogLength;
+		glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLogLength);
+		vector<GLchar> infoLog(max(infoLogLength, 1));
+		glGetShaderInfoLog(shader, (GLsizei)infoLog.size(), nullptr, infoLog.data());
+		glDeleteShader(shader);
+		throw runtime_error(string("Shader compilation failed: ") + infoLog.data());
+	}
+	return shader;
+}
+
+GLuint HeadlessGL::CompileProgram(const string& vertexSource, const string& fragmentSource)
+{
+	GLuint program = glCreateProgram();
+	GLuint vs = CompileShader(GL_VERTEX_SHADER, vertexSource);
+	GLuint fs = CompileShader(GL_FRAGMENT_SHADER, fragmentSource);
+	glAttachShader(program, vs);
+	glDeleteShader(vs);
+	glAttachShader(program, fs);
+	glDeleteShader(fs);
+	glLinkProgram(program);
+
+	GLint linkStatus;
+	glGetProgramiv(program, GL_LINK_STATUS, &linkStatus);
+	if (linkStatus == 0)
+	{
+		glDeleteProgram(program);
+		throw runtime_error("Program link failed");
+	}
+	return program;
+}
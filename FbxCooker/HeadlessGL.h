@@ -0,0 +1,26 @@
+#pragma once
+#include "pch.h"
+#include <string>
+
+using namespace std;
+
+// An offscreen GLES2 context on Mesa's surfaceless EGL platform, so the
+// renderer's GL code can run on a Linux machine with no display.
+class HeadlessGL
+{
+public:
+	HeadlessGL(int width, int height);
+	~HeadlessGL();
+
+	GLuint CompileProgram(const string& vertexSource, const string& fragmentSource);
+
+	int Width() const { return _width; }
+	int Height() const { return _height; }
+
+private:
+	EGLDisplay _display;
+	EGLContext _context;
+	EGLSurface _surface;
+	int _width;
+	int _height;
+};
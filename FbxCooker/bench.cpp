@@ -0,0 +1,1898 @@
+//
+// fbxbench - measures the viewer's renderer code on a Linux machine, drawing
+// through Mesa's headless EGL and GLES.
+//
+// Usage: fbxbench [-n frames] [-t trace] [-f frame-times] <benchmark>... [file.fbx...]
+//
+//   layout     draw throughput of interleaved against split vertex streams,
+//              -t records its first frame as a GL trace for gltrace
+//   vao        CPU time per draw with and without vertex array objects
+//   pool       buffer switches and CPU time per draw with a buffer per mesh
+//              against geometry pools, and the time to defragment a pool
+//   clusters   triangles submitted after cluster culling against those
+//              actually visible, orbiting the given binary FBX files or the
+//              viewer's sample assets
+//   strips     draw time of each mesh as a triangle list and as a strip,
+//              against the one the importer would pick
+//   cleanup    triangles and vertices the importer's cleanup removes from
+//              each mesh, exactly and welding at a fraction of its size
+//   budget     time to share a triangle budget among the LODs of thousands
+//              of meshes
+//   queue      time to key and sort a frame's draws, against std::stable_sort
+//   frustum    time to cull bounding boxes and spheres against the stereo
+//              frustum a bound at a time, with SIMD on one core and across
+//              every core
+//   occlusion  time to draw walls into the occlusion culler's depth buffer
+//              and test boxes behind them against it, with GL checking
+//              that none of the boxes culled would have shown
+//   batching   draw calls and frame time of thousands of small boxes drawn
+//              a mesh each and merged into batches, with GL checking both
+//              draw the same picture, then the draw calls batching saves on
+//              the given binary FBX files or the sample assets
+//   governor   the resolution governor's decisions on made up frame time
+//              traces, heavy, changing load, hitches and locked to the
+//              display's refresh, and with -f on the frame times in a file
+//   frames     update to swap latency and missed refreshes with updates on
+//              the render thread and handed to it through the frame queue,
+//              at steady load, with update hitches and with heavy updates
+//   normals    octahedral normals decoded on the CPU and by the vertex
+//              shader, with GL checking every one is within the quantizer's
+//              error bound
+//
+
+#include "pch.h"
+#include "HeadlessGL.h"
+#include "FbxReader.h"
+#include "Mesh.h"
+#include "GlState.h"
+#include "GeometryPool.h"
+#include "GlTrace.h"
+#include "VertexCache.h"
+#include "Overdraw.h"
+#include "Stripifier.h"
+#include "MeshCleaner.h"
+#include "ThreadPool.h"
+#include "LodBudget.h"
+#include "RenderQueue.h"
+#include "FrustumCuller.h"
+#include "OcclusionCuller.h"
+#include "Batcher.h"
+#include "Model.h"
+#include "ResolutionGovernor.h"
+#include "FrameQueue.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = chrono::steady_clock;
+
+struct Options
+{
+	int frames = 10;
+	string trace;
+	string frameTimes;
+	vector<string> files;
+};
+
+static double Milliseconds(Clock::duration duration)
+{
+	return chrono::duration<double, milli>(duration).count();
+}
+
+// Checks of results known in advance that came out wrong, fbxbench exits
+// with an error if there are any so it can run as a test.
+static int Failures = 0;
+
+static void Expect(bool met, const char *failure)
+{
+	if (met)
+		return;
+	fprintf(stderr, "fbxbench: %s\n", failure);
+	Failures++;
+}
+
+// A wavy grid of size x size vertices, in the strip friendly row order the
+// optimisers would leave it in.
+static unique_ptr<MeshData> MakeGrid(int size, float phase)
+{
+	auto mesh = make_unique<MeshData>();
+	for (int y = 0; y < size; y++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			float u = x / (float)(size - 1);
+			float v = y / (float)(size - 1);
+			float height = 0.1f * sinf(u * 12.0f + phase) * cosf(v * 9.0f);
+			mesh->positions.insert(mesh->positions.end(), { u * 2.0f - 1.0f, v * 2.0f - 1.0f, height, 1.0f });
+			mesh->normals.insert(mesh->normals.end(), { 0.0f, 0.0f, 1.0f });
+			mesh->colors.insert(mesh->colors.end(), { u, v, 0.5f, 1.0f });
+		}
+	}
+	for (int y = 0; y + 1 < size; y++)
+	{
+		for (int x = 0; x + 1 < size; x++)
+		{
+			unsigned short v = (unsigned short)(y * size + x);
+			mesh->indices.insert(mesh->indices.end(), { v, (unsigned short)(v + size), (unsigned short)(v + 1) });
+			mesh->indices.insert(mesh->indices.end(), { (unsigned short)(v + 1), (unsigned short)(v + size), (unsigned short)(v + size + 1) });
+		}
+	}
+	return mesh;
+}
+
+// The renderer's non-holographic shaders, minus the transforms.
+static const string VertexShader = string(VertexQuantizer::NormalDecodeShader) + R"(
+	uniform vec3 uPositionScale;
+	uniform vec3 uPositionOffset;
+	attribute vec4 aPosition;
+	attribute vec4 aColor;
+	attribute vec2 aNormal;
+	varying vec4 vColor;
+	void main()
+	{
+		gl_Position = vec4(uPositionOffset + uPositionScale * aPosition.xyz, 1.0);
+		vec3 normal = DecodeNormal(aNormal);
+		vColor = vec4(aColor.rgb * (0.6 + 0.4 * max(dot(normal, vec3(0.0, 0.8, 0.6)), 0.0)), aColor.a);
+	}
+)";
+
+static const char *FragmentShader = R"(
+	precision mediump float;
+	varying vec4 vColor;
+	void main()
+	{
+		gl_FragColor = vColor;
+	}
+)";
+
+// A mesh drawn by program, which uses the renderer's attribute and uniform
+// names.
+static unique_ptr<Mesh> MakeMesh(GLuint program, unique_ptr<MeshData> data)
+{
+	auto mesh = make_unique<Mesh>();
+	mesh->SetPositionAttribLocation(glGetAttribLocation(program, "aPosition"));
+	mesh->SetColorAttribLocation(glGetAttribLocation(program, "aColor"));
+	mesh->SetNormalAttribLocation(glGetAttribLocation(program, "aNormal"));
+	mesh->SetPositionScaleUniformLocation(glGetUniformLocation(program, "uPositionScale"));
+	mesh->SetPositionOffsetUniformLocation(glGetUniformLocation(program, "uPositionOffset"));
+	mesh->SetData(std::move(data));
+	return mesh;
+}
+
+// Draws the same meshes in each layout. The target is tiny so the time goes
+// on vertex fetch and setup rather than on filling pixels.
+static void BenchLayout(const Options& options)
+{
+	HeadlessGL gl(64, 64);
+	GLuint program = gl.CompileProgram(VertexShader, FragmentShader);
+	glUseProgram(program);
+
+	const int numMeshes = 32;
+	const int gridSize = 96;
+	vector<unique_ptr<Mesh>> meshes;
+	int triangles = 0;
+	for (int i = 0; i < numMeshes; i++)
+	{
+		meshes.push_back(MakeMesh(program, MakeGrid(gridSize, (float)i)));
+		triangles += meshes.back()->Data().IndexCount() / 3;
+	}
+
+	// Alternate the layouts a few times and keep the best of each, so the
+	// comparison isn't skewed by whatever else the machine is doing.
+	const Mesh::VertexLayout layouts[] = { Mesh::VertexLayout::Split, Mesh::VertexLayout::Interleaved };
+	const int rounds = 3;
+	double best[2] = { 1e30, 1e30 };
+	double bestSubmit[2] = { 1e30, 1e30 };
+	GlState::Counters calls[2];
+
+	printf("layout: %d meshes, %d triangles, %d frames\n", numMeshes, triangles, options.frames);
+	for (int round = 0; round < rounds * 2; round++)
+	{
+		auto layout = layouts[round % 2];
+		if (round == 0 && !options.trace.empty())
+			GlTrace::Current().BeginFrame(options.trace);
+		for (auto& mesh : meshes)
+			mesh->SetVertexLayout(layout);
+
+		auto drawFrame = [&]()
+		{
+			glClear(GL_COLOR_BUFFER_BIT);
+			for (auto& mesh : meshes)
+				mesh->Render(false);
+			GlState::Current().EndFrame();
+		};
+
+		// The first frame pays for any buffer setup the driver deferred.
+		drawFrame();
+		glFinish();
+		GlTrace::Current().EndFrame();
+
+		Clock::duration submit{};
+		auto start = Clock::now();
+		for (int frame = 0; frame < options.frames; frame++)
+		{
+			auto submitStart = Clock::now();
+			drawFrame();
+			submit += Clock::now() - submitStart;
+			glFinish();
+		}
+		best[round % 2] = min(best[round % 2], Milliseconds(Clock::now() - start) / options.frames);
+		bestSubmit[round % 2] = min(bestSubmit[round % 2], Milliseconds(submit) / options.frames);
+		calls[round % 2] = GlState::Current().LastFrame();
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		printf("  %-12s %8.3f ms/frame  %8.3f ms submit  %8.1f Mtri/s  %4d GL state calls, %4d avoided\n",
+			layouts[i] == Mesh::VertexLayout::Interleaved ? "interleaved" : "split",
+			best[i], bestSubmit[i], triangles / (best[i] * 1000.0), calls[i].issued, calls[i].avoided);
+	}
+	printf("  interleaved is %.2fx the throughput of split\n", best[0] / best[1]);
+
+	meshes.clear();
+	glDeleteProgram(program);
+}
+
+// Hundreds of small meshes, so a frame's CPU time goes on setting up each
+// draw. Compares setting the attributes for every draw with binding a vertex
+// array that has them, in both layouts.
+static void BenchVertexArrays(const Options& options)
+{
+	HeadlessGL gl(64, 64);
+	GLuint program = gl.CompileProgram(VertexShader, FragmentShader);
+	glUseProgram(program);
+	if (!GlState::Current().HasVertexArrays())
+	{
+		printf("vao: OES_vertex_array_object not available\n");
+		glDeleteProgram(program);
+		return;
+	}
+
+	const int numMeshes = 500;
+	vector<unique_ptr<Mesh>> meshes;
+	for (int i = 0; i < numMeshes; i++)
+		meshes.push_back(MakeMesh(program, MakeGrid(4, (float)i)));
+
+	printf("vao: %d meshes, %d frames\n", numMeshes, options.frames);
+	printf("  %-12s %-10s %10s %12s %10s\n", "layout", "setup", "us/draw", "GL calls", "avoided");
+	const Mesh::VertexLayout layouts[] = { Mesh::VertexLayout::Split, Mesh::VertexLayout::Interleaved };
+	for (auto layout : layouts)
+	{
+		double best[2] = { 1e30, 1e30 };
+		GlState::Counters calls[2];
+		const int rounds = 3;
+		for (int round = 0; round < rounds * 2; round++)
+		{
+			const int useVertexArray = round % 2;
+			for (auto& mesh : meshes)
+			{
+				mesh->SetVertexLayout(layout);
+				mesh->SetUseVertexArray(useVertexArray != 0);
+			}
+
+			// The first frame makes the vertex arrays.
+			auto drawFrame = [&]()
+			{
+				for (auto& mesh : meshes)
+					mesh->Render(false);
+				GlState::Current().EndFrame();
+			};
+			drawFrame();
+			glFinish();
+
+			// Only the submission is timed, the GPU's share is the same
+			// either way.
+			Clock::duration submit{};
+			for (int frame = 0; frame < options.frames; frame++)
+			{
+				glClear(GL_COLOR_BUFFER_BIT);
+				auto start = Clock::now();
+				drawFrame();
+				submit += Clock::now() - start;
+				glFinish();
+			}
+			best[useVertexArray] = min(best[useVertexArray], 1000.0 * Milliseconds(submit) / (options.frames * numMeshes));
+			calls[useVertexArray] = GlState::Current().LastFrame();
+		}
+
+		for (int i = 0; i < 2; i++)
+		{
+			printf("  %-12s %-10s %10.2f %12d %10d\n", layout == Mesh::VertexLayout::Interleaved ? "interleaved" : "split",
+				i ? "vao" : "per draw", best[i], calls[i].issued, calls[i].avoided);
+		}
+	}
+
+	meshes.clear();
+	glDeleteProgram(program);
+}
+
+// Thousands of small meshes drawn from buffers of their own and from shared
+// geometry pools, then half of them released and the pools defragmented,
+// checking the rest still draw the same.
+static void BenchGeometryPool(const Options& options)
+{
+	HeadlessGL gl(64, 64);
+	GLuint program = gl.CompileProgram(VertexShader, FragmentShader);
+	glUseProgram(program);
+
+	const int numMeshes = 2000;
+	vector<unique_ptr<Mesh>> meshes;
+	for (int i = 0; i < numMeshes; i++)
+		meshes.push_back(MakeMesh(program, MakeGrid(4 + i % 5, (float)i)));
+
+	auto drawFrame = [&]()
+	{
+		for (auto& mesh : meshes)
+		{
+			if (mesh->HasDeviceResources())
+				mesh->Render(false);
+		}
+		GlState::Current().EndFrame();
+	};
+	auto readPixels = [&]()
+	{
+		glClear(GL_COLOR_BUFFER_BIT);
+		drawFrame();
+		vector<unsigned char> pixels(64 * 64 * 4);
+		glReadPixels(0, 0, 64, 64, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		return pixels;
+	};
+
+	auto vertices = make_shared<GeometryPool>(GL_ARRAY_BUFFER);
+	auto indices = make_shared<GeometryPool>(GL_ELEMENT_ARRAY_BUFFER);
+	const bool hasVertexArrays = GlState::Current().HasVertexArrays();
+	printf("pool: %d meshes, %d frames\n", numMeshes, options.frames);
+	printf("  %-8s %-10s %10s %12s %14s\n", "buffers", "setup", "us/draw", "GL calls", "buffer binds");
+	for (int pooled = 0; pooled < 2; pooled++)
+	{
+		for (auto& mesh : meshes)
+			mesh->SetGeometryPools(pooled ? vertices : nullptr, pooled ? indices : nullptr);
+
+		for (int useVertexArray = 0; useVertexArray < (hasVertexArrays ? 2 : 1); useVertexArray++)
+		{
+			for (auto& mesh : meshes)
+				mesh->SetUseVertexArray(useVertexArray != 0);
+
+			double best = 1e30;
+			GlState::Counters calls;
+			for (int round = 0; round < 3; round++)
+			{
+				drawFrame();
+				glFinish();
+				Clock::duration submit{};
+				for (int frame = 0; frame < options.frames; frame++)
+				{
+					glClear(GL_COLOR_BUFFER_BIT);
+					auto start = Clock::now();
+					drawFrame();
+					submit += Clock::now() - start;
+					glFinish();
+				}
+				best = min(best, 1000.0 * Milliseconds(submit) / (options.frames * numMeshes));
+				calls = GlState::Current().LastFrame();
+			}
+			printf("  %-8s %-10s %10.2f %12d %14d\n", pooled ? "pooled" : "own", useVertexArray ? "vao" : "per draw",
+				best, calls.issued, calls.bufferBinds);
+		}
+	}
+
+	auto printStats = [&](const char *when)
+	{
+		auto v = vertices->GetStats();
+		auto i = indices->GetStats();
+		printf("  %-22s %d + %d buffers, %d + %d allocations, %d KB of %d KB used, %d holes, largest free %d KB\n", when,
+			v.arenas, i.arenas, v.allocations, i.allocations, (v.used + i.used) / 1024, (v.capacity + i.capacity) / 1024,
+			v.holes + i.holes, max(v.largestFree, i.largestFree) / 1024);
+	};
+	printStats("loaded:");
+
+	// Every other mesh goes, as after reloading part of a scene.
+	for (size_t i = 0; i < meshes.size(); i += 2)
+		meshes[i]->ReleaseDeviceResources();
+	printStats("half released:");
+	auto before = readPixels();
+
+	auto start = Clock::now();
+	int moved = vertices->Defragment(numeric_limits<int>::max());
+	moved += indices->Defragment(numeric_limits<int>::max());
+	glFinish();
+	double elapsed = Milliseconds(Clock::now() - start);
+	printStats("defragmented:");
+	printf("  moved %d KB in %.2f ms, the meshes left draw %s\n", moved / 1024, elapsed,
+		readPixels() == before ? "the same" : "DIFFERENTLY");
+
+	meshes.clear();
+	glDeleteProgram(program);
+}
+
+// Shaders that also transform, for drawing real views.
+static const string ViewVertexShader = string(VertexQuantizer::NormalDecodeShader) + R"(
+	uniform mat4 uModelViewProjection;
+	uniform vec3 uPositionScale;
+	uniform vec3 uPositionOffset;
+	attribute vec4 aPosition;
+	attribute vec4 aColor;
+	attribute vec2 aNormal;
+	varying vec4 vColor;
+	void main()
+	{
+		gl_Position = uModelViewProjection * vec4(uPositionOffset + uPositionScale * aPosition.xyz, 1.0);
+		vec3 normal = DecodeNormal(aNormal);
+		vColor = vec4(aColor.rgb * (0.6 + 0.4 * max(dot(normal, vec3(0.0, 0.8, 0.6)), 0.0)), aColor.a);
+	}
+)";
+
+// Column major, as GL takes them.
+static void Multiply(const float *a, const float *b, float *result)
+{
+	for (int column = 0; column < 4; column++)
+	{
+		for (int row = 0; row < 4; row++)
+		{
+			result[column * 4 + row] = 0.0f;
+			for (int k = 0; k < 4; k++)
+				result[column * 4 + row] += a[k * 4 + row] * b[column * 4 + k];
+		}
+	}
+}
+
+static void LookAt(const float *eye, const float *target, float *result)
+{
+	float f[3] = { target[0] - eye[0], target[1] - eye[1], target[2] - eye[2] };
+	float length = sqrtf(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+	for (auto& x : f)
+		x /= length;
+	// Right is forward x up, with up along y.
+	float s[3] = { -f[2], 0.0f, f[0] };
+	length = sqrtf(s[0] * s[0] + s[2] * s[2]);
+	s[0] /= length;
+	s[2] /= length;
+	float u[3] = { s[1] * f[2] - s[2] * f[1], s[2] * f[0] - s[0] * f[2], s[0] * f[1] - s[1] * f[0] };
+
+	const float view[16] = {
+		s[0], u[0], -f[0], 0.0f,
+		s[1], u[1], -f[1], 0.0f,
+		s[2], u[2], -f[2], 0.0f,
+		-(s[0] * eye[0] + s[1] * eye[1] + s[2] * eye[2]),
+		-(u[0] * eye[0] + u[1] * eye[1] + u[2] * eye[2]),
+		f[0] * eye[0] + f[1] * eye[1] + f[2] * eye[2], 1.0f,
+	};
+	copy(view, view + 16, result);
+}
+
+static void Perspective(float fovY, float aspect, float zNear, float zFar, float *result)
+{
+	float f = 1.0f / tanf(fovY * 0.5f);
+	const float projection[16] = {
+		f / aspect, 0.0f, 0.0f, 0.0f,
+		0.0f, f, 0.0f, 0.0f,
+		0.0f, 0.0f, (zFar + zNear) / (zNear - zFar), -1.0f,
+		0.0f, 0.0f, 2.0f * zFar * zNear / (zNear - zFar), 0.0f,
+	};
+	copy(projection, projection + 16, result);
+}
+
+// Triangles that really show: facing the eye and not wholly outside any one
+// frustum plane. Occlusion is left out, so this is what a perfect per
+// triangle cull would submit.
+static int VisibleTriangles(const MeshData& mesh, const float *eye, const float (*planes)[4])
+{
+	const float *p = mesh.positions.data();
+	int visible = 0;
+	for (int t = 0; t < mesh.IndexCount() / 3; t++)
+	{
+		const float *a = p + mesh.indices[t * 3 + 0] * 4;
+		const float *b = p + mesh.indices[t * 3 + 1] * 4;
+		const float *c = p + mesh.indices[t * 3 + 2] * 4;
+		float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+		if (n[0] * (eye[0] - a[0]) + n[1] * (eye[1] - a[1]) + n[2] * (eye[2] - a[2]) <= 0.0f)
+			continue;
+
+		bool outside = false;
+		for (int plane = 0; plane < Clusters::NumPlanes && !outside; plane++)
+		{
+			auto distance = [&](const float *v)
+			{
+				return planes[plane][0] * v[0] + planes[plane][1] * v[1] + planes[plane][2] * v[2] + planes[plane][3];
+			};
+			outside = distance(a) < 0.0f && distance(b) < 0.0f && distance(c) < 0.0f;
+		}
+		visible += outside ? 0 : 1;
+	}
+	return visible;
+}
+
+// The sample assets next to the viewer, whichever of them are binary FBX.
+static vector<string> SampleAssets()
+{
+	vector<string> files;
+	for (auto& entry : filesystem::directory_iterator(FBXBENCH_ASSETS))
+	{
+		if (entry.path().extension() == ".fbx")
+			files.push_back(entry.path().string());
+	}
+	sort(files.begin(), files.end());
+	return files;
+}
+
+// The meshes of a model, or none after saying why the benchmark skips it.
+static vector<unique_ptr<MeshData>> ReadModel(const char *benchmark, const string& file)
+{
+	try
+	{
+		return FbxReader::ReadMeshes(file);
+	}
+	catch (const exception& e)
+	{
+		printf("%s: skipping %s, %s\n", benchmark, file.c_str(), e.what());
+		return {};
+	}
+}
+
+// The importer's triangle order: vertex cache, then overdraw, then cut into
+// culling clusters.
+static void OptimizeTriangles(MeshData& data)
+{
+	const int numIndices = data.IndexCount();
+	VertexCache::Reorder(data.indices.data(), VertexCache::Optimize(data.indices.data(), numIndices, data.VertexCount()));
+	VertexCache::Reorder(data.indices.data(), Overdraw::Optimize(data.positions.data(), data.indices.data(), numIndices));
+	VertexCache::Reorder(data.indices.data(), Clusters::Build(data.positions.data(), data.indices.data(),
+		numIndices, data.VertexCount(), data.clusters));
+}
+
+// Orbits each model at two distances, one where it fills the view and one
+// close enough that much of it is off screen, and compares the triangles
+// cluster culling submits with those actually visible.
+static void BenchClusters(const Options& options)
+{
+	HeadlessGL gl(256, 256);
+	GLuint program = gl.CompileProgram(ViewVertexShader, FragmentShader);
+	glUseProgram(program);
+	GLint matrixLocation = glGetUniformLocation(program, "uModelViewProjection");
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_BACK);
+	glFrontFace(GL_CCW);
+
+	auto files = options.files.empty() ? SampleAssets() : options.files;
+	for (auto& file : files)
+	{
+		auto datas = ReadModel("clusters", file);
+		vector<unique_ptr<Mesh>> meshes;
+		int triangles = 0, clusters = 0;
+		float lower[3] = { 1e30f, 1e30f, 1e30f }, upper[3] = { -1e30f, -1e30f, -1e30f };
+		for (auto& data : datas)
+		{
+			OptimizeTriangles(*data);
+			triangles += data->IndexCount() / 3;
+			clusters += (int)data->clusters.size();
+			for (int v = 0; v < data->VertexCount(); v++)
+			{
+				for (int axis = 0; axis < 3; axis++)
+				{
+					lower[axis] = min(lower[axis], data->positions[v * 4 + axis]);
+					upper[axis] = max(upper[axis], data->positions[v * 4 + axis]);
+				}
+			}
+			meshes.push_back(MakeMesh(program, std::move(data)));
+		}
+		if (meshes.empty())
+			continue;
+
+		float center[3], radius = 0.0f;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			center[axis] = (lower[axis] + upper[axis]) * 0.5f;
+			radius += (upper[axis] - lower[axis]) * (upper[axis] - lower[axis]) * 0.25f;
+		}
+		radius = max(sqrtf(radius), 1e-6f);
+
+		printf("clusters: %s, %d meshes, %d triangles in %d clusters, %d frames per view\n",
+			filesystem::path(file).filename().string().c_str(), (int)meshes.size(), triangles, clusters, options.frames);
+		printf("  %-8s %10s %10s %10s %9s %11s %11s\n", "distance", "submitted", "visible", "efficiency",
+			"cull us", "all ms", "culled ms");
+
+		const float fov = 1.0472f;
+		const float distances[] = { 1.0f / sinf(fov * 0.5f), 1.3f };
+		const float elevations[] = { -0.5f, 0.0f, 0.5f };
+		const int azimuths = 12;
+		for (float distance : distances)
+		{
+			long long submitted = 0, visible = 0, total = 0;
+			double cullTime = 0.0, frameTime[2] = { 0.0, 0.0 };
+			int views = 0;
+			for (float elevation : elevations)
+			{
+				for (int azimuth = 0; azimuth < azimuths; azimuth++)
+				{
+					float angle = azimuth * 6.2831853f / azimuths;
+					float eye[3] = {
+						center[0] + distance * radius * cosf(elevation) * sinf(angle),
+						center[1] + distance * radius * sinf(elevation),
+						center[2] + distance * radius * cosf(elevation) * cosf(angle),
+					};
+					float modelView[16], projection[16], modelViewProjection[16];
+					LookAt(eye, center, modelView);
+					Perspective(fov, 1.0f, radius * 0.01f, radius * (distance + 2.0f), projection);
+					Multiply(projection, modelView, modelViewProjection);
+					glUniformMatrix4fv(matrixLocation, 1, GL_FALSE, modelViewProjection);
+
+					float objectEye[3], planes[Clusters::NumPlanes][4];
+					auto cullStart = Clock::now();
+					Clusters::ObjectSpaceView(modelView, projection, objectEye, planes);
+					for (auto& mesh : meshes)
+						mesh->Cull(objectEye, planes, Clusters::NumPlanes);
+					cullTime += Milliseconds(Clock::now() - cullStart);
+
+					// Everything drawn first, then culled, each after a warm
+					// up frame.
+					for (int culled = 0; culled < 2; culled++)
+					{
+						for (auto& mesh : meshes)
+						{
+							if (culled)
+								mesh->Cull(objectEye, planes, Clusters::NumPlanes);
+							else
+								mesh->Cull(nullptr, nullptr, 0);
+						}
+						for (int frame = -1; frame < options.frames; frame++)
+						{
+							auto start = Clock::now();
+							glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+							for (auto& mesh : meshes)
+								mesh->Render(false);
+							glFinish();
+							if (frame >= 0)
+								frameTime[culled] += Milliseconds(Clock::now() - start);
+						}
+					}
+
+					for (auto& mesh : meshes)
+					{
+						submitted += mesh->DrawnTriangles();
+						visible += VisibleTriangles(mesh->Data(), objectEye, planes);
+						total += mesh->Data().IndexCount() / 3;
+					}
+					views++;
+				}
+			}
+			printf("  %-8.2f %9.1f%% %9.1f%% %9.1f%% %9.2f %11.3f %11.3f\n", distance,
+				100.0 * submitted / total, 100.0 * visible / total, 100.0 * visible / max(submitted, 1LL),
+				1000.0 * cullTime / views, frameTime[0] / (views * options.frames), frameTime[1] / (views * options.frames));
+		}
+	}
+	glDeleteProgram(program);
+}
+
+// Nonnegative costs c that best fit sum of counts[k] * c[k] to times, one
+// sample per row, by coordinate descent on the least squares problem.
+typedef array<double, 4> CostCounts;
+static CostCounts FitCosts(const vector<CostCounts>& counts, const vector<double>& times)
+{
+	const int n = (int)tuple_size<CostCounts>::value;
+	double normal[n][n] = {}, right[n] = {};
+	for (size_t s = 0; s < counts.size(); s++)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			right[i] += counts[s][i] * times[s];
+			for (int j = 0; j < n; j++)
+				normal[i][j] += counts[s][i] * counts[s][j];
+		}
+	}
+	CostCounts costs = {};
+	for (int iteration = 0; iteration < 1000; iteration++)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			if (normal[i][i] <= 0.0)
+				continue;
+			double rest = right[i];
+			for (int j = 0; j < n; j++)
+				rest -= j != i ? normal[i][j] * costs[j] : 0.0;
+			costs[i] = max(0.0, rest / normal[i][i]);
+		}
+	}
+	return costs;
+}
+
+// Draws every mesh of each model as the importer's list and as a strip,
+// and checks the importer's choice between them, and the one llvmpipe's
+// costs would make, against which one drew faster. Each mesh is drawn
+// enough times a frame to take measurable time, filling a small target so
+// vertex and index work dominates. The strip's extra indices, vertices
+// transformed, triangles assembled and the draw itself against the time it
+// takes over the list then fit Stripifier's costs for this GPU.
+static void BenchStrips(const Options& options)
+{
+	HeadlessGL gl(128, 128);
+	GLuint program = gl.CompileProgram(ViewVertexShader, FragmentShader);
+	glUseProgram(program);
+	GLint matrixLocation = glGetUniformLocation(program, "uModelViewProjection");
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+
+	const int drawTriangles = 200000;
+	const int maxRepeat = 256;
+	const int rounds = 5;
+	const double tieFraction = 0.03;
+	int agreed = 0, costAgreed = 0, compared = 0;
+	vector<CostCounts> extraCounts;
+	vector<double> extraNanoseconds;
+	vector<bool> ties;
+	auto files = options.files.empty() ? SampleAssets() : options.files;
+	for (auto& file : files)
+	{
+		auto datas = ReadModel("strips", file);
+		if (datas.empty())
+			continue;
+
+		printf("strips: %s, %d frames\n", filesystem::path(file).filename().string().c_str(), options.frames);
+		printf("  %-20s %9s %9s %9s %7s %7s %9s %9s %7s %7s\n", "mesh", "triangles", "list idx", "strip idx",
+			"list vc", "strip vc", "list ms", "strip ms", "picked", "faster");
+		for (size_t i = 0; i < datas.size(); i++)
+		{
+			auto& list = datas[i];
+			OptimizeTriangles(*list);
+			const int triangles = list->IndexCount() / 3;
+
+			auto strip = make_unique<MeshData>();
+			strip->positions = list->positions;
+			strip->normals = list->normals;
+			strip->colors = list->colors;
+			strip->clusters = list->clusters;
+			strip->indices = Stripifier::Stripify(list->indices.data(), list->IndexCount(), strip->clusters);
+			strip->strip = true;
+
+			bool picked = Stripifier::IsBetter(list->indices.data(), list->IndexCount(), strip->indices.data(), strip->IndexCount());
+			bool costPicked = Stripifier::IsBetter(list->indices.data(), list->IndexCount(), strip->indices.data(),
+				strip->IndexCount(), &Stripifier::LlvmpipeCosts);
+			int listMisses = VertexCache::Misses(list->indices.data(), list->IndexCount());
+			int stripMisses = VertexCache::Misses(strip->indices.data(), strip->IndexCount());
+			int listIndices = list->IndexCount(), stripIndices = strip->IndexCount();
+			string name = list->name.empty() ? "mesh " + to_string(i) : list->name;
+
+			// Looking at the mesh from the front, the quantized positions
+			// already span [offset, offset + scale].
+			unique_ptr<Mesh> meshes[] = { MakeMesh(program, std::move(list)), MakeMesh(program, std::move(strip)) };
+			float center[3], radius;
+			meshes[0]->Bounds(center, radius);
+			float eye[3] = { center[0], center[1], center[2] + radius * 2.5f };
+			float modelView[16], projection[16], modelViewProjection[16];
+			LookAt(eye, center, modelView);
+			Perspective(1.0472f, 1.0f, radius * 0.5f, radius * 4.0f, projection);
+			Multiply(projection, modelView, modelViewProjection);
+			glUniformMatrix4fv(matrixLocation, 1, GL_FALSE, modelViewProjection);
+
+			const int repeat = max(1, min(maxRepeat, drawTriangles / max(triangles, 1)));
+			double best[2] = { 1e30, 1e30 };
+			for (int round = 0; round < rounds * 2; round++)
+			{
+				auto& mesh = meshes[round % 2];
+				auto drawFrame = [&]()
+				{
+					glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+					for (int r = 0; r < repeat; r++)
+						mesh->Render(false);
+				};
+				drawFrame();
+				glFinish();
+
+				auto start = Clock::now();
+				for (int frame = 0; frame < options.frames; frame++)
+				{
+					drawFrame();
+					glFinish();
+				}
+				best[round % 2] = min(best[round % 2], Milliseconds(Clock::now() - start) / options.frames);
+			}
+
+			// Draws within a few percent of each other are too close to
+			// call on a timer, and either pick is right.
+			bool faster = best[1] < best[0];
+			bool tied = fabs(best[1] - best[0]) < tieFraction * min(best[0], best[1]);
+			agreed += picked == faster || tied ? 1 : 0;
+			costAgreed += costPicked == faster || tied ? 1 : 0;
+			compared++;
+			extraCounts.push_back({ (double)(stripIndices - listIndices), (double)(stripMisses - listMisses),
+				(double)(max(stripIndices - 2, 0) - triangles), 1.0 });
+			extraNanoseconds.push_back((best[1] - best[0]) * 1e6 / repeat);
+			ties.push_back(tied);
+			printf("  %-20.20s %9d %9d %9d %7.3f %7.3f %9.3f %9.3f %7s %7s\n", name.c_str(), triangles,
+				listIndices, stripIndices, (float)listMisses / triangles, (float)stripMisses / triangles,
+				best[0], best[1], picked ? "strip" : "list", tied ? "either" : faster ? "strip" : "list");
+		}
+	}
+	printf("strips: picked the faster topology for %d of %d meshes, llvmpipe's costs for %d\n", agreed, compared,
+		costAgreed);
+	if (compared == 0)
+	{
+		glDeleteProgram(program);
+		return;
+	}
+
+	CostCounts costs = FitCosts(extraCounts, extraNanoseconds);
+	int fitAgreed = 0;
+	for (size_t s = 0; s < extraCounts.size(); s++)
+	{
+		double extra = 0.0;
+		for (size_t i = 0; i < costs.size(); i++)
+			extra += extraCounts[s][i] * costs[i];
+		fitAgreed += (extra < 0.0) == (extraNanoseconds[s] < 0.0) || ties[s] ? 1 : 0;
+	}
+	auto& llvmpipe = Stripifier::LlvmpipeCosts;
+	printf("strips: llvmpipe's costs in ns index %.1f, vertex %.1f, triangle %.1f, strip draw %.1f\n", llvmpipe.index,
+		llvmpipe.vertex, llvmpipe.triangle, llvmpipe.stripDraw);
+	printf("strips: fitted index %.1f, vertex %.1f, triangle %.1f, strip draw %.1f, picking the faster for %d of %d "
+		"meshes\n", costs[0], costs[1], costs[2], costs[3], fitAgreed, compared);
+	glDeleteProgram(program);
+}
+
+// Cleans each mesh as the importer would, then again welding vertices within
+// 1/1000 and 1/100 of the mesh's size, timing each pass on every core.
+static void BenchCleanup(const Options& options)
+{
+	ThreadPool pool;
+	const float weldFractions[] = { 0.0f, 0.001f, 0.01f };
+	auto files = options.files.empty() ? SampleAssets() : options.files;
+	for (auto& file : files)
+	{
+		auto datas = ReadModel("cleanup", file);
+		if (datas.empty())
+			continue;
+
+		printf("cleanup: %s, %u threads\n", filesystem::path(file).filename().string().c_str(), pool.ThreadCount());
+		printf("  %-20s %6s %9s %9s %9s %9s %9s %9s\n", "mesh", "weld", "triangles", "vertices",
+			"welded", "degen", "dupes", "ms");
+		for (size_t i = 0; i < datas.size(); i++)
+		{
+			auto& data = *datas[i];
+			string name = data.name.empty() ? "mesh " + to_string(i) : data.name;
+			float low[3] = { 1e30f, 1e30f, 1e30f }, high[3] = { -1e30f, -1e30f, -1e30f };
+			for (int v = 0; v < data.VertexCount(); v++)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					low[k] = min(low[k], data.positions[v * 4 + k]);
+					high[k] = max(high[k], data.positions[v * 4 + k]);
+				}
+			}
+			float size = max(high[0] - low[0], max(high[1] - low[1], high[2] - low[2]));
+
+			for (float fraction : weldFractions)
+			{
+				MeshData copy;
+				vector<int> materials;
+				MeshCleaner::Result result;
+				double best = 1e30;
+				for (int frame = 0; frame < options.frames; frame++)
+				{
+					copy.positions = data.positions;
+					copy.normals = data.normals;
+					copy.colors = data.colors;
+					copy.indices = data.indices;
+					auto start = Clock::now();
+					result = MeshCleaner::Clean(copy, materials, fraction * size, pool);
+					best = min(best, Milliseconds(Clock::now() - start));
+				}
+				printf("  %-20.20s %6.3f %9d %9d %9d %9d %9d %9.3f\n", name.c_str(), fraction,
+					data.IndexCount() / 3, data.VertexCount(), result.weldedVertices,
+					result.degenerateTriangles, result.duplicateTriangles, best);
+			}
+		}
+	}
+}
+
+// Scenes of made up meshes with five LODs each, halving the triangles and
+// doubling the error each level, scattered from close by to far away, with
+// budgets of all of the scene at full detail down to a quarter of it.
+static void BenchBudget(const Options& options)
+{
+	const int meshCounts[] = { 1000, 4000, 16000 };
+	const int budgetPercents[] = { 100, 75, 25 };
+	const int rounds = 100;
+	printf("budget: best of %d frames of %d solves, from one view and from one moving 1%% closer a solve\n",
+		options.frames, rounds);
+	printf("  %8s %7s %11s %11s %11s %9s %9s %9s\n", "meshes", "budget", "full tris", "drawn tris", "full detail",
+		"add ms", "solve ms", "moving ms");
+	for (int count : meshCounts)
+	{
+		mt19937 random(count);
+		uniform_real_distribution<float> unit(0.0f, 1.0f);
+		vector<LodBudget::Level> levels;
+		vector<float> pixelsPerUnit;
+		int fullTriangles = 0;
+		for (int i = 0; i < count; i++)
+		{
+			int triangles = 500 + (int)(unit(random) * 20000);
+			float error = 0.0005f + unit(random) * 0.002f;
+			fullTriangles += triangles;
+			for (int level = 0; level < 5; level++)
+				levels.push_back({ triangles >> level, (triangles >> level) / 2, level == 0 ? 0.0f : error * (1 << level) });
+			pixelsPerUnit.push_back(2000.0f / (1.0f + unit(random) * 50.0f));
+		}
+
+		for (int percent : budgetPercents)
+		{
+			LodBudget budget;
+			budget.SetBudget((int)((long long)fullTriangles * percent / 100), numeric_limits<int>::max());
+			double bestAdd = 1e30, bestSolve = 1e30, bestMoving = 1e30;
+			for (int frame = 0; frame < options.frames; frame++)
+			{
+				Clock::duration add{}, solve{}, moving{};
+				for (int round = 0; round < rounds; round++)
+				{
+					auto start = Clock::now();
+					budget.Clear();
+					for (int i = 0; i < count; i++)
+						budget.Add(&levels[i * 5], 5, pixelsPerUnit[i], 0);
+					auto added = Clock::now();
+					budget.Solve();
+					solve += Clock::now() - added;
+					add += added - start;
+				}
+
+				// Closer, every mesh's priorities rise and the threshold
+				// moves every few solves.
+				for (int round = 0; round < rounds; round++)
+				{
+					float closer = powf(1.01f, (float)round);
+					budget.Clear();
+					for (int i = 0; i < count; i++)
+						budget.Add(&levels[i * 5], 5, pixelsPerUnit[i] * closer, 0);
+					auto added = Clock::now();
+					budget.Solve();
+					moving += Clock::now() - added;
+				}
+				bestAdd = min(bestAdd, Milliseconds(add) / rounds);
+				bestSolve = min(bestSolve, Milliseconds(solve) / rounds);
+				bestMoving = min(bestMoving, Milliseconds(moving) / rounds);
+			}
+
+			// The last solve was the moving one's.
+			budget.Clear();
+			for (int i = 0; i < count; i++)
+				budget.Add(&levels[i * 5], 5, pixelsPerUnit[i], 0);
+			budget.Solve();
+
+			int fullDetail = 0;
+			for (int i = 0; i < count; i++)
+				fullDetail += budget.Lod(i) == 0 ? 1 : 0;
+			printf("  %8d %6d%% %11d %11d %11d %9.4f %9.4f %9.4f\n", count, percent, fullTriangles, budget.Triangles(),
+				fullDetail, bestAdd, bestSolve, bestMoving);
+		}
+	}
+}
+
+// Keys and sorts made up draws, a tenth of them transparent, spread over a
+// scene's worth of materials and pool buffers, and checks the order.
+static void BenchQueue(const Options& options)
+{
+	const int drawCounts[] = { 1000, 10000, 100000 };
+	const int rounds = 100;
+	printf("queue: best of %d frames of %d sorts\n", options.frames, rounds);
+	printf("  %8s %9s %9s %9s %14s %8s\n", "draws", "key ms", "sort ms", "std ms", "state changes", "ordered");
+	for (int count : drawCounts)
+	{
+		mt19937 random(count);
+		uniform_real_distribution<float> unit(0.0f, 1.0f);
+		struct Item
+		{
+			RenderQueue::Layer layer;
+			unsigned int material;
+			unsigned int geometry;
+			float depth;
+		};
+		vector<Item> items;
+		for (int i = 0; i < count; i++)
+		{
+			items.push_back({ unit(random) < 0.1f ? RenderQueue::Layer::Transparent : RenderQueue::Layer::Opaque,
+				(unsigned int)(unit(random) * 200), 1 + (unsigned int)(unit(random) * 4), 0.5f + unit(random) * 50.0f });
+		}
+
+		RenderQueue queue;
+		vector<RenderQueue::Draw> copy;
+		double bestKey = 1e30, bestSort = 1e30, bestStd = 1e30;
+		for (int frame = 0; frame < options.frames; frame++)
+		{
+			Clock::duration key{}, sort{}, standard{};
+			for (int round = 0; round < rounds; round++)
+			{
+				auto start = Clock::now();
+				queue.Clear();
+				for (int i = 0; i < count; i++)
+				{
+					auto& item = items[i];
+					queue.Add(RenderQueue::MakeKey(item.layer, 0, item.material, item.geometry, item.depth), i);
+				}
+				auto keyed = Clock::now();
+				copy = queue.Draws();
+				auto copied = Clock::now();
+				queue.Sort();
+				auto sorted = Clock::now();
+				stable_sort(copy.begin(), copy.end(), [](const RenderQueue::Draw& a, const RenderQueue::Draw& b)
+				{
+					return a.key < b.key;
+				});
+				standard += Clock::now() - sorted;
+				sort += sorted - copied;
+				key += keyed - start;
+			}
+			bestKey = min(bestKey, Milliseconds(key) / rounds);
+			bestSort = min(bestSort, Milliseconds(sort) / rounds);
+			bestStd = min(bestStd, Milliseconds(standard) / rounds);
+		}
+
+		// Opaque first and front to back within a material and buffer,
+		// transparent back to front, and the same order stable_sort gives.
+		auto& draws = queue.Draws();
+		bool ordered = true;
+		int changes = 0;
+		for (size_t i = 0; i < draws.size(); i++)
+		{
+			ordered = ordered && draws[i].item == copy[i].item;
+			if (i == 0)
+				continue;
+			auto& a = items[draws[i - 1].item];
+			auto& b = items[draws[i].item];
+			changes += a.material != b.material || a.geometry != b.geometry ? 1 : 0;
+			ordered = ordered && a.layer <= b.layer;
+			if (a.layer == RenderQueue::Layer::Transparent && b.layer == RenderQueue::Layer::Transparent)
+				ordered = ordered && a.depth >= b.depth;
+			else if (a.layer == b.layer && a.material == b.material && a.geometry == b.geometry)
+				ordered = ordered && a.depth <= b.depth;
+		}
+		printf("  %8d %9.4f %9.4f %9.4f %14d %8s\n", count, bestKey, bestSort, bestStd, changes, ordered ? "yes" : "NO");
+		Expect(ordered, "queue: draws sorted out of order");
+	}
+}
+
+// Boxes of all sizes scattered around a head, tested against the frustum
+// both holographic eyes share, carried into an object space turned and
+// moved away from the head.
+static void BenchFrustum(const Options& options)
+{
+	const int boundCounts[] = { 10000, 100000, 1000000 };
+	const int rounds = 20;
+	ThreadPool pool;
+	printf("frustum: best of %d frames of %d culls, %u threads\n", options.frames, rounds, pool.ThreadCount());
+	printf("  %8s %8s %10s %10s %10s %7s\n", "bounds", "visible", "scalar ms", "simd ms", "threads ms", "agree");
+
+	const float angle = 0.5f;
+	const float modelView[16] = {
+		cosf(angle), 0.0f, -sinf(angle), 0.0f,
+		0.0f, 1.0f, 0.0f, 0.0f,
+		sinf(angle), 0.0f, cosf(angle), 0.0f,
+		0.5f, -0.2f, -5.0f, 1.0f,
+	};
+	Frustum frustum = Frustum::Stereo(0.064f, 0.364f, 0.2217f, 0.1f, 20.0f).Transformed(modelView);
+
+	for (int count : boundCounts)
+	{
+		mt19937 random(count);
+		uniform_real_distribution<float> position(-25.0f, 25.0f);
+		uniform_real_distribution<float> size(0.01f, 1.0f);
+		FrustumCuller culler;
+		for (int i = 0; i < count; i++)
+		{
+			float center[3] = { position(random), position(random), position(random) };
+			float extent[3] = { size(random), size(random), size(random) };
+			float boxMin[3], boxMax[3];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				boxMin[axis] = center[axis] - extent[axis];
+				boxMax[axis] = center[axis] + extent[axis];
+			}
+			culler.Add(boxMin, boxMax, center, sqrtf(extent[0] * extent[0] + extent[1] * extent[1] + extent[2] * extent[2]));
+		}
+
+		vector<unsigned char> scalar(count), simd(count), threaded(count);
+		int visible = 0;
+		double bestScalar = 1e30, bestSimd = 1e30, bestThreaded = 1e30;
+		for (int frame = 0; frame < options.frames; frame++)
+		{
+			Clock::duration scalarTime{}, simdTime{}, threadedTime{};
+			for (int round = 0; round < rounds; round++)
+			{
+				auto start = Clock::now();
+				visible = culler.CullScalar(frustum, scalar.data());
+				auto culled = Clock::now();
+				culler.Cull(frustum, simd.data());
+				auto simdCulled = Clock::now();
+				culler.Cull(frustum, threaded.data(), &pool);
+				threadedTime += Clock::now() - simdCulled;
+				simdTime += simdCulled - culled;
+				scalarTime += culled - start;
+			}
+			bestScalar = min(bestScalar, Milliseconds(scalarTime) / rounds);
+			bestSimd = min(bestSimd, Milliseconds(simdTime) / rounds);
+			bestThreaded = min(bestThreaded, Milliseconds(threadedTime) / rounds);
+		}
+
+		bool agree = scalar == simd && scalar == threaded;
+		printf("  %8d %8d %10.4f %10.4f %10.4f %7s\n", count, visible, bestScalar, bestSimd, bestThreaded,
+			agree ? "yes" : "NO");
+		Expect(agree, "frustum: the culls disagree");
+	}
+}
+
+// A quad facing +z split into cells x cells squares, so a wall has as many
+// triangles as a real occluder might.
+static unique_ptr<MeshData> MakeWall(float x0, float x1, float y0, float y1, float z, int cells)
+{
+	auto mesh = make_unique<MeshData>();
+	for (int y = 0; y <= cells; y++)
+	{
+		for (int x = 0; x <= cells; x++)
+			mesh->positions.insert(mesh->positions.end(), { x0 + (x1 - x0) * x / cells, y0 + (y1 - y0) * y / cells, z, 1.0f });
+	}
+	for (int y = 0; y < cells; y++)
+	{
+		for (int x = 0; x < cells; x++)
+		{
+			unsigned short v = (unsigned short)(y * (cells + 1) + x);
+			unsigned short above = (unsigned short)(v + cells + 1);
+			mesh->indices.insert(mesh->indices.end(), { v, (unsigned short)(v + 1), above });
+			mesh->indices.insert(mesh->indices.end(), { (unsigned short)(v + 1), (unsigned short)(above + 1), above });
+		}
+	}
+	mesh->ComputeBounds();
+	return mesh;
+}
+
+// Staggered rows of wall panels with gaps between them, like the partitions
+// of an office, and small boxes scattered among and behind them. Boxes the
+// occlusion culler hides are then drawn by GL behind the same walls at four
+// times its resolution, any box with a pixel showing was culled wrongly.
+static void BenchOcclusion(const Options& options)
+{
+	const int scale = 4;
+	HeadlessGL gl(OcclusionCuller::Width * scale, OcclusionCuller::Height * scale);
+	GLuint program = gl.CompileProgram(ViewVertexShader, FragmentShader);
+	glUseProgram(program);
+	glUniform3f(glGetUniformLocation(program, "uPositionScale"), 1.0f, 1.0f, 1.0f);
+	glUniform3f(glGetUniformLocation(program, "uPositionOffset"), 0.0f, 0.0f, 0.0f);
+	GLint positionLocation = glGetAttribLocation(program, "aPosition");
+	GLint colorLocation = glGetAttribLocation(program, "aColor");
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	glEnableVertexAttribArray(positionLocation);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LESS);
+
+	const float eye[3] = { 0.0f, 0.0f, 0.0f }, target[3] = { 0.0f, 0.0f, -1.0f };
+	float view[16], projection[16], viewProjection[16];
+	LookAt(eye, target, view);
+	Perspective(2.0f * atanf(0.4f), 2.0f, 0.1f, 100.0f, projection);
+	Multiply(projection, view, viewProjection);
+	glUniformMatrix4fv(glGetUniformLocation(program, "uModelViewProjection"), 1, GL_FALSE, viewProjection);
+
+	vector<unique_ptr<MeshData>> walls;
+	for (int row = 0; row < 6; row++)
+	{
+		for (int panel = 0; panel < 4; panel++)
+		{
+			float x = -10.5f + panel * 6.0f + (row % 2) * 3.0f;
+			walls.push_back(MakeWall(x, x + 5.0f, -2.0f, 2.0f, -3.0f - row * 3.0f, 16));
+		}
+	}
+
+	const int count = 20000;
+	mt19937 random(count);
+	uniform_real_distribution<float> x(-15.0f, 15.0f), y(-1.8f, 1.8f), z(-30.0f, -1.0f), size(0.05f, 0.2f);
+	vector<float> boxes;
+	FrustumCuller frustumCuller;
+	for (int i = 0; i < count; i++)
+	{
+		float center[3] = { x(random), y(random), z(random) };
+		float extent = size(random);
+		float boxMin[3] = { center[0] - extent, center[1] - extent, center[2] - extent };
+		float boxMax[3] = { center[0] + extent, center[1] + extent, center[2] + extent };
+		boxes.insert(boxes.end(), boxMin, boxMin + 3);
+		boxes.insert(boxes.end(), boxMax, boxMax + 3);
+		frustumCuller.Add(boxMin, boxMax, center, extent * 1.7321f);
+	}
+	vector<unsigned char> visible(count);
+	int inFrustum = frustumCuller.Cull(Frustum::FromMatrix(viewProjection), visible.data());
+
+	ThreadPool pool;
+	printf("occlusion: %d boxes, %d in the view, %d walls, mean of %d frames, %u threads\n", count, inFrustum,
+		(int)walls.size(), options.frames, pool.ThreadCount());
+	printf("  %9s %9s %10s %10s %9s %9s %9s %7s\n", "budget ms", "occluders", "raster ms", "threads ms", "test ms",
+		"worst ms", "occluded", "wrong");
+	const double budgets[] = { 1.0, 2.0, 100.0 };
+	OcclusionCuller culler;
+	for (double budget : budgets)
+	{
+		// A few frames first, for the culler to learn how long testing takes.
+		culler.SetBudget(budget);
+		const int warmUp = 4;
+		double raster[2] = {}, test = 0.0, worst = 0.0;
+		int occluders = 0, occludedTotal = 0;
+		vector<int> occluded;
+		for (int frame = -warmUp; frame < options.frames; frame++)
+		{
+			for (int threaded = 0; threaded < 2; threaded++)
+			{
+				auto start = Clock::now();
+				culler.Begin(viewProjection);
+				for (auto& wall : walls)
+				{
+					float distance = max(-wall->bounds.center[2], 1e-3f);
+					culler.AddOccluder(wall->positions.data(), wall->indices.data(), wall->IndexCount(),
+						wall->bounds.radius / distance);
+				}
+				culler.Rasterize(threaded ? &pool : nullptr);
+
+				auto tested = Clock::now();
+				occluded.clear();
+				for (int i = 0; i < count; i++)
+				{
+					if (visible[i] && culler.IsOccluded(&boxes[i * 6], &boxes[i * 6 + 3]))
+						occluded.push_back(i);
+				}
+				if (frame < 0)
+					continue;
+				raster[threaded] += culler.FrameStats().rasterMilliseconds;
+				test += Milliseconds(Clock::now() - tested) / 2;
+				worst = max(worst, Milliseconds(Clock::now() - start));
+				occluders += culler.FrameStats().occluders;
+				occludedTotal += (int)occluded.size();
+			}
+		}
+		const double runs = options.frames * 2.0;
+
+		// Walls in black, then each occluded box in a colour of its own.
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glVertexAttrib4f(colorLocation, 0.0f, 0.0f, 0.0f, 0.0f);
+		for (auto& wall : walls)
+		{
+			glVertexAttribPointer(positionLocation, 4, GL_FLOAT, GL_FALSE, 0, wall->positions.data());
+			glDrawElements(GL_TRIANGLES, wall->IndexCount(), GL_UNSIGNED_SHORT, wall->indices.data());
+		}
+		static const unsigned short BoxIndices[36] = {
+			0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5, 0, 4, 5, 0, 5, 1,
+			2, 3, 7, 2, 7, 6, 0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3,
+		};
+		for (int i : occluded)
+		{
+			float corners[8 * 3];
+			for (int corner = 0; corner < 8; corner++)
+			{
+				for (int axis = 0; axis < 3; axis++)
+					corners[corner * 3 + axis] = boxes[i * 6 + (corner >> axis & 1) * 3 + axis];
+			}
+			int id = i + 1;
+			glVertexAttrib4f(colorLocation, (id & 255) / 255.0f, (id >> 8 & 255) / 255.0f, (id >> 16 & 255) / 255.0f, 1.0f);
+			glVertexAttribPointer(positionLocation, 3, GL_FLOAT, GL_FALSE, 0, corners);
+			glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_SHORT, BoxIndices);
+		}
+		vector<unsigned char> pixels(gl.Width() * gl.Height() * 4);
+		glReadPixels(0, 0, gl.Width(), gl.Height(), GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		vector<bool> shown(count + 1, false);
+		for (size_t p = 0; p < pixels.size(); p += 4)
+			shown[pixels[p] | pixels[p + 1] << 8 | pixels[p + 2] << 16] = true;
+		int wrong = (int)count_if(shown.begin() + 1, shown.end(), [](bool b) { return b; });
+
+		printf("  %9.2f %9.1f %10.4f %10.4f %9.4f %9.4f %9.0f %7d\n", budget, occluders / runs,
+			raster[0] / options.frames, raster[1] / options.frames, test / options.frames, worst, occludedTotal / runs, wrong);
+	}
+	glDisableVertexAttribArray(positionLocation);
+	glDeleteProgram(program);
+}
+
+// A box with four vertices a face, so each face keeps its own normal.
+static unique_ptr<MeshData> MakeBox(const float *center, float halfSize, const float *color)
+{
+	auto mesh = make_unique<MeshData>();
+	for (int face = 0; face < 6; face++)
+	{
+		int axis = face / 2, u = (axis + 1) % 3, v = (axis + 2) % 3;
+		float sign = face % 2 == 0 ? 1.0f : -1.0f;
+		unsigned short first = (unsigned short)mesh->VertexCount();
+		for (int corner = 0; corner < 4; corner++)
+		{
+			float offset[3];
+			offset[axis] = sign;
+			offset[u] = corner & 1 ? 1.0f : -1.0f;
+			offset[v] = corner & 2 ? 1.0f : -1.0f;
+			for (int k = 0; k < 3; k++)
+				mesh->positions.push_back(center[k] + halfSize * offset[k]);
+			mesh->positions.push_back(1.0f);
+			float normal[3] = {};
+			normal[axis] = sign;
+			mesh->normals.insert(mesh->normals.end(), normal, normal + 3);
+			mesh->colors.insert(mesh->colors.end(), color, color + 4);
+		}
+		// Anticlockwise seen from outside.
+		if (sign > 0.0f)
+			mesh->indices.insert(mesh->indices.end(), { first, (unsigned short)(first + 1), (unsigned short)(first + 3),
+				first, (unsigned short)(first + 3), (unsigned short)(first + 2) });
+		else
+			mesh->indices.insert(mesh->indices.end(), { first, (unsigned short)(first + 3), (unsigned short)(first + 1),
+				first, (unsigned short)(first + 2), (unsigned short)(first + 3) });
+	}
+	return mesh;
+}
+
+// A town of small boxes in a few materials, a mesh and a node each like
+// cubegroup.fbx, seen from a camera circling inside it so much of it is
+// culled. It is drawn as it is and batched, reading back the last frame of
+// each to check both draw the same picture.
+static void BenchBatching(const Options& options)
+{
+	HeadlessGL gl(256, 256);
+	GLuint program = gl.CompileProgram(ViewVertexShader, FragmentShader);
+	glUseProgram(program);
+	GLint matrixLocation = glGetUniformLocation(program, "uModelViewProjection");
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+	glCullFace(GL_BACK);
+
+	const int side = 48, materials = 4;
+	const float colors[materials][4] = {
+		{ 0.8f, 0.2f, 0.2f, 1.0f }, { 0.2f, 0.8f, 0.2f, 1.0f }, { 0.2f, 0.2f, 0.8f, 1.0f }, { 0.8f, 0.8f, 0.2f, 1.0f },
+	};
+	float projection[16];
+	Perspective(1.0f, 1.0f, 0.1f, 200.0f, projection);
+	const float projectionScale = 0.5f * gl.Height() / tanf(0.5f);
+
+	printf("batching: %d boxes of %d materials, mean of %d frames\n", side * side, materials, options.frames);
+	printf("  %-9s %7s %7s %9s %9s %9s %9s %9s\n", "", "meshes", "culled", "draws", "triangles", "cpu ms", "frame ms",
+		"differ");
+	vector<unsigned char> pictures[2];
+	for (int batched = 0; batched < 2; batched++)
+	{
+		vector<unique_ptr<MeshData>> meshes;
+		vector<SceneNode> nodes(1);
+		for (int z = 0; z < side; z++)
+		{
+			for (int x = 0; x < side; x++)
+			{
+				int material = (x / 4 + z / 4) % materials;
+				float center[3] = { (x - side / 2) * 2.0f, 0.5f * ((x * 7 + z * 3) % 5), (z - side / 2) * 2.0f };
+				SceneNode node;
+				node.parent = 0;
+				node.mesh = (int)meshes.size();
+				node.materials.push_back("material " + to_string(material));
+				nodes.push_back(node);
+				meshes.push_back(MakeBox(center, 0.6f, colors[material]));
+				OptimizeTriangles(*meshes.back());
+			}
+		}
+
+		auto start = Clock::now();
+		Batcher::Stats stats;
+		if (batched)
+			stats = Batcher::Batch(meshes, nodes);
+		double batchMilliseconds = Milliseconds(Clock::now() - start);
+
+		Model model;
+		model.SetPositionAttribLocation(glGetAttribLocation(program, "aPosition"));
+		model.SetColorAttribLocation(glGetAttribLocation(program, "aColor"));
+		model.SetNormalAttribLocation(glGetAttribLocation(program, "aNormal"));
+		model.SetPositionScaleUniformLocation(glGetUniformLocation(program, "uPositionScale"));
+		model.SetPositionOffsetUniformLocation(glGetUniformLocation(program, "uPositionOffset"));
+		for (auto& data : meshes)
+		{
+			auto mesh = make_shared<Mesh>();
+			model.AddMesh(mesh);
+			mesh->SetData(std::move(data));
+		}
+		int numMeshes = (int)meshes.size();
+		model.SetNodes(std::move(nodes));
+		model.Loaded();
+
+		LodBudget budget;
+		double cpu = 0.0, frame = 0.0;
+		long long culled = 0, draws = 0, triangles = 0;
+		for (int f = 0; f < options.frames; f++)
+		{
+			float angle = 6.2832f * f / options.frames;
+			const float eye[3] = { 20.0f * cosf(angle), 6.0f, 20.0f * sinf(angle) };
+			const float target[3] = { eye[0] - 10.0f * sinf(angle), 0.0f, eye[2] + 10.0f * cosf(angle) };
+			float view[16], viewProjection[16];
+			LookAt(eye, target, view);
+			Multiply(projection, view, viewProjection);
+			glUniformMatrix4fv(matrixLocation, 1, GL_FALSE, viewProjection);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+			auto frameStart = Clock::now();
+			model.SetView(view, projection, projectionScale);
+			budget.Clear();
+			model.SelectLods(budget);
+			budget.Solve();
+			model.ApplyLods(budget);
+			model.Render(false);
+			cpu += Milliseconds(Clock::now() - frameStart);
+			glFinish();
+			frame += Milliseconds(Clock::now() - frameStart);
+
+			culled += model.CulledMeshes();
+			draws += model.DrawCalls();
+			triangles += model.DrawnTriangles();
+		}
+		pictures[batched].resize(gl.Width() * gl.Height() * 4);
+		glReadPixels(0, 0, gl.Width(), gl.Height(), GL_RGBA, GL_UNSIGNED_BYTE, pictures[batched].data());
+
+		int differ = 0;
+		for (size_t p = 0; batched && p < pictures[0].size(); p += 4)
+			differ += equal(&pictures[0][p], &pictures[0][p] + 4, &pictures[1][p]) ? 0 : 1;
+		const double frames = options.frames;
+		printf("  %-9s %7d %7.0f %9.1f %9.0f %9.3f %9.3f %9d\n", batched ? "batched" : "a mesh", numMeshes, culled / frames,
+			draws / frames, triangles / frames, cpu / frames, frame / frames, differ);
+		if (batched)
+			printf("  %d boxes merged into %d batches in %.2f ms, %d draw calls down to %d\n", stats.batchedMeshes,
+				stats.batches, batchMilliseconds, stats.DrawCallsBefore(), stats.DrawCallsAfter());
+	}
+
+	// Files give no materials here, so each mesh counts as having the same.
+	auto files = options.files.empty() ? SampleAssets() : options.files;
+	for (auto& file : files)
+	{
+		auto meshes = ReadModel("batching", file);
+		if (meshes.empty())
+			continue;
+		vector<SceneNode> nodes(meshes.size());
+		for (size_t i = 0; i < nodes.size(); i++)
+			nodes[i].mesh = (int)i;
+		auto stats = Batcher::Batch(meshes, nodes);
+		printf("  %s: %d meshes into %d batches, %d draw calls down to %d\n", filesystem::path(file).filename().string().c_str(),
+			stats.batchedMeshes, stats.batches, stats.DrawCallsBefore(), stats.DrawCallsAfter());
+	}
+	glDeleteProgram(program);
+}
+
+// Runs the governor over frames whose time depends on the scale it picks,
+// and prints how it went. Times at a scale of 1 come from fullScale, of
+// which gpuFraction goes with the pixels drawn. With a refresh interval,
+// frames take whole intervals as when waiting for the display.
+// Returns the governor as the trace left it.
+static ResolutionGovernor RunGovernor(const char *name, int frames, function<double(int)> fullScale,
+	double gpuFraction, double refreshMilliseconds, bool printHistory)
+{
+	ResolutionGovernor governor;
+	double target = governor.GetSettings().targetMilliseconds;
+	double scaleSum = 0.0, worst = 0.0;
+	for (int frame = 0; frame < frames; frame++)
+	{
+		float scale = governor.Scale();
+		double full = fullScale(frame);
+		double work = full * (1.0 - gpuFraction) + full * gpuFraction * scale * scale;
+		double taken = refreshMilliseconds > 0.0 ? ceil(work / refreshMilliseconds - 1e-9) * refreshMilliseconds : work;
+		scaleSum += scale;
+		worst = max(worst, taken);
+		governor.Update(taken);
+	}
+
+	auto& stats = governor.GetStats();
+	auto& history = governor.History();
+	int reversals = 0;
+	for (size_t i = 1; i < history.size(); i++)
+	{
+		bool up = history[i].toScale > history[i].fromScale;
+		bool wasUp = history[i - 1].toScale > history[i - 1].fromScale;
+		reversals += up != wasUp ? 1 : 0;
+	}
+	printf("  %-14s %6d %6.2f %6.3f %7d %7d %7d %9d %8.1f%% %8.1f\n", name, frames, governor.Scale(), scaleSum / frames,
+		stats.changes, stats.probes, stats.failedProbes, history.empty() ? 0 : history.back().frame,
+		100.0 * stats.overBudgetFrames / frames, worst / target);
+	if (printHistory)
+	{
+		for (auto& decision : history)
+			printf("  %14s frame %5d  %6.2f ms, %6.2f ms filtered  %.2f -> %.2f%s\n", "", decision.frame,
+				decision.frameMilliseconds, decision.filteredMilliseconds, decision.fromScale, decision.toScale,
+				decision.probe ? "  probe" : "");
+	}
+	return governor;
+}
+
+// Traces where the right scale is known. Most of a frame is taken as
+// drawing pixels, the rest fixed CPU and vertex work.
+static void BenchGovernor(const Options& options)
+{
+	ResolutionGovernor::Settings settings;
+	const double target = settings.targetMilliseconds;
+	printf("governor: target %.2f ms, scale %.2f to %.2f\n", target, settings.minScale, settings.maxScale);
+	printf("  %-14s %6s %6s %6s %7s %7s %7s %9s %9s %8s\n", "trace", "frames", "final", "mean", "changes", "probes",
+		"failed", "last", "over", "worst");
+
+	mt19937 random(49);
+	normal_distribution<double> noise(0.0, 0.03);
+	const double gpuFraction = 0.8;
+
+	// Twice what fits, and two thirds of it. Pixels at 0.61 scale fit.
+	auto heavy = RunGovernor("heavy", 1200, [&](int) { return 2.0 * target * (1.0 + noise(random)); }, gpuFraction,
+		0.0, false);
+	Expect(heavy.Scale() <= 0.605f, "governor: heavy settled above 0.6 scale");
+	RunGovernor("light", 1200, [&](int) { return 0.6 * target * (1.0 + noise(random)); }, gpuFraction, 0.0, false);
+
+	// Light, then heavy for 10 s, then light again.
+	RunGovernor("load step", 1800, [&](int frame)
+	{
+		return (frame >= 600 && frame < 1200 ? 1.6 : 0.7) * target * (1.0 + noise(random));
+	}, gpuFraction, 0.0, true);
+
+	// A 100 ms hitch every couple of seconds shouldn't move the scale.
+	auto hitches = RunGovernor("hitches", 1800, [&](int frame)
+	{
+		return frame % 150 == 149 ? 100.0 : 0.8 * target * (1.0 + noise(random));
+	}, gpuFraction, 0.0, false);
+	Expect(hitches.GetStats().changes == 0, "governor: hitches changed the scale");
+
+	// Waiting for the refresh hides headroom, only probing finds it.
+	RunGovernor("vsync heavy", 3600, [&](int) { return 1.5 * target * (1.0 + noise(random)); }, gpuFraction, target, true);
+	auto vsyncStep = RunGovernor("vsync step", 3600, [&](int frame)
+	{
+		return (frame < 1200 ? 1.5 : 0.7) * target * (1.0 + noise(random));
+	}, gpuFraction, target, false);
+	Expect(vsyncStep.Scale() == settings.maxScale, "governor: vsync step never got back to full scale");
+
+	if (options.frameTimes.empty())
+		return;
+
+	// One time in milliseconds a line, taken as measured at full scale.
+	ifstream in(options.frameTimes);
+	if (!in)
+		throw runtime_error("Can't read " + options.frameTimes);
+	vector<double> times;
+	for (double time; in >> time;)
+		times.push_back(time);
+	if (times.empty())
+		throw runtime_error("No frame times in " + options.frameTimes);
+	RunGovernor(filesystem::path(options.frameTimes).filename().string().c_str(), (int)times.size(),
+		[&](int frame) { return times[frame]; }, gpuFraction, 0.0, true);
+}
+
+// Sleeps stand in for update and draw work and for swaps waiting on a 60 Hz
+// display, so only the hand over between the loops is real. The update
+// loop is timed by updateMilliseconds(frame), the render loop by
+// renderMilliseconds, for the given number of refreshes.
+static void RunFrames(const char *name, bool threaded, int refreshes, function<double(int)> updateMilliseconds,
+	double renderMilliseconds)
+{
+	const auto refresh = chrono::duration_cast<Clock::duration>(chrono::duration<double, milli>(1000.0 / 60.0));
+	auto sleep = [](double milliseconds)
+	{
+		this_thread::sleep_for(chrono::duration<double, milli>(milliseconds));
+	};
+
+	FrameQueue queue;
+	FrameCommands frame;
+	bool hasFrame = false;
+	int swaps = 0, worstMissed = 0;
+	auto start = Clock::now();
+	auto swap = [&]
+	{
+		// Shown at the next refresh.
+		auto now = Clock::now();
+		long long refreshes = (now - start + refresh - Clock::duration(1)) / refresh;
+		this_thread::sleep_until(start + refreshes * refresh);
+		queue.Presented(frame);
+		worstMissed = max(worstMissed, (int)refreshes - swaps - 1);
+		swaps = (int)refreshes;
+	};
+
+	if (!threaded)
+	{
+		// Update, draw and swap in turn, as Run used to.
+		for (int i = 0; swaps < refreshes; i++)
+		{
+			sleep(updateMilliseconds(i));
+			auto& recording = queue.BeginFrame();
+			recording.frame = i;
+			recording.recorded = Clock::now();
+			queue.Publish();
+			frame = *queue.Acquire(Clock::duration::zero());
+			queue.Release();
+			sleep(renderMilliseconds);
+			swap();
+		}
+	}
+	else
+	{
+		atomic<bool> stopping(false);
+		thread update([&]
+		{
+			for (int i = 0; !stopping; i++)
+			{
+				sleep(updateMilliseconds(i));
+				auto& recording = queue.BeginFrame();
+				recording.frame = i;
+				recording.recorded = Clock::now();
+				queue.Publish();
+				queue.WaitUntilTaken(chrono::milliseconds(100));
+			}
+		});
+
+		// As App::RenderLoop, drawing the last frame again when the next is
+		// half a refresh late.
+		while (swaps < refreshes)
+		{
+			auto next = queue.Acquire(hasFrame ? refresh / 2 : chrono::milliseconds(100));
+			if (next != nullptr)
+			{
+				frame = *next;
+				queue.Release();
+				hasFrame = true;
+			}
+			else if (!hasFrame)
+			{
+				continue;
+			}
+			sleep(renderMilliseconds);
+			swap();
+		}
+		stopping = true;
+		queue.Stop();
+		update.join();
+	}
+
+	auto stats = queue.GetStats();
+	int shown = stats.presented + stats.repeated;
+	printf("  %-14s %-8s %6d %7d %7d %7d %7d %7d %9.2f %9.2f\n", name, threaded ? "threaded" : "one", refreshes,
+		stats.presented, stats.repeated, stats.dropped, refreshes - shown, worstMissed,
+		stats.meanLatencyMilliseconds, stats.worstLatencyMilliseconds);
+}
+
+// How the render thread keeps the display fed when the update side is slow
+// or stalls, and what handing frames over costs in latency.
+static void BenchFrames(const Options& options)
+{
+	const int refreshes = 240;
+	printf("frames: %d refreshes at 60 Hz, times in ms\n", refreshes);
+	printf("  %-14s %-8s %6s %7s %7s %7s %7s %7s %9s %9s\n", "load", "loop", "frames", "new", "again", "dropped",
+		"missed", "longest", "latency", "worst");
+
+	for (bool threaded : { false, true })
+		RunFrames("steady", threaded, refreshes, [](int) { return 3.0; }, 6.0);
+
+	// A 50 ms burst of window events or loading every second.
+	for (bool threaded : { false, true })
+		RunFrames("update hitches", threaded, refreshes, [](int frame) { return frame % 60 == 59 ? 50.0 : 3.0; }, 6.0);
+
+	// Update and draw fit a refresh each, not both.
+	for (bool threaded : { false, true })
+		RunFrames("heavy update", threaded, refreshes, [](int) { return 10.0; }, 10.0);
+}
+
+// A point per pixel, each decoding one normal and turning red when it's
+// further than uSine, the sine of the allowed error, from the unit normal it
+// was encoded from.
+static const string NormalCheckShader = string(VertexQuantizer::NormalDecodeShader) + R"(
+	uniform float uSine;
+	attribute vec2 aPixel;
+	attribute vec2 aNormal;
+	attribute vec3 aReference;
+	varying vec4 vColor;
+	void main()
+	{
+		gl_Position = vec4(aPixel, 0.0, 1.0);
+		gl_PointSize = 1.0;
+		vec3 decoded = DecodeNormal(aNormal);
+		bool wrong = length(cross(decoded, aReference)) > uSine || dot(decoded, aReference) < 0.0;
+		vColor = wrong ? vec4(1.0, 0.0, 0.0, 1.0) : vec4(0.0, 1.0, 0.0, 1.0);
+	}
+)";
+
+// Decodes normals on the CPU and in the vertex shader as the renderer does,
+// checking both against VertexQuantizer::NormalErrorDegrees, and at tighter
+// bounds to show the check would catch a worse decode.
+static void BenchNormals(const Options& options)
+{
+	const int size = 512;
+	HeadlessGL gl(size, size);
+	GLuint program = gl.CompileProgram(NormalCheckShader, FragmentShader);
+	glUseProgram(program);
+
+	// The axes, the diagonals and either side of the fold at z = 0 first,
+	// where the octahedral wrap and its sign handling go wrong, then random.
+	vector<float> normals;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		for (float sign : { 1.0f, -1.0f })
+		{
+			float normal[3] = { 0.0f, 0.0f, 0.0f };
+			normal[axis] = sign;
+			normals.insert(normals.end(), normal, normal + 3);
+		}
+	}
+	for (int octant = 0; octant < 8; octant++)
+	{
+		for (float z : { 1.0f, 1e-4f, 0.0f, -1e-4f })
+		{
+			float x = octant & 1 ? -1.0f : 1.0f, y = octant & 2 ? -1.0f : 1.0f;
+			z *= octant & 4 ? -1.0f : 1.0f;
+			float length = sqrtf(x * x + y * y + z * z);
+			normals.insert(normals.end(), { x / length, y / length, z / length });
+		}
+	}
+	mt19937 random(7);
+	normal_distribution<float> gaussian;
+	while (normals.size() < size * size * 3)
+	{
+		float x = gaussian(random), y = gaussian(random), z = gaussian(random);
+		float length = sqrtf(x * x + y * y + z * z);
+		if (length > 1e-3f)
+			normals.insert(normals.end(), { x / length, y / length, z / length });
+	}
+
+	int count = size * size;
+	vector<VertexQuantizer::Normal> encoded(count);
+	vector<float> pixels(count * 2);
+	double worst = 0.0;
+	for (int i = 0; i < count; i++)
+	{
+		const float *normal = &normals[i * 3];
+		encoded[i] = VertexQuantizer::EncodeNormal(normal);
+		float decoded[3];
+		VertexQuantizer::DecodeNormal(encoded[i], decoded);
+		double cosine = (double)decoded[0] * normal[0] + (double)decoded[1] * normal[1] + (double)decoded[2] * normal[2];
+		double crossX = (double)decoded[1] * normal[2] - (double)decoded[2] * normal[1];
+		double crossY = (double)decoded[2] * normal[0] - (double)decoded[0] * normal[2];
+		double crossZ = (double)decoded[0] * normal[1] - (double)decoded[1] * normal[0];
+		worst = max(worst, atan2(sqrt(crossX * crossX + crossY * crossY + crossZ * crossZ), cosine) * 57.29577951308232);
+		pixels[i * 2] = (i % size + 0.5f) * 2.0f / size - 1.0f;
+		pixels[i * 2 + 1] = (i / size + 0.5f) * 2.0f / size - 1.0f;
+	}
+
+	GLint pixelLocation = glGetAttribLocation(program, "aPixel");
+	GLint normalLocation = glGetAttribLocation(program, "aNormal");
+	GLint referenceLocation = glGetAttribLocation(program, "aReference");
+	GLuint buffers[3];
+	glGenBuffers(3, buffers);
+	glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+	glBufferData(GL_ARRAY_BUFFER, pixels.size() * sizeof(float), pixels.data(), GL_STATIC_DRAW);
+	glVertexAttribPointer(pixelLocation, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+	glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+	glBufferData(GL_ARRAY_BUFFER, encoded.size() * sizeof(VertexQuantizer::Normal), encoded.data(), GL_STATIC_DRAW);
+	glVertexAttribPointer(normalLocation, 2, GL_SHORT, GL_TRUE, 0, nullptr);
+	glBindBuffer(GL_ARRAY_BUFFER, buffers[2]);
+	glBufferData(GL_ARRAY_BUFFER, count * 3 * sizeof(float), normals.data(), GL_STATIC_DRAW);
+	glVertexAttribPointer(referenceLocation, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+	for (GLint location : { pixelLocation, normalLocation, referenceLocation })
+		glEnableVertexAttribArray(location);
+
+	float bound = VertexQuantizer::NormalErrorDegrees();
+	printf("normals: %d normals, bound %.4f degrees, CPU worst %.4f degrees\n", count, bound, worst);
+	printf("  %9s %9s %9s %9s\n", "degrees", "drawn", "wrong", "ms");
+	GLint sineLocation = glGetUniformLocation(program, "uSine");
+	vector<unsigned char> picture(count * 4);
+	for (float fraction : { 1.0f, 0.5f, 0.25f, 0.1f })
+	{
+		float degrees = bound * fraction;
+		glUniform1f(sineLocation, sinf(degrees / 57.29578f));
+		double best = 1e30;
+		for (int frame = 0; frame < options.frames; frame++)
+		{
+			glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+			glClear(GL_COLOR_BUFFER_BIT);
+			auto start = Clock::now();
+			glDrawArrays(GL_POINTS, 0, count);
+			glFinish();
+			best = min(best, Milliseconds(Clock::now() - start));
+		}
+		glReadPixels(0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, picture.data());
+		int drawn = 0, wrong = 0;
+		for (int p = 0; p < count; p++)
+		{
+			drawn += picture[p * 4] > 127 || picture[p * 4 + 1] > 127;
+			wrong += picture[p * 4] > 127;
+		}
+		printf("  %9.4f %9d %9d %9.2f\n", degrees, drawn, wrong, best);
+	}
+
+	for (GLint location : { pixelLocation, normalLocation, referenceLocation })
+		glDisableVertexAttribArray(location);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glDeleteBuffers(3, buffers);
+	glDeleteProgram(program);
+}
+
+struct Benchmark
+{
+	const char *name;
+	function<void(const Options&)> run;
+};
+
+static const Benchmark Benchmarks[] =
+{
+	{ "layout", BenchLayout },
+	{ "vao", BenchVertexArrays },
+	{ "pool", BenchGeometryPool },
+	{ "clusters", BenchClusters },
+	{ "strips", BenchStrips },
+	{ "cleanup", BenchCleanup },
+	{ "budget", BenchBudget },
+	{ "queue", BenchQueue },
+	{ "frustum", BenchFrustum },
+	{ "occlusion", BenchOcclusion },
+	{ "batching", BenchBatching },
+	{ "governor", BenchGovernor },
+	{ "frames", BenchFrames },
+	{ "normals", BenchNormals },
+};
+
+static void Usage()
+{
+	fprintf(stderr, "Usage: fbxbench [-n frames] [-t trace] [-f frame-times] <benchmark>... [file.fbx...]\n");
+	fprintf(stderr, "Benchmarks:");
+	for (auto& benchmark : Benchmarks)
+		fprintf(stderr, " %s", benchmark.name);
+	fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv)
+{
+	Options options;
+	vector<const Benchmark *> selected;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+		{
+			options.frames = max(1, atoi(argv[++i]));
+			continue;
+		}
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+		{
+			options.trace = argv[++i];
+			continue;
+		}
+		if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+		{
+			options.frameTimes = argv[++i];
+			continue;
+		}
+
+		const Benchmark *found = nullptr;
+		for (auto& benchmark : Benchmarks)
+		{
+			if (strcmp(argv[i], benchmark.name) == 0)
+				found = &benchmark;
+		}
+		if (!found && filesystem::is_regular_file(argv[i]))
+		{
+			options.files.push_back(argv[i]);
+			continue;
+		}
+		if (!found)
+		{
+			Usage();
+			return 1;
+		}
+		selected.push_back(found);
+	}
+	if (selected.empty())
+	{
+		Usage();
+		return 1;
+	}
+
+	try
+	{
+		for (auto benchmark : selected)
+			benchmark->run(options);
+	}
+	catch (const exception& e)
+	{
+		fprintf(stderr, "fbxbench: %s\n", e.what());
+		return 1;
+	}
+	return Failures > 0 ? 1 : 0;
+}
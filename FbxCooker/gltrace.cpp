@@ -0,0 +1,466 @@
+//
+// gltrace - reports on GL traces the viewer records, and replays them
+// through Mesa's headless EGL and GLES to time the command stream.
+//
+// Usage: gltrace [-r replays] file.gltrace...
+//
+// Statistics count each command, the calls that left the state they set as
+// it was, draws and the bytes uploaded. Replaying needs no assets: buffers
+// are filled with zeros, every program becomes one that reads the same
+// attributes, and uniforms are skipped, so it measures what the calls cost
+// the driver rather than what they draw.
+//
+
+#include "pch.h"
+#include "HeadlessGL.h"
+#include "GlTrace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static const char *CommandNames[] =
+{
+	"BindBuffer",
+	"DeleteBuffer",
+	"UseProgram",
+	"BindVertexArray",
+	"DeleteVertexArray",
+	"EnableVertexAttribArray",
+	"DisableVertexAttribArray",
+	"VertexAttribPointer",
+	"VertexAttribDivisor",
+	"Enable",
+	"Disable",
+	"CullFace",
+	"FrontFace",
+	"BufferData",
+	"BufferSubData",
+	"Uniform3fv",
+	"UniformMatrix4fv",
+	"DrawElements",
+	"DrawElementsInstanced",
+	"Clear",
+	"Error",
+	"EndFrame",
+	"DepthMask",
+	"BlendFunc",
+};
+static_assert(sizeof(CommandNames) / sizeof(CommandNames[0]) == (size_t)GlCommand::Count, "a name for every command");
+
+typedef vector<unsigned long long> Args;
+
+// What the trace has set so far, to tell which calls changed nothing. State
+// that belongs to a vertex array is kept per array, as GL does.
+class Shadow
+{
+public:
+	// Applies the call and returns whether it left the state as it was.
+	bool Redundant(const GlTrace::Call& call)
+	{
+		auto& a = call.args;
+		auto& array = _arrays[_vertexArray];
+		switch (call.command)
+		{
+		case GlCommand::BindBuffer:
+			return Set(a[0] == GL_ELEMENT_ARRAY_BUFFER ? array.elements : _buffers[a[0]], a);
+		case GlCommand::DeleteBuffer:
+			for (auto& buffer : _buffers)
+			{
+				if (buffer.second.size() == 2 && buffer.second[1] == a[0])
+					buffer.second.clear();
+			}
+			if (array.elements.size() == 2 && array.elements[1] == a[0])
+				array.elements.clear();
+			return false;
+		case GlCommand::UseProgram:
+			return Set(_program, a);
+		case GlCommand::BindVertexArray:
+			if (_vertexArray == a[0])
+				return true;
+			_vertexArray = a[0];
+			return false;
+		case GlCommand::DeleteVertexArray:
+			_arrays.erase(a[0]);
+			if (_vertexArray == a[0])
+				_vertexArray = 0;
+			return false;
+		case GlCommand::EnableVertexAttribArray:
+		case GlCommand::DisableVertexAttribArray:
+			return Set(array.attribs[a[0]].enabled, { call.command == GlCommand::EnableVertexAttribArray ? 1ull : 0ull });
+		case GlCommand::VertexAttribPointer:
+		{
+			// The pointer reads from the buffer bound at the time.
+			Args pointer = a;
+			pointer.push_back(_buffers[GL_ARRAY_BUFFER].empty() ? ~0ull : _buffers[GL_ARRAY_BUFFER][1]);
+			return Set(array.attribs[a[0]].pointer, pointer);
+		}
+		case GlCommand::VertexAttribDivisor:
+			return Set(array.attribs[a[0]].divisor, { a[1] });
+		case GlCommand::Enable:
+		case GlCommand::Disable:
+			return Set(_capabilities[a[0]], { call.command == GlCommand::Enable ? 1ull : 0ull });
+		case GlCommand::CullFace:
+			return Set(_cullFace, a);
+		case GlCommand::FrontFace:
+			return Set(_frontFace, a);
+		case GlCommand::DepthMask:
+			return Set(_depthMask, a);
+		case GlCommand::BlendFunc:
+			return Set(_blendFunc, a);
+		case GlCommand::Uniform3fv:
+		case GlCommand::UniformMatrix4fv:
+			return Set(_uniforms[make_pair(_program.empty() ? 0 : _program[0], a[0])], a);
+		default:
+			return false;
+		}
+	}
+
+private:
+	static bool Set(Args& state, const Args& value)
+	{
+		if (state == value)
+			return true;
+		state = value;
+		return false;
+	}
+
+	struct Attrib
+	{
+		Args enabled;
+		Args pointer;
+		Args divisor;
+	};
+
+	struct VertexArray
+	{
+		Args elements;
+		map<unsigned long long, Attrib> attribs;
+	};
+
+	map<unsigned long long, Args> _buffers;
+	Args _program;
+	unsigned long long _vertexArray = 0;
+	map<unsigned long long, VertexArray> _arrays;
+	map<unsigned long long, Args> _capabilities;
+	Args _cullFace;
+	Args _frontFace;
+	Args _depthMask;
+	Args _blendFunc;
+	map<pair<unsigned long long, unsigned long long>, Args> _uniforms;
+};
+
+static void Report(const string& filename, const vector<GlTrace::Call>& calls)
+{
+	long long counts[(int)GlCommand::Count] = {};
+	long long redundant[(int)GlCommand::Count] = {};
+	long long draws = 0, triangles = 0, instances = 0;
+	long long uploadCalls = 0, uploadBytes = 0, allocatedBytes = 0;
+	long long frameMicros = 0;
+	vector<unsigned long long> errors;
+
+	Shadow shadow;
+	for (auto& call : calls)
+	{
+		auto& a = call.args;
+		counts[(int)call.command]++;
+		if (shadow.Redundant(call))
+			redundant[(int)call.command]++;
+
+		switch (call.command)
+		{
+		case GlCommand::DrawElements:
+		case GlCommand::DrawElementsInstanced:
+		{
+			long long count = (long long)a[1];
+			long long drawn = a[0] == GL_TRIANGLE_STRIP ? max(count - 2, 0LL) : count / 3;
+			long long copies = call.command == GlCommand::DrawElementsInstanced ? (long long)a[4] : 1;
+			draws++;
+			instances += copies;
+			triangles += drawn * copies;
+			break;
+		}
+		case GlCommand::BufferData:
+			if (a[2])
+			{
+				uploadCalls++;
+				uploadBytes += (long long)a[1];
+			}
+			else
+			{
+				allocatedBytes += (long long)a[1];
+			}
+			break;
+		case GlCommand::BufferSubData:
+			uploadCalls++;
+			uploadBytes += (long long)a[2];
+			break;
+		case GlCommand::Error:
+			errors.push_back(a[0]);
+			break;
+		case GlCommand::EndFrame:
+			frameMicros += (long long)a[0];
+			break;
+		default:
+			break;
+		}
+	}
+
+	long long total = 0, totalRedundant = 0;
+	printf("%s: %d calls, %.3f ms of CPU time\n", filename.c_str(), (int)calls.size(), frameMicros / 1000.0);
+	printf("  %-26s %8s %10s\n", "command", "calls", "redundant");
+	for (int i = 0; i < (int)GlCommand::Count; i++)
+	{
+		if (counts[i] == 0 || i == (int)GlCommand::EndFrame)
+			continue;
+		printf("  %-26s %8lld %10lld\n", CommandNames[i], counts[i], redundant[i]);
+		total += counts[i];
+		totalRedundant += redundant[i];
+	}
+	printf("  %-26s %8lld %10lld\n", "total", total, totalRedundant);
+	printf("  draws: %lld, %lld instances, %lld triangles\n", draws, instances, triangles);
+	printf("  uploads: %lld bytes in %lld calls, %lld bytes allocated without data\n", uploadBytes, uploadCalls,
+		allocatedBytes);
+	for (auto error : errors)
+		printf("  error: 0x%04llx\n", error);
+}
+
+static const char *ReplayVertexShader = R"(
+	attribute vec4 a0;
+	attribute vec4 a1;
+	attribute vec4 a2;
+	attribute vec4 a3;
+	void main()
+	{
+		gl_Position = a0 + (a1 + a2 + a3) * 0.001;
+	}
+)";
+
+static const char *ReplayFragmentShader = R"(
+	precision mediump float;
+	void main()
+	{
+		gl_FragColor = vec4(1.0);
+	}
+)";
+
+// Replays the calls against the current context, GL objects are made when
+// the trace first names them.
+class Replayer
+{
+public:
+	explicit Replayer(HeadlessGL& gl)
+	{
+		_program = gl.CompileProgram(ReplayVertexShader, ReplayFragmentShader);
+		for (int i = 0; i < 4; i++)
+			glBindAttribLocation(_program, i, ("a" + to_string(i)).c_str());
+		glLinkProgram(_program);
+		_hasVertexArrays = strstr((const char *)glGetString(GL_EXTENSIONS), "GL_OES_vertex_array_object") != nullptr;
+	}
+
+	~Replayer()
+	{
+		for (auto& buffer : _buffers)
+			glDeleteBuffers(1, &buffer.second);
+		if (_hasVertexArrays)
+		{
+			for (auto& array : _arrays)
+				glDeleteVertexArraysOES(1, &array.second);
+		}
+		glDeleteProgram(_program);
+	}
+
+	void Replay(const vector<GlTrace::Call>& calls)
+	{
+		for (auto& call : calls)
+		{
+			auto& a = call.args;
+			switch (call.command)
+			{
+			case GlCommand::BindBuffer:
+				glBindBuffer((GLenum)a[0], Buffer(a[1]));
+				break;
+			case GlCommand::DeleteBuffer:
+				if (_buffers.count(a[0]))
+				{
+					glDeleteBuffers(1, &_buffers[a[0]]);
+					_buffers.erase(a[0]);
+				}
+				break;
+			case GlCommand::UseProgram:
+				glUseProgram(a[0] != 0 ? _program : 0);
+				break;
+			case GlCommand::BindVertexArray:
+				if (_hasVertexArrays)
+					glBindVertexArrayOES(VertexArray(a[0]));
+				break;
+			case GlCommand::DeleteVertexArray:
+				if (_hasVertexArrays && _arrays.count(a[0]))
+				{
+					glDeleteVertexArraysOES(1, &_arrays[a[0]]);
+					_arrays.erase(a[0]);
+				}
+				break;
+			case GlCommand::EnableVertexAttribArray:
+				glEnableVertexAttribArray((GLuint)a[0]);
+				break;
+			case GlCommand::DisableVertexAttribArray:
+				glDisableVertexAttribArray((GLuint)a[0]);
+				break;
+			case GlCommand::VertexAttribPointer:
+				glVertexAttribPointer((GLuint)a[0], (GLint)a[1], (GLenum)a[2], (GLboolean)a[3], (GLsizei)a[4],
+					(const void *)(uintptr_t)a[5]);
+				break;
+			case GlCommand::VertexAttribDivisor:
+				glVertexAttribDivisorANGLE((GLuint)a[0], (GLuint)a[1]);
+				break;
+			case GlCommand::Enable:
+				glEnable((GLenum)a[0]);
+				break;
+			case GlCommand::Disable:
+				glDisable((GLenum)a[0]);
+				break;
+			case GlCommand::CullFace:
+				glCullFace((GLenum)a[0]);
+				break;
+			case GlCommand::FrontFace:
+				glFrontFace((GLenum)a[0]);
+				break;
+			case GlCommand::DepthMask:
+				glDepthMask((GLboolean)a[0]);
+				break;
+			case GlCommand::BlendFunc:
+				glBlendFunc((GLenum)a[0], (GLenum)a[1]);
+				break;
+			case GlCommand::BufferData:
+				glBufferData((GLenum)a[0], (GLsizeiptr)a[1], a[2] ? Zeros(a[1]) : nullptr, (GLenum)a[3]);
+				break;
+			case GlCommand::BufferSubData:
+				glBufferSubData((GLenum)a[0], (GLintptr)a[1], (GLsizeiptr)a[2], Zeros(a[2]));
+				break;
+			case GlCommand::DrawElements:
+				glDrawElements((GLenum)a[0], (GLsizei)a[1], (GLenum)a[2], (const void *)(uintptr_t)a[3]);
+				break;
+			case GlCommand::DrawElementsInstanced:
+				glDrawElementsInstancedANGLE((GLenum)a[0], (GLsizei)a[1], (GLenum)a[2], (const void *)(uintptr_t)a[3],
+					(GLsizei)a[4]);
+				break;
+			case GlCommand::Clear:
+				glClear((GLbitfield)a[0]);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+private:
+	GLuint Buffer(unsigned long long name)
+	{
+		if (name == 0)
+			return 0;
+		auto& buffer = _buffers[name];
+		if (buffer == 0)
+			glGenBuffers(1, &buffer);
+		return buffer;
+	}
+
+	GLuint VertexArray(unsigned long long name)
+	{
+		if (name == 0)
+			return 0;
+		auto& array = _arrays[name];
+		if (array == 0)
+			glGenVertexArraysOES(1, &array);
+		return array;
+	}
+
+	const void *Zeros(unsigned long long size)
+	{
+		if (_zeros.size() < size)
+			_zeros.resize((size_t)size);
+		return _zeros.data();
+	}
+
+	GLuint _program;
+	bool _hasVertexArrays;
+	map<unsigned long long, GLuint> _buffers;
+	map<unsigned long long, GLuint> _arrays;
+	vector<unsigned char> _zeros;
+};
+
+static void Replay(const vector<GlTrace::Call>& calls, int replays)
+{
+	HeadlessGL gl(64, 64);
+	Replayer replayer(gl);
+
+	// The first replay makes the buffers and arrays the trace only binds.
+	replayer.Replay(calls);
+	glFinish();
+
+	double submit = 0.0, total = 0.0;
+	for (int i = 0; i < replays; i++)
+	{
+		auto start = Clock::now();
+		replayer.Replay(calls);
+		auto submitted = Clock::now();
+		glFinish();
+		submit += chrono::duration<double, milli>(submitted - start).count();
+		total += chrono::duration<double, milli>(Clock::now() - start).count();
+	}
+	printf("  replay: %.3f ms to submit, %.3f ms to finish, over %d replays\n", submit / replays, total / replays,
+		replays);
+
+	GLenum error;
+	while ((error = glGetError()) != GL_NO_ERROR)
+		printf("  replay error: 0x%04x\n", error);
+}
+
+static void Usage()
+{
+	fprintf(stderr, "Usage: gltrace [-r replays] file.gltrace...\n");
+}
+
+int main(int argc, char **argv)
+{
+	int replays = 0;
+	vector<string> files;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			replays = max(0, atoi(argv[++i]));
+		else
+			files.push_back(argv[i]);
+	}
+	if (files.empty())
+	{
+		Usage();
+		return 1;
+	}
+
+	try
+	{
+		for (auto& file : files)
+		{
+			auto calls = GlTrace::Read(file);
+			Report(file, calls);
+			if (replays > 0)
+				Replay(calls, replays);
+		}
+	}
+	catch (const exception& e)
+	{
+		fprintf(stderr, "gltrace: %s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,323 @@
+//
+// fbxcook - converts FBX files into cooked runtime data for the viewer.
+//
+// Usage: fbxcook [-j threads] [-o output-dir] [-w tolerance] [-b vertices] [-f] [-v] <file.fbx | directory>...
+//
+// Files whose cooked output is newer than the source and was cooked with the
+// same settings are skipped, and otherwise only the meshes whose source data
+// and settings hash differently from the previous cook are converted again. -f recooks everything, -v
+// prints the conversion stats (e.g. vertex cache miss ratios) of each mesh.
+// Degenerate and duplicate triangles are removed from every mesh and the
+// count lost is reported per file, -w also welds vertices closer than the
+// tolerance, in model units. Small meshes sharing a material are merged into
+// batches of up to -b vertices, 0 for none and at most 65536, and the draw
+// calls that saves are reported per file.
+//
+
+#include "pch.h"
+#include "Importer.h"
+#include "CookedFile.h"
+#include "ThreadPool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+using Clock = chrono::steady_clock;
+
+struct CookResult
+{
+	fs::path source;
+	bool succeeded = false;
+	string error;
+	double milliseconds = 0.0;
+	uintmax_t sourceBytes = 0;
+	uintmax_t cookedBytes = 0;
+	bool upToDate = false;
+	int meshes = 0;
+	int convertedMeshes = 0;
+	int vertices = 0;
+	int triangles = 0;
+	int removedTriangles = 0;
+	int drawCalls = 0;
+	int batchedDrawCalls = 0;
+	vector<string> meshStats;
+};
+
+static void Usage()
+{
+	fprintf(stderr, "Usage: fbxcook [-j threads] [-o output-dir] [-w tolerance] [-b vertices] [-f] [-v] <file.fbx | directory>...\n");
+}
+
+static bool IsFbx(const fs::path& path)
+{
+	string extension = path.extension().string();
+	for (auto& c : extension)
+		c = (char)tolower((unsigned char)c);
+	return extension == ".fbx";
+}
+
+static void CollectInputs(const fs::path& path, vector<fs::path>& inputs)
+{
+	if (fs::is_directory(path))
+	{
+		for (auto& entry : fs::recursive_directory_iterator(path))
+		{
+			if (entry.is_regular_file() && IsFbx(entry.path()))
+				inputs.push_back(entry.path());
+		}
+	}
+	else if (fs::is_regular_file(path))
+	{
+		inputs.push_back(path);
+	}
+	else
+	{
+		fprintf(stderr, "fbxcook: no such file or directory '%s'\n", path.string().c_str());
+	}
+}
+
+static bool CookedWith(const fs::path& target, unsigned long long settings)
+{
+	try
+	{
+		return CookedFile::ReadSettings(target.string().c_str()) == settings;
+	}
+	catch (const exception&)
+	{
+		return false;
+	}
+}
+
+static void Cook(const fs::path& source, const fs::path& outputDir, bool force, float weldTolerance,
+	int maxBatchVertices, ThreadPool& pool, CookResult& result)
+{
+	auto start = Clock::now();
+	result.source = source;
+	try
+	{
+		result.sourceBytes = fs::file_size(source);
+
+		fs::path target = (outputDir.empty() ? source.parent_path() : outputDir) / source.stem();
+		target += ".cooked";
+
+		unsigned long long settings = Importer::SettingsHash(weldTolerance, maxBatchVertices);
+		vector<unique_ptr<MeshData>> previous;
+		if (!force && fs::exists(target))
+		{
+			if (fs::last_write_time(target) >= fs::last_write_time(source) && CookedWith(target, settings))
+			{
+				result.upToDate = true;
+				result.succeeded = true;
+				result.cookedBytes = fs::file_size(target);
+				return;
+			}
+
+			// An unreadable or older format file just means a full cook.
+			try
+			{
+				previous = CookedFile::Read(target.string().c_str());
+			}
+			catch (const exception&)
+			{
+				previous.clear();
+			}
+		}
+
+		// Each task has its own importer and so its own FbxManager, the
+		// meshes it converts are optimised on the shared pool.
+		Importer importer;
+		importer.SetThreadPool(&pool);
+		importer.SetWeldTolerance(weldTolerance);
+		importer.SetMaxBatchVertices(maxBatchVertices);
+		vector<const MeshData *> previousMeshes;
+		for (auto& mesh : previous)
+			previousMeshes.push_back(mesh.get());
+		MeshHashes hashes = MeshData::HashesOf(previousMeshes);
+		auto meshes = importer.ConvertFile(source.string().c_str(), previous.empty() ? nullptr : &hashes);
+		for (auto& mesh : meshes)
+		{
+			if (mesh->unchanged)
+				continue;
+			result.convertedMeshes++;
+
+			string stats = "    " + mesh->name;
+			for (auto& stat : mesh->stats)
+			{
+				char value[64];
+				snprintf(value, sizeof(value), "  %s %.3f", stat.first.c_str(), stat.second);
+				stats += value;
+
+				if (stat.first == "degenerate triangles removed" || stat.first == "duplicate triangles removed")
+					result.removedTriangles += (int)stat.second;
+			}
+			result.meshStats.push_back(stats);
+		}
+		Importer::MergeUnchanged(meshes, previous);
+		result.drawCalls = importer.BatchStats().DrawCallsBefore();
+		result.batchedDrawCalls = importer.BatchStats().DrawCallsAfter();
+
+		vector<const MeshData *> cooked;
+		for (auto& mesh : meshes)
+			cooked.push_back(mesh.get());
+		CookedFile::Write(target.string().c_str(), cooked, importer.Nodes(), settings);
+
+		result.cookedBytes = fs::file_size(target);
+		result.meshes = (int)meshes.size();
+		for (auto& mesh : meshes)
+		{
+			result.vertices += mesh->VertexCount();
+			result.triangles += mesh->TriangleCount();
+		}
+		result.succeeded = true;
+	}
+	catch (const exception& e)
+	{
+		result.error = e.what();
+	}
+	result.milliseconds = chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int threads = 0;
+	bool force = false;
+	bool verbose = false;
+	float weldTolerance = 0.0f;
+	int maxBatchVertices = Batcher::DefaultMaxVertices;
+	fs::path outputDir;
+	vector<fs::path> inputs;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+		{
+			threads = (unsigned int)atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+		{
+			outputDir = argv[++i];
+		}
+		else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc)
+		{
+			weldTolerance = (float)atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc)
+		{
+			maxBatchVertices = atoi(argv[++i]);
+			if (maxBatchVertices < 0 || maxBatchVertices > Batcher::MaxVertices)
+			{
+				fprintf(stderr, "fbxcook: -b takes 0 to %d vertices, as many as 16 bit indices address\n", Batcher::MaxVertices);
+				return 2;
+			}
+		}
+		else if (strcmp(argv[i], "-f") == 0)
+		{
+			force = true;
+		}
+		else if (strcmp(argv[i], "-v") == 0)
+		{
+			verbose = true;
+		}
+		else if (argv[i][0] == '-')
+		{
+			Usage();
+			return 2;
+		}
+		else
+		{
+			CollectInputs(argv[i], inputs);
+		}
+	}
+
+	if (inputs.empty())
+	{
+		Usage();
+		return 2;
+	}
+
+	if (!outputDir.empty())
+		fs::create_directories(outputDir);
+
+	// Biggest files first so a large straggler doesn't start last.
+	sort(inputs.begin(), inputs.end(), [](const fs::path& a, const fs::path& b)
+	{
+		return fs::file_size(a) > fs::file_size(b);
+	});
+
+	vector<CookResult> results(inputs.size());
+	mutex printLock;
+	auto start = Clock::now();
+	{
+		ThreadPool pool(threads);
+		printf("Cooking %d files on %u threads\n", (int)inputs.size(), pool.ThreadCount());
+
+		for (size_t i = 0; i < inputs.size(); i++)
+		{
+			pool.Submit([&, i]
+			{
+				auto& result = results[i];
+				Cook(inputs[i], outputDir, force, weldTolerance, maxBatchVertices, pool, result);
+
+				lock_guard<mutex> lock(printLock);
+				if (result.upToDate)
+				{
+					printf("   up to date                                                                                %s\n",
+						result.source.string().c_str());
+				}
+				else if (result.succeeded)
+				{
+					printf("%9.1f ms  %6d/%-6d meshes %9d tris %7d removed %6d/%-6d draws  %8.2f MB/s  %s\n",
+						result.milliseconds, result.convertedMeshes, result.meshes, result.triangles, result.removedTriangles,
+						result.batchedDrawCalls, result.drawCalls,
+						result.sourceBytes / (1024.0 * 1024.0) / (result.milliseconds / 1000.0),
+						result.source.string().c_str());
+					if (verbose)
+					{
+						for (auto& stats : result.meshStats)
+							printf("%s\n", stats.c_str());
+					}
+				}
+				else
+				{
+					printf("   FAILED  %s: %s\n", result.source.string().c_str(), result.error.c_str());
+				}
+			});
+		}
+		pool.Wait();
+	}
+	double wall = chrono::duration<double, milli>(Clock::now() - start).count();
+
+	int failed = 0;
+	double busy = 0.0;
+	uintmax_t sourceBytes = 0;
+	uintmax_t cookedBytes = 0;
+	int removedTriangles = 0;
+	int drawCalls = 0;
+	int batchedDrawCalls = 0;
+	for (auto& result : results)
+	{
+		removedTriangles += result.removedTriangles;
+		drawCalls += result.drawCalls;
+		batchedDrawCalls += result.batchedDrawCalls;
+		busy += result.milliseconds;
+		sourceBytes += result.sourceBytes;
+		cookedBytes += result.cookedBytes;
+		if (!result.succeeded)
+			failed++;
+	}
+
+	printf("\n%d files (%d failed) in %.1f ms, %d triangles removed, %d draw calls batched down to %d\n",
+		(int)results.size(), failed, wall, removedTriangles, drawCalls, batchedDrawCalls);
+	printf("%.2f files/s, %.2f MB/s in, %.2f MB out, %.2fx parallel speedup\n",
+		results.size() / (wall / 1000.0), sourceBytes / (1024.0 * 1024.0) / (wall / 1000.0),
+		cookedBytes / (1024.0 * 1024.0), busy / wall);
+
+	return failed == 0 ? 0 : 1;
+}
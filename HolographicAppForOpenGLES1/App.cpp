@@ -5,7 +5,11 @@
 #include "pch.h"
 #include "app.h"
 #include "SimpleRenderer.h"
+#include "utils.h"
+#include <algorithm>
+#include <chrono>
 
+using namespace Windows::ApplicationModel;
 using namespace Windows::ApplicationModel::Core;
 using namespace Windows::ApplicationModel::Activation;
 using namespace Windows::UI::Core;
@@ -20,6 +24,14 @@ using namespace Platform;
 
 using namespace HolographicAppForOpenGLES1;
 
+// How long the render thread waits for the update loop's next frame before
+// it draws the last one again, as the display won't wait. Half a refresh at
+// 60 Hz, leaving the rest to draw in.
+static const double FrameWaitMilliseconds = 1000.0 / 120.0;
+
+// How often frame latency is logged, about every five seconds at 60 Hz.
+static const int FrameLogFrames = 300;
+
 // Helper to convert a length in device-independent pixels (DIPs) to a length in physical pixels.
 inline float ConvertDipsToPixels(float dips, float dpi)
 {
@@ -49,9 +61,15 @@ int main(Platform::Array<Platform::String^>^)
 App::App() :
     mWindowClosed(false),
     mWindowVisible(true),
+    mSuspended(false),
+    mStopRendering(false),
+    mRenderFailed(false),
     mEglDisplay(EGL_NO_DISPLAY),
     mEglContext(EGL_NO_CONTEXT),
-    mEglSurface(EGL_NO_SURFACE)
+    mEglSurface(EGL_NO_SURFACE),
+    mEglConfig(NULL),
+    mTimingFrames(false),
+    mCameraScale(1.0f)
 {
 }
 
@@ -63,6 +81,13 @@ void App::Initialize(CoreApplicationView^ applicationView)
     applicationView->Activated += 
         ref new TypedEventHandler<CoreApplicationView^, IActivatedEventArgs^>(this, &App::OnActivated);
 
+    // The app may be terminated while suspended, snapshot the scene so the
+    // next launch doesn't have to import it again.
+    CoreApplication::Suspending +=
+        ref new EventHandler<SuspendingEventArgs^>(this, &App::OnSuspending);
+    CoreApplication::Resuming +=
+        ref new EventHandler<Platform::Object^>(this, &App::OnResuming);
+
     // Logic for other event handlers could go here.
     // Information about the Suspending and Resuming event handlers can be found here:
     // http://msdn.microsoft.com/en-us/library/windows/apps/xaml/hh994930.aspx
@@ -77,16 +102,26 @@ void App::SetWindow(CoreWindow^ window)
     window->Closed += 
         ref new TypedEventHandler<CoreWindow^, CoreWindowEventArgs^>(this, &App::OnWindowClosed);
 
+    // F12 captures a GL trace of the next frame.
+    window->KeyDown +=
+        ref new TypedEventHandler<CoreWindow^, KeyEventArgs^>(this, &App::OnKeyDown);
+
     try
     {
         // Create a holographic space for the core window for the current view.
         mHolographicSpace = HolographicSpace::CreateForCoreWindow(window);
 
         // Get the default SpatialLocator.
-        SpatialLocator^ locator = SpatialLocator::GetDefault();
+        mLocator = SpatialLocator::GetDefault();
 
         // Create a stationary frame of reference.
-        mStationaryReferenceFrame = locator->CreateStationaryFrameOfReferenceAtCurrentLocation();
+        mStationaryReferenceFrame = mLocator->CreateStationaryFrameOfReferenceAtCurrentLocation();
+
+        // Keep the cameras, whose viewports the governor scales.
+        mHolographicSpace->CameraAdded +=
+            ref new TypedEventHandler<HolographicSpace^, HolographicSpaceCameraAddedEventArgs^>(this, &App::OnCameraAdded);
+        mHolographicSpace->CameraRemoved +=
+            ref new TypedEventHandler<HolographicSpace^, HolographicSpaceCameraRemovedEventArgs^>(this, &App::OnCameraRemoved);
 
         // The HolographicSpace has been created, so EGL can be initialized in holographic mode.
         InitializeEGL(mHolographicSpace);
@@ -122,42 +157,115 @@ void App::RecreateRenderer()
     }
 }
 
-// This method is called after the window becomes active.
+// The head as of now. ANGLE renders from a pose predicted a little further
+// ahead, the culling frustum has margin enough for the difference.
+void App::UpdateHeadPose()
+{
+    Windows::Globalization::Calendar^ calendar = ref new Windows::Globalization::Calendar();
+    calendar->SetToNow();
+    auto timestamp = Windows::Perception::PerceptionTimestampHelper::FromHistoricalTargetTime(calendar->GetDateTime());
+
+    SpatialLocation^ location = mLocator->TryLocateAtTimestamp(timestamp, mStationaryReferenceFrame->CoordinateSystem);
+    if (location == nullptr)
+    {
+        // Tracking lost, draw everything until it's back.
+        mCubeRenderer->ClearHeadPose();
+        return;
+    }
+
+    float position[3] = { location->Position.x, location->Position.y, location->Position.z };
+    float orientation[4] = { location->Orientation.x, location->Orientation.y, location->Orientation.z, location->Orientation.w };
+    mCubeRenderer->SetHeadPose(position, orientation);
+}
+
+// Times the frame just swapped, less the time the render thread waited for
+// the update loop, and renders the next at the scale the governor picks.
+// Without a holographic space that means a new window surface, the context
+// and all GL objects stay as they are. The renderer sees the surface's new
+// size as any other resize.
+void App::UpdateResolution(std::chrono::steady_clock::duration waited)
+{
+    auto now = std::chrono::steady_clock::now();
+    bool timed = mTimingFrames;
+    std::chrono::duration<double, std::milli> frameTime = now - mLastSwap - waited;
+    mLastSwap = now;
+    mTimingFrames = true;
+    if (!timed)
+    {
+        return;
+    }
+
+    mGovernor.Update(frameTime.count());
+    if (!mGovernor.Changed())
+    {
+        return;
+    }
+
+    auto& decision = mGovernor.History().back();
+    DebugLog(L"Frame %d took %.2f ms, %.2f ms filtered, resolution scale %.2f -> %.2f%s", decision.frame,
+        decision.frameMilliseconds, decision.filteredMilliseconds, decision.fromScale, decision.toScale,
+        decision.probe ? L", probing" : L"");
+
+    if (mHolographicSpace != nullptr)
+    {
+        std::lock_guard<std::mutex> lock(mCamerasLock);
+        mCameraScale = mGovernor.Scale();
+        for (auto camera : mCameras)
+        {
+            camera->ViewportScaleFactor = mCameraScale;
+        }
+    }
+    else
+    {
+        eglMakeCurrent(mEglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, mEglContext);
+        eglDestroySurface(mEglDisplay, mEglSurface);
+        mEglSurface = EGL_NO_SURFACE;
+        CreateSurface();
+    }
+
+    // Recreating the surface isn't part of any frame.
+    mLastSwap = std::chrono::steady_clock::now();
+}
+
+// This method is called after the window becomes active. It handles window
+// events and records frames, the render thread draws them.
 void App::Run()
 {
     while (!mWindowClosed)
     {
-        if (mWindowVisible)
+        // EGL failing to come back after a lost device is fatal, as it was
+        // when frames were drawn here.
+        if (mRenderFailed)
+        {
+            StopRenderThread();
+            std::rethrow_exception(mRenderError);
+        }
+
+        if (mWindowVisible && !mSuspended)
         {
             CoreWindow::GetForCurrentThread()->Dispatcher->ProcessEvents(CoreProcessEventsOption::ProcessAllIfPresent);
+            if (mSuspended)
+            {
+                continue;
+            }
 
-            EGLint panelWidth = 0;
-            EGLint panelHeight = 0;
-            eglQuerySurface(mEglDisplay, mEglSurface, EGL_WIDTH, &panelWidth);
-            eglQuerySurface(mEglDisplay, mEglSurface, EGL_HEIGHT, &panelHeight);
-            
-            // Logic to update the scene could go here
-            mCubeRenderer->UpdateWindowSize(panelWidth, panelHeight);
-            mCubeRenderer->Draw();
+            // Stopped to save the scene on suspending, started again once
+            // resumed.
+            if (!mRenderThread.joinable())
+            {
+                StartRenderThread();
+            }
 
-            // The call to eglSwapBuffers might not be successful (e.g. due to Device Lost)
-            // If the call fails, then we must reinitialize EGL and the GL resources.
-            if (eglSwapBuffers(mEglDisplay, mEglSurface) != GL_TRUE)
+            // Logic to update the scene could go here
+            if (mHolographicSpace != nullptr)
             {
-                mCubeRenderer.reset(nullptr);
-                CleanupEGL();
-
-                if (mHolographicSpace != nullptr)
-                {
-                    InitializeEGL(mHolographicSpace);
-                }
-                else
-                {
-                    InitializeEGL(CoreWindow::GetForCurrentThread());
-                }
-
-                RecreateRenderer();
+                UpdateHeadPose();
             }
+            mCubeRenderer->Record(mFrames.BeginFrame());
+            mFrames.Publish();
+
+            // Keep at most a frame ahead of the render thread.
+            mFrames.WaitUntilTaken(std::chrono::milliseconds(100));
         }
         else
         {
@@ -165,9 +273,119 @@ void App::Run()
         }
     }
 
+    StopRenderThread();
     CleanupEGL();
 }
 
+void App::StartRenderThread()
+{
+    // A context is current on one thread at a time.
+    eglMakeCurrent(mEglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    mFrames.Start();
+    mStopRendering = false;
+    mRenderThread = std::thread([this] { RenderLoop(); });
+}
+
+void App::StopRenderThread()
+{
+    if (!mRenderThread.joinable())
+    {
+        return;
+    }
+
+    mStopRendering = true;
+    mFrames.Stop();
+    mRenderThread.join();
+}
+
+// Recreating EGL throws when it fails, which would end the app from the
+// render thread without unwinding. Run rethrows it on the UI thread instead.
+void App::RenderLoop()
+{
+    try
+    {
+        RenderFrames();
+    }
+    catch (...)
+    {
+        mRenderError = std::current_exception();
+        mRenderFailed = true;
+    }
+}
+
+// Draws the newest frame the update loop has recorded. When it is late the
+// last frame is drawn again, so a burst of window events or a slow update
+// costs the scene's motion a frame rather than the display.
+void App::RenderFrames()
+{
+    if (eglMakeCurrent(mEglDisplay, mEglSurface, mEglSurface, mEglContext) == EGL_FALSE)
+    {
+        DebugLog(L"Render thread couldn't make the EGL context current");
+        return;
+    }
+
+    FrameCommands frame;
+    bool hasFrame = false;
+    mTimingFrames = false;
+    while (!mStopRendering)
+    {
+        auto waitStart = std::chrono::steady_clock::now();
+        auto wait = std::chrono::duration<double, std::milli>(hasFrame && mWindowVisible ? FrameWaitMilliseconds : 100.0);
+        const FrameCommands *next = mFrames.Acquire(std::chrono::duration_cast<std::chrono::steady_clock::duration>(wait));
+        auto waited = std::chrono::steady_clock::now() - waitStart;
+        if (next != nullptr)
+        {
+            frame = *next;
+            mFrames.Release();
+            hasFrame = true;
+        }
+        else if (!hasFrame || !mWindowVisible)
+        {
+            mTimingFrames = false;
+            continue;
+        }
+
+        EGLint panelWidth = 0;
+        EGLint panelHeight = 0;
+        eglQuerySurface(mEglDisplay, mEglSurface, EGL_WIDTH, &panelWidth);
+        eglQuerySurface(mEglDisplay, mEglSurface, EGL_HEIGHT, &panelHeight);
+        mCubeRenderer->UpdateWindowSize(panelWidth, panelHeight);
+        mCubeRenderer->Draw(frame);
+
+        // Drawn again, the frame isn't captured again.
+        frame.capture = false;
+
+        // The call to eglSwapBuffers might not be successful (e.g. due to Device Lost)
+        // If the call fails, then we must reinitialize EGL and the GL resources.
+        // The renderer keeps its scene in memory, only its GL objects are recreated.
+        if (eglSwapBuffers(mEglDisplay, mEglSurface) != GL_TRUE)
+        {
+            auto start = std::chrono::steady_clock::now();
+            mCubeRenderer->ReleaseDeviceResources();
+            CleanupEGL();
+            InitializeEGLInner(mWindowBasis);
+            mCubeRenderer->CreateDeviceResources();
+            DebugLog(L"Device lost, EGL and renderer recreated in %.2f ms",
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            mTimingFrames = false;
+            continue;
+        }
+
+        mFrames.Presented(frame);
+        UpdateResolution(waited);
+
+        auto stats = mFrames.GetStats();
+        if (stats.presented + stats.repeated >= FrameLogFrames)
+        {
+            DebugLog(L"Frames: %d presented, %d drawn again, %d dropped, update to swap %.2f ms mean, %.2f ms worst",
+                stats.presented, stats.repeated, stats.dropped, stats.meanLatencyMilliseconds, stats.worstLatencyMilliseconds);
+            mFrames.ResetStats();
+        }
+    }
+
+    eglMakeCurrent(mEglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
+
 // Terminate events do not cause Uninitialize to be called. It will be called if your IFrameworkView
 // class is torn down while the app is in the foreground.
 void App::Uninitialize()
@@ -181,6 +399,27 @@ void App::OnActivated(CoreApplicationView^ applicationView, IActivatedEventArgs^
     CoreWindow::GetForCurrentThread()->Activate();
 }
 
+void App::OnSuspending(Platform::Object^ sender, SuspendingEventArgs^ args)
+{
+    // Run starts it again once resumed.
+    mSuspended = true;
+    StopRenderThread();
+
+    if (mCubeRenderer)
+    {
+        mCubeRenderer->SaveSnapshot();
+    }
+
+    auto& stats = mGovernor.GetStats();
+    DebugLog(L"Resolution scale %.2f, %d of %d frames over budget, %d changes, %d of %d probes failed",
+        mGovernor.Scale(), stats.overBudgetFrames, stats.frames, stats.changes, stats.failedProbes, stats.probes);
+}
+
+void App::OnResuming(Platform::Object^ sender, Platform::Object^ args)
+{
+    mSuspended = false;
+}
+
 // Window event handlers.
 void App::OnVisibilityChanged(CoreWindow^ sender, VisibilityChangedEventArgs^ args)
 {
@@ -192,6 +431,27 @@ void App::OnWindowClosed(CoreWindow^ sender, CoreWindowEventArgs^ args)
     mWindowClosed = true;
 }
 
+void App::OnKeyDown(CoreWindow^ sender, KeyEventArgs^ args)
+{
+    if (args->VirtualKey == Windows::System::VirtualKey::F12 && mCubeRenderer)
+    {
+        mCubeRenderer->CaptureFrame();
+    }
+}
+
+void App::OnCameraAdded(HolographicSpace^ sender, HolographicSpaceCameraAddedEventArgs^ args)
+{
+    std::lock_guard<std::mutex> lock(mCamerasLock);
+    args->Camera->ViewportScaleFactor = mCameraScale;
+    mCameras.push_back(args->Camera);
+}
+
+void App::OnCameraRemoved(HolographicSpace^ sender, HolographicSpaceCameraRemovedEventArgs^ args)
+{
+    std::lock_guard<std::mutex> lock(mCamerasLock);
+    mCameras.erase(std::remove(mCameras.begin(), mCameras.end(), args->Camera), mCameras.end());
+}
+
 void App::InitializeEGL(Windows::UI::Core::CoreWindow^ window)
 {
     App::InitializeEGLInner(window);
@@ -221,14 +481,6 @@ void App::InitializeEGLInner(Platform::Object^ windowBasis)
         EGL_NONE
     };
 
-    const EGLint surfaceAttributes[] =
-    {
-        // EGL_ANGLE_SURFACE_RENDER_TO_BACK_BUFFER is part of the same optimization as EGL_ANGLE_DISPLAY_ALLOW_RENDER_TO_BACK_BUFFER (see above).
-        // If you have compilation issues with it then please update your Visual Studio templates.
-        EGL_ANGLE_SURFACE_RENDER_TO_BACK_BUFFER, EGL_TRUE,
-        EGL_NONE
-    };
-
     const EGLint defaultDisplayAttributes[] =
     {
         // These are the default display attributes, used to request ANGLE's D3D11 renderer.
@@ -269,8 +521,6 @@ void App::InitializeEGLInner(Platform::Object^ windowBasis)
         EGL_NONE,
     };
     
-    EGLConfig config = NULL;
-
     // eglGetPlatformDisplayEXT is an alternative to eglGetDisplay. It allows us to pass in display attributes, used to configure D3D11.
     PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
     if (!eglGetPlatformDisplayEXT)
@@ -322,41 +572,53 @@ void App::InitializeEGLInner(Platform::Object^ windowBasis)
     }
 
     EGLint numConfigs = 0;
-    if ((eglChooseConfig(mEglDisplay, configAttributes, &config, 1, &numConfigs) == EGL_FALSE) || (numConfigs == 0))
+    if ((eglChooseConfig(mEglDisplay, configAttributes, &mEglConfig, 1, &numConfigs) == EGL_FALSE) || (numConfigs == 0))
     {
         throw Exception::CreateException(E_FAIL, L"Failed to choose first EGLConfig");
     }
 
+    mEglContext = eglCreateContext(mEglDisplay, mEglConfig, EGL_NO_CONTEXT, contextAttributes);
+    if (mEglContext == EGL_NO_CONTEXT)
+    {
+        throw Exception::CreateException(E_FAIL, L"Failed to create EGL context");
+    }
+
+    mWindowBasis = windowBasis;
+    CreateSurface();
+}
+
+// Creates the window surface for the display and config already chosen, at
+// the governor's scale, and makes it current with the context.
+void App::CreateSurface()
+{
+    const EGLint surfaceAttributes[] =
+    {
+        // EGL_ANGLE_SURFACE_RENDER_TO_BACK_BUFFER is part of the same optimization as EGL_ANGLE_DISPLAY_ALLOW_RENDER_TO_BACK_BUFFER (see above).
+        // If you have compilation issues with it then please update your Visual Studio templates.
+        EGL_ANGLE_SURFACE_RENDER_TO_BACK_BUFFER, EGL_TRUE,
+        EGL_NONE
+    };
+
     // Create a PropertySet and initialize with the EGLNativeWindowType.
     PropertySet^ surfaceCreationProperties = ref new PropertySet();
-    surfaceCreationProperties->Insert(ref new String(EGLNativeWindowTypeProperty), windowBasis);
+    surfaceCreationProperties->Insert(ref new String(EGLNativeWindowTypeProperty), mWindowBasis);
     if (mStationaryReferenceFrame != nullptr)
     {
         surfaceCreationProperties->Insert(ref new String(EGLBaseCoordinateSystemProperty), mStationaryReferenceFrame);
     }
 
-    // You can configure the surface to render at a lower resolution and be scaled up to
-    // the full window size. This scaling is often free on mobile hardware.
-    //
-    // One way to configure the SwapChainPanel is to specify precisely which resolution it should render at.
-    // Size customRenderSurfaceSize = Size(800, 600);
-    // surfaceCreationProperties->Insert(ref new String(EGLRenderSurfaceSizeProperty), PropertyValue::CreateSize(customRenderSurfaceSize));
-    //
-    // Another way is to tell the SwapChainPanel to render at a certain scale factor compared to its size.
-    // e.g. if the SwapChainPanel is 1920x1280 then setting a factor of 0.5f will make the app render at 960x640
-    // float customResolutionScale = 0.5f;
-    // surfaceCreationProperties->Insert(ref new String(EGLRenderResolutionScaleProperty), PropertyValue::CreateSingle(customResolutionScale));
-
-    mEglSurface = eglCreateWindowSurface(mEglDisplay, config, reinterpret_cast<IInspectable*>(surfaceCreationProperties), surfaceAttributes);
-    if (mEglSurface == EGL_NO_SURFACE)
+    // The surface renders at a scale of the window's size and is scaled up to
+    // fill it, which is often free on mobile hardware. A holographic surface
+    // is scaled through its cameras instead.
+    if (mHolographicSpace == nullptr)
     {
-        throw Exception::CreateException(E_FAIL, L"Failed to create EGL fullscreen surface");
+        surfaceCreationProperties->Insert(ref new String(EGLRenderResolutionScaleProperty), PropertyValue::CreateSingle(mGovernor.Scale()));
     }
 
-    mEglContext = eglCreateContext(mEglDisplay, config, EGL_NO_CONTEXT, contextAttributes);
-    if (mEglContext == EGL_NO_CONTEXT)
+    mEglSurface = eglCreateWindowSurface(mEglDisplay, mEglConfig, reinterpret_cast<IInspectable*>(surfaceCreationProperties), surfaceAttributes);
+    if (mEglSurface == EGL_NO_SURFACE)
     {
-        throw Exception::CreateException(E_FAIL, L"Failed to create EGL context");
+        throw Exception::CreateException(E_FAIL, L"Failed to create EGL fullscreen surface");
     }
 
     if (eglMakeCurrent(mEglDisplay, mEglSurface, mEglSurface, mEglContext) == EGL_FALSE)
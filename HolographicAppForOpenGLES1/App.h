@@ -1,8 +1,16 @@
 ﻿#pragma once
 
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "pch.h"
+#include "FrameQueue.h"
+#include "ResolutionGovernor.h"
 #include "SimpleRenderer.h"
 
 namespace HolographicAppForOpenGLES1
@@ -21,33 +29,86 @@ namespace HolographicAppForOpenGLES1
 
     private:
         void RecreateRenderer();
+        void UpdateHeadPose();
+        void UpdateResolution(std::chrono::steady_clock::duration waited);
+
+        // The render thread owns the EGL context while it runs. Stopping it
+        // leaves the scene free to save.
+        void StartRenderThread();
+        void StopRenderThread();
+        void RenderLoop();
+        void RenderFrames();
 
         // Application lifecycle event handlers.
         void OnActivated(Windows::ApplicationModel::Core::CoreApplicationView^ applicationView, Windows::ApplicationModel::Activation::IActivatedEventArgs^ args);
+        void OnSuspending(Platform::Object^ sender, Windows::ApplicationModel::SuspendingEventArgs^ args);
+        void OnResuming(Platform::Object^ sender, Platform::Object^ args);
 
         // Window event handlers.
         void OnVisibilityChanged(Windows::UI::Core::CoreWindow^ sender, Windows::UI::Core::VisibilityChangedEventArgs^ args);
         void OnWindowClosed(Windows::UI::Core::CoreWindow^ sender, Windows::UI::Core::CoreWindowEventArgs^ args);
+        void OnKeyDown(Windows::UI::Core::CoreWindow^ sender, Windows::UI::Core::KeyEventArgs^ args);
+
+        // Holographic camera event handlers.
+        void OnCameraAdded(Windows::Graphics::Holographic::HolographicSpace^ sender, Windows::Graphics::Holographic::HolographicSpaceCameraAddedEventArgs^ args);
+        void OnCameraRemoved(Windows::Graphics::Holographic::HolographicSpace^ sender, Windows::Graphics::Holographic::HolographicSpaceCameraRemovedEventArgs^ args);
 
         void InitializeEGL(Windows::Graphics::Holographic::HolographicSpace^ holographicSpace);
         void InitializeEGL(Windows::UI::Core::CoreWindow^ window);
         void App::InitializeEGLInner(Platform::Object^ windowBasis);
+        void CreateSurface();
         void CleanupEGL();
 
         bool mWindowClosed;
-        bool mWindowVisible;
+        std::atomic<bool> mWindowVisible;
+
+        // From suspending to resuming, with the render thread stopped and
+        // no frames recorded. Only the UI thread sees it.
+        bool mSuspended;
         
         EGLDisplay mEglDisplay;
         EGLContext mEglContext;
         EGLSurface mEglSurface;
+        EGLConfig mEglConfig;
+
+        // What the surface was created for, to create it again at another scale.
+        Platform::Object^ mWindowBasis = nullptr;
 
         std::unique_ptr<SimpleRenderer> mCubeRenderer;
 
+        // Frames go from the update loop in Run, which also handles window
+        // events, to a thread of their own for GL.
+        FrameQueue mFrames;
+        std::thread mRenderThread;
+        std::atomic<bool> mStopRendering;
+
+        // What ended the render thread, set before mRenderFailed.
+        std::exception_ptr mRenderError;
+        std::atomic<bool> mRenderFailed;
+
+        // Scales the resolution rendered at to keep up with the display. Frames
+        // are timed on the render thread from one swap to the next, less any
+        // wait for the update loop, and none while the window is hidden.
+        ResolutionGovernor mGovernor;
+        std::chrono::steady_clock::time_point mLastSwap;
+        bool mTimingFrames;
+
+        // The holographic cameras, scaled by the governor rather than the
+        // surface. They come and go on another thread, so the scale they
+        // take is kept here under the lock, apart from the governor the
+        // render thread updates.
+        std::mutex mCamerasLock;
+        std::vector<Windows::Graphics::Holographic::HolographicCamera^> mCameras;
+        float mCameraScale;
+
         // The holographic space the app will use for rendering.
         Windows::Graphics::Holographic::HolographicSpace^ mHolographicSpace = nullptr;
 
         // The world coordinate system. In this example, a reference frame placed in the environment.
         Windows::Perception::Spatial::SpatialStationaryFrameOfReference^ mStationaryReferenceFrame = nullptr;
+
+        // Locates the head in that frame each frame, for the renderer to cull by.
+        Windows::Perception::Spatial::SpatialLocator^ mLocator = nullptr;
     };
 
 }
\ No newline at end of file
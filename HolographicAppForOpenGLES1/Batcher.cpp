@@ -0,0 +1,312 @@
+#include "pch.h"
+#include "Batcher.h"
+#include "ContentHash.h"
+#include "Stripifier.h"
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+
+const int Batcher::DefaultMaxVertices;
+const int Batcher::MaxVertices;
+const int Batcher::MaxSpread;
+
+namespace
+{
+	bool IsTransparent(const MeshData& mesh)
+	{
+		for (size_t i = 3; i < mesh.colors.size(); i += 4)
+		{
+			if (mesh.colors[i] < 1.0f)
+				return true;
+		}
+		return false;
+	}
+
+	float Size(const float *boxMin, const float *boxMax)
+	{
+		return max(max(boxMax[0] - boxMin[0], boxMax[1] - boxMin[1]), boxMax[2] - boxMin[2]);
+	}
+
+	// The low 10 bits of value moved to every third bit, for Z order.
+	unsigned int SpreadBits(unsigned int value)
+	{
+		value &= 0x3FF;
+		value = (value | value << 16) & 0x030000FF;
+		value = (value | value << 8) & 0x0300F00F;
+		value = (value | value << 4) & 0x030C30C3;
+		value = (value | value << 2) & 0x09249249;
+		return value;
+	}
+
+	// The triangles of strip[first, first + count) as a list, without the
+	// degenerate ones. Runs start on an even index, so it is the odd
+	// triangles whose winding is flipped.
+	void AppendStripAsList(const vector<unsigned short>& strip, int first, int count, vector<unsigned short>& list)
+	{
+		for (int i = first; i + 2 < first + count; i++)
+		{
+			unsigned short a = strip[i], b = strip[i + 1], c = strip[i + 2];
+			if (a == b || b == c || a == c)
+				continue;
+			if (i % 2 != 0)
+				swap(a, b);
+			list.insert(list.end(), { a, b, c });
+		}
+	}
+
+	// Puts each batch in place of the mesh owning it, drops the other meshes
+	// it owns and renumbers the nodes.
+	void ReplaceBatched(vector<unique_ptr<MeshData>>& meshes, vector<SceneNode>& nodes, const vector<int>& owners,
+		vector<unique_ptr<MeshData>>& batches)
+	{
+		vector<int> remap(meshes.size(), -1);
+		vector<unique_ptr<MeshData>> batched;
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			if (owners[i] >= 0 && owners[i] != (int)i)
+				continue;
+			remap[i] = (int)batched.size();
+			batched.push_back(batches[i] ? std::move(batches[i]) : std::move(meshes[i]));
+		}
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			if (owners[i] >= 0)
+				remap[i] = remap[owners[i]];
+		}
+		for (auto& node : nodes)
+		{
+			if (node.mesh >= 0 && node.mesh < (int)remap.size())
+				node.mesh = remap[node.mesh];
+		}
+		meshes = std::move(batched);
+	}
+}
+
+Batcher::Stats Batcher::Batch(vector<unique_ptr<MeshData>>& meshes, vector<SceneNode>& nodes, int maxVertices)
+{
+	Stats stats;
+	stats.meshes = (int)meshes.size();
+	maxVertices = min(maxVertices, MaxVertices);
+
+	// An instance drawn by several nodes stays a mesh of its own.
+	vector<int> users(meshes.size(), 0);
+	vector<string> materials(meshes.size());
+	for (auto& node : nodes)
+	{
+		if (node.mesh < 0 || node.mesh >= (int)meshes.size())
+			continue;
+		users[node.mesh]++;
+		materials[node.mesh] = node.materials.empty() ? string() : node.materials[0];
+	}
+
+	// Candidates by material and transparency, groups in order of first use.
+	unordered_map<string, int> groupIndices;
+	vector<vector<int>> groups;
+	for (size_t i = 0; i < meshes.size(); i++)
+	{
+		auto& mesh = *meshes[i];
+		if (users[i] != 1 || mesh.unchanged || mesh.progressive || !mesh.lods.empty() || !mesh.parts.empty() ||
+			mesh.TriangleCount() == 0 || mesh.VertexCount() > maxVertices)
+			continue;
+		if (mesh.bounds.radius < 0.0f)
+			mesh.ComputeBounds();
+
+		string key = materials[i] + (IsTransparent(mesh) ? "\ntransparent" : "");
+		int group = groupIndices.emplace(key, (int)groups.size()).first->second;
+		if (group == (int)groups.size())
+			groups.emplace_back();
+		groups[group].push_back((int)i);
+	}
+
+	// Each batch takes the place of the first of its meshes, the rest are
+	// left empty.
+	vector<int> owners(meshes.size(), -1);
+	vector<unique_ptr<MeshData>> batches(meshes.size());
+	for (auto& group : groups)
+	{
+		if (group.size() < 2)
+			continue;
+
+		// Z order of the centres across the group, so a batch takes meshes
+		// near each other.
+		float low[3], high[3];
+		for (int axis = 0; axis < 3; axis++)
+			low[axis] = high[axis] = meshes[group[0]]->bounds.center[axis];
+		for (int i : group)
+		{
+			for (int axis = 0; axis < 3; axis++)
+			{
+				low[axis] = min(low[axis], meshes[i]->bounds.center[axis]);
+				high[axis] = max(high[axis], meshes[i]->bounds.center[axis]);
+			}
+		}
+		vector<pair<unsigned int, int>> order;
+		for (int i : group)
+		{
+			unsigned int code = 0;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float extent = high[axis] - low[axis];
+				float t = extent > 0.0f ? (meshes[i]->bounds.center[axis] - low[axis]) / extent : 0.0f;
+				code |= SpreadBits((unsigned int)(t * 1023.0f)) << axis;
+			}
+			order.emplace_back(code, i);
+		}
+		sort(order.begin(), order.end());
+
+		for (size_t first = 0; first < order.size();)
+		{
+			auto& start = meshes[order[first].second]->bounds;
+			float boxMin[3] = { start.min[0], start.min[1], start.min[2] };
+			float boxMax[3] = { start.max[0], start.max[1], start.max[2] };
+			float smallest = Size(start.min, start.max);
+			int vertices = meshes[order[first].second]->VertexCount();
+
+			size_t last = first + 1;
+			for (; last < order.size(); last++)
+			{
+				auto& mesh = *meshes[order[last].second];
+				float grownMin[3], grownMax[3];
+				for (int axis = 0; axis < 3; axis++)
+				{
+					grownMin[axis] = min(boxMin[axis], mesh.bounds.min[axis]);
+					grownMax[axis] = max(boxMax[axis], mesh.bounds.max[axis]);
+				}
+				float grownSmallest = min(smallest, Size(mesh.bounds.min, mesh.bounds.max));
+				if (vertices + mesh.VertexCount() > maxVertices || Size(grownMin, grownMax) > MaxSpread * grownSmallest)
+					break;
+
+				copy(grownMin, grownMin + 3, boxMin);
+				copy(grownMax, grownMax + 3, boxMax);
+				smallest = grownSmallest;
+				vertices += mesh.VertexCount();
+			}
+
+			if (last - first > 1)
+			{
+				// Parts go in file order.
+				vector<int> members;
+				for (size_t k = first; k < last; k++)
+					members.push_back(order[k].second);
+				sort(members.begin(), members.end());
+
+				vector<MeshData *> parts;
+				for (int i : members)
+				{
+					parts.push_back(meshes[i].get());
+					owners[i] = members[0];
+				}
+				batches[members[0]] = Merge(parts);
+				stats.batches++;
+				stats.batchedMeshes += (int)members.size();
+			}
+			first = last;
+		}
+	}
+	if (stats.batches > 0)
+		ReplaceBatched(meshes, nodes, owners, batches);
+	return stats;
+}
+
+Batcher::Stats Batcher::Keep(vector<unique_ptr<MeshData>>& meshes, vector<SceneNode>& nodes,
+	const vector<KeptBatch>& kept)
+{
+	Stats stats;
+	stats.meshes = (int)meshes.size();
+
+	vector<int> owners(meshes.size(), -1);
+	vector<unique_ptr<MeshData>> batches(meshes.size());
+	for (auto& batch : kept)
+	{
+		if (batch.parts.empty())
+			continue;
+
+		int owner = batch.parts.front();
+		for (int i : batch.parts)
+			owners[i] = owner;
+		batches[owner] = make_unique<MeshData>();
+		batches[owner]->name = batch.name;
+		batches[owner]->sourceHash = batch.sourceHash;
+		batches[owner]->unchanged = true;
+		stats.batches++;
+		stats.batchedMeshes += (int)batch.parts.size();
+	}
+	if (stats.batches > 0)
+		ReplaceBatched(meshes, nodes, owners, batches);
+	return stats;
+}
+
+unique_ptr<MeshData> Batcher::Merge(const vector<MeshData *>& meshes)
+{
+	auto batch = make_unique<MeshData>();
+	ContentHash hash;
+	for (auto mesh : meshes)
+	{
+		if (mesh->bounds.radius < 0.0f)
+			mesh->ComputeBounds();
+		hash.Add(mesh->sourceHash);
+
+		const int baseVertex = batch->VertexCount();
+		batch->positions.insert(batch->positions.end(), mesh->positions.begin(), mesh->positions.end());
+		batch->normals.insert(batch->normals.end(), mesh->normals.begin(), mesh->normals.end());
+		batch->colors.insert(batch->colors.end(), mesh->colors.begin(), mesh->colors.end());
+
+		MeshData::Part part;
+		part.name = mesh->name;
+		part.sourceHash = mesh->sourceHash;
+		part.firstCluster = (int)batch->clusters.size();
+		part.bounds = mesh->bounds;
+
+		// A mesh without clusters is one, whose cone says nothing.
+		vector<Cluster> clusters = mesh->clusters;
+		if (clusters.empty())
+		{
+			Cluster all = {};
+			all.indexCount = mesh->IndexCount();
+			all.triangleCount = mesh->TriangleCount();
+			copy(mesh->bounds.center, mesh->bounds.center + 3, all.center);
+			all.radius = mesh->bounds.radius;
+			all.coneCutoff = -1.0f;
+			clusters.push_back(all);
+		}
+
+		for (auto cluster : clusters)
+		{
+			int first = batch->IndexCount();
+			if (mesh->strip)
+			{
+				AppendStripAsList(mesh->indices, cluster.firstIndex, cluster.indexCount, batch->indices);
+			}
+			else
+			{
+				auto source = mesh->indices.begin() + cluster.firstIndex;
+				batch->indices.insert(batch->indices.end(), source, source + cluster.indexCount);
+			}
+			for (int i = first; i < batch->IndexCount(); i++)
+				batch->indices[i] = (unsigned short)(batch->indices[i] + baseVertex);
+
+			cluster.firstIndex = first;
+			cluster.indexCount = batch->IndexCount() - first;
+			batch->clusters.push_back(cluster);
+		}
+		part.clusterCount = (int)batch->clusters.size() - part.firstCluster;
+		batch->parts.push_back(std::move(part));
+	}
+
+	batch->name = meshes.front()->name + " and " + to_string(meshes.size() - 1) + " more";
+	batch->sourceHash = hash.Value();
+
+	// Clusters keep their order in a strip, so the parts' runs of them hold.
+	auto clusters = batch->clusters;
+	auto strip = Stripifier::Stripify(batch->indices.data(), batch->IndexCount(), clusters);
+	if (Stripifier::IsBetter(batch->indices.data(), batch->IndexCount(), strip.data(), (int)strip.size()))
+	{
+		batch->indices = std::move(strip);
+		batch->clusters = std::move(clusters);
+		batch->strip = true;
+	}
+
+	batch->ComputeBounds();
+	batch->stats.push_back({ "batched meshes", (float)meshes.size() });
+	return batch;
+}
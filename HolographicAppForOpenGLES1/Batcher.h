@@ -0,0 +1,67 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "MeshData.h"
+#include "SceneNode.h"
+
+using namespace std;
+
+// Static batching. Files like cubegroup.fbx convert to many tiny meshes,
+// each a draw call of its own. Small meshes sharing a material are merged
+// into batches that draw as one, each original kept as a part of its batch
+// with its own bounds and clusters so culling still works part by part.
+//
+// Every mesh is drawn in the model's one object space, so the merged
+// vertices are used as they are.
+class Batcher
+{
+public:
+	static const int DefaultMaxVertices = 16384;
+
+	// All a batch's 16 bit indices can address. Larger sizes are clamped.
+	static const int MaxVertices = 65536;
+
+	// A batch's positions are quantized over its bounds, so it spans at most
+	// this many times the size of its smallest part.
+	static const int MaxSpread = 64;
+
+	struct Stats
+	{
+		int meshes = 0;
+		int batches = 0;
+		int batchedMeshes = 0;
+
+		// One draw per mesh, before and after merging.
+		int DrawCallsBefore() const { return meshes; }
+		int DrawCallsAfter() const { return meshes - batchedMeshes + batches; }
+	};
+
+	// Merges meshes with no LODs that one node each draws with the same first
+	// material, and the same transparency, into batches of up to maxVertices
+	// vertices. Near ones go together. Each batch takes the place of its
+	// first mesh and the nodes are renumbered to match. Meshes still marked
+	// unchanged have no geometry to merge and are left alone, as are
+	// progressive meshes.
+	static Stats Batch(vector<unique_ptr<MeshData>>& meshes, vector<SceneNode>& nodes,
+		int maxVertices = DefaultMaxVertices);
+
+	// A batch merged by an earlier import whose parts are all unchanged: its
+	// name and source hash, and the meshes standing for its parts in order.
+	struct KeptBatch
+	{
+		string name;
+		unsigned long long sourceHash = 0;
+		vector<int> parts;
+	};
+
+	// Replaces the parts of each kept batch with one mesh marked unchanged,
+	// for the caller to fill in with the old batch, and renumbers the nodes
+	// to match, as Batch does.
+	static Stats Keep(vector<unique_ptr<MeshData>>& meshes, vector<SceneNode>& nodes,
+		const vector<KeptBatch>& kept);
+
+	// One mesh of the given ones in order, as parts, filling in any bounds
+	// they lack. Strips are drawn as lists in it, and the whole is a strip
+	// again if that costs less.
+	static unique_ptr<MeshData> Merge(const vector<MeshData *>& meshes);
+};
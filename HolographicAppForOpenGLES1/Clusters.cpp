@@ -0,0 +1,324 @@
+#include "pch.h"
+#include "Clusters.h"
+#include "VertexCache.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+	struct Vec
+	{
+		float x, y, z;
+	};
+
+	Vec operator-(const Vec& a, const Vec& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+	Vec operator+(const Vec& a, const Vec& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+	Vec operator*(const Vec& a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+	float Dot(const Vec& a, const Vec& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+	Vec Cross(const Vec& a, const Vec& b)
+	{
+		return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+	}
+
+	Vec Normalize(const Vec& a)
+	{
+		float length = sqrtf(Dot(a, a));
+		return length > 0.0f ? a * (1.0f / length) : a;
+	}
+
+	Vec Position(const float *positions, int vertex)
+	{
+		return { positions[vertex * 4 + 0], positions[vertex * 4 + 1], positions[vertex * 4 + 2] };
+	}
+
+	// Growing picks the frontier triangle with the lowest score: how far it
+	// turns from the cluster's facing, how far it sits from the cluster
+	// relative to the cluster's size, less a bonus for each vertex it
+	// already shares.
+	const float ConeWeight = 4.0f;
+	const float SharedWeight = 0.25f;
+
+	// Sphere around the cluster's bounding box, and the narrowest cone
+	// around its average normal that holds every triangle's normal.
+	void ComputeBounds(const float *positions, const unsigned short *indices, const vector<Vec>& normals,
+		const vector<float>& areas, const vector<int>& triangles, Cluster& cluster)
+	{
+		Vec lower = Position(positions, indices[triangles[0] * 3]);
+		Vec upper = lower;
+		Vec normalSum = { 0.0f, 0.0f, 0.0f };
+		for (int t : triangles)
+		{
+			for (int corner = 0; corner < 3; corner++)
+			{
+				Vec p = Position(positions, indices[t * 3 + corner]);
+				lower = { min(lower.x, p.x), min(lower.y, p.y), min(lower.z, p.z) };
+				upper = { max(upper.x, p.x), max(upper.y, p.y), max(upper.z, p.z) };
+			}
+			normalSum = normalSum + normals[t] * areas[t];
+		}
+
+		Vec center = (lower + upper) * 0.5f;
+		float radius = 0.0f;
+		for (int t : triangles)
+		{
+			for (int corner = 0; corner < 3; corner++)
+			{
+				Vec d = Position(positions, indices[t * 3 + corner]) - center;
+				radius = max(radius, Dot(d, d));
+			}
+		}
+
+		Vec axis = Normalize(normalSum);
+		float cutoff = Dot(axis, axis) > 0.0f ? 1.0f : -1.0f;
+		for (int t : triangles)
+		{
+			if (areas[t] > 0.0f)
+				cutoff = min(cutoff, Dot(axis, normals[t]));
+		}
+
+		cluster.center[0] = center.x;
+		cluster.center[1] = center.y;
+		cluster.center[2] = center.z;
+		cluster.radius = sqrtf(radius);
+		cluster.coneAxis[0] = axis.x;
+		cluster.coneAxis[1] = axis.y;
+		cluster.coneAxis[2] = axis.z;
+		cluster.coneCutoff = cutoff;
+	}
+
+	// Maps each vertex to the first vertex at exactly the same position.
+	vector<int> Weld(const float *positions, int numVertices)
+	{
+		vector<int> sorted(numVertices);
+		for (int v = 0; v < numVertices; v++)
+			sorted[v] = v;
+		auto less = [positions](int a, int b)
+		{
+			return lexicographical_compare(positions + a * 4, positions + a * 4 + 3, positions + b * 4, positions + b * 4 + 3);
+		};
+		stable_sort(sorted.begin(), sorted.end(), less);
+
+		vector<int> welded(numVertices);
+		for (int i = 0; i < numVertices; i++)
+			welded[sorted[i]] = i > 0 && !less(sorted[i - 1], sorted[i]) ? welded[sorted[i - 1]] : sorted[i];
+		return welded;
+	}
+
+	// Tipsify again inside the cluster, on the few vertices it uses.
+	void OptimizeCluster(const unsigned short *indices, vector<int>& triangles, vector<int>& local)
+	{
+		vector<unsigned short> compact;
+		vector<int> used;
+		for (int t : triangles)
+		{
+			for (int corner = 0; corner < 3; corner++)
+			{
+				int v = indices[t * 3 + corner];
+				if (local[v] < 0)
+				{
+					local[v] = (int)used.size();
+					used.push_back(v);
+				}
+				compact.push_back((unsigned short)local[v]);
+			}
+		}
+		for (int v : used)
+			local[v] = -1;
+
+		auto order = VertexCache::Optimize(compact.data(), (int)compact.size(), (int)used.size());
+		vector<int> reordered(triangles.size());
+		for (size_t i = 0; i < order.size(); i++)
+			reordered[i] = triangles[order[i]];
+		triangles = std::move(reordered);
+	}
+}
+
+vector<int> Clusters::Build(const float *positions, const unsigned short *indices, int numIndices,
+	int numVertices, vector<Cluster>& clusters, int maxTriangles)
+{
+	const int numTris = numIndices / 3;
+	clusters.clear();
+
+	vector<Vec> normals(numTris), centroids(numTris);
+	vector<float> areas(numTris);
+	for (int t = 0; t < numTris; t++)
+	{
+		Vec a = Position(positions, indices[t * 3 + 0]);
+		Vec b = Position(positions, indices[t * 3 + 1]);
+		Vec c = Position(positions, indices[t * 3 + 2]);
+		Vec n = Cross(b - a, c - a);
+		areas[t] = 0.5f * sqrtf(Dot(n, n));
+		normals[t] = Normalize(n);
+		centroids[t] = (a + b + c) * (1.0f / 3.0f);
+	}
+
+	// Triangles around each position, vertices split for normals or
+	// colours still join up their triangles.
+	vector<int> welded = Weld(positions, numVertices);
+	vector<int> firstTriangle(numVertices + 1, 0);
+	for (int i = 0; i < numIndices; i++)
+		firstTriangle[welded[indices[i]] + 1]++;
+	for (int v = 0; v < numVertices; v++)
+		firstTriangle[v + 1] += firstTriangle[v];
+	vector<int> vertexTriangles(numIndices);
+	vector<int> filled(firstTriangle.begin(), firstTriangle.end() - 1);
+	for (int i = 0; i < numIndices; i++)
+		vertexTriangles[filled[welded[indices[i]]]++] = i / 3;
+
+	vector<int> clusterOf(numTris, -1);
+	vector<int> vertexCluster(numVertices, -1);
+	vector<int> local(numVertices, -1);
+	vector<int> order;
+	order.reserve(numTris);
+	vector<int> members, candidates;
+
+	for (int seed = 0; seed < numTris; seed++)
+	{
+		if (clusterOf[seed] >= 0)
+			continue;
+
+		const int id = (int)clusters.size();
+		members.clear();
+		candidates.clear();
+		Vec normalSum = { 0.0f, 0.0f, 0.0f };
+		Vec centroidSum = { 0.0f, 0.0f, 0.0f };
+		float area = 0.0f;
+
+		for (int next = seed; next >= 0;)
+		{
+			clusterOf[next] = id;
+			members.push_back(next);
+			normalSum = normalSum + normals[next] * max(areas[next], 1e-20f);
+			centroidSum = centroidSum + centroids[next];
+			area += areas[next];
+			for (int corner = 0; corner < 3; corner++)
+			{
+				int v = welded[indices[next * 3 + corner]];
+				vertexCluster[v] = id;
+				for (int i = firstTriangle[v]; i < firstTriangle[v + 1]; i++)
+				{
+					if (clusterOf[vertexTriangles[i]] < 0)
+						candidates.push_back(vertexTriangles[i]);
+				}
+			}
+			if ((int)members.size() == maxTriangles)
+				break;
+
+			Vec axis = Normalize(normalSum);
+			Vec center = centroidSum * (1.0f / members.size());
+			float size = area > 0.0f ? sqrtf(area) : 1.0f;
+
+			next = -1;
+			float bestScore = numeric_limits<float>::max();
+			for (size_t i = 0; i < candidates.size();)
+			{
+				int t = candidates[i];
+				if (clusterOf[t] >= 0)
+				{
+					candidates[i] = candidates.back();
+					candidates.pop_back();
+					continue;
+				}
+
+				int shared = 0;
+				for (int corner = 0; corner < 3; corner++)
+					shared += vertexCluster[welded[indices[t * 3 + corner]]] == id ? 1 : 0;
+				Vec offset = centroids[t] - center;
+				float score = ConeWeight * (1.0f - Dot(normals[t], axis)) + sqrtf(Dot(offset, offset)) / size -
+					SharedWeight * shared;
+				if (score < bestScore)
+				{
+					bestScore = score;
+					next = t;
+				}
+				i++;
+			}
+		}
+
+		OptimizeCluster(indices, members, local);
+
+		Cluster cluster;
+		cluster.firstIndex = (int)order.size() * 3;
+		cluster.indexCount = (int)members.size() * 3;
+		cluster.triangleCount = (int)members.size();
+		ComputeBounds(positions, indices, normals, areas, members, cluster);
+		clusters.push_back(cluster);
+		order.insert(order.end(), members.begin(), members.end());
+	}
+	return order;
+}
+
+void Clusters::ObjectSpaceView(const float *modelView, const float *projection, float *eye,
+	float (*planes)[4])
+{
+	// The camera sits where the model view takes to the origin, -A^-1 t for
+	// its upper 3x3 A and translation t. Cofactors of A, row by row.
+	const float *m = modelView;
+	float inverse[9] = {
+		m[5] * m[10] - m[9] * m[6], m[9] * m[2] - m[1] * m[10], m[1] * m[6] - m[5] * m[2],
+		m[8] * m[6] - m[4] * m[10], m[0] * m[10] - m[8] * m[2], m[4] * m[2] - m[0] * m[6],
+		m[4] * m[9] - m[8] * m[5], m[8] * m[1] - m[0] * m[9], m[0] * m[5] - m[4] * m[1],
+	};
+	float determinant = m[0] * inverse[0] + m[4] * inverse[1] + m[8] * inverse[2];
+	float scale = determinant != 0.0f ? -1.0f / determinant : 0.0f;
+	for (int row = 0; row < 3; row++)
+		eye[row] = scale * (inverse[row] * m[12] + inverse[3 + row] * m[13] + inverse[6 + row] * m[14]);
+
+	// Clip space planes pulled back through projection * modelView, after
+	// Gribb and Hartmann.
+	float clip[16];
+	for (int column = 0; column < 4; column++)
+	{
+		for (int row = 0; row < 4; row++)
+		{
+			clip[column * 4 + row] = 0.0f;
+			for (int k = 0; k < 4; k++)
+				clip[column * 4 + row] += projection[k * 4 + row] * modelView[column * 4 + k];
+		}
+	}
+	for (int plane = 0; plane < NumPlanes; plane++)
+	{
+		int row = plane / 2;
+		float sign = plane % 2 == 0 ? 1.0f : -1.0f;
+		for (int column = 0; column < 4; column++)
+			planes[plane][column] = clip[column * 4 + 3] + sign * clip[column * 4 + row];
+		float length = sqrtf(planes[plane][0] * planes[plane][0] + planes[plane][1] * planes[plane][1] +
+			planes[plane][2] * planes[plane][2]);
+		for (int column = 0; column < 4 && length > 0.0f; column++)
+			planes[plane][column] /= length;
+	}
+}
+
+bool Clusters::IsVisible(const Cluster& cluster, const float *eye, const float (*planes)[4], int numPlanes)
+{
+	const float *c = cluster.center;
+	for (int plane = 0; plane < numPlanes; plane++)
+	{
+		const float *p = planes[plane];
+		if (p[0] * c[0] + p[1] * c[1] + p[2] * c[2] + p[3] < -cluster.radius)
+			return false;
+	}
+
+	// Every normal is within a of the axis and every point of the sphere
+	// within b of the view direction, where sin b = radius / distance. All
+	// of it faces away once the axis is within 90 - a - b of the view
+	// direction, while a + b is still under 90.
+	if (cluster.coneCutoff <= 0.0f)
+		return true;
+	float view[3] = { c[0] - eye[0], c[1] - eye[1], c[2] - eye[2] };
+	float distance = sqrtf(view[0] * view[0] + view[1] * view[1] + view[2] * view[2]);
+	if (distance <= cluster.radius)
+		return true;
+
+	float cosA = cluster.coneCutoff;
+	float sinA = sqrtf(max(0.0f, 1.0f - cosA * cosA));
+	float sinB = cluster.radius / distance;
+	float cosB = sqrtf(1.0f - sinB * sinB);
+	if (cosA * cosB <= sinA * sinB)
+		return true;
+
+	const float *a = cluster.coneAxis;
+	return a[0] * view[0] + a[1] * view[1] + a[2] * view[2] <= (sinA * cosB + cosA * sinB) * distance;
+}
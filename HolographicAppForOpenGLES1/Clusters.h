@@ -0,0 +1,46 @@
+#pragma once
+#include <vector>
+
+using namespace std;
+
+// A run of triangles in the index buffer that is culled as one. Normals of
+// all its triangles lie within the cone around coneAxis whose half angle
+// has cosine coneCutoff, a cutoff of -1 means the cone says nothing.
+struct Cluster
+{
+	int firstIndex;
+	int indexCount;
+	int triangleCount;
+	float center[3];
+	float radius;
+	float coneAxis[3];
+	float coneCutoff;
+};
+
+// Splits triangle lists into small spatially coherent clusters with bounds,
+// so the CPU can skip the ones facing away or off screen each frame and
+// draw only what is left.
+class Clusters
+{
+public:
+	static const int MaxTriangles = 64;
+
+	// Grows clusters of up to maxTriangles neighbouring triangles of similar
+	// facing, seeded in the list's current order so the order it was
+	// optimised for mostly survives. Returns the triangles in their new
+	// order, as for VertexCache::Optimize, with the clusters matching it.
+	// Positions are xyzw.
+	static vector<int> Build(const float *positions, const unsigned short *indices, int numIndices,
+		int numVertices, vector<Cluster>& clusters, int maxTriangles = MaxTriangles);
+
+	// Camera position and frustum planes in object space, from the column
+	// major modelView and projection GL draws with. Planes are ax+by+cz+d
+	// with the inside positive, left, right, bottom and top.
+	static const int NumPlanes = 4;
+	static void ObjectSpaceView(const float *modelView, const float *projection, float *eye,
+		float (*planes)[4]);
+
+	// False when every triangle of the cluster faces away from the eye, or
+	// the cluster is entirely outside one of the planes.
+	static bool IsVisible(const Cluster& cluster, const float *eye, const float (*planes)[4], int numPlanes);
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include <vector>
+#include <string>
+
+using namespace std;
+
+// 64-bit FNV-1a, used to tell whether a mesh's source data has changed.
+class ContentHash
+{
+public:
+	ContentHash() : _value(14695981039346656037ull) {}
+
+	void Add(const void *data, size_t size)
+	{
+		auto bytes = static_cast<const unsigned char *>(data);
+		for (size_t i = 0; i < size; i++)
+		{
+			_value ^= bytes[i];
+			_value *= 1099511628211ull;
+		}
+	}
+
+	template <typename T>
+	void Add(const T& value)
+	{
+		Add(&value, sizeof(T));
+	}
+
+	void Add(const string& value)
+	{
+		Add((unsigned int)value.size());
+		Add(value.data(), value.size());
+	}
+
+	template <typename T>
+	void Add(const vector<T>& values)
+	{
+		Add((unsigned int)values.size());
+		if (!values.empty())
+			Add(values.data(), sizeof(T) * values.size());
+	}
+
+	unsigned long long Value() const { return _value; }
+
+private:
+	unsigned long long _value;
+};
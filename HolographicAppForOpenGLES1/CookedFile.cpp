@@ -0,0 +1,381 @@
+#include "pch.h"
+#include "CookedFile.h"
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char Magic[4] = { 'F', 'B', 'X', 'C' };
+
+const unsigned int CookedFile::Version;
+
+namespace
+{
+	template <typename T>
+	void WriteValue(ostream& out, const T& value)
+	{
+		out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+	}
+
+	template <typename T>
+	void WriteArray(ostream& out, const vector<T>& values)
+	{
+		WriteValue(out, (unsigned int)values.size());
+		if (!values.empty())
+			out.write(reinterpret_cast<const char *>(values.data()), sizeof(T) * values.size());
+	}
+
+	void WriteString(ostream& out, const string& value)
+	{
+		WriteValue(out, (unsigned int)value.size());
+		out.write(value.data(), value.size());
+	}
+
+	// The whole file mapped read only, so reading copies each array once,
+	// straight from the page cache into its mesh.
+	class MappedFile
+	{
+	public:
+		explicit MappedFile(const char *filename)
+		{
+#ifdef _MSC_VER
+			int length = MultiByteToWideChar(CP_ACP, 0, filename, -1, nullptr, 0);
+			wstring wideName(length, L'\0');
+			MultiByteToWideChar(CP_ACP, 0, filename, -1, &wideName[0], length);
+			_file = CreateFile2(wideName.c_str(), GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, nullptr);
+			if (_file == INVALID_HANDLE_VALUE)
+				throw runtime_error("Failed to open cooked file");
+			FILE_STANDARD_INFO info;
+			if (!GetFileInformationByHandleEx(_file, FileStandardInfo, &info, sizeof(info)))
+			{
+				CloseHandle(_file);
+				throw runtime_error("Failed to read cooked file");
+			}
+			_size = (size_t)info.EndOfFile.QuadPart;
+			_mapping = _size > 0 ? CreateFileMappingFromApp(_file, nullptr, PAGE_READONLY, 0, nullptr) : nullptr;
+			_data = _mapping ? static_cast<const char *>(MapViewOfFileFromApp(_mapping, FILE_MAP_READ, 0, 0)) : nullptr;
+#else
+			_file = open(filename, O_RDONLY);
+			if (_file < 0)
+				throw runtime_error("Failed to open cooked file");
+			struct stat info;
+			if (fstat(_file, &info) != 0)
+			{
+				close(_file);
+				throw runtime_error("Failed to read cooked file");
+			}
+			_size = (size_t)info.st_size;
+			void *data = _size > 0 ? mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _file, 0) : MAP_FAILED;
+			_data = data != MAP_FAILED ? static_cast<const char *>(data) : nullptr;
+#endif
+			if (_size > 0 && !_data)
+			{
+				Close();
+				throw runtime_error("Failed to map cooked file");
+			}
+		}
+
+		~MappedFile()
+		{
+			Close();
+		}
+
+		const char *Data() const { return _data; }
+		size_t Size() const { return _size; }
+
+	private:
+		void Close()
+		{
+#ifdef _MSC_VER
+			if (_data)
+				UnmapViewOfFile(_data);
+			if (_mapping)
+				CloseHandle(_mapping);
+			CloseHandle(_file);
+#else
+			if (_data)
+				munmap(const_cast<char *>(_data), _size);
+			close(_file);
+#endif
+		}
+
+#ifdef _MSC_VER
+		HANDLE _file;
+		HANDLE _mapping;
+#else
+		int _file;
+#endif
+		const char *_data;
+		size_t _size;
+	};
+
+	void ReadBytes(const char *&data, const char *end, void *target, size_t size)
+	{
+		if ((size_t)(end - data) < size)
+			throw runtime_error("Truncated cooked file");
+		if (size > 0)
+			memcpy(target, data, size);
+		data += size;
+	}
+
+	template <typename T>
+	T ReadValue(const char *&data, const char *end)
+	{
+		T value;
+		ReadBytes(data, end, &value, sizeof(T));
+		return value;
+	}
+
+	template <typename T>
+	void ReadArray(const char *&data, const char *end, vector<T>& values)
+	{
+		unsigned int count = ReadValue<unsigned int>(data, end);
+		if ((size_t)(end - data) / sizeof(T) < count)
+			throw runtime_error("Truncated cooked file");
+		values.resize(count);
+		ReadBytes(data, end, values.data(), sizeof(T) * count);
+	}
+
+	string ReadString(const char *&data, const char *end)
+	{
+		string value(ReadValue<unsigned int>(data, end), '\0');
+		ReadBytes(data, end, &value[0], value.size());
+		return value;
+	}
+
+	// An index past the last vertex has the GPU read outside the vertex
+	// buffers, so a corrupt one has to be caught here rather than when drawn.
+	void CheckIndices(const vector<unsigned short>& indices, int vertexCount)
+	{
+		for (unsigned short index : indices)
+		{
+			if (index >= vertexCount)
+				throw runtime_error("Corrupt cooked file");
+		}
+	}
+
+	void CheckProgressive(const ProgressiveMesh& progressive, int vertexCount, int indexCount)
+	{
+		auto& writes = progressive.Writes();
+		for (auto& split : progressive.Splits())
+		{
+			if (split.vertexCount < 0 || split.vertexCount > vertexCount ||
+				split.triangleCount < 0 || split.triangleCount > indexCount / 3 ||
+				split.firstWrite < 0 || split.writeCount < 0 || split.writeCount > (int)writes.size() - split.firstWrite)
+				throw runtime_error("Corrupt cooked file");
+		}
+		for (auto& write : writes)
+		{
+			if (write.position < 0 || write.position >= indexCount || write.value >= vertexCount)
+				throw runtime_error("Corrupt cooked file");
+		}
+		CheckIndices(progressive.FinalIndices(), vertexCount);
+	}
+}
+
+bool CookedFile::Exists(const char *filename)
+{
+	ifstream in(filename, ios::binary);
+	return in.good();
+}
+
+void CookedFile::Write(const char *filename, const vector<const MeshData *>& meshes,
+	const vector<SceneNode>& nodes, unsigned long long settings)
+{
+	ofstream out(filename, ios::binary | ios::trunc);
+	if (!out)
+		throw runtime_error("Failed to create cooked file");
+
+	out.write(Magic, sizeof(Magic));
+	WriteValue(out, Version);
+	WriteValue(out, settings);
+	WriteValue(out, (unsigned int)meshes.size());
+
+	for (auto mesh : meshes)
+	{
+		WriteString(out, mesh->name);
+		WriteValue(out, mesh->sourceHash);
+		WriteArray(out, mesh->positions);
+		WriteArray(out, mesh->normals);
+		WriteArray(out, mesh->colors);
+		WriteArray(out, mesh->indices);
+
+		WriteValue(out, (unsigned char)(mesh->progressive ? 1 : 0));
+		if (mesh->progressive)
+		{
+			WriteProgressive(out, *mesh->progressive);
+			WriteValue(out, mesh->appliedSplits);
+		}
+
+		WriteValue(out, (unsigned int)mesh->lods.size());
+		for (auto& lod : mesh->lods)
+		{
+			WriteValue(out, lod.error);
+			WriteArray(out, lod.indices);
+		}
+		WriteArray(out, mesh->clusters);
+		WriteValue(out, mesh->bounds);
+		WriteValue(out, (unsigned char)(mesh->strip ? 1 : 0));
+
+		WriteValue(out, (unsigned int)mesh->parts.size());
+		for (auto& part : mesh->parts)
+		{
+			WriteString(out, part.name);
+			WriteValue(out, part.sourceHash);
+			WriteValue(out, part.firstCluster);
+			WriteValue(out, part.clusterCount);
+			WriteValue(out, part.bounds);
+		}
+	}
+
+	WriteValue(out, (unsigned int)nodes.size());
+	for (auto& node : nodes)
+	{
+		WriteString(out, node.name);
+		WriteValue(out, node.parent);
+		WriteValue(out, node.transform);
+		WriteValue(out, node.mesh);
+		WriteValue(out, (unsigned int)node.materials.size());
+		for (auto& material : node.materials)
+			WriteString(out, material);
+	}
+
+	if (!out)
+		throw runtime_error("Failed to write cooked file");
+}
+
+vector<unique_ptr<MeshData>> CookedFile::Read(const char *filename, vector<SceneNode> *nodes)
+{
+	MappedFile file(filename);
+	const char *data = file.Data();
+	const char *end = data + file.Size();
+	ReadHeader(data, end);
+
+	vector<unique_ptr<MeshData>> meshes;
+	unsigned int meshCount = ReadValue<unsigned int>(data, end);
+	for (unsigned int i = 0; i < meshCount; i++)
+	{
+		auto mesh = make_unique<MeshData>();
+		mesh->name = ReadString(data, end);
+		mesh->sourceHash = ReadValue<unsigned long long>(data, end);
+		ReadArray(data, end, mesh->positions);
+		ReadArray(data, end, mesh->normals);
+		ReadArray(data, end, mesh->colors);
+		ReadArray(data, end, mesh->indices);
+		CheckIndices(mesh->indices, mesh->VertexCount());
+
+		if (ReadValue<unsigned char>(data, end) != 0)
+		{
+			mesh->progressive = ReadProgressive(data, end);
+			mesh->appliedSplits = ReadValue<int>(data, end);
+			if (mesh->appliedSplits < 0 || mesh->appliedSplits > (int)mesh->progressive->Splits().size())
+				throw runtime_error("Corrupt cooked file");
+			CheckProgressive(*mesh->progressive, mesh->VertexCount(), mesh->IndexCount());
+		}
+
+		unsigned int lodCount = ReadValue<unsigned int>(data, end);
+		if (lodCount > (size_t)(end - data) / (sizeof(float) + sizeof(unsigned int)))
+			throw runtime_error("Truncated cooked file");
+		mesh->lods.resize(lodCount);
+		for (auto& lod : mesh->lods)
+		{
+			lod.error = ReadValue<float>(data, end);
+			ReadArray(data, end, lod.indices);
+			CheckIndices(lod.indices, mesh->VertexCount());
+		}
+
+		ReadArray(data, end, mesh->clusters);
+		for (auto& cluster : mesh->clusters)
+		{
+			if (cluster.firstIndex < 0 || cluster.indexCount < 0 || cluster.indexCount > mesh->IndexCount() - cluster.firstIndex)
+				throw runtime_error("Corrupt cooked file");
+		}
+		mesh->bounds = ReadValue<MeshData::Bounds>(data, end);
+		mesh->strip = ReadValue<unsigned char>(data, end) != 0;
+		if (mesh->strip && mesh->progressive)
+			throw runtime_error("Corrupt cooked file");
+
+		unsigned int partCount = ReadValue<unsigned int>(data, end);
+		if (partCount > mesh->clusters.size())
+			throw runtime_error("Corrupt cooked file");
+		mesh->parts.resize(partCount);
+		for (auto& part : mesh->parts)
+		{
+			part.name = ReadString(data, end);
+			part.sourceHash = ReadValue<unsigned long long>(data, end);
+			part.firstCluster = ReadValue<int>(data, end);
+			part.clusterCount = ReadValue<int>(data, end);
+			part.bounds = ReadValue<MeshData::Bounds>(data, end);
+			if (part.firstCluster < 0 || part.clusterCount < 0 ||
+				part.clusterCount > (int)mesh->clusters.size() - part.firstCluster)
+				throw runtime_error("Corrupt cooked file");
+		}
+
+		meshes.push_back(std::move(mesh));
+	}
+
+	vector<SceneNode> readNodes(ReadValue<unsigned int>(data, end));
+	for (auto& node : readNodes)
+	{
+		node.name = ReadString(data, end);
+		node.parent = ReadValue<int>(data, end);
+		ReadBytes(data, end, node.transform, sizeof(node.transform));
+		node.mesh = ReadValue<int>(data, end);
+		node.materials.resize(ReadValue<unsigned int>(data, end));
+		for (auto& material : node.materials)
+			material = ReadString(data, end);
+
+		if (node.parent >= (int)(&node - readNodes.data()) || node.mesh >= (int)meshCount)
+			throw runtime_error("Corrupt cooked file");
+	}
+	if (nodes != nullptr)
+		*nodes = std::move(readNodes);
+
+	return meshes;
+}
+
+unsigned long long CookedFile::ReadSettings(const char *filename)
+{
+	MappedFile file(filename);
+	const char *data = file.Data();
+	return ReadHeader(data, data + file.Size());
+}
+
+unsigned long long CookedFile::ReadHeader(const char *&data, const char *end)
+{
+	char magic[sizeof(Magic)];
+	ReadBytes(data, end, magic, sizeof(magic));
+	if (!equal(magic, magic + sizeof(magic), Magic))
+		throw runtime_error("Not a cooked file");
+	if (ReadValue<unsigned int>(data, end) != Version)
+		throw runtime_error("Cooked file version mismatch");
+	return ReadValue<unsigned long long>(data, end);
+}
+
+void CookedFile::WriteProgressive(ostream& out, const ProgressiveMesh& progressive)
+{
+	WriteValue(out, progressive._baseVertexCount);
+	WriteValue(out, progressive._baseTriangleCount);
+	WriteArray(out, progressive._splits);
+	WriteArray(out, progressive._writes);
+	WriteArray(out, progressive._finalIndices);
+}
+
+unique_ptr<ProgressiveMesh> CookedFile::ReadProgressive(const char *&data, const char *end)
+{
+	// The vertex order is only needed while cooking, the data is already
+	// stored in split order.
+	auto progressive = unique_ptr<ProgressiveMesh>(new ProgressiveMesh());
+	progressive->_baseVertexCount = ReadValue<int>(data, end);
+	progressive->_baseTriangleCount = ReadValue<int>(data, end);
+	ReadArray(data, end, progressive->_splits);
+	ReadArray(data, end, progressive->_writes);
+	ReadArray(data, end, progressive->_finalIndices);
+	return progressive;
+}
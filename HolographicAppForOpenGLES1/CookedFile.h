@@ -0,0 +1,33 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include "MeshData.h"
+#include "SceneNode.h"
+
+using namespace std;
+
+// Cooked runtime data: the converted meshes and node hierarchy of one FBX file
+// stored exactly as they are uploaded, so loading one skips the FBX SDK
+// entirely. The app also writes one as a snapshot of whatever it has loaded.
+class CookedFile
+{
+public:
+	static const unsigned int Version = 11;
+
+	// Both throw on I/O errors, Read also throws on a version mismatch.
+	// 'settings' is whatever the writer converted the meshes with, see
+	// Importer::SettingsHash, zero for none.
+	static void Write(const char *filename, const vector<const MeshData *>& meshes,
+		const vector<SceneNode>& nodes, unsigned long long settings = 0);
+	static vector<unique_ptr<MeshData>> Read(const char *filename, vector<SceneNode> *nodes = nullptr);
+
+	// Only the settings the file was written with, throwing as Read does.
+	static unsigned long long ReadSettings(const char *filename);
+
+	static bool Exists(const char *filename);
+
+private:
+	static unsigned long long ReadHeader(const char *&data, const char *end);
+	static void WriteProgressive(ostream& out, const ProgressiveMesh& progressive);
+	static unique_ptr<ProgressiveMesh> ReadProgressive(const char *&data, const char *end);
+};
@@ -0,0 +1,48 @@
+#include "pch.h"
+#include "FileWatcher.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+
+FileWatcher::FileWatcher(const string& filename, int intervalMilliseconds) :
+	_filename(filename),
+	_interval(intervalMilliseconds),
+	_nextCheck(chrono::steady_clock::now() + _interval)
+{
+	_lastModified = ModifiedTime(_filename);
+}
+
+long long FileWatcher::ModifiedTime(const string& filename)
+{
+#ifdef _MSC_VER
+	// 100 ns ticks.
+	int length = MultiByteToWideChar(CP_ACP, 0, filename.c_str(), -1, nullptr, 0);
+	wstring wideName(length, L'\0');
+	MultiByteToWideChar(CP_ACP, 0, filename.c_str(), -1, &wideName[0], length);
+	WIN32_FILE_ATTRIBUTE_DATA info;
+	if (!GetFileAttributesExW(wideName.c_str(), GetFileExInfoStandard, &info))
+		return 0;
+	return (long long)info.ftLastWriteTime.dwHighDateTime << 32 | info.ftLastWriteTime.dwLowDateTime;
+#else
+	// Nanoseconds.
+	struct stat info;
+	if (stat(filename.c_str(), &info) != 0)
+		return 0;
+	return (long long)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+}
+
+bool FileWatcher::HasChanged()
+{
+	auto now = chrono::steady_clock::now();
+	if (now < _nextCheck)
+		return false;
+	_nextCheck = now + _interval;
+
+	// A missing file (e.g. mid-save) isn't a change, wait for it to come back.
+	long long modified = ModifiedTime(_filename);
+	if (modified == 0 || modified == _lastModified)
+		return false;
+
+	_lastModified = modified;
+	return true;
+}
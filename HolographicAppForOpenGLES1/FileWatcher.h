@@ -0,0 +1,32 @@
+#pragma once
+#include <string>
+#include <chrono>
+
+using namespace std;
+
+// Polls a file's modification time. Checks are rate limited so it is cheap
+// enough to call once a frame.
+class FileWatcher
+{
+public:
+	FileWatcher(const string& filename, int intervalMilliseconds = 500);
+
+	// Returns true once for each time the file has been modified.
+	bool HasChanged();
+
+	// Reports the file as changed at the next check, to retry reading a
+	// change that failed to read.
+	void Reset() { _lastModified = 0; }
+
+	// In units finer than a second, so a save landing in the same second as
+	// the last check still counts, 0 if the file doesn't exist. Only
+	// compares with other times it returns.
+	static long long ModifiedTime(const string& filename);
+
+private:
+
+	string _filename;
+	chrono::milliseconds _interval;
+	chrono::steady_clock::time_point _nextCheck;
+	long long _lastModified;
+};
@@ -0,0 +1,227 @@
+#include "pch.h"
+#include "FrameQueue.h"
+#include <algorithm>
+
+const int FrameQueue::Slots;
+
+namespace
+{
+	// The state word holds two bits per slot, then the newest slot.
+	enum SlotState : unsigned int
+	{
+		Free,
+		Writing,
+		Ready,
+		Reading
+	};
+
+	const unsigned int NewestShift = 4;
+
+	SlotState StateOf(unsigned int state, int slot)
+	{
+		return (SlotState)((state >> (2 * slot)) & 3);
+	}
+
+	unsigned int WithState(unsigned int state, int slot, SlotState slotState)
+	{
+		return (state & ~(3u << (2 * slot))) | (unsigned int)slotState << (2 * slot);
+	}
+
+	int NewestOf(unsigned int state)
+	{
+		return (int)(state >> NewestShift);
+	}
+
+	unsigned int WithNewest(unsigned int state, int slot)
+	{
+		return (state & ((1u << NewestShift) - 1)) | (unsigned int)slot << NewestShift;
+	}
+}
+
+FrameQueue::FrameQueue() :
+	_state(0),
+	_writing(-1),
+	_reading(-1),
+	_renderWaiting(false),
+	_updateWaiting(false),
+	_stopped(false),
+	_lastPresented(-1)
+{
+	ResetStats();
+}
+
+FrameCommands& FrameQueue::BeginFrame()
+{
+	// The render side holds at most one slot, so another is free or holds
+	// a frame it hasn't taken, which this one replaces.
+	unsigned int state = _state.load();
+	for (;;)
+	{
+		int slot = -1;
+		for (int i = 0; i < Slots && slot < 0; i++)
+			slot = StateOf(state, i) == Free ? i : -1;
+		bool drop = slot < 0;
+		for (int i = 0; i < Slots && slot < 0; i++)
+			slot = StateOf(state, i) == Ready ? i : -1;
+
+		if (_state.compare_exchange_weak(state, WithState(state, slot, Writing)))
+		{
+			if (drop)
+				_dropped++;
+			_writing = slot;
+			return _slots[slot];
+		}
+	}
+}
+
+void FrameQueue::Publish()
+{
+	unsigned int state = _state.load();
+	bool drop;
+	for (;;)
+	{
+		unsigned int next = WithNewest(WithState(state, _writing, Ready), _writing);
+
+		// Anything older still waiting is never drawn now.
+		drop = false;
+		for (int i = 0; i < Slots; i++)
+		{
+			if (i != _writing && StateOf(state, i) == Ready)
+			{
+				next = WithState(next, i, Free);
+				drop = true;
+			}
+		}
+		if (_state.compare_exchange_weak(state, next))
+			break;
+	}
+	_writing = -1;
+	_published++;
+	if (drop)
+		_dropped++;
+	Wake(_renderWaiting);
+}
+
+bool FrameQueue::WaitUntilTaken(chrono::steady_clock::duration timeout)
+{
+	auto taken = [this]
+	{
+		unsigned int state = _state.load();
+		return StateOf(state, NewestOf(state)) != Ready;
+	};
+	if (taken())
+		return true;
+
+	unique_lock<mutex> lock(_wakeLock);
+	_updateWaiting = true;
+	bool result = _wake.wait_for(lock, timeout, [&] { return _stopped || taken(); }) && taken();
+	_updateWaiting = false;
+	return result;
+}
+
+const FrameCommands *FrameQueue::Acquire(chrono::steady_clock::duration timeout)
+{
+	auto take = [this]
+	{
+		unsigned int state = _state.load();
+		for (;;)
+		{
+			int newest = NewestOf(state);
+			if (StateOf(state, newest) != Ready)
+				return false;
+			if (_state.compare_exchange_weak(state, WithState(state, newest, Reading)))
+			{
+				_reading = newest;
+				return true;
+			}
+		}
+	};
+
+	bool taken = !_stopped && take();
+	if (!taken && timeout > chrono::steady_clock::duration::zero())
+	{
+		unique_lock<mutex> lock(_wakeLock);
+		_renderWaiting = true;
+		taken = _wake.wait_for(lock, timeout, [&] { return _stopped || take(); }) && _reading >= 0;
+		_renderWaiting = false;
+	}
+	if (!taken)
+		return nullptr;
+
+	Wake(_updateWaiting);
+	return &_slots[_reading];
+}
+
+void FrameQueue::Release()
+{
+	unsigned int state = _state.load();
+	while (!_state.compare_exchange_weak(state, WithState(state, _reading, Free)))
+	{
+	}
+	_reading = -1;
+}
+
+void FrameQueue::Presented(const FrameCommands& frame)
+{
+	if (frame.frame == _lastPresented)
+	{
+		_repeated++;
+		return;
+	}
+
+	double latency = chrono::duration<double, milli>(chrono::steady_clock::now() - frame.recorded).count();
+	_lastPresented = frame.frame;
+	_presented++;
+	_totalLatency += latency;
+	_worstLatency = max(_worstLatency, latency);
+}
+
+FrameQueue::Stats FrameQueue::GetStats() const
+{
+	Stats stats;
+	stats.published = _published;
+	stats.dropped = _dropped;
+	stats.presented = _presented;
+	stats.repeated = _repeated;
+	stats.meanLatencyMilliseconds = _presented > 0 ? _totalLatency / _presented : 0.0;
+	stats.worstLatencyMilliseconds = _worstLatency;
+	return stats;
+}
+
+void FrameQueue::ResetStats()
+{
+	_published = 0;
+	_dropped = 0;
+	_presented = 0;
+	_repeated = 0;
+	_totalLatency = 0.0;
+	_worstLatency = 0.0;
+}
+
+void FrameQueue::Stop()
+{
+	_stopped = true;
+	lock_guard<mutex> lock(_wakeLock);
+	_wake.notify_all();
+}
+
+void FrameQueue::Start()
+{
+	_state = 0;
+	_writing = -1;
+	_reading = -1;
+	_lastPresented = -1;
+	_stopped = false;
+}
+
+void FrameQueue::Wake(atomic<bool>& waiting)
+{
+	// Taking the lock once the other side says it's waiting means it is
+	// inside wait_for by the time of the notify, so the notify isn't lost.
+	if (!waiting)
+		return;
+	{
+		lock_guard<mutex> lock(_wakeLock);
+	}
+	_wake.notify_all();
+}
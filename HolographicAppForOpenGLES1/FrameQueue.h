@@ -0,0 +1,109 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+using namespace std;
+
+// What the update thread decides about a frame, for the render thread to
+// draw. Matrices are column major as uploaded to GL.
+struct FrameCommands
+{
+	// Numbered by the update side, a frame drawn again keeps its number.
+	int frame = 0;
+	chrono::steady_clock::time_point recorded;
+
+	float model[16];
+
+	// The view the scene is culled and its LODs picked from, and without a
+	// holographic space drawn with. Holographic frames have none until the
+	// head has been located.
+	bool hasView = false;
+	float view[16];
+
+	// Record this frame's GL calls to a trace.
+	bool capture = false;
+};
+
+// Hands frames from the update thread to the render thread through two
+// slots. The update side records into whichever slot the render side isn't
+// drawing from and publishes it, the render side takes the newest published
+// and gives it back when drawn. Slot states and which is newest share one
+// atomic word, so neither side ever takes a lock to pass a frame. A frame
+// published while the render side is still drawing replaces any published
+// one it hasn't taken, which is then dropped.
+//
+// Either side can also wait for the other, the only time a lock is taken.
+class FrameQueue
+{
+public:
+	struct Stats
+	{
+		int published = 0;
+		int dropped = 0;
+		int presented = 0;
+
+		// Presented again as the update side had nothing newer in time.
+		int repeated = 0;
+
+		// From a frame's recording to the swap that first presents it.
+		double meanLatencyMilliseconds = 0.0;
+		double worstLatencyMilliseconds = 0.0;
+	};
+
+	FrameQueue();
+
+	// Update side. The frame to record into, then Publish it.
+	FrameCommands& BeginFrame();
+	void Publish();
+
+	// Waits until the render side has taken the last frame published, or
+	// the queue stops, for at most timeout. Keeps the update side from
+	// recording frames nobody draws. Returns whether it was taken.
+	bool WaitUntilTaken(chrono::steady_clock::duration timeout);
+
+	// Render side. The newest frame published since the last taken, waiting
+	// for one for at most timeout. Null on timeout or once stopped. Each
+	// frame taken is given back with Release before the next.
+	const FrameCommands *Acquire(chrono::steady_clock::duration timeout);
+	void Release();
+
+	// Call after the swap that shows frame, drawn again or not.
+	void Presented(const FrameCommands& frame);
+
+	// Counts since the last ResetStats. Only the render side reads them.
+	Stats GetStats() const;
+	void ResetStats();
+
+	// Wakes both sides and keeps Acquire returning null until Start, which
+	// also empties the queue.
+	void Stop();
+	void Start();
+
+private:
+	static const int Slots = 2;
+
+	// The render side waits for frames, the update side for them to be
+	// taken, each woken by the other only when it says it's waiting.
+	void Wake(atomic<bool>& waiting);
+
+	FrameCommands _slots[Slots];
+	atomic<unsigned int> _state;
+	int _writing;
+	int _reading;
+
+	mutex _wakeLock;
+	condition_variable _wake;
+	atomic<bool> _renderWaiting;
+	atomic<bool> _updateWaiting;
+	atomic<bool> _stopped;
+
+	atomic<int> _published;
+	atomic<int> _dropped;
+	int _presented;
+	int _repeated;
+	int _lastPresented;
+	double _totalLatency;
+	double _worstLatency;
+};
@@ -0,0 +1,231 @@
+#include "pch.h"
+#include "FrustumCuller.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUM_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define FRUSTUM_NEON
+
+// Whether every lane is set, 32 bit ARM has no vminvq.
+static inline bool AllLanes(uint32x4_t mask)
+{
+	uint32x2_t half = vpmin_u32(vget_low_u32(mask), vget_high_u32(mask));
+	return vget_lane_u32(vpmin_u32(half, half), 0) != 0;
+}
+#endif
+
+// Bounds each thread takes at a time, a multiple of the SIMD width.
+static const int ParallelChunk = 8192;
+
+static void Normalize(float *plane)
+{
+	float length = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+	for (int i = 0; i < 4 && length > 0.0f; i++)
+		plane[i] /= length;
+}
+
+Frustum Frustum::FromMatrix(const float *matrix)
+{
+	// Rows of the matrix, added to and taken from the w row.
+	Frustum frustum;
+	frustum.numPlanes = MaxPlanes;
+	for (int plane = 0; plane < MaxPlanes; plane++)
+	{
+		int row = plane / 2;
+		float sign = plane % 2 == 0 ? 1.0f : -1.0f;
+		for (int column = 0; column < 4; column++)
+			frustum.planes[plane][column] = matrix[column * 4 + 3] + sign * matrix[column * 4 + row];
+		Normalize(frustum.planes[plane]);
+	}
+	return frustum;
+}
+
+Frustum Frustum::Stereo(float eyeSeparation, float tanHalfWidth, float tanHalfHeight, float nearZ, float farZ)
+{
+	// x >= -h + t z for the left eye's left side, and so on, where h is half
+	// the eye separation and z is negative ahead.
+	float h = 0.5f * eyeSeparation;
+	Frustum frustum;
+	frustum.numPlanes = MaxPlanes;
+	const float planes[MaxPlanes][4] = {
+		{ 1.0f, 0.0f, -tanHalfWidth, h },
+		{ -1.0f, 0.0f, -tanHalfWidth, h },
+		{ 0.0f, 1.0f, -tanHalfHeight, 0.0f },
+		{ 0.0f, -1.0f, -tanHalfHeight, 0.0f },
+		{ 0.0f, 0.0f, -1.0f, -nearZ },
+		{ 0.0f, 0.0f, 1.0f, farZ },
+	};
+	for (int plane = 0; plane < MaxPlanes; plane++)
+	{
+		copy(planes[plane], planes[plane] + 4, frustum.planes[plane]);
+		Normalize(frustum.planes[plane]);
+	}
+	return frustum;
+}
+
+Frustum Frustum::Transformed(const float *matrix) const
+{
+	// A point p in the source space is matrix * p here, so each plane is
+	// carried back by the transpose.
+	Frustum frustum;
+	frustum.numPlanes = numPlanes;
+	for (int plane = 0; plane < numPlanes; plane++)
+	{
+		for (int column = 0; column < 4; column++)
+		{
+			const float *m = matrix + column * 4;
+			frustum.planes[plane][column] = m[0] * planes[plane][0] + m[1] * planes[plane][1] + m[2] * planes[plane][2] +
+				m[3] * planes[plane][3];
+		}
+		Normalize(frustum.planes[plane]);
+	}
+	return frustum;
+}
+
+void FrustumCuller::Clear()
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		_boxCenter[axis].clear();
+		_boxExtent[axis].clear();
+		_sphereCenter[axis].clear();
+	}
+	_sphereRadius.clear();
+}
+
+void FrustumCuller::Add(const float *boxMin, const float *boxMax, const float *center, float radius)
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		_boxCenter[axis].push_back(0.5f * (boxMin[axis] + boxMax[axis]));
+		_boxExtent[axis].push_back(0.5f * (boxMax[axis] - boxMin[axis]));
+		_sphereCenter[axis].push_back(center[axis]);
+	}
+	_sphereRadius.push_back(radius);
+}
+
+int FrustumCuller::Cull(const Frustum& frustum, unsigned char *visible, ThreadPool *pool) const
+{
+	const int count = Count();
+	if (!pool || count < ParallelMinBounds)
+		return CullRange(frustum, 0, count, visible);
+
+	const int chunks = (count + ParallelChunk - 1) / ParallelChunk;
+	vector<int> counts(chunks);
+	pool->ParallelFor(chunks, [&](int chunk)
+	{
+		int first = chunk * ParallelChunk;
+		counts[chunk] = CullRange(frustum, first, min(first + ParallelChunk, count), visible);
+	});
+
+	int total = 0;
+	for (int n : counts)
+		total += n;
+	return total;
+}
+
+int FrustumCuller::CullScalar(const Frustum& frustum, unsigned char *visible) const
+{
+	return CullScalarRange(frustum, 0, Count(), visible);
+}
+
+int FrustumCuller::CullScalarRange(const Frustum& frustum, int first, int last, unsigned char *visible) const
+{
+	int total = 0;
+	for (int i = first; i < last; i++)
+	{
+		bool inside = true;
+		for (int p = 0; p < frustum.numPlanes && inside; p++)
+		{
+			// Summed in the same order as the SSE2 path, so both agree exactly.
+			auto& plane = frustum.planes[p];
+			float box = (plane[0] * _boxCenter[0][i] + plane[1] * _boxCenter[1][i]) + (plane[2] * _boxCenter[2][i] + plane[3]);
+			box += fabsf(plane[0]) * _boxExtent[0][i] + (fabsf(plane[1]) * _boxExtent[1][i] + fabsf(plane[2]) * _boxExtent[2][i]);
+			float sphere = (plane[0] * _sphereCenter[0][i] + plane[1] * _sphereCenter[1][i]) +
+				(plane[2] * _sphereCenter[2][i] + plane[3]);
+			sphere += _sphereRadius[i];
+			inside = box >= 0.0f && sphere >= 0.0f;
+		}
+		visible[i] = inside ? 1 : 0;
+		total += inside ? 1 : 0;
+	}
+	return total;
+}
+
+int FrustumCuller::CullRange(const Frustum& frustum, int first, int last, unsigned char *visible) const
+{
+	int total = 0;
+	int i = first;
+#if defined(FRUSTUM_SSE2)
+	// Each plane's coefficients and their magnitudes, splatted once.
+	__m128 planes[Frustum::MaxPlanes][7];
+	for (int p = 0; p < frustum.numPlanes; p++)
+	{
+		for (int k = 0; k < 4; k++)
+			planes[p][k] = _mm_set1_ps(frustum.planes[p][k]);
+		for (int k = 0; k < 3; k++)
+			planes[p][4 + k] = _mm_set1_ps(fabsf(frustum.planes[p][k]));
+	}
+
+	const __m128 zero = _mm_setzero_ps();
+	for (; i + 4 <= last; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(&_boxCenter[0][i]), cy = _mm_loadu_ps(&_boxCenter[1][i]), cz = _mm_loadu_ps(&_boxCenter[2][i]);
+		__m128 ex = _mm_loadu_ps(&_boxExtent[0][i]), ey = _mm_loadu_ps(&_boxExtent[1][i]), ez = _mm_loadu_ps(&_boxExtent[2][i]);
+		__m128 sx = _mm_loadu_ps(&_sphereCenter[0][i]), sy = _mm_loadu_ps(&_sphereCenter[1][i]), sz = _mm_loadu_ps(&_sphereCenter[2][i]);
+		__m128 r = _mm_loadu_ps(&_sphereRadius[i]);
+		// Most of a scene is usually outside, so stop once all four are.
+		int mask = 0;
+		for (int p = 0; p < frustum.numPlanes && mask != 0xF; p++)
+		{
+			const __m128 *plane = planes[p];
+			__m128 box = _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane[0], cx), _mm_mul_ps(plane[1], cy)),
+				_mm_add_ps(_mm_mul_ps(plane[2], cz), plane[3]));
+			box = _mm_add_ps(box, _mm_add_ps(_mm_mul_ps(plane[4], ex), _mm_add_ps(_mm_mul_ps(plane[5], ey), _mm_mul_ps(plane[6], ez))));
+			__m128 sphere = _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane[0], sx), _mm_mul_ps(plane[1], sy)),
+				_mm_add_ps(_mm_mul_ps(plane[2], sz), plane[3]));
+			sphere = _mm_add_ps(sphere, r);
+			mask |= _mm_movemask_ps(_mm_or_ps(_mm_cmplt_ps(box, zero), _mm_cmplt_ps(sphere, zero)));
+		}
+		for (int lane = 0; lane < 4; lane++)
+		{
+			int inside = (mask >> lane & 1) ^ 1;
+			visible[i + lane] = (unsigned char)inside;
+			total += inside;
+		}
+	}
+#elif defined(FRUSTUM_NEON)
+	const float32x4_t zero = vdupq_n_f32(0.0f);
+	for (; i + 4 <= last; i += 4)
+	{
+		float32x4_t cx = vld1q_f32(&_boxCenter[0][i]), cy = vld1q_f32(&_boxCenter[1][i]), cz = vld1q_f32(&_boxCenter[2][i]);
+		float32x4_t ex = vld1q_f32(&_boxExtent[0][i]), ey = vld1q_f32(&_boxExtent[1][i]), ez = vld1q_f32(&_boxExtent[2][i]);
+		float32x4_t sx = vld1q_f32(&_sphereCenter[0][i]), sy = vld1q_f32(&_sphereCenter[1][i]), sz = vld1q_f32(&_sphereCenter[2][i]);
+		float32x4_t r = vld1q_f32(&_sphereRadius[i]);
+		uint32x4_t outside = vdupq_n_u32(0);
+		for (int p = 0; p < frustum.numPlanes && !AllLanes(outside); p++)
+		{
+			auto& plane = frustum.planes[p];
+			float32x4_t box = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vdupq_n_f32(plane[3]), cx, plane[0]), cy, plane[1]), cz, plane[2]);
+			box = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(box, ex, fabsf(plane[0])), ey, fabsf(plane[1])), ez, fabsf(plane[2]));
+			float32x4_t sphere = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vaddq_f32(r, vdupq_n_f32(plane[3])), sx, plane[0]), sy,
+				plane[1]), sz, plane[2]);
+			outside = vorrq_u32(outside, vorrq_u32(vcltq_f32(box, zero), vcltq_f32(sphere, zero)));
+		}
+		uint32_t lanes[4];
+		vst1q_u32(lanes, outside);
+		for (int lane = 0; lane < 4; lane++)
+		{
+			int inside = lanes[lane] ? 0 : 1;
+			visible[i + lane] = (unsigned char)inside;
+			total += inside;
+		}
+	}
+#endif
+	return total + CullScalarRange(frustum, i, last, visible);
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <vector>
+
+using namespace std;
+
+class ThreadPool;
+
+// A convex volume as planes facing inwards, a point is inside when
+// ax + by + cz + d >= 0 for every plane. Planes are kept normalised, so d
+// plus the dot product is a distance.
+struct Frustum
+{
+	static const int MaxPlanes = 6;
+
+	float planes[MaxPlanes][4];
+	int numPlanes = 0;
+
+	// Left, right, bottom, top, near and far of a column major projection,
+	// or projection * modelView, after Gribb and Hartmann.
+	static Frustum FromMatrix(const float *matrix);
+
+	// One frustum holding both eyes' views, in the space of a head looking
+	// down -z with its eyes eyeSeparation apart along x. Each eye sees
+	// tanHalfWidth and tanHalfHeight either side of straight ahead, the side
+	// planes go through the outer eye so everything either eye sees is
+	// inside.
+	static Frustum Stereo(float eyeSeparation, float tanHalfWidth, float tanHalfHeight, float nearZ, float farZ);
+
+	// The same volume in the space matrix maps from, object space given a
+	// column major model view.
+	Frustum Transformed(const float *matrix) const;
+};
+
+// Tests many bounding boxes and spheres against a frustum at once. The
+// bounds are kept as a structure of arrays so four are tested per SSE2 or
+// NEON instruction, with plain C++ for other targets and the last few.
+// A bound is culled when either its box or its sphere is entirely outside a
+// plane, each alone keeps some that the other would drop.
+class FrustumCuller
+{
+public:
+	// Below this many bounds a pool's threads cost more than they save.
+	static const int ParallelMinBounds = 16384;
+
+	void Clear();
+	void Add(const float *boxMin, const float *boxMax, const float *center, float radius);
+	int Count() const { return (int)_sphereRadius.size(); }
+
+	// Sets visible[i] to 1 for each bound at least partly inside frustum and
+	// to 0 for the rest, returns how many are visible. Given a pool, large
+	// sets are split across its threads.
+	int Cull(const Frustum& frustum, unsigned char *visible, ThreadPool *pool = nullptr) const;
+
+	// The same a bound at a time, to check and measure the SIMD path by.
+	int CullScalar(const Frustum& frustum, unsigned char *visible) const;
+
+private:
+	int CullRange(const Frustum& frustum, int first, int last, unsigned char *visible) const;
+	int CullScalarRange(const Frustum& frustum, int first, int last, unsigned char *visible) const;
+
+	vector<float> _boxCenter[3];
+	vector<float> _boxExtent[3];
+	vector<float> _sphereCenter[3];
+	vector<float> _sphereRadius;
+};
@@ -0,0 +1,220 @@
+#include "pch.h"
+#include "GeometryPool.h"
+#include "GlState.h"
+#include "GlTrace.h"
+#include <algorithm>
+
+const int GeometryPool::Alignment;
+
+GeometryPool::GeometryPool(GLenum target, int arenaBytes) :
+	_target(target),
+	_arenaBytes(Align(arenaBytes))
+{
+}
+
+GeometryPool::~GeometryPool()
+{
+	for (auto& arena : _arenas)
+		GlState::Current().DeleteBuffer(arena.buffer);
+}
+
+int GeometryPool::NewArena(int capacity)
+{
+	int index = 0;
+	while (index < (int)_arenas.size() && _arenas[index].buffer != 0)
+		index++;
+	if (index == (int)_arenas.size())
+		_arenas.emplace_back();
+
+	auto& arena = _arenas[index];
+	arena.capacity = capacity;
+	arena.free.clear();
+	arena.free[0] = capacity;
+	arena.allocations.clear();
+	glGenBuffers(1, &arena.buffer);
+	GlState::Current().BindBuffer(_target, arena.buffer);
+	GlTrace::Current().BufferData(_target, capacity, nullptr, GL_STATIC_DRAW);
+	return index;
+}
+
+GeometryPool::Allocation GeometryPool::Allocate(int bytes, MovedFunction moved)
+{
+	const int size = Align(max(bytes, 1));
+
+	int best = -1;
+	int bestOffset = 0;
+	int bestSize = 0;
+	for (int i = 0; i < (int)_arenas.size(); i++)
+	{
+		for (auto& block : _arenas[i].free)
+		{
+			if (block.second >= size && (best < 0 || block.second < bestSize))
+			{
+				best = i;
+				bestOffset = block.first;
+				bestSize = block.second;
+			}
+		}
+	}
+	if (best < 0)
+	{
+		best = NewArena(max(size, _arenaBytes));
+		bestOffset = 0;
+		bestSize = _arenas[best].capacity;
+	}
+
+	auto& arena = _arenas[best];
+	arena.free.erase(bestOffset);
+	if (bestSize > size)
+		arena.free[bestOffset + size] = bestSize - size;
+
+	int id;
+	if (_unusedRecords.empty())
+	{
+		id = (int)_records.size();
+		_records.emplace_back();
+	}
+	else
+	{
+		id = _unusedRecords.back();
+		_unusedRecords.pop_back();
+	}
+	auto& record = _records[id];
+	record.arena = best;
+	record.offset = bestOffset;
+	record.size = size;
+	record.moved = std::move(moved);
+	arena.allocations[bestOffset] = id;
+
+	GlState::Current().BindBuffer(_target, arena.buffer);
+	return { id, arena.buffer, bestOffset };
+}
+
+void GeometryPool::Free(int& id)
+{
+	if (id < 0)
+		return;
+
+	auto& record = _records[id];
+	auto& arena = _arenas[record.arena];
+	arena.allocations.erase(record.offset);
+
+	int offset = record.offset;
+	int size = record.size;
+	auto next = arena.free.lower_bound(offset);
+	if (next != arena.free.end() && offset + size == next->first)
+	{
+		size += next->second;
+		next = arena.free.erase(next);
+	}
+	if (next != arena.free.begin())
+	{
+		auto previous = prev(next);
+		if (previous->first + previous->second == offset)
+		{
+			offset = previous->first;
+			size += previous->second;
+			arena.free.erase(previous);
+		}
+	}
+	arena.free[offset] = size;
+
+	if (arena.allocations.empty())
+	{
+		GlState::Current().DeleteBuffer(arena.buffer);
+		arena.free.clear();
+	}
+
+	record.arena = -1;
+	record.moved = nullptr;
+	_unusedRecords.push_back(id);
+	id = -1;
+}
+
+bool GeometryPool::HasHoles(const Arena& arena)
+{
+	return !arena.free.empty() && !arena.allocations.empty() &&
+		arena.free.begin()->first < arena.allocations.rbegin()->first;
+}
+
+void GeometryPool::RebuildFreeList(Arena& arena, const vector<Record>& records)
+{
+	arena.free.clear();
+	int end = 0;
+	for (auto& allocation : arena.allocations)
+	{
+		if (allocation.first > end)
+			arena.free[end] = allocation.first - end;
+		end = allocation.first + records[allocation.second].size;
+	}
+	if (end < arena.capacity)
+		arena.free[end] = arena.capacity - end;
+}
+
+int GeometryPool::Defragment(int byteBudget)
+{
+	int used = 0;
+	for (auto& arena : _arenas)
+	{
+		if (arena.buffer == 0 || !HasHoles(arena))
+			continue;
+
+		// Everything before the cursor is packed.
+		vector<int> moved;
+		map<int, int> allocations;
+		int cursor = 0;
+		bool outOfBudget = false;
+		for (auto& allocation : arena.allocations)
+		{
+			auto& record = _records[allocation.second];
+			if (!outOfBudget && record.offset > cursor)
+			{
+				if (used > 0 && used + record.size > byteBudget)
+				{
+					outOfBudget = true;
+				}
+				else
+				{
+					record.offset = cursor;
+					used += record.size;
+					moved.push_back(allocation.second);
+				}
+			}
+			allocations[record.offset] = allocation.second;
+			cursor = record.offset + record.size;
+		}
+		arena.allocations = std::move(allocations);
+		RebuildFreeList(arena, _records);
+
+		// The bookkeeping is settled before anyone uploads.
+		for (int id : moved)
+			_records[id].moved(_records[id].offset);
+
+		if (outOfBudget)
+			break;
+	}
+	return used;
+}
+
+GeometryPool::Stats GeometryPool::GetStats() const
+{
+	Stats stats;
+	for (auto& arena : _arenas)
+	{
+		if (arena.buffer == 0)
+			continue;
+
+		stats.arenas++;
+		stats.allocations += (int)arena.allocations.size();
+		stats.capacity += arena.capacity;
+		int lastAllocation = arena.allocations.empty() ? -1 : arena.allocations.rbegin()->first;
+		for (auto& block : arena.free)
+		{
+			stats.used -= block.second;
+			stats.holes += block.first < lastAllocation ? 1 : 0;
+			stats.largestFree = max(stats.largestFree, block.second);
+		}
+		stats.used += arena.capacity;
+	}
+	return stats;
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include "pch.h"
+#include <functional>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+// Hands out ranges of a few large buffers bound to one target, so meshes
+// share buffers instead of each owning its own, and drawing one after
+// another leaves the bindings alone. Each arena is one buffer with a free
+// list in offset order, ranges are taken best fit and merged with their
+// neighbours again when freed.
+//
+// Defragment slides allocations down over the holes freeing leaves. GLES2
+// can't copy between buffers on the GPU, so the owner is told the new offset
+// and uploads its data there again from its CPU side copy.
+class GeometryPool
+{
+public:
+	static const int DefaultArenaBytes = 4 * 1024 * 1024;
+
+	// Offsets are kept to a multiple of this, which suits every attribute
+	// type and the indices.
+	static const int Alignment = 16;
+
+	typedef function<void(int offset)> MovedFunction;
+
+	explicit GeometryPool(GLenum target, int arenaBytes = DefaultArenaBytes);
+	~GeometryPool();
+
+	struct Allocation
+	{
+		int id;
+		GLuint buffer;
+		int offset;
+	};
+
+	// Takes bytes from the arena where they fit tightest, making a new arena
+	// if none has room, one of their own for allocations larger than an
+	// arena. The buffer is left bound. moved is called whenever Defragment
+	// moves the range, until it is freed.
+	Allocation Allocate(int bytes, MovedFunction moved);
+
+	// Gives the range back and sets id to -1. An arena's buffer is deleted
+	// once nothing is left in it.
+	void Free(int& id);
+
+	// Moves allocations down over the holes until byteBudget bytes have been
+	// moved, always moving one if there is a hole at all. Returns the bytes
+	// moved, which their owners have uploaded again.
+	int Defragment(int byteBudget);
+
+	static int Align(int bytes) { return (bytes + Alignment - 1) / Alignment * Alignment; }
+
+	struct Stats
+	{
+		int arenas = 0;
+		int allocations = 0;
+		int capacity = 0;
+		int used = 0;
+
+		// Free ranges with allocations after them, which only Defragment
+		// gets back in one piece.
+		int holes = 0;
+		int largestFree = 0;
+	};
+	Stats GetStats() const;
+
+private:
+	struct Arena
+	{
+		// 0 for a slot whose arena has been deleted.
+		GLuint buffer;
+		int capacity;
+
+		// Offset to size, and offset to the allocation's id.
+		map<int, int> free;
+		map<int, int> allocations;
+	};
+
+	struct Record
+	{
+		// -1 while the record isn't in use.
+		int arena;
+		int offset;
+		int size;
+		MovedFunction moved;
+	};
+
+	int NewArena(int capacity);
+	static bool HasHoles(const Arena& arena);
+	static void RebuildFreeList(Arena& arena, const vector<Record>& records);
+
+	GLenum _target;
+	int _arenaBytes;
+	vector<Arena> _arenas;
+	vector<Record> _records;
+	vector<int> _unusedRecords;
+};
@@ -0,0 +1,354 @@
+#include "pch.h"
+#include "GlState.h"
+#include "GlTrace.h"
+#include <algorithm>
+#include <cstring>
+
+const GLuint GlState::Unknown;
+
+GlState& GlState::Current()
+{
+	static GlState state;
+	return state;
+}
+
+GlState::GlState()
+{
+	Invalidate();
+}
+
+void GlState::Invalidate()
+{
+	_arrayBuffer = Unknown;
+	_elementArrayBuffer = Unknown;
+	_program = Unknown;
+	ForgetAttribs(_attribs);
+	_hasVertexArrays = -1;
+	_vertexArray = Unknown;
+	_defaultElementArrayBuffer = Unknown;
+	ForgetAttribs(_defaultAttribs);
+	_vertexArrayElements.clear();
+	_cullFace = -1;
+	_depthTest = -1;
+	_blend = -1;
+	_cullFaceMode = Unknown;
+	_frontFace = Unknown;
+	_depthMask = -1;
+	_blendSource = Unknown;
+	_blendDestination = Unknown;
+}
+
+void GlState::ForgetAttribs(Attrib *attribs)
+{
+	for (int i = 0; i < MaxAttribs; i++)
+	{
+		attribs[i].known = false;
+		attribs[i].enabled = false;
+		attribs[i].pointerKnown = false;
+		attribs[i].divisorKnown = false;
+	}
+}
+
+bool GlState::Changed(bool changed)
+{
+	if (changed)
+		_thisFrame.issued++;
+	else
+		_thisFrame.avoided++;
+	return changed;
+}
+
+void GlState::EndFrame()
+{
+	_lastFrame = _thisFrame;
+	_thisFrame = Counters();
+}
+
+void GlState::BindBuffer(GLenum target, GLuint buffer)
+{
+	GLuint *bound = target == GL_ARRAY_BUFFER ? &_arrayBuffer :
+		target == GL_ELEMENT_ARRAY_BUFFER ? &_elementArrayBuffer : nullptr;
+	if (Changed(bound == nullptr || *bound != buffer))
+	{
+		_thisFrame.bufferBinds++;
+		glBindBuffer(target, buffer);
+		GlTrace::Current().Record(GlCommand::BindBuffer, { target, buffer });
+	}
+	if (bound != nullptr)
+		*bound = buffer;
+}
+
+void GlState::DeleteBuffer(GLuint& buffer)
+{
+	if (buffer == 0)
+		return;
+
+	glDeleteBuffers(1, &buffer);
+	GlTrace::Current().Record(GlCommand::DeleteBuffer, { buffer });
+	if (_arrayBuffer == buffer)
+		_arrayBuffer = 0;
+	if (_elementArrayBuffer == buffer)
+		_elementArrayBuffer = 0;
+
+	// Arrays that aren't bound keep a deleted buffer attached, and its name
+	// can come back for a new one, so those bindings become unknown.
+	if (_defaultElementArrayBuffer == buffer)
+		_defaultElementArrayBuffer = Unknown;
+	replace(_vertexArrayElements.begin(), _vertexArrayElements.end(), buffer, Unknown);
+	for (int i = 0; i < MaxAttribs; i++)
+	{
+		if (_attribs[i].pointerKnown && _attribs[i].buffer == buffer)
+			_attribs[i].pointerKnown = false;
+		if (_defaultAttribs[i].pointerKnown && _defaultAttribs[i].buffer == buffer)
+			_defaultAttribs[i].pointerKnown = false;
+	}
+	buffer = 0;
+}
+
+void GlState::UseProgram(GLuint program)
+{
+	if (Changed(_program != program))
+	{
+		glUseProgram(program);
+		GlTrace::Current().Record(GlCommand::UseProgram, { program });
+	}
+	_program = program;
+}
+
+bool GlState::HasVertexArrays()
+{
+	if (_hasVertexArrays < 0)
+	{
+		auto extensions = (const char *)glGetString(GL_EXTENSIONS);
+		_hasVertexArrays = extensions != nullptr && strstr(extensions, "GL_OES_vertex_array_object") != nullptr ? 1 : 0;
+	}
+	return _hasVertexArrays != 0;
+}
+
+void GlState::BindVertexArray(GLuint array)
+{
+	if (!Changed(_vertexArray != array))
+		return;
+
+	glBindVertexArrayOES(array);
+	GlTrace::Current().Record(GlCommand::BindVertexArray, { array });
+	if (_vertexArray == 0)
+	{
+		_defaultElementArrayBuffer = _elementArrayBuffer;
+		copy(_attribs, _attribs + MaxAttribs, _defaultAttribs);
+	}
+	else if (_vertexArray != Unknown)
+	{
+		if (_vertexArray >= _vertexArrayElements.size())
+			_vertexArrayElements.resize(_vertexArray + 1, Unknown);
+		_vertexArrayElements[_vertexArray] = _elementArrayBuffer;
+	}
+
+	if (array == 0)
+	{
+		_elementArrayBuffer = _defaultElementArrayBuffer;
+		copy(_defaultAttribs, _defaultAttribs + MaxAttribs, _attribs);
+	}
+	else
+	{
+		_elementArrayBuffer = array < _vertexArrayElements.size() ? _vertexArrayElements[array] : Unknown;
+		ForgetAttribs(_attribs);
+	}
+	_vertexArray = array;
+}
+
+void GlState::DeleteVertexArray(GLuint& array)
+{
+	if (array == 0)
+		return;
+
+	if (_vertexArray == array)
+		BindVertexArray(0);
+	glDeleteVertexArraysOES(1, &array);
+	GlTrace::Current().Record(GlCommand::DeleteVertexArray, { array });
+	if (array < _vertexArrayElements.size())
+		_vertexArrayElements[array] = Unknown;
+	array = 0;
+}
+
+void GlState::EnableVertexAttribArray(GLint index)
+{
+	if (index < 0 || index >= MaxAttribs)
+	{
+		Changed(true);
+		glEnableVertexAttribArray(index);
+		GlTrace::Current().Record(GlCommand::EnableVertexAttribArray, { (unsigned int)index });
+		return;
+	}
+
+	auto& attrib = _attribs[index];
+	if (Changed(!attrib.known || !attrib.enabled))
+	{
+		glEnableVertexAttribArray(index);
+		GlTrace::Current().Record(GlCommand::EnableVertexAttribArray, { (unsigned int)index });
+	}
+	attrib.known = true;
+	attrib.enabled = true;
+}
+
+void GlState::DisableVertexAttribArray(GLint index)
+{
+	if (index < 0 || index >= MaxAttribs)
+	{
+		Changed(true);
+		glDisableVertexAttribArray(index);
+		GlTrace::Current().Record(GlCommand::DisableVertexAttribArray, { (unsigned int)index });
+		return;
+	}
+
+	auto& attrib = _attribs[index];
+	if (Changed(!attrib.known || attrib.enabled))
+	{
+		glDisableVertexAttribArray(index);
+		GlTrace::Current().Record(GlCommand::DisableVertexAttribArray, { (unsigned int)index });
+	}
+	attrib.known = true;
+	attrib.enabled = false;
+}
+
+void GlState::RecordAttribPointer(GLint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride,
+	const void *pointer)
+{
+	GlTrace::Current().Record(GlCommand::VertexAttribPointer, { (unsigned int)index, (unsigned int)size, type, normalized,
+		(unsigned int)stride, (unsigned long long)(uintptr_t)pointer });
+}
+
+void GlState::VertexAttribPointer(GLint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride,
+	const void *pointer)
+{
+	if (index < 0 || index >= MaxAttribs || _arrayBuffer == Unknown)
+	{
+		Changed(true);
+		glVertexAttribPointer(index, size, type, normalized, stride, pointer);
+		RecordAttribPointer(index, size, type, normalized, stride, pointer);
+		if (index >= 0 && index < MaxAttribs)
+			_attribs[index].pointerKnown = false;
+		return;
+	}
+
+	auto& attrib = _attribs[index];
+	if (Changed(!HasPointer(index, _arrayBuffer, size, type, normalized, stride, pointer)))
+	{
+		glVertexAttribPointer(index, size, type, normalized, stride, pointer);
+		RecordAttribPointer(index, size, type, normalized, stride, pointer);
+	}
+	attrib.pointerKnown = true;
+	attrib.buffer = _arrayBuffer;
+	attrib.size = size;
+	attrib.type = type;
+	attrib.normalized = normalized;
+	attrib.stride = stride;
+	attrib.pointer = pointer;
+}
+
+bool GlState::HasPointer(GLint index, GLuint buffer, GLint size, GLenum type, GLboolean normalized, GLsizei stride,
+	const void *pointer) const
+{
+	auto& attrib = _attribs[index];
+	return attrib.pointerKnown && attrib.buffer == buffer && attrib.size == size && attrib.type == type &&
+		attrib.normalized == normalized && attrib.stride == stride && attrib.pointer == pointer;
+}
+
+void GlState::VertexAttribPointer(GLint index, GLuint buffer, GLint size, GLenum type, GLboolean normalized,
+	GLsizei stride, const void *pointer)
+{
+	if (index >= 0 && index < MaxAttribs && HasPointer(index, buffer, size, type, normalized, stride, pointer))
+	{
+		Changed(false);
+		return;
+	}
+	BindBuffer(GL_ARRAY_BUFFER, buffer);
+	VertexAttribPointer(index, size, type, normalized, stride, pointer);
+}
+
+void GlState::VertexAttribDivisor(GLint index, GLuint divisor)
+{
+	if (index < 0 || index >= MaxAttribs)
+	{
+		Changed(true);
+		glVertexAttribDivisorANGLE(index, divisor);
+		GlTrace::Current().Record(GlCommand::VertexAttribDivisor, { (unsigned int)index, divisor });
+		return;
+	}
+
+	auto& attrib = _attribs[index];
+	if (Changed(!attrib.divisorKnown || attrib.divisor != divisor))
+	{
+		glVertexAttribDivisorANGLE(index, divisor);
+		GlTrace::Current().Record(GlCommand::VertexAttribDivisor, { (unsigned int)index, divisor });
+	}
+	attrib.divisorKnown = true;
+	attrib.divisor = divisor;
+}
+
+void GlState::SetCapability(GLenum capability, bool enabled)
+{
+	int *known = capability == GL_CULL_FACE ? &_cullFace : capability == GL_DEPTH_TEST ? &_depthTest :
+		capability == GL_BLEND ? &_blend : nullptr;
+	if (Changed(known == nullptr || *known != (enabled ? 1 : 0)))
+	{
+		if (enabled)
+			glEnable(capability);
+		else
+			glDisable(capability);
+		GlTrace::Current().Record(enabled ? GlCommand::Enable : GlCommand::Disable, { capability });
+	}
+	if (known != nullptr)
+		*known = enabled ? 1 : 0;
+}
+
+void GlState::Enable(GLenum capability)
+{
+	SetCapability(capability, true);
+}
+
+void GlState::Disable(GLenum capability)
+{
+	SetCapability(capability, false);
+}
+
+void GlState::CullFace(GLenum mode)
+{
+	if (Changed(_cullFaceMode != mode))
+	{
+		glCullFace(mode);
+		GlTrace::Current().Record(GlCommand::CullFace, { mode });
+	}
+	_cullFaceMode = mode;
+}
+
+void GlState::FrontFace(GLenum mode)
+{
+	if (Changed(_frontFace != mode))
+	{
+		glFrontFace(mode);
+		GlTrace::Current().Record(GlCommand::FrontFace, { mode });
+	}
+	_frontFace = mode;
+}
+
+void GlState::DepthMask(GLboolean write)
+{
+	if (Changed(_depthMask != (write ? 1 : 0)))
+	{
+		glDepthMask(write);
+		GlTrace::Current().Record(GlCommand::DepthMask, { write });
+	}
+	_depthMask = write ? 1 : 0;
+}
+
+void GlState::BlendFunc(GLenum source, GLenum destination)
+{
+	if (Changed(_blendSource != source || _blendDestination != destination))
+	{
+		glBlendFunc(source, destination);
+		GlTrace::Current().Record(GlCommand::BlendFunc, { source, destination });
+	}
+	_blendSource = source;
+	_blendDestination = destination;
+}
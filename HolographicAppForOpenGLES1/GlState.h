@@ -0,0 +1,139 @@
+#pragma once
+#include "pch.h"
+#include <vector>
+
+using namespace std;
+
+// Shadows the GL state the renderer sets for every draw, buffer bindings,
+// the program, vertex arrays and attributes and the cull, depth and blend
+// state, and drops calls that would leave it as it is. Everything that
+// changes this state has to go through here, or Invalidate afterwards. GL
+// state belongs to the context, and the renderer has one context on one
+// thread, so there is one of these.
+class GlState
+{
+public:
+	static GlState& Current();
+
+	// Forgets everything, so the next call of each kind is always made. For a
+	// new context, or after GL calls made around the cache.
+	void Invalidate();
+
+	void BindBuffer(GLenum target, GLuint buffer);
+
+	// Deletes the buffer and sets it to 0. GL unbinds a deleted buffer from
+	// everywhere it was bound, so the cache does too.
+	void DeleteBuffer(GLuint& buffer);
+
+	void UseProgram(GLuint program);
+
+	// Whether the context has OES_vertex_array_object, checked on first use.
+	bool HasVertexArrays();
+
+	// The element buffer binding and the attributes belong to the bound
+	// vertex array, so binding one switches the cache to what it knows of
+	// that array. The default array's state is kept while others are bound,
+	// and each array's element buffer is remembered. Other arrays' attributes
+	// are not, they are expected to be set once when the array is made.
+	void BindVertexArray(GLuint array);
+
+	// Deletes the array and sets it to 0. Deleting the bound array binds the
+	// default one, as GL does.
+	void DeleteVertexArray(GLuint& array);
+
+	void EnableVertexAttribArray(GLint index);
+	void DisableVertexAttribArray(GLint index);
+
+	// Takes the buffer bound to GL_ARRAY_BUFFER, as GL does.
+	void VertexAttribPointer(GLint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride,
+		const void *pointer);
+
+	// Points the attribute into buffer, binding it only if the attribute
+	// isn't set up that way already, so an attribute every draw shares
+	// doesn't cost a buffer switch per draw.
+	void VertexAttribPointer(GLint index, GLuint buffer, GLint size, GLenum type, GLboolean normalized, GLsizei stride,
+		const void *pointer);
+
+	// Instanced drawing through ANGLE_instanced_arrays.
+	void VertexAttribDivisor(GLint index, GLuint divisor);
+
+	// GL_CULL_FACE, GL_DEPTH_TEST and GL_BLEND are tracked, other
+	// capabilities pass straight through.
+	void Enable(GLenum capability);
+	void Disable(GLenum capability);
+	void CullFace(GLenum mode);
+	void FrontFace(GLenum mode);
+	void DepthMask(GLboolean write);
+	void BlendFunc(GLenum source, GLenum destination);
+
+	// Calls made and calls skipped, since the last EndFrame and over the
+	// frame before it, and how many of the calls made switched a buffer.
+	struct Counters
+	{
+		int issued = 0;
+		int avoided = 0;
+		int bufferBinds = 0;
+	};
+	const Counters& ThisFrame() const { return _thisFrame; }
+	const Counters& LastFrame() const { return _lastFrame; }
+	void EndFrame();
+
+	static const int MaxAttribs = 16;
+
+private:
+	GlState();
+
+	// Counts the call, returns whether it has to be made.
+	bool Changed(bool changed);
+	void SetCapability(GLenum capability, bool enabled);
+	bool HasPointer(GLint index, GLuint buffer, GLint size, GLenum type, GLboolean normalized, GLsizei stride,
+		const void *pointer) const;
+	static void RecordAttribPointer(GLint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride,
+		const void *pointer);
+
+	struct Attrib
+	{
+		bool known;
+		bool enabled;
+		bool pointerKnown;
+		GLuint buffer;
+		GLint size;
+		GLenum type;
+		GLboolean normalized;
+		GLsizei stride;
+		const void *pointer;
+		bool divisorKnown;
+		GLuint divisor;
+	};
+
+	static void ForgetAttribs(Attrib *attribs);
+
+	// Unknown state is held as a value GL never reports, so the first call
+	// always differs.
+	static const GLuint Unknown = 0xFFFFFFFF;
+
+	GLuint _arrayBuffer;
+	GLuint _elementArrayBuffer;
+	GLuint _program;
+	Attrib _attribs[MaxAttribs];
+
+	// -1 until checked.
+	int _hasVertexArrays;
+	GLuint _vertexArray;
+	GLuint _defaultElementArrayBuffer;
+	Attrib _defaultAttribs[MaxAttribs];
+
+	// Element buffer of each vertex array by name, GL hands out small ones.
+	vector<GLuint> _vertexArrayElements;
+	int _cullFace;
+	int _depthTest;
+	int _blend;
+	GLenum _cullFaceMode;
+	GLenum _frontFace;
+	int _depthMask;
+	GLenum _blendSource;
+	GLenum _blendDestination;
+
+	Counters _thisFrame;
+	Counters _lastFrame;
+};
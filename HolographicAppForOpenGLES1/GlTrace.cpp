@@ -0,0 +1,169 @@
+#include "pch.h"
+#include "GlTrace.h"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+GlTrace& GlTrace::Current()
+{
+	static GlTrace trace;
+	return trace;
+}
+
+GlTrace::GlTrace() :
+	_recording(false),
+	_frameStart(chrono::steady_clock::now())
+{
+}
+
+unsigned long long GlTrace::Bits(float value)
+{
+	unsigned int bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+void GlTrace::Write(unsigned long long value)
+{
+	while (value >= 0x80)
+	{
+		_bytes.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	_bytes.push_back((unsigned char)value);
+}
+
+void GlTrace::Append(GlCommand command, const unsigned long long *args, int numArgs)
+{
+	_bytes.push_back((unsigned char)command);
+	Write(numArgs);
+	for (int i = 0; i < numArgs; i++)
+		Write(args[i]);
+}
+
+void GlTrace::BeginFrame(const string& filename)
+{
+	_recording = true;
+	_filename = filename;
+	_bytes.clear();
+	Write(Magic);
+	Write(Version);
+	_frameStart = chrono::steady_clock::now();
+}
+
+void GlTrace::EndFrame()
+{
+	auto now = chrono::steady_clock::now();
+	auto micros = chrono::duration_cast<chrono::microseconds>(now - _frameStart).count();
+	_frameStart = now;
+	if (!_recording)
+		return;
+
+	Record(GlCommand::EndFrame, { (unsigned long long)micros });
+	_recording = false;
+	ofstream file(_filename, ios::binary);
+	file.write((const char *)_bytes.data(), _bytes.size());
+	if (!file)
+		throw runtime_error("can't write " + _filename);
+}
+
+void GlTrace::BufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage)
+{
+	glBufferData(target, size, data, usage);
+	Record(GlCommand::BufferData, { target, (unsigned long long)size, data != nullptr ? 1ull : 0ull, usage });
+}
+
+void GlTrace::BufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data)
+{
+	glBufferSubData(target, offset, size, data);
+	Record(GlCommand::BufferSubData, { target, (unsigned long long)offset, (unsigned long long)size });
+}
+
+void GlTrace::Uniform3fv(GLint location, GLsizei count, const GLfloat *value)
+{
+	glUniform3fv(location, count, value);
+	if (_recording)
+	{
+		vector<unsigned long long> args = { (unsigned int)location, (unsigned long long)count };
+		for (int i = 0; i < count * 3; i++)
+			args.push_back(Bits(value[i]));
+		Append(GlCommand::Uniform3fv, args.data(), (int)args.size());
+	}
+}
+
+void GlTrace::UniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value)
+{
+	glUniformMatrix4fv(location, count, transpose, value);
+	if (_recording)
+	{
+		vector<unsigned long long> args = { (unsigned int)location, (unsigned long long)count, transpose };
+		for (int i = 0; i < count * 16; i++)
+			args.push_back(Bits(value[i]));
+		Append(GlCommand::UniformMatrix4fv, args.data(), (int)args.size());
+	}
+}
+
+void GlTrace::DrawElements(GLenum mode, GLsizei count, GLenum type, const void *offset)
+{
+	glDrawElements(mode, count, type, offset);
+	Record(GlCommand::DrawElements, { mode, (unsigned long long)count, type, (unsigned long long)(uintptr_t)offset });
+}
+
+void GlTrace::DrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void *offset, GLsizei instances)
+{
+	glDrawElementsInstancedANGLE(mode, count, type, offset, instances);
+	Record(GlCommand::DrawElementsInstanced, { mode, (unsigned long long)count, type,
+		(unsigned long long)(uintptr_t)offset, (unsigned long long)instances });
+}
+
+void GlTrace::Clear(GLbitfield mask)
+{
+	glClear(mask);
+	Record(GlCommand::Clear, { mask });
+}
+
+vector<GlTrace::Call> GlTrace::Read(const string& filename)
+{
+	ifstream file(filename, ios::binary);
+	if (!file)
+		throw runtime_error("can't open " + filename);
+	vector<unsigned char> bytes((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+
+	size_t at = 0;
+	auto read = [&]()
+	{
+		unsigned long long value = 0;
+		for (int shift = 0; ; shift += 7)
+		{
+			if (at >= bytes.size() || shift > 63)
+				throw runtime_error(filename + " is truncated");
+			unsigned char byte = bytes[at++];
+			value |= (unsigned long long)(byte & 0x7F) << shift;
+			if ((byte & 0x80) == 0)
+				return value;
+		}
+	};
+
+	if (read() != Magic)
+		throw runtime_error(filename + " is not a GL trace");
+	if (read() != Version)
+		throw runtime_error(filename + " is from another version");
+
+	vector<Call> calls;
+	while (at < bytes.size())
+	{
+		Call call;
+		call.command = (GlCommand)bytes[at++];
+		if (call.command >= GlCommand::Count)
+			throw runtime_error(filename + " has an unknown command");
+		auto numArgs = read();
+		if (numArgs > bytes.size() - at)
+			throw runtime_error(filename + " is truncated");
+		call.args.resize((size_t)numArgs);
+		for (auto& arg : call.args)
+			arg = read();
+		calls.push_back(std::move(call));
+	}
+	return calls;
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include "pch.h"
+#include <chrono>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// The GL calls a trace records. Numbers are part of the file format, new
+// ones go at the end.
+enum class GlCommand : unsigned char
+{
+	BindBuffer,
+	DeleteBuffer,
+	UseProgram,
+	BindVertexArray,
+	DeleteVertexArray,
+	EnableVertexAttribArray,
+	DisableVertexAttribArray,
+	VertexAttribPointer,
+	VertexAttribDivisor,
+	Enable,
+	Disable,
+	CullFace,
+	FrontFace,
+	BufferData,
+	BufferSubData,
+	Uniform3fv,
+	UniformMatrix4fv,
+	DrawElements,
+	DrawElementsInstanced,
+	Clear,
+	Error,
+	EndFrame,
+	DepthMask,
+	BlendFunc,
+	Count
+};
+
+// Records the GL command stream of a frame to a file, for finding out what a
+// frame really costs on a device. GlState records the state changes it
+// makes, the other calls the renderer makes every frame go through here.
+// Nothing is recorded unless a capture is running, then each call costs a
+// few bytes in memory until the frame is written out.
+//
+// A trace is Magic and Version, then a record per call: the command's
+// byte, the number of arguments and the arguments, all as LEB128 varints.
+// Floats are stored as their bits, pointers as offsets, and buffer contents
+// only as their sizes.
+class GlTrace
+{
+public:
+	static GlTrace& Current();
+
+	static const unsigned int Magic = 0x52544C47;
+	static const unsigned int Version = 1;
+
+	// Records everything up to EndFrame, which writes it to filename.
+	void BeginFrame(const string& filename);
+	bool Recording() const { return _recording; }
+
+	// Ends the frame with its CPU time, and writes the trace out if one is
+	// being recorded. Throws runtime_error if it can't be written.
+	void EndFrame();
+
+	void Record(GlCommand command, initializer_list<unsigned long long> args)
+	{
+		if (_recording)
+			Append(command, args.begin(), (int)args.size());
+	}
+	static unsigned long long Bits(float value);
+
+	// Issued and recorded.
+	void BufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage);
+	void BufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data);
+	void Uniform3fv(GLint location, GLsizei count, const GLfloat *value);
+	void UniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
+	void DrawElements(GLenum mode, GLsizei count, GLenum type, const void *offset);
+	void DrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void *offset, GLsizei instances);
+	void Clear(GLbitfield mask);
+
+	struct Call
+	{
+		GlCommand command;
+		vector<unsigned long long> args;
+	};
+
+	// Every call in a trace file, for tools. Throws runtime_error if the file
+	// can't be read or isn't a trace.
+	static vector<Call> Read(const string& filename);
+
+private:
+	GlTrace();
+
+	void Append(GlCommand command, const unsigned long long *args, int numArgs);
+	void Write(unsigned long long value);
+
+	bool _recording;
+	string _filename;
+	vector<unsigned char> _bytes;
+	chrono::steady_clock::time_point _frameStart;
+};
@@ -2,11 +2,225 @@
 #include "Importer.h"
 #include <fbxsdk.h>
 #include "utils.h"
-#include "Model.h"
+#include "ProgressiveMesh.h"
+#include "ContentHash.h"
+#include "VertexCache.h"
+#include "Overdraw.h"
+#include "VertexFetch.h"
+#include "VertexQuantizer.h"
+#include "Simplifier.h"
+#include "Clusters.h"
+#include "Stripifier.h"
+#include "MeshCleaner.h"
+#include "ThreadPool.h"
+#include "Batcher.h"
 #include <iterator>
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+
+// Meshes with more triangles than this are streamed in coarse-to-fine, starting
+// from a base mesh of roughly 1/BaseMeshFraction of the triangles.
+static const int ProgressiveMinTriangles = 2048;
+static const int BaseMeshFraction = 16;
+
+// LODs halve the triangle count each level, down to no fewer than
+// LodMinTriangles.
+static const int LodReduction = 2;
+static const int LodMinTriangles = 64;
+static const int MaxLods = 4;
+
+// The one interleaved stream of quantized vertices Mesh uploads.
+static const int VertexStride = VertexQuantizer::BytesPerVertex;
+
+// Vertex cache order first, then clusters of that sorted to cut overdraw.
+static vector<int> OptimizeTriangleOrder(const float *positions, const unsigned short *indices,
+	int numIndices, int numVertices)
+{
+	auto cacheOrder = VertexCache::Optimize(indices, numIndices, numVertices);
+	vector<unsigned short> cached(indices, indices + numIndices);
+	VertexCache::Reorder(cached.data(), cacheOrder);
+
+	auto clusterOrder = Overdraw::Optimize(positions, cached.data(), numIndices);
+	vector<int> order(clusterOrder.size());
+	for (size_t t = 0; t < order.size(); t++)
+		order[t] = cacheOrder[clusterOrder[t]];
+	return order;
+}
+
+// Bump whenever the conversion below changes, so cached meshes get redone.
+static const unsigned int ConversionVersion = 10;
+
+// Simplifies the source triangles into LODs. They are built before any
+// reordering, while the triangles still line up with their materials, and
+// follow the vertices through every renumbering after.
+static void BuildLods(MeshData& mesh, const vector<int>& triangleMaterials)
+{
+	const int numTris = mesh.IndexCount() / 3;
+	vector<int> targets;
+	for (int target = numTris / LodReduction; target >= LodMinTriangles && (int)targets.size() < MaxLods; target /= LodReduction)
+		targets.push_back(target);
+	if (targets.empty())
+		return;
+
+	auto levels = Simplifier::Simplify(mesh.positions.data(), mesh.VertexCount(), mesh.indices.data(),
+		mesh.IndexCount(), triangleMaterials.size() == (size_t)numTris ? triangleMaterials.data() : nullptr, targets);
+	for (auto& level : levels)
+	{
+		MeshData::Lod lod;
+		lod.indices = std::move(level.indices);
+		lod.error = level.error;
+		mesh.lods.push_back(std::move(lod));
+	}
+}
+
+// Cuts the full detail triangles into clusters the renderer can cull,
+// keeping them in their optimised order within each cluster.
+static void BuildClusters(MeshData& mesh, vector<unsigned short>& indices)
+{
+	VertexCache::Reorder(indices.data(), Clusters::Build(mesh.positions.data(), indices.data(),
+		(int)indices.size(), mesh.VertexCount(), mesh.clusters));
+	mesh.stats.push_back({ "clusters", (float)mesh.clusters.size() });
+}
+
+// Drops what draws nothing before the rest of the pipeline spends time on it.
+static void CleanMesh(MeshData& mesh, vector<int>& triangleMaterials, float weldTolerance, ThreadPool& pool)
+{
+	auto cleaned = MeshCleaner::Clean(mesh, triangleMaterials, weldTolerance, pool);
+	mesh.stats.push_back({ "welded vertices", (float)cleaned.weldedVertices });
+	mesh.stats.push_back({ "degenerate triangles removed", (float)cleaned.degenerateTriangles });
+	mesh.stats.push_back({ "duplicate triangles removed", (float)cleaned.duplicateTriangles });
+}
+
+// Everything after extraction from the FBX SDK, so it can run on any thread.
+static void OptimizeMesh(MeshData& mesh, vector<int>& triangleMaterials, float weldTolerance, ThreadPool& pool)
+{
+	CleanMesh(mesh, triangleMaterials, weldTolerance, pool);
+	mesh.ComputeBounds();
+
+	const int numVertices = mesh.VertexCount();
+	const int numIndices = mesh.IndexCount();
+	const int numTris = numIndices / 3;
 
-static wchar_t* currentwidecharbuffer = nullptr;
-static int wcharcurrentsize = 0;
+	BuildLods(mesh, triangleMaterials);
+
+	float acmrBefore = VertexCache::Acmr(mesh.indices.data(), numIndices);
+	float overdrawBefore = Overdraw::Measure(mesh.positions.data(), mesh.indices.data(), numIndices);
+
+	// Big meshes get a coarse base mesh up first and refine over the
+	// following frames, so reorder the vertex data into split order..
+	if (numTris > ProgressiveMinTriangles)
+	{
+		auto progressive = ProgressiveMesh::Build(mesh.positions.data(), numVertices,
+			mesh.indices.data(), numIndices, numTris / BaseMeshFraction);
+
+		auto& order = progressive->VertexOrder();
+		vector<int> remap(numVertices);
+		for (int j = 0; j < numVertices; j++)
+			remap[order[j]] = j;
+		mesh.RemapVertices(remap);
+
+		// Split triangles have to stay in split order while refining, so
+		// only the base is optimised until the last split swaps in a
+		// fully optimised copy.
+		progressive->ReorderBaseTriangles(OptimizeTriangleOrder(mesh.positions.data(),
+			progressive->Indices().data(), progressive->BaseTriangleCount() * 3, progressive->BaseVertexCount()));
+		auto finalIndices = progressive->ApplySplits(progressive->Indices());
+		VertexCache::Reorder(finalIndices.data(),
+			OptimizeTriangleOrder(mesh.positions.data(), finalIndices.data(), numIndices, numVertices));
+		BuildClusters(mesh, finalIndices);
+		progressive->SetFinalIndices(std::move(finalIndices));
+		mesh.indices = progressive->TakeIndices();
+
+		DebugLog(L"Progressive mesh base %d/%d triangles, %d splits", progressive->BaseTriangleCount(),
+			numTris, (int)progressive->Splits().size());
+		mesh.progressive = std::move(progressive);
+	}
+	else
+	{
+		VertexCache::Reorder(mesh.indices.data(),
+			OptimizeTriangleOrder(mesh.positions.data(), mesh.indices.data(), numIndices, numVertices));
+		BuildClusters(mesh, mesh.indices);
+	}
+
+	// Renumber the vertices in the order the triangles now use them. A
+	// progressive mesh's splits append vertices, so only its base can move.
+	auto& drawn = mesh.progressive ? mesh.progressive->FinalIndices() : mesh.indices;
+	float overfetchBefore = VertexFetch::Overfetch(drawn.data(), numIndices, &VertexStride, 1);
+	if (mesh.progressive)
+	{
+		int baseVertices = mesh.progressive->BaseVertexCount();
+		auto remap = VertexFetch::FirstUseOrder(mesh.indices.data(),
+			mesh.progressive->BaseTriangleCount() * 3, baseVertices);
+		for (int v = baseVertices; v < numVertices; v++)
+			remap.push_back(v);
+		mesh.RemapVertices(remap);
+	}
+	else
+	{
+		mesh.RemapVertices(VertexFetch::FirstUseOrder(mesh.indices.data(), numIndices, numVertices));
+	}
+
+	// Measured on the fully refined mesh. No order beats one cache miss
+	// per vertex.
+	float overfetchAfter = VertexFetch::Overfetch(drawn.data(), numIndices, &VertexStride, 1);
+	float acmrAfter = VertexCache::Acmr(drawn.data(), numIndices);
+	float overdrawAfter = Overdraw::Measure(mesh.positions.data(), drawn.data(), numIndices);
+	mesh.stats.push_back({ "acmr before", acmrBefore });
+	mesh.stats.push_back({ "acmr after", acmrAfter });
+	mesh.stats.push_back({ "acmr bound", numTris > 0 ? (float)numVertices / numTris : 0.0f });
+	mesh.stats.push_back({ "overdraw before", overdrawBefore });
+	mesh.stats.push_back({ "overdraw after", overdrawAfter });
+	mesh.stats.push_back({ "overfetch before", overfetchBefore });
+	mesh.stats.push_back({ "overfetch after", overfetchAfter });
+
+	// What the compact upload format costs, against what it promises.
+	float positionError, normalDegrees, colorError;
+	VertexQuantizer quantizer(mesh);
+	quantizer.MeasureError(mesh, positionError, normalDegrees, colorError);
+	mesh.stats.push_back({ "position error", positionError });
+	mesh.stats.push_back({ "position error bound", quantizer.PositionErrorBound() });
+	mesh.stats.push_back({ "normal error degrees", normalDegrees });
+	mesh.stats.push_back({ "colour error", colorError });
+	DebugLog(L"ACMR %.3f -> %.3f, overdraw %.3f -> %.3f, overfetch %.3f -> %.3f", acmrBefore, acmrAfter,
+		overdrawBefore, overdrawAfter, overfetchBefore, overfetchAfter);
+
+	// A strip when its fewer indices outweigh what it loses in vertex cache
+	// hits, then numbered in its own first use order. Splits patch a progressive
+	// mesh's list in place, so that stays a list.
+	if (!mesh.progressive)
+	{
+		auto clusters = mesh.clusters;
+		auto strip = Stripifier::Stripify(mesh.indices.data(), numIndices, clusters);
+		mesh.stats.push_back({ "strip indices per triangle", numTris > 0 ? (float)strip.size() / numTris : 0.0f });
+		mesh.stats.push_back({ "strip acmr", numTris > 0 ? (float)VertexCache::Misses(strip.data(), (int)strip.size()) / numTris : 0.0f });
+		if (Stripifier::IsBetter(mesh.indices.data(), numIndices, strip.data(), (int)strip.size()))
+		{
+			mesh.indices = std::move(strip);
+			mesh.clusters = std::move(clusters);
+			mesh.strip = true;
+			mesh.RemapVertices(VertexFetch::FirstUseOrder(mesh.indices.data(), mesh.IndexCount(), numVertices));
+		}
+		mesh.stats.push_back({ "strip", mesh.strip ? 1.0f : 0.0f });
+	}
+
+	// The LODs keep the final vertex numbering, only their triangles move.
+	for (size_t i = 0; i < mesh.lods.size(); i++)
+	{
+		auto& lod = mesh.lods[i];
+		VertexCache::Reorder(lod.indices.data(),
+			OptimizeTriangleOrder(mesh.positions.data(), lod.indices.data(), (int)lod.indices.size(), numVertices));
+		string name = "lod " + to_string(i + 1);
+		mesh.stats.push_back({ name + " triangles", (float)(lod.indices.size() / 3) });
+		mesh.stats.push_back({ name + " error", lod.error });
+	}
+}
+
+// Per thread, the cooker converts several files at once.
+static thread_local wchar_t* currentwidecharbuffer = nullptr;
+static thread_local int wcharcurrentsize = 0;
 
 const wchar_t *CH_TO_WCH(const char *original)
 {
@@ -20,13 +234,20 @@ const wchar_t *CH_TO_WCH(const char *original)
 			wcharcurrentsize * sizeof(wchar_t));
 	}
 
+#ifdef _MSC_VER
 	size_t outSize;
 	mbstowcs_s(&outSize, currentwidecharbuffer, size, original, size - 1);
+#else
+	mbstowcs(currentwidecharbuffer, original, size);
+#endif
 
 	return currentwidecharbuffer;
 }
 
-Importer::Importer()
+Importer::Importer() :
+	_importer(nullptr),
+	_scene(nullptr),
+	_threadPool(nullptr)
 {
 	_sdkManager = FbxManager::Create();
 	_settings = FbxIOSettings::Create(_sdkManager, IOSROOT);
@@ -42,29 +263,101 @@ Importer::~Importer()
 	_sdkManager->Destroy();
 }
 
-unique_ptr<Model> Importer::LoadModelFromFile(const char *filename)
+vector<unique_ptr<MeshData>> Importer::ConvertFile(const char *filename, const MeshHashes *known)
 {
+	vector<unique_ptr<MeshData>> meshes;
+	_nodes.clear();
+
 	// Import the file into an fbx scene
 	ImportFile(filename);
 	FbxNode *rootNode = _scene->GetRootNode();
 	if (rootNode == nullptr)
-		return nullptr;
+		return meshes;
 
 	// Print out details of the whole scene..
 	for (int i = 0; i < rootNode->GetChildCount(); i++)
 		PrintNode(rootNode->GetChild(i));
 
-	// Convert the scene to triangles..
-	FbxGeometryConverter clsConverter(_sdkManager);
-	clsConverter.Triangulate(_scene, false);
+	// A known mesh is skipped when its hash still matches, but a known batch
+	// only when the hashes of all its parts do, so every mesh is hashed
+	// before any is converted. Both passes visit the meshes in one order.
+	typedef pair<string, unsigned long long> BatchKey;
+	vector<unsigned long long> hashes;
+	vector<const SourceHash *> matches;
+	map<BatchKey, int> partsLeft;
+	if (known != nullptr)
+	{
+		for (auto& entry : *known)
+		{
+			if (!entry.second.batch.empty())
+				partsLeft[BatchKey(entry.second.batch, entry.second.batchHash)]++;
+		}
+
+		// Each known hash matches one mesh, as names can repeat.
+		unordered_set<const SourceHash *> used;
+		TraverseScene(rootNode, [this, known, &hashes, &matches, &partsLeft, &used](FbxMesh *fbxMesh)
+		{
+			unsigned long long hash = HashMesh(fbxMesh);
+			const SourceHash *match = nullptr;
+			auto range = known->equal_range(fbxMesh->GetNode()->GetName());
+			for (auto entry = range.first; entry != range.second && match == nullptr; ++entry)
+			{
+				if (entry->second.hash == hash && used.insert(&entry->second).second)
+					match = &entry->second;
+			}
+			if (match != nullptr && !match->batch.empty())
+				partsLeft[BatchKey(match->batch, match->batchHash)]--;
+			hashes.push_back(hash);
+			matches.push_back(match);
+		});
+	}
 
-	auto model = std::make_unique<Model>();
-	model->SetPositionAttribLocation(_positionAttribLocation);
-	model->SetColorAttribLocation(_colorAttribLocation);
+	// Meshes are converted to triangles one at a time, only once we know
+	// they have changed..
+	FbxGeometryConverter clsConverter(_sdkManager);
 
-	// Create A Model type, pass it in here and fill it in...
-	TraverseScene(rootNode, [this, &model](FbxMesh *fbxMesh)
+	// Convert each mesh into plain CPU side data..
+	unordered_map<FbxNode *, int> meshIndices;
+	vector<vector<int>> triangleMaterials;
+	map<BatchKey, Batcher::KeptBatch> kept;
+	int visited = 0;
+	TraverseScene(rootNode, [this, &meshes, &meshIndices, &triangleMaterials, &clsConverter, &hashes, &matches,
+		&partsLeft, &kept, &visited](FbxMesh *fbxMesh)
 	{
+		int visit = visited++;
+		unsigned long long hash = visit < (int)hashes.size() ? hashes[visit] : HashMesh(fbxMesh);
+		const SourceHash *match = visit < (int)matches.size() ? matches[visit] : nullptr;
+		const char *name = fbxMesh->GetNode()->GetName();
+
+		// Parts of a batch with any part changed are converted again, to be
+		// merged again.
+		BatchKey batch = match != nullptr ? BatchKey(match->batch, match->batchHash) : BatchKey();
+		if (match != nullptr && (batch.first.empty() || partsLeft[batch] == 0))
+		{
+			auto mesh = make_unique<MeshData>();
+			mesh->name = name;
+			mesh->sourceHash = hash;
+			mesh->unchanged = true;
+			if (!batch.first.empty())
+			{
+				auto& keptBatch = kept[batch];
+				keptBatch.name = batch.first;
+				keptBatch.sourceHash = batch.second;
+				keptBatch.parts.push_back((int)meshes.size());
+			}
+			meshIndices[fbxMesh->GetNode()] = (int)meshes.size();
+			meshes.push_back(std::move(mesh));
+			triangleMaterials.emplace_back();
+			return;
+		}
+
+		if (!fbxMesh->IsTriangleMesh())
+		{
+			fbxMesh = static_cast<FbxMesh *>(clsConverter.Triangulate(fbxMesh, true));
+			if (fbxMesh == nullptr)
+				return;
+		}
+
 		DisplayMaterial(fbxMesh);
 		
 		//auto node = fbxMesh->GetNode();
@@ -115,89 +408,227 @@ unique_ptr<Model> Importer::LoadModelFromFile(const char *filename)
 
 		// Get vertices from the mesh
 		int numVertices = fbxMesh->GetControlPointsCount();
-		auto verts = make_unique<GLfloat[]>(numVertices * 4);
-		auto mesh = make_shared<Mesh>();
-		auto normals = make_unique<GLfloat[]>(numVertices * 3);
+		auto mesh = make_unique<MeshData>();
+		mesh->name = name;
+		mesh->sourceHash = hash;
+		mesh->positions.resize(numVertices * 4);
+		mesh->normals.resize(numVertices * 3);
 		for (int j = 0; j < numVertices; j++)
 		{
 			FbxVector4 coord = fbxMesh->GetControlPointAt(j);
 
-			verts.get()[j * 4 + 0] = (GLfloat)coord.mData[0];
-			verts.get()[j * 4 + 1] = (GLfloat)coord.mData[1];
-			verts.get()[j * 4 + 2] = (GLfloat)coord.mData[2];
-			verts.get()[j * 4 + 3] = 1.0f;
+			mesh->positions[j * 4 + 0] = (float)coord.mData[0];
+			mesh->positions[j * 4 + 1] = (float)coord.mData[1];
+			mesh->positions[j * 4 + 2] = (float)coord.mData[2];
+			mesh->positions[j * 4 + 3] = 1.0f;
 
-			DebugLog(L"Vertex %d - {%f %f %f}", j, (GLfloat)coord.mData[0],
-				(GLfloat)coord.mData[1], (GLfloat)coord.mData[2]);
+			DebugLog(L"Vertex %d - {%f %f %f}", j, (float)coord.mData[0],
+				(float)coord.mData[1], (float)coord.mData[2]);
 
 			Vector3 ret = ReadNormal(fbxMesh, j, j);
-			normals.get()[j * 3 + 0] = ret.x;
-			normals.get()[j * 3 + 1] = ret.y;
-			normals.get()[j * 3 + 2] = ret.z;
+			mesh->normals[j * 3 + 0] = ret.x;
+			mesh->normals[j * 3 + 1] = ret.y;
+			mesh->normals[j * 3 + 2] = ret.z;
 
 			DebugLog(L"Normal %d - {%f %f %f}", j, ret.x, ret.y, ret.z);
 		}
 
-		// Transfer ownership to the model..
-		mesh->SetVertices(std::move(verts), numVertices);
-		mesh->SetNormals(std::move(normals), numVertices);
 		int numIndices = fbxMesh->GetPolygonVertexCount();
 		int* indices = fbxMesh->GetPolygonVertices();
 
 		auto isMesh = fbxMesh->IsTriangleMesh();
 		auto count = fbxMesh->GetPolygonCount();
 
-		auto idxes = make_unique<unsigned short[]>(numIndices);
+		mesh->indices.resize(numIndices);
 		for (int j = 0; j < numIndices; j++)
 		{
-			idxes[j] = indices[j];
+			mesh->indices[j] = indices[j];
 		}
 
 		for (int j = 0; j < numIndices; j++)
 		{
-			DebugLog(L"Index %d - {%d}", j, idxes[j]);
+			DebugLog(L"Index %d - {%d}", j, mesh->indices[j]);
 		}
 
-		mesh->SetIndexBuffer(std::move(idxes), numIndices);
-
-		// Set the vertex colours...
+		// Set the vertex colours from the material of the first triangle
+		// using each vertex...
 		int numTris = fbxMesh->GetPolygonCount();
-		auto triangleMapping = make_unique<int[]>(numVertices);
-		for (int i = 0; i < numVertices; i++)
+		vector<int> materials(numTris, 0);
+		ConnectMaterialToMesh(fbxMesh, numTris, materials.data());
+		vector<int> vertexMaterials(numVertices, 0);
+		for (int t = numTris - 1; t >= 0; t--)
 		{
-			DebugLog(L"tri %d -> %d", i, triangleMapping[i]);
+			for (int k = 0; k < 3; k++)
+				vertexMaterials[mesh->indices[t * 3 + k]] = materials[t];
 		}
 
-		ConnectMaterialToMesh(fbxMesh, numTris, triangleMapping.get());
-
 		auto node = fbxMesh->GetNode();
 
-		auto colors = make_unique<GLfloat[]>(numVertices*4);
+		mesh->colors.resize(numVertices * 4);
 
 		// Look up the materials diffuse colours, and...
 		for (int i = 0; i < numVertices; i++)
 		{
-			// The triangle mapping has been stored by looping over each triangle
-			// and querying it's material and storing the indices..
-			int matIdx = triangleMapping[i];
-			auto mt = node->GetMaterial(matIdx);
-			FbxProperty prop = mt->FindProperty(FbxSurfaceMaterial::sDiffuse);
+			auto mt = node->GetMaterial(vertexMaterials[i]);
+			FbxProperty prop = mt ? mt->FindProperty(FbxSurfaceMaterial::sDiffuse) : FbxProperty();
 			if (prop.IsValid())
 			{
 				auto diffuse = prop.Get<FbxColor>();
-				colors[4 * i + 0] = diffuse.mRed;
-				colors[4 * i + 1] = diffuse.mGreen;
-				colors[4 * i + 2] = diffuse.mBlue;
-				colors[4 * i + 3] = diffuse.mAlpha;
+				mesh->colors[4 * i + 0] = (float)diffuse.mRed;
+				mesh->colors[4 * i + 1] = (float)diffuse.mGreen;
+				mesh->colors[4 * i + 2] = (float)diffuse.mBlue;
+				mesh->colors[4 * i + 3] = (float)diffuse.mAlpha;
 			}
 		}
 
-		mesh->SetVertexColors(std::move(colors), numVertices);
-		model->AddMesh(mesh);
+		meshIndices[fbxMesh->GetNode()] = (int)meshes.size();
+		meshes.push_back(std::move(mesh));
+		triangleMaterials.push_back(std::move(materials));
 	});
 
-	model->Loaded();
-	return model;
+	// The FBX SDK isn't thread safe but once a mesh is out of it the mesh
+	// can be optimised on its own, so the rest runs on every core.
+	auto optimize = [this, &meshes, &triangleMaterials](ThreadPool& pool)
+	{
+		pool.ParallelFor((int)meshes.size(), [&](int i)
+		{
+			if (!meshes[i]->unchanged)
+				OptimizeMesh(*meshes[i], triangleMaterials[i], _weldTolerance, pool);
+		});
+	};
+	if (_threadPool != nullptr)
+	{
+		optimize(*_threadPool);
+	}
+	else
+	{
+		ThreadPool pool;
+		optimize(pool);
+	}
+
+	AddNodes(rootNode, -1, meshIndices);
+
+	// Batches whose parts are all unchanged stay as they are, the rest of
+	// the meshes are batched afresh.
+	vector<Batcher::KeptBatch> keptBatches;
+	for (auto& batch : kept)
+		keptBatches.push_back(std::move(batch.second));
+	_batchStats = Batcher::Keep(meshes, _nodes, keptBatches);
+	if (_maxBatchVertices > 0)
+	{
+		auto batched = Batcher::Batch(meshes, _nodes, _maxBatchVertices);
+		_batchStats.batches += batched.batches;
+		_batchStats.batchedMeshes += batched.batchedMeshes;
+	}
+
+	return meshes;
+}
+
+void Importer::AddNodes(FbxNode *node, int parent, const unordered_map<FbxNode *, int>& meshIndices)
+{
+	SceneNode sceneNode;
+	sceneNode.name = node->GetName();
+	sceneNode.parent = parent;
+
+	// FbxAMatrix keeps the translation in its last row, so copied across in
+	// order it is already column major.
+	FbxAMatrix transform = node->EvaluateLocalTransform();
+	for (int row = 0; row < 4; row++)
+	{
+		for (int column = 0; column < 4; column++)
+			sceneNode.transform[row * 4 + column] = (float)transform.Get(row, column);
+	}
+
+	auto mesh = meshIndices.find(node);
+	if (mesh != meshIndices.end())
+		sceneNode.mesh = mesh->second;
+
+	for (int i = 0; i < node->GetMaterialCount(); i++)
+		sceneNode.materials.push_back(node->GetMaterial(i)->GetName());
+
+	int index = (int)_nodes.size();
+	_nodes.push_back(std::move(sceneNode));
+	for (int i = 0; i < node->GetChildCount(); i++)
+		AddNodes(node->GetChild(i), index, meshIndices);
+}
+
+void Importer::MergeUnchanged(vector<unique_ptr<MeshData>>& meshes, vector<unique_ptr<MeshData>>& previous)
+{
+	for (auto& mesh : meshes)
+	{
+		if (!mesh->unchanged)
+			continue;
+
+		for (auto& old : previous)
+		{
+			if (old && old->name == mesh->name && old->sourceHash == mesh->sourceHash)
+			{
+				mesh = std::move(old);
+				break;
+			}
+		}
+	}
+}
+
+unsigned long long Importer::SettingsHash(float weldTolerance, int maxBatchVertices)
+{
+	ContentHash hash;
+	hash.Add(ConversionVersion);
+	hash.Add(weldTolerance);
+	hash.Add(min(maxBatchVertices, Batcher::MaxVertices));
+	return hash.Value();
+}
+
+unsigned long long Importer::HashMesh(FbxMesh *mesh)
+{
+	ContentHash hash;
+	hash.Add(SettingsHash(_weldTolerance, _maxBatchVertices));
+	hash.Add(string(mesh->GetNode()->GetName()));
+
+	const int numControlPoints = mesh->GetControlPointsCount();
+	hash.Add(numControlPoints);
+	hash.Add(mesh->GetControlPoints(), sizeof(FbxVector4) * numControlPoints);
+
+	const int numPolygons = mesh->GetPolygonCount();
+	hash.Add(numPolygons);
+	for (int i = 0; i < numPolygons; i++)
+		hash.Add(mesh->GetPolygonSize(i));
+	hash.Add(mesh->GetPolygonVertices(), sizeof(int) * mesh->GetPolygonVertexCount());
+
+	if (mesh->GetElementNormalCount() > 0)
+	{
+		FbxGeometryElementNormal *normals = mesh->GetElementNormal(0);
+		hash.Add(normals->GetMappingMode());
+		hash.Add(normals->GetReferenceMode());
+		auto& direct = normals->GetDirectArray();
+		for (int i = 0; i < direct.GetCount(); i++)
+			hash.Add(direct.GetAt(i));
+		if (normals->GetReferenceMode() != FbxGeometryElement::eDirect)
+		{
+			auto& index = normals->GetIndexArray();
+			for (int i = 0; i < index.GetCount(); i++)
+				hash.Add(index.GetAt(i));
+		}
+	}
+
+	if (mesh->GetElementMaterial())
+	{
+		auto& materialIndices = mesh->GetElementMaterial()->GetIndexArray();
+		hash.Add(mesh->GetElementMaterial()->GetMappingMode());
+		for (int i = 0; i < materialIndices.GetCount(); i++)
+			hash.Add(materialIndices.GetAt(i));
+	}
+
+	// Vertex colours come from the diffuse colour of the node's materials.
+	FbxNode *node = mesh->GetNode();
+	for (int i = 0; i < node->GetMaterialCount(); i++)
+	{
+		FbxProperty prop = node->GetMaterial(i)->FindProperty(FbxSurfaceMaterial::sDiffuse);
+		if (prop.IsValid())
+			hash.Add(prop.Get<FbxColor>());
+	}
+
+	return hash.Value();
 }
 
 void Importer::ConnectMaterialToMesh(FbxMesh* pMesh, int triangleCount, int* pTriangleMtlIndex)
@@ -233,8 +664,7 @@ void Importer::ConnectMaterialToMesh(FbxMesh* pMesh, int triangleCount, int* pTr
 
 					for (int triangleIndex = 0; triangleIndex < triangleCount; ++triangleIndex)
 					{
-						int materialIndex = pMaterialIndices->GetAt(triangleIndex);
-						pTriangleMtlIndex[triangleIndex] = materialIndex;
+						pTriangleMtlIndex[triangleIndex] = lMaterialIndex;
 					}
 				}
 			}
@@ -242,12 +672,6 @@ void Importer::ConnectMaterialToMesh(FbxMesh* pMesh, int triangleCount, int* pTr
 	}
 }
 
-void Importer::SetShaderAttributes(GLuint positionAttribLocation, GLuint colorAttribLocation)
-{
-	_positionAttribLocation = positionAttribLocation;
-	_colorAttribLocation = colorAttribLocation;
-}
-
 void Importer::ImportFile(const char *filename)
 {
 	if (_importer != nullptr)
@@ -260,7 +684,7 @@ void Importer::ImportFile(const char *filename)
 	// Use the first argument as the filename for the importer.
 	if (!_importer->Initialize(filename, -1, _sdkManager->GetIOSettings()))
 	{
-		throw new std::exception("Failed to Import");
+		throw runtime_error("Failed to Import");
 	}
 
 	// Create a new scene so that it can be populated by the imported file.
@@ -296,7 +720,7 @@ Vector3 Importer::ReadNormal(FbxMesh* inMesh, int inCtrlPointIndex, int inVertex
 	Vector3 outNormal;
 	if (inMesh->GetElementNormalCount() < 1)
 	{
-		throw std::exception("Invalid Normal Number");
+		throw runtime_error("Invalid Normal Number");
 	}
 
 	FbxGeometryElementNormal* vertexNormal = inMesh->GetElementNormal(0);
@@ -323,7 +747,7 @@ Vector3 Importer::ReadNormal(FbxMesh* inMesh, int inCtrlPointIndex, int inVertex
 		break;
 
 		default:
-			throw std::exception("Invalid Reference");
+			throw runtime_error("Invalid Reference");
 		}
 		break;
 
@@ -348,7 +772,7 @@ Vector3 Importer::ReadNormal(FbxMesh* inMesh, int inCtrlPointIndex, int inVertex
 		break;
 
 		default:
-			throw std::exception("Invalid Reference");
+			throw runtime_error("Invalid Reference");
 		}
 		break;
 	}
@@ -1,27 +1,68 @@
 #pragma once
 #include <fbxsdk.h>
-#include <fbxsdk\scene\geometry\fbxgeometry.h>
-#include <fbxsdk\fileio\fbximporter.h>
+#include <fbxsdk/scene/geometry/fbxgeometry.h>
+#include <fbxsdk/fileio/fbximporter.h>
+#include <algorithm>
 #include <functional>
-#include "Model.h"
+#include <vector>
+#include <unordered_map>
+#include "Batcher.h"
+#include "MeshData.h"
+#include "SceneNode.h"
 #include "utils.h"
 
 using namespace fbxsdk;
 using namespace std;
 
+class ThreadPool;
+
 class Importer
 {
 public:
 	Importer();
 	~Importer();
 
-	unique_ptr<Model> LoadModelFromFile(const char * filename);
+	// Converts every mesh in the file to CPU side data, no GL calls are made
+	// so this can run off the render thread or in the cooker. Meshes whose
+	// source hash matches 'known' are skipped and come back marked unchanged,
+	// as does a batch once the hashes of all its parts match.
+	vector<unique_ptr<MeshData>> ConvertFile(const char * filename, const MeshHashes * known = nullptr);
+
+	// Meshes are optimised in parallel once they are out of the FBX SDK, on
+	// this pool if set or else on one made for the call.
+	void SetThreadPool(ThreadPool * pool) { _threadPool = pool; }
+
+	// Vertices closer than this, with matching normals and colours, are
+	// welded before degenerate and duplicate triangles are removed. Zero,
+	// the default, only removes exact degenerates and duplicates.
+	void SetWeldTolerance(float tolerance) { _weldTolerance = tolerance; }
+
+	// The conversion and the settings above that change what a file converts
+	// to, for a cooked file to record. A file cooked with others is out of
+	// date however new it is.
+	static unsigned long long SettingsHash(float weldTolerance, int maxBatchVertices);
+
+	// Small meshes sharing a material are merged into batches of up to this
+	// many vertices once converted, see Batcher. Zero turns batching off, and
+	// sizes past Batcher::MaxVertices are clamped to it.
+	void SetMaxBatchVertices(int vertices) { _maxBatchVertices = min(vertices, Batcher::MaxVertices); }
+
+	// What batching did to the last converted file.
+	const Batcher::Stats& BatchStats() const { return _batchStats; }
+
+	// Fills in 'meshes' entries marked unchanged from 'previous', by name and
+	// source hash.
+	static void MergeUnchanged(vector<unique_ptr<MeshData>>& meshes, vector<unique_ptr<MeshData>>& previous);
+
+	// The hierarchy of the last converted file, referring to its meshes by index.
+	const vector<SceneNode>& Nodes() const { return _nodes; }
 	void ConnectMaterialToMesh(FbxMesh * pMesh, int triangleCount, int * pTriangleMtlIndex);
-	void SetShaderAttributes(GLuint positionAttribLocation, GLuint colorAttribLocation);
 
 protected:
 	void ImportFile(const char * filename);
 	void TraverseScene(FbxNode * node, function<void(FbxMesh*)> callback);
+	void AddNodes(FbxNode * node, int parent, const unordered_map<FbxNode *, int>& meshIndices);
+	unsigned long long HashMesh(FbxMesh * mesh);
 	Vector3 ReadNormal(FbxMesh * inMesh, int inCtrlPointIndex, int inVertexCounter);
 	void PrintNode(FbxNode * pNode);
 	void PrintTabs();
@@ -34,10 +75,13 @@ private:
 	FbxIOSettings *_settings;
 	FbxImporter *_importer;
 	FbxScene *_scene;
+	vector<SceneNode> _nodes;
+	ThreadPool *_threadPool;
+	float _weldTolerance = 0.0f;
+	int _maxBatchVertices = Batcher::DefaultMaxVertices;
+	Batcher::Stats _batchStats;
 
 	/* Tab character ("\t") counter */
 	int _numTabs = 0;
-	GLuint _positionAttribLocation;
-	GLuint _colorAttribLocation;
 };
 
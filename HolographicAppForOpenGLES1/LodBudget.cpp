@@ -0,0 +1,191 @@
+#include "pch.h"
+#include "LodBudget.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+LodBudget::LodBudget() :
+	_triangleBudget(numeric_limits<int>::max()),
+	_vertexBudget(numeric_limits<int>::max()),
+	_triangleScale(0.0f),
+	_vertexScale(0.0f),
+	_triangles(0),
+	_vertices(0),
+	_threshold(NumBuckets)
+{
+}
+
+void LodBudget::SetBudget(int triangles, int vertices)
+{
+	_triangleBudget = triangles;
+	_vertexBudget = vertices;
+	_triangleScale = 1.0f / max(triangles, 1);
+	_vertexScale = 1.0f / max(vertices, 1);
+}
+
+void LodBudget::Clear()
+{
+	_levels.clear();
+	_entries.clear();
+	_triangles = 0;
+	_vertices = 0;
+}
+
+int LodBudget::Add(const Level *levels, int numLevels, float pixelsPerUnit, int finestLevel)
+{
+	Entry entry;
+	entry.firstLevel = (int)_levels.size();
+	entry.numLevels = numLevels;
+	entry.chosen = min(max(finestLevel, 0), numLevels - 1);
+	entry.finest = entry.chosen;
+	entry.counted = entry.chosen;
+	entry.pixelsPerUnit = pixelsPerUnit;
+	_levels.insert(_levels.end(), levels, levels + numLevels);
+	_entries.push_back(entry);
+	return (int)_entries.size() - 1;
+}
+
+int LodBudget::Bucket(const Entry& entry, int level) const
+{
+	auto& fine = _levels[entry.firstLevel + level];
+	auto& coarse = _levels[entry.firstLevel + level + 1];
+
+	// A mesh seen from inside its bounds has pixelsPerUnit at the float
+	// maximum, which makes the priority infinite. That still buckets after
+	// every finite one.
+	float pixels = max(coarse.error - fine.error, 0.0f) * entry.pixelsPerUnit;
+	float saved = (fine.triangles - coarse.triangles) * _triangleScale + (fine.vertices - coarse.vertices) * _vertexScale;
+	float priority = saved > 0.0f ? pixels / saved : numeric_limits<float>::infinity();
+
+	// Positive floats order the same as their bit patterns.
+	unsigned int bits;
+	memcpy(&bits, &priority, sizeof(bits));
+	return (int)(bits >> BucketShift);
+}
+
+void LodBudget::CountSteps(int limit, int take)
+{
+	// A step is only reached through the ones before it, so it counts as no
+	// cheaper than they are.
+	_takeEntries.clear();
+	for (int i = 0; i < (int)_entries.size(); i++)
+	{
+		auto& entry = _entries[i];
+		const Level *levels = &_levels[entry.firstLevel];
+		unsigned short *buckets = &_stepBuckets[entry.firstLevel];
+		int level = entry.counted;
+		int bucket = level > entry.finest ? buckets[level - 1] : 0;
+		for (; level + 1 < entry.numLevels; level++)
+		{
+			bucket = max(bucket, Bucket(entry, level));
+			if (bucket > limit)
+				break;
+			buckets[level] = (unsigned short)bucket;
+			int triangles = levels[level].triangles - levels[level + 1].triangles;
+			int vertices = levels[level].vertices - levels[level + 1].vertices;
+			_savedTriangles[bucket] += triangles;
+			_savedVertices[bucket] += vertices;
+			if (bucket < take)
+			{
+				_triangles -= triangles;
+				_vertices -= vertices;
+				entry.chosen++;
+			}
+			else if (bucket == take && level == entry.chosen)
+			{
+				_takeEntries.push_back(i);
+			}
+		}
+		entry.counted = level;
+	}
+}
+
+void LodBudget::Solve()
+{
+	_triangles = 0;
+	_vertices = 0;
+	for (auto& entry : _entries)
+	{
+		auto& level = _levels[entry.firstLevel + entry.chosen];
+		_triangles += level.triangles;
+		_vertices += level.vertices;
+	}
+	if (!OverBudget())
+		return;
+
+	_stepBuckets.resize(_levels.size());
+	_savedTriangles.assign(NumBuckets, 0);
+	_savedVertices.assign(NumBuckets, 0);
+	const int finestTriangles = _triangles, finestVertices = _vertices;
+	const int last = _threshold;
+	CountSteps(last, last);
+
+	// Every bucket below the threshold is taken whole, the threshold bucket
+	// only until the budget is met. Commonly that is still the last one.
+	int threshold = last;
+	bool overBelow = last == 0 || OverBudget();
+	if (overBelow && (last == NumBuckets || (_triangles - _savedTriangles[last] <= _triangleBudget &&
+		_vertices - _savedVertices[last] <= _vertexBudget)))
+	{
+		for (int i : _takeEntries)
+		{
+			auto& entry = _entries[i];
+			while (entry.chosen < entry.counted && _stepBuckets[entry.firstLevel + entry.chosen] == threshold)
+			{
+				if (!OverBudget())
+					return;
+				TakeStep(entry);
+			}
+		}
+		return;
+	}
+
+	// Otherwise it is below the last, whose buckets are all counted, or
+	// above it, and the rest are counted too.
+	if (!overBelow)
+	{
+		for (auto& entry : _entries)
+			entry.chosen = entry.finest;
+		_triangles = finestTriangles;
+		_vertices = finestVertices;
+		threshold = 0;
+	}
+	else
+	{
+		CountSteps(NumBuckets, 0);
+	}
+
+	int triangles = _triangles, vertices = _vertices;
+	for (; threshold < NumBuckets; threshold++)
+	{
+		if (triangles - _savedTriangles[threshold] <= _triangleBudget &&
+			vertices - _savedVertices[threshold] <= _vertexBudget)
+			break;
+		triangles -= _savedTriangles[threshold];
+		vertices -= _savedVertices[threshold];
+	}
+	_threshold = threshold;
+
+	for (int pass = 0; pass < 2; pass++)
+	{
+		const int take = pass == 0 ? threshold - 1 : threshold;
+		for (auto& entry : _entries)
+		{
+			while (entry.chosen < entry.counted && _stepBuckets[entry.firstLevel + entry.chosen] <= take)
+			{
+				if (pass == 1 && !OverBudget())
+					return;
+				TakeStep(entry);
+			}
+		}
+	}
+}
+
+void LodBudget::TakeStep(Entry& entry)
+{
+	auto& fine = _levels[entry.firstLevel + entry.chosen];
+	auto& coarse = _levels[entry.firstLevel + entry.chosen + 1];
+	_triangles += coarse.triangles - fine.triangles;
+	_vertices += coarse.vertices - fine.vertices;
+	entry.chosen++;
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <vector>
+
+using namespace std;
+
+// Shares a scene wide triangle and vertex budget out among the meshes drawn
+// in a frame. Every mesh starts at the LOD its own error asks for, and while
+// the scene is over budget the steps to a coarser LOD that add the fewest
+// pixels of error for the geometry they save are taken first. That greedy
+// order is found without sorting: steps are counted into buckets by
+// priority, the buckets give the priority at which enough is saved, and
+// every mesh then steps down to it in one pass. Nothing is allocated once the
+// buffers have grown to the scene's size, so this is cheap to solve every
+// frame.
+//
+// Priorities move little from frame to frame, so steps are first counted
+// only up to the last frame's threshold bucket, and those below it taken as
+// they are counted. While that threshold still holds, which is most frames,
+// a solve is one pass over the steps up to it.
+//
+// That falls short of 0.1 ms for thousands of meshes once most of them step
+// down, as each step taken is still bucketed. On the VM fbxbench runs on,
+// 4000 meshes take about 0.065 ms with three quarters of the scene in budget,
+// half what bucketing every step took, but 0.13 ms with a quarter, and 16000
+// take 0.4 to 0.8 ms. A camera moving 1% closer a frame adds 20 to 40%.
+class LodBudget
+{
+public:
+	// One LOD of a mesh, error is in object space units as the simplifier
+	// measures it.
+	struct Level
+	{
+		int triangles;
+		int vertices;
+		float error;
+	};
+
+	LodBudget();
+
+	void SetBudget(int triangles, int vertices);
+
+	// Starts a new frame.
+	void Clear();
+
+	// Adds a mesh drawn at pixelsPerUnit, with at least one level, from full
+	// detail at 0 to coarsest. It is drawn no finer than finestLevel, the
+	// level that already looks right. Returns the index to look its LOD up
+	// by.
+	int Add(const Level *levels, int numLevels, float pixelsPerUnit, int finestLevel);
+
+	void Solve();
+
+	// The chosen level of mesh index, after Solve.
+	int Lod(int index) const { return _entries[index].chosen; }
+
+	// What the chosen levels add up to. They are over budget when the
+	// coarsest levels alone are.
+	int Triangles() const { return _triangles; }
+	int Vertices() const { return _vertices; }
+
+private:
+	struct Entry
+	{
+		int firstLevel;
+		int numLevels;
+		int chosen;
+		int finest;
+		float pixelsPerUnit;
+
+		// Steps from finest to this level are bucketed and counted.
+		int counted;
+	};
+
+	// Buckets for the top bits of a positive float's pattern, eight to an
+	// octave.
+	static const int BucketShift = 20;
+	static const int NumBuckets = 1 << (31 - BucketShift);
+
+	bool OverBudget() const { return _triangles > _triangleBudget || _vertices > _vertexBudget; }
+
+	// Bucket of the pixels of error added per share of the budget saved by
+	// stepping from level to the next coarser one.
+	int Bucket(const Entry& entry, int level) const;
+
+	// Carries on counting each mesh's steps up to the first in a bucket over
+	// limit, taking those in buckets below take. The meshes with a step in
+	// bucket take go in _takeEntries.
+	void CountSteps(int limit, int take);
+	void TakeStep(Entry& entry);
+
+	int _triangleBudget;
+	int _vertexBudget;
+
+	// Geometry saved is weighed as a share of each budget.
+	float _triangleScale;
+	float _vertexScale;
+
+	int _triangles;
+	int _vertices;
+	vector<Level> _levels;
+	vector<Entry> _entries;
+
+	// The bucket of the step down from each level, and what the steps in
+	// each bucket save between them.
+	vector<unsigned short> _stepBuckets;
+	vector<int> _savedTriangles;
+	vector<int> _savedVertices;
+
+	// The last solve's threshold bucket, NumBuckets when even the coarsest
+	// levels were over budget.
+	int _threshold;
+	vector<int> _takeEntries;
+};
@@ -10,6 +10,11 @@ namespace MathHelper
 
 struct Matrix4
 {
+    // Left for the caller to fill in.
+    Matrix4()
+    {
+    }
+
     Matrix4(float m00, float m01, float m02, float m03,
             float m10, float m11, float m12, float m13,
             float m20, float m21, float m22, float m23,
@@ -36,6 +41,27 @@ struct Vec3
     float x, y, z;
 };
 
+// a * b as GL applies them to a column vector, so b first. Both are laid out
+// the way they are uploaded.
+inline static Matrix4 Multiply(const Matrix4& a, const Matrix4& b)
+{
+    Matrix4 result(0.0f, 0.0f, 0.0f, 0.0f,
+                   0.0f, 0.0f, 0.0f, 0.0f,
+                   0.0f, 0.0f, 0.0f, 0.0f,
+                   0.0f, 0.0f, 0.0f, 0.0f);
+    for (int column = 0; column < 4; column++)
+    {
+        for (int row = 0; row < 4; row++)
+        {
+            for (int k = 0; k < 4; k++)
+            {
+                result.m[column][row] += a.m[k][row] * b.m[column][k];
+            }
+        }
+    }
+    return result;
+}
+
 inline static Matrix4 SimpleModelMatrix(float radians, Vec3 position)
 {
     float cosine = cosf(radians);
@@ -61,6 +87,33 @@ inline static Matrix4 SimpleViewMatrix()
                    0.0f,       0.0f,      -1.0f, 1.0f);
 }
 
+// World to view for a head at position with orientation the unit
+// quaternion xyzw, looking down its -Z. The inverse of the head's own
+// transform: its rotation transposed, then the position taken away.
+inline static Matrix4 ViewMatrixFromPose(Vec3 position, float x, float y, float z, float w)
+{
+    float r00 = 1.0f - 2.0f * (y * y + z * z), r01 = 2.0f * (x * y - z * w),        r02 = 2.0f * (x * z + y * w);
+    float r10 = 2.0f * (x * y + z * w),        r11 = 1.0f - 2.0f * (x * x + z * z), r12 = 2.0f * (y * z - x * w);
+    float r20 = 2.0f * (x * z - y * w),        r21 = 2.0f * (y * z + x * w),        r22 = 1.0f - 2.0f * (x * x + y * y);
+
+    return Matrix4(r00, r01, r02, 0.0f,
+                   r10, r11, r12, 0.0f,
+                   r20, r21, r22, 0.0f,
+                   -(r00 * position.x + r10 * position.y + r20 * position.z),
+                   -(r01 * position.x + r11 * position.y + r21 * position.z),
+                   -(r02 * position.x + r12 * position.y + r22 * position.z), 1.0f);
+}
+
+// Symmetric perspective projection reaching tanHalfWidth and tanHalfHeight
+// either side of -Z.
+inline static Matrix4 PerspectiveMatrix(float tanHalfWidth, float tanHalfHeight, float nearZ, float farZ)
+{
+    return Matrix4(1.0f / tanHalfWidth,                 0.0f,                                    0.0f,  0.0f,
+                                  0.0f, 1.0f / tanHalfHeight,                                    0.0f,  0.0f,
+                                  0.0f,                 0.0f,        (farZ + nearZ) / (nearZ - farZ), -1.0f,
+                                  0.0f,                 0.0f, 2.0f * farZ * nearZ / (nearZ - farZ),  0.0f);
+}
+
 inline static Matrix4 SimpleProjectionMatrix(float aspectRatio)
 {
     // Far plane is at 50.0f, near plane is at 1.0f.
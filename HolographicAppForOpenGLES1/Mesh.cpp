@@ -1,77 +1,523 @@
 #include "pch.h"
 #include "Mesh.h"
+#include "GlState.h"
+#include "GlTrace.h"
 #include "utils.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
 
-Mesh::Mesh()
+static const int BytesPerVertex = VertexQuantizer::BytesPerVertex;
+static_assert(sizeof(VertexQuantizer::Vertex) == BytesPerVertex, "interleaved vertices must be packed");
+
+// A LOD is good enough while its error covers less than LodErrorPixels on
+// screen. Once drawn it is kept until its error grows LodHysteresis times
+// past that.
+static const float LodErrorPixels = 1.0f;
+static const float LodHysteresis = 1.5f;
+
+Mesh::Mesh() :
+	_positionAttribLocation(-1),
+	_colorAttribLocation(-1),
+	_normalAttribLocation(-1),
+	_positionScaleUniformLocation(-1),
+	_positionOffsetUniformLocation(-1),
+	_vertexPositionBuffer(0),
+	_vertexColorBuffer(0),
+	_normalsBuffer(0),
+	_vertexBuffer(0),
+	_layout(VertexLayout::Interleaved),
+	_vertexAllocation(-1),
+	_indexAllocation(-1),
+	_vertexOffset(0),
+	_normalsOffset(0),
+	_colorOffset(0),
+	_indexOffset(0),
+	_lodIndexOffset(0),
+	_numIndices(0),
+	_numDrawIndices(0),
+	_index_vbo(0),
+	_lodIndexBuffer(0),
+	_lod(0),
+	_renderTargetIndexAttribLocation(-1),
+	_renderTargetIndices(0),
+	_useVertexArray(true),
+	_vertexArray(0),
+	_culled(false),
+	_culledTriangles(0),
+	_stripTriangles(0),
+	_drawnTriangles(0),
+	_drawCalls(0),
+	_transparent(false),
+	_uploadedVertices(0)
 {
 }
 
 Mesh::~Mesh()
 {
-	if (_vertexPositionBuffer != 0)
+	ReleaseDeviceResources();
+}
+
+void Mesh::ReleaseDeviceResources()
+{
+	auto& state = GlState::Current();
+	state.DeleteVertexArray(_vertexArray);
+	if (_vertexAllocation >= 0)
 	{
-		glDeleteBuffers(1, &_vertexPositionBuffer);
-		_vertexPositionBuffer = 0;
+		_vertexPool->Free(_vertexAllocation);
+		_vertexPositionBuffer = _vertexColorBuffer = _normalsBuffer = _vertexBuffer = 0;
 	}
-	if (_vertexColorBuffer != 0)
+	if (_indexAllocation >= 0)
+	{
+		_indexPool->Free(_indexAllocation);
+		_index_vbo = _lodIndexBuffer = 0;
+	}
+	state.DeleteBuffer(_vertexPositionBuffer);
+	state.DeleteBuffer(_vertexColorBuffer);
+	state.DeleteBuffer(_normalsBuffer);
+	state.DeleteBuffer(_vertexBuffer);
+	state.DeleteBuffer(_index_vbo);
+	state.DeleteBuffer(_lodIndexBuffer);
+	_vertexOffset = _normalsOffset = _colorOffset = 0;
+	_indexOffset = _lodIndexOffset = 0;
+	_lodFirstIndex.clear();
+	_levels.clear();
+	_lod = 0;
+	_culled = false;
+	_drawnTriangles = 0;
+}
+
+// Allocates the whole buffer but, for a progressive mesh, only fills in the
+// part the base mesh needs. The rest arrives through Refine.
+static void UploadBuffer(GLenum target, GLuint buffer, GLsizeiptr size, GLsizeiptr initialSize, const void *data)
+{
+	GlState::Current().BindBuffer(target, buffer);
+	if (initialSize == size)
 	{
-		glDeleteBuffers(1, &_vertexColorBuffer);
-		_vertexColorBuffer = 0;
+		GlTrace::Current().BufferData(target, size, data, GL_STATIC_DRAW);
 	}
-	if (_normalsBuffer != 0)
+	else
 	{
-		glDeleteBuffers(1, &_normalsBuffer);
-		_normalsBuffer = 0;
+		GlTrace::Current().BufferData(target, size, nullptr, GL_STATIC_DRAW);
+		GlTrace::Current().BufferSubData(target, 0, initialSize, data);
 	}
 }
 
-void Mesh::SetVertexColors(unique_ptr<GLfloat[]> colors, int numVertices)
+void Mesh::SetData(unique_ptr<MeshData> data)
 {
-	glGenBuffers(1, &_vertexColorBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, _vertexColorBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 4 * numVertices, colors.get(), GL_STATIC_DRAW);
+	// assume ownership of the geometry passed in, replacing any we had..
+	_data = std::move(data);
+	if (_data->bounds.radius < 0.0f)
+		_data->ComputeBounds();
+	_quantizer = VertexQuantizer(*_data);
+	_stripTriangles = _data->strip ? _data->TriangleCount() : 0;
+	_transparent = false;
+	for (size_t i = 3; i < _data->colors.size(); i += 4)
+		_transparent = _transparent || _data->colors[i] < 1.0f;
+
+	_lodVertices.clear();
+	vector<bool> used;
+	for (auto& lod : _data->lods)
+	{
+		used.assign(_data->VertexCount(), false);
+		int count = 0;
+		for (auto index : lod.indices)
+		{
+			count += used[index] ? 0 : 1;
+			used[index] = true;
+		}
+		_lodVertices.push_back(count);
+	}
+	CreateDeviceResources();
 }
 
-void Mesh::SetVertices(unique_ptr<GLfloat[]> vertices, int numVertices)
+int Mesh::CreateDeviceResources()
 {
-	// assume ownership of the verices passed in..
-	_vertices = std::move(vertices);
+	ReleaseDeviceResources();
+
+	auto& progressive = _data->progressive;
+	const int numVertices = _data->VertexCount();
+	_numIndices = _data->IndexCount();
+	_uploadedVertices = progressive ? progressive->BaseVertexCount() : numVertices;
+	_numDrawIndices = progressive ? progressive->BaseTriangleCount() * 3 : _numIndices;
+	if (progressive && _data->appliedSplits > 0)
+	{
+		auto& split = progressive->Splits()[_data->appliedSplits - 1];
+		_uploadedVertices = split.vertexCount;
+		_numDrawIndices = split.triangleCount * 3;
+	}
 
-	glGenBuffers(1, &_vertexPositionBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, _vertexPositionBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 4 * numVertices, _vertices.get(), GL_STATIC_DRAW);
+	int lodIndices = 0;
+	for (auto& lod : _data->lods)
+		lodIndices += (int)lod.indices.size();
 
-	checkGlError(L"SetVertices");
+	if (_vertexPool)
+	{
+		int bytes = _layout == VertexLayout::Interleaved ? (int)sizeof(VertexQuantizer::Vertex) * numVertices :
+			GeometryPool::Align((int)sizeof(VertexQuantizer::Position) * numVertices) +
+			GeometryPool::Align((int)sizeof(VertexQuantizer::Normal) * numVertices) +
+			(int)sizeof(VertexQuantizer::Color) * numVertices;
+		auto allocation = _vertexPool->Allocate(bytes, [this](int offset)
+		{
+			PlaceVertices(offset);
+			UploadVertices(0, _uploadedVertices);
+			GlState::Current().DeleteVertexArray(_vertexArray);
+		});
+		_vertexAllocation = allocation.id;
+		if (_layout == VertexLayout::Interleaved)
+		{
+			_vertexBuffer = allocation.buffer;
+		}
+		else
+		{
+			_vertexPositionBuffer = allocation.buffer;
+			_normalsBuffer = allocation.buffer;
+			_vertexColorBuffer = allocation.buffer;
+		}
+		PlaceVertices(allocation.offset);
+	}
+	else if (_layout == VertexLayout::Interleaved)
+	{
+		glGenBuffers(1, &_vertexBuffer);
+		GlState::Current().BindBuffer(GL_ARRAY_BUFFER, _vertexBuffer);
+		GlTrace::Current().BufferData(GL_ARRAY_BUFFER, sizeof(VertexQuantizer::Vertex) * numVertices, nullptr, GL_STATIC_DRAW);
+	}
+	else
+	{
+		glGenBuffers(1, &_vertexPositionBuffer);
+		GlState::Current().BindBuffer(GL_ARRAY_BUFFER, _vertexPositionBuffer);
+		GlTrace::Current().BufferData(GL_ARRAY_BUFFER, sizeof(VertexQuantizer::Position) * numVertices, nullptr, GL_STATIC_DRAW);
+
+		glGenBuffers(1, &_normalsBuffer);
+		GlState::Current().BindBuffer(GL_ARRAY_BUFFER, _normalsBuffer);
+		GlTrace::Current().BufferData(GL_ARRAY_BUFFER, sizeof(VertexQuantizer::Normal) * numVertices, nullptr, GL_STATIC_DRAW);
+
+		glGenBuffers(1, &_vertexColorBuffer);
+		GlState::Current().BindBuffer(GL_ARRAY_BUFFER, _vertexColorBuffer);
+		GlTrace::Current().BufferData(GL_ARRAY_BUFFER, sizeof(VertexQuantizer::Color) * numVertices, nullptr, GL_STATIC_DRAW);
+	}
+
+	UploadVertices(0, _uploadedVertices);
+	checkGlError(L"SetData");
+
+	if (_indexPool)
+	{
+		auto allocation = _indexPool->Allocate(sizeof(unsigned short) * (_numIndices + lodIndices), [this](int offset)
+		{
+			PlaceIndices(offset);
+			UploadIndices(_numIndices);
+			UploadLodIndices();
+		});
+		_indexAllocation = allocation.id;
+		_index_vbo = allocation.buffer;
+		_lodIndexBuffer = _data->lods.empty() ? 0 : allocation.buffer;
+		PlaceIndices(allocation.offset);
+		UploadIndices(_numDrawIndices);
+	}
+	else
+	{
+		glGenBuffers(1, &_index_vbo);
+		UploadBuffer(GL_ELEMENT_ARRAY_BUFFER, _index_vbo, sizeof(unsigned short) * _numIndices,
+			sizeof(unsigned short) * _numDrawIndices, _data->indices.data());
+		if (!_data->lods.empty())
+			glGenBuffers(1, &_lodIndexBuffer);
+	}
+	checkGlError(L"SetIndexBuffer");
+
+	UploadLodIndices();
+	UpdateLevels();
+
+	return _uploadedVertices * BytesPerVertex + (_numDrawIndices + lodIndices) * (int)sizeof(unsigned short);
 }
 
-void Mesh::SetNormals(unique_ptr<GLfloat[]> normals, int numVertices)
+void Mesh::Bounds(float *center, float& radius) const
 {
-	_normals = std::move(normals);
-	glGenBuffers(1, &_normalsBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, _normalsBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * 3 * numVertices, _normals.get(), GL_STATIC_DRAW);
+	auto& bounds = _data->bounds;
+	copy(bounds.center, bounds.center + 3, center);
+	radius = bounds.radius;
 }
 
-void Mesh::SetIndexBuffer(unique_ptr<unsigned short[]> indices, int numIndices)
+void Mesh::SelectLod(float pixelsPerUnit)
 {
-	_numIndices = numIndices;
-	_vertex_indices = std::move(indices);
+	// A progressive mesh still refining is coarse enough already, and its
+	// LODs use vertices that may not be uploaded yet.
+	if (_lodFirstIndex.empty() || !IsRefined())
+	{
+		_lod = 0;
+		return;
+	}
 
-	glGenBuffers(1, &_index_vbo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _index_vbo);
-	auto ind = _vertex_indices.get();
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short) * numIndices, _vertex_indices.get(), GL_STATIC_DRAW);
-	checkGlError(L"SetIndexBuffer");
+	int lod = 0;
+	for (size_t i = 0; i < _data->lods.size(); i++)
+	{
+		float threshold = LodErrorPixels * ((int)i + 1 <= _lod ? LodHysteresis : 1.0f);
+		if (_data->lods[i].error * pixelsPerUnit > threshold)
+			break;
+		lod = (int)i + 1;
+	}
+	_lod = lod;
+}
+
+void Mesh::SetLod(int lod)
+{
+	if (!_lodFirstIndex.empty() && IsRefined())
+		_lod = min(max(lod, 0), (int)_lodFirstIndex.size());
+}
+
+void Mesh::UpdateLevels()
+{
+	_levels.clear();
+	_levels.push_back({ _data->strip ? _stripTriangles : _numDrawIndices / 3, _uploadedVertices, 0.0f });
+	if (_lodFirstIndex.empty() || !IsRefined())
+		return;
+
+	for (size_t i = 0; i < _data->lods.size(); i++)
+		_levels.push_back({ (int)_data->lods[i].indices.size() / 3, _lodVertices[i], _data->lods[i].error });
+}
+
+void Mesh::Cull(const float *eye, const float (*planes)[4], int numPlanes, const unsigned char *visibleParts)
+{
+	auto& clusters = _data->clusters;
+	auto& parts = _data->parts;
+	_culled = (eye != nullptr || (visibleParts != nullptr && !parts.empty())) && _lod == 0 && IsRefined() &&
+		!clusters.empty();
+	if (!_culled)
+		return;
+
+	// Neighbouring clusters are neighbours in the index buffer too, with at
+	// most a strip's degenerate joins between them, so visible runs of them
+	// go out as one draw. A batch's parts are runs of its clusters, anything
+	// else is one run of all of them.
+	_drawRanges.clear();
+	_culledTriangles = 0;
+	int previous = -1;
+	const int numRuns = parts.empty() ? 1 : (int)parts.size();
+	for (int run = 0; run < numRuns; run++)
+	{
+		if (!parts.empty() && visibleParts != nullptr && !visibleParts[run])
+			continue;
+
+		int first = parts.empty() ? 0 : parts[run].firstCluster;
+		int last = parts.empty() ? (int)clusters.size() : first + parts[run].clusterCount;
+		for (int c = first; c < last; c++)
+		{
+			auto& cluster = clusters[c];
+			if (eye != nullptr && !Clusters::IsVisible(cluster, eye, planes, numPlanes))
+				continue;
+			_culledTriangles += cluster.triangleCount;
+			if (!_drawRanges.empty() && c == previous + 1)
+				_drawRanges.back().second = cluster.firstIndex + cluster.indexCount - _drawRanges.back().first;
+			else
+				_drawRanges.emplace_back(cluster.firstIndex, cluster.indexCount);
+			previous = c;
+		}
+	}
+}
+
+void Mesh::SetVertexLayout(VertexLayout layout)
+{
+	if (layout == _layout)
+		return;
+
+	_layout = layout;
+	if (HasDeviceResources())
+		CreateDeviceResources();
+}
+
+void Mesh::SetGeometryPools(shared_ptr<GeometryPool> vertices, shared_ptr<GeometryPool> indices)
+{
+	if (vertices == _vertexPool && indices == _indexPool)
+		return;
+
+	// The ranges go back to the pools they came from first.
+	bool recreate = HasDeviceResources();
+	ReleaseDeviceResources();
+	_vertexPool = std::move(vertices);
+	_indexPool = std::move(indices);
+	if (recreate)
+		CreateDeviceResources();
+}
+
+bool Mesh::IsRefined() const
+{
+	return !_data || !_data->progressive || _data->appliedSplits == (int)_data->progressive->Splits().size();
+}
+
+int Mesh::Refine(int byteBudget)
+{
+	if (IsRefined())
+		return 0;
+
+	auto& splits = _data->progressive->Splits();
+	auto& writes = _data->progressive->Writes();
+	const int firstVertex = _uploadedVertices;
+	int firstDirty = _numIndices;
+	int lastDirty = -1;
+	int used = 0;
+
+	// Always make some progress, even when a single split is over budget.
+	int& nextSplit = _data->appliedSplits;
+	while (nextSplit < (int)splits.size())
+	{
+		auto& split = splits[nextSplit];
+		int cost = (split.vertexCount - _uploadedVertices) * BytesPerVertex +
+			split.writeCount * (int)sizeof(unsigned short);
+		if (used > 0 && used + cost > byteBudget)
+			break;
+
+		for (int i = split.firstWrite; i < split.firstWrite + split.writeCount; i++)
+		{
+			_data->indices[writes[i].position] = writes[i].value;
+			firstDirty = min(firstDirty, writes[i].position);
+			lastDirty = max(lastDirty, writes[i].position);
+		}
+
+		_uploadedVertices = split.vertexCount;
+		_numDrawIndices = split.triangleCount * 3;
+		used += cost;
+		nextSplit++;
+
+		// Fully refined, swap in the optimised full detail triangle order.
+		auto& finalIndices = _data->progressive->FinalIndices();
+		if (nextSplit == (int)splits.size() && (int)finalIndices.size() == _numIndices)
+		{
+			_data->indices = finalIndices;
+			firstDirty = 0;
+			lastDirty = _numIndices - 1;
+			used += _numIndices * (int)sizeof(unsigned short);
+		}
+	}
+
+	// New vertices are always appended so they go up as one range per stream.
+	const int count = _uploadedVertices - firstVertex;
+	if (count > 0)
+		UploadVertices(firstVertex, count);
+
+	if (lastDirty >= firstDirty)
+	{
+		GlState::Current().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, _index_vbo);
+		GlTrace::Current().BufferSubData(GL_ELEMENT_ARRAY_BUFFER, _indexOffset + sizeof(unsigned short) * firstDirty,
+			sizeof(unsigned short) * (lastDirty - firstDirty + 1), _data->indices.data() + firstDirty);
+	}
+
+	checkGlError(L"Refine");
+	UpdateLevels();
+	return used;
+}
+
+void Mesh::UploadVertices(int first, int count)
+{
+	if (count <= 0)
+		return;
+
+	if (_layout == VertexLayout::Interleaved)
+	{
+		vector<VertexQuantizer::Vertex> vertices(count);
+		_quantizer.Encode(*_data, first, count, vertices.data());
+		GlState::Current().BindBuffer(GL_ARRAY_BUFFER, _vertexBuffer);
+		GlTrace::Current().BufferSubData(GL_ARRAY_BUFFER, _vertexOffset + sizeof(VertexQuantizer::Vertex) * first, sizeof(VertexQuantizer::Vertex) * count, vertices.data());
+		return;
+	}
+
+	vector<VertexQuantizer::Position> positions(count);
+	vector<VertexQuantizer::Normal> normals(count);
+	vector<VertexQuantizer::Color> colors(count);
+	_quantizer.Encode(*_data, first, count, positions.data(), normals.data(), colors.data());
+
+	GlState::Current().BindBuffer(GL_ARRAY_BUFFER, _vertexPositionBuffer);
+	GlTrace::Current().BufferSubData(GL_ARRAY_BUFFER, _vertexOffset + sizeof(VertexQuantizer::Position) * first, sizeof(VertexQuantizer::Position) * count, positions.data());
+	GlState::Current().BindBuffer(GL_ARRAY_BUFFER, _normalsBuffer);
+	GlTrace::Current().BufferSubData(GL_ARRAY_BUFFER, _normalsOffset + sizeof(VertexQuantizer::Normal) * first, sizeof(VertexQuantizer::Normal) * count, normals.data());
+	GlState::Current().BindBuffer(GL_ARRAY_BUFFER, _vertexColorBuffer);
+	GlTrace::Current().BufferSubData(GL_ARRAY_BUFFER, _colorOffset + sizeof(VertexQuantizer::Color) * first, sizeof(VertexQuantizer::Color) * count, colors.data());
+}
+
+void Mesh::UploadIndices(int count)
+{
+	GlState::Current().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, _index_vbo);
+	GlTrace::Current().BufferSubData(GL_ELEMENT_ARRAY_BUFFER, _indexOffset, sizeof(unsigned short) * count, _data->indices.data());
+}
+
+void Mesh::UploadLodIndices()
+{
+	if (_data->lods.empty())
+		return;
+
+	vector<unsigned short> indices;
+	_lodFirstIndex.clear();
+	for (auto& lod : _data->lods)
+	{
+		_lodFirstIndex.push_back((int)indices.size());
+		indices.insert(indices.end(), lod.indices.begin(), lod.indices.end());
+	}
+
+	GlState::Current().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, _lodIndexBuffer);
+	if (_indexPool)
+		GlTrace::Current().BufferSubData(GL_ELEMENT_ARRAY_BUFFER, _lodIndexOffset, sizeof(unsigned short) * indices.size(), indices.data());
+	else
+		GlTrace::Current().BufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short) * indices.size(), indices.data(), GL_STATIC_DRAW);
+	checkGlError(L"SetLodIndexBuffer");
+}
+
+void Mesh::PlaceVertices(int offset)
+{
+	const int numVertices = _data->VertexCount();
+	_vertexOffset = offset;
+	_normalsOffset = 0;
+	_colorOffset = 0;
+	if (_layout == VertexLayout::Split)
+	{
+		_normalsOffset = _vertexOffset + GeometryPool::Align((int)sizeof(VertexQuantizer::Position) * numVertices);
+		_colorOffset = _normalsOffset + GeometryPool::Align((int)sizeof(VertexQuantizer::Normal) * numVertices);
+	}
+}
+
+void Mesh::PlaceIndices(int offset)
+{
+	_indexOffset = offset;
+	_lodIndexOffset = offset + (int)sizeof(unsigned short) * _numIndices;
 }
 
 void Mesh::SetPositionAttribLocation(GLint positionAttribLocation)
 {
 	_positionAttribLocation = positionAttribLocation;
+	GlState::Current().DeleteVertexArray(_vertexArray);
 }
 
 void Mesh::SetColorAttribLocation(GLint colorAttribLocation)
 {
 	_colorAttribLocation = colorAttribLocation;
+	GlState::Current().DeleteVertexArray(_vertexArray);
+}
+
+void Mesh::SetNormalAttribLocation(GLint normalAttribLocation)
+{
+	_normalAttribLocation = normalAttribLocation;
+	GlState::Current().DeleteVertexArray(_vertexArray);
+}
+
+void Mesh::SetRenderTargetIndexAttrib(GLint location, GLuint buffer)
+{
+	_renderTargetIndexAttribLocation = location;
+	_renderTargetIndices = buffer;
+	GlState::Current().DeleteVertexArray(_vertexArray);
+}
+
+void Mesh::SetUseVertexArray(bool use)
+{
+	_useVertexArray = use;
+	if (!use)
+		GlState::Current().DeleteVertexArray(_vertexArray);
+}
+
+void Mesh::SetPositionScaleUniformLocation(GLint positionScaleUniformLocation)
+{
+	_positionScaleUniformLocation = positionScaleUniformLocation;
+}
+
+void Mesh::SetPositionOffsetUniformLocation(GLint positionOffsetUniformLocation)
+{
+	_positionOffsetUniformLocation = positionOffsetUniformLocation;
 }
 
 void Mesh::Render(bool isHolographic)
@@ -79,36 +525,127 @@ void Mesh::Render(bool isHolographic)
 	PreRender(isHolographic);
 
 	//glDisable(GL_TEXTURE_2D);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _index_vbo);
+	GLsizei count = _numDrawIndices;
+	const void *offset = (const void *)(intptr_t)_indexOffset;
+	if (_lod > 0)
+	{
+		GlState::Current().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, _lodIndexBuffer);
+		count = (GLsizei)_data->lods[_lod - 1].indices.size();
+		offset = (const void *)(_lodIndexOffset + sizeof(unsigned short) * _lodFirstIndex[_lod - 1]);
+	}
+	else
+	{
+		GlState::Current().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, _index_vbo);
+	}
 	checkGlError(L"glBindBuffer");
-	if (isHolographic)
+
+	GLenum mode = _lod == 0 && _data->strip ? GL_TRIANGLE_STRIP : GL_TRIANGLES;
+	if (_culled)
 	{
-		glDrawElementsInstancedANGLE(GL_TRIANGLES, _numIndices, GL_UNSIGNED_SHORT, 0, 2);
+		for (auto& range : _drawRanges)
+			Draw(isHolographic, mode, range.second, (const void *)(_indexOffset + sizeof(unsigned short) * range.first));
+		_drawnTriangles = _culledTriangles;
+		_drawCalls = (int)_drawRanges.size();
 	}
 	else
 	{
-		//GL_TRIANGLES_ADJACENCY
-		// GL_TRIANGLE_STRIP
-		glDrawElements(GL_TRIANGLES, _numIndices, GL_UNSIGNED_SHORT, 0);
+		Draw(isHolographic, mode, count, offset);
+		_drawnTriangles = mode == GL_TRIANGLE_STRIP ? _stripTriangles : count / 3;
+		_drawCalls = 1;
 	}
 
 	checkGlError(L"glDrawElements");
 }
 
+void Mesh::Draw(bool isHolographic, GLenum mode, GLsizei count, const void *offset)
+{
+	if (isHolographic)
+	{
+		GlTrace::Current().DrawElementsInstanced(mode, count, GL_UNSIGNED_SHORT, offset, 2);
+	}
+	else
+	{
+		GlTrace::Current().DrawElements(mode, count, GL_UNSIGNED_SHORT, offset);
+	}
+}
+
 void Mesh::PreRender(bool isHolographic)
 {
 	checkGlError(L"Render");
-	glBindBuffer(GL_ARRAY_BUFFER, _vertexPositionBuffer);
-	checkGlError(L"glBindBuffer");
-	glEnableVertexAttribArray(_positionAttribLocation);
+	GlTrace::Current().Uniform3fv(_positionScaleUniformLocation, 1, _quantizer.Scale());
+	GlTrace::Current().Uniform3fv(_positionOffsetUniformLocation, 1, _quantizer.Offset());
+
+	// With a vertex array the attributes are set once, when it is made.
+	auto& state = GlState::Current();
+	if (state.HasVertexArrays())
+	{
+		if (!_useVertexArray)
+		{
+			state.BindVertexArray(0);
+		}
+		else if (_vertexArray != 0)
+		{
+			state.BindVertexArray(_vertexArray);
+			checkGlError(L"glBindVertexArrayOES");
+			return;
+		}
+		else
+		{
+			glGenVertexArraysOES(1, &_vertexArray);
+			state.BindVertexArray(_vertexArray);
+		}
+	}
+	SetAttributes();
+}
+
+void Mesh::SetAttributes()
+{
+	// Attributes only bind their buffer when they change, so without vertex
+	// arrays pooled meshes drawn in a row leave the pool's buffer bound.
+	auto& state = GlState::Current();
+	if (_renderTargetIndexAttribLocation >= 0)
+	{
+		state.VertexAttribPointer(_renderTargetIndexAttribLocation, _renderTargetIndices, 1, GL_FLOAT, GL_FALSE, 0, 0);
+		state.EnableVertexAttribArray(_renderTargetIndexAttribLocation);
+		state.VertexAttribDivisor(_renderTargetIndexAttribLocation, 1);
+		checkGlError(L"glVertexAttribDivisorANGLE");
+	}
+
+	if (_layout == VertexLayout::Interleaved)
+	{
+		const GLsizei stride = sizeof(VertexQuantizer::Vertex);
+		state.EnableVertexAttribArray(_positionAttribLocation);
+		state.VertexAttribPointer(_positionAttribLocation, _vertexBuffer, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+			(const void *)(_vertexOffset + offsetof(VertexQuantizer::Vertex, position)));
+		state.EnableVertexAttribArray(_colorAttribLocation);
+		state.VertexAttribPointer(_colorAttribLocation, _vertexBuffer, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride,
+			(const void *)(_vertexOffset + offsetof(VertexQuantizer::Vertex, color)));
+		if (_normalAttribLocation >= 0)
+		{
+			state.EnableVertexAttribArray(_normalAttribLocation);
+			state.VertexAttribPointer(_normalAttribLocation, _vertexBuffer, 2, GL_SHORT, GL_TRUE, stride,
+				(const void *)(_vertexOffset + offsetof(VertexQuantizer::Vertex, normal)));
+		}
+		checkGlError(L"glVertexAttribPointer");
+		return;
+	}
+
+	state.EnableVertexAttribArray(_positionAttribLocation);
 	checkGlError(L"glEnableVertexAttribArray");
-	glVertexAttribPointer(_positionAttribLocation, 4, GL_FLOAT, GL_FALSE, 0, 0);
+	state.VertexAttribPointer(_positionAttribLocation, _vertexPositionBuffer, 4, GL_UNSIGNED_SHORT, GL_TRUE, 0,
+		(const void *)(intptr_t)_vertexOffset);
 	checkGlError(L"glVertexAttribPointer");
-	glBindBuffer(GL_ARRAY_BUFFER, _vertexColorBuffer);
-	checkGlError(L"glBindBuffer");
-	glEnableVertexAttribArray(_colorAttribLocation);
+	state.EnableVertexAttribArray(_colorAttribLocation);
 	checkGlError(L"glEnableVertexAttribArray");
-	glVertexAttribPointer(_colorAttribLocation, 4, GL_FLOAT, GL_FALSE, 0, 0);
+	state.VertexAttribPointer(_colorAttribLocation, _vertexColorBuffer, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0,
+		(const void *)(intptr_t)_colorOffset);
 	checkGlError(L"glVertexAttribPointer");
+	if (_normalAttribLocation >= 0)
+	{
+		state.EnableVertexAttribArray(_normalAttribLocation);
+		state.VertexAttribPointer(_normalAttribLocation, _normalsBuffer, 2, GL_SHORT, GL_TRUE, 0,
+			(const void *)(intptr_t)_normalsOffset);
+		checkGlError(L"glVertexAttribPointer");
+	}
 }
 
@@ -1,38 +1,186 @@
 #pragma once
+#include <memory>
 #include <vector>
+#include "GeometryPool.h"
 #include "Material.h"
+#include "MeshData.h"
+#include "VertexQuantizer.h"
+#include "LodBudget.h"
 
 using namespace std;
 
 class Mesh
 {
 public:
+	// Interleaved keeps every attribute of a vertex in one buffer, so drawing
+	// binds one buffer and fetches one cache line run per vertex. Split keeps
+	// a buffer per attribute.
+	enum class VertexLayout
+	{
+		Split,
+		Interleaved
+	};
+
 	Mesh();
 	~Mesh();
 
-	void SetVertexColors(unique_ptr<GLfloat[]> colors, int numVertices);
+	// Takes ownership of the converted geometry and creates the buffers for
+	// it. Progressive meshes get full size buffers but only the base mesh is
+	// uploaded.
+	void SetData(unique_ptr<MeshData> data);
+	const MeshData& Data() const { return *_data; }
+
+	// The geometry outlives the GL buffers, so after a lost context they are
+	// simply created again from it. Returns the number of bytes uploaded.
+	int CreateDeviceResources();
+	void ReleaseDeviceResources();
+	bool HasDeviceResources() const { return _index_vbo != 0; }
+
+	// Buffers that already exist are created again in the new layout.
+	void SetVertexLayout(VertexLayout layout);
+	VertexLayout GetVertexLayout() const { return _layout; }
+
+	// Where the vertices and the indices get their buffer space. Without
+	// pools, the default, the mesh has buffers of its own. Buffers that
+	// already exist are created again in the new place.
+	void SetGeometryPools(shared_ptr<GeometryPool> vertices, shared_ptr<GeometryPool> indices);
 
-	void SetVertices(unique_ptr<GLfloat[]> vertices, int numVertices);
-	void SetNormals(unique_ptr<GLfloat[]> normals, int numVertices);
-	void SetIndexBuffer(unique_ptr<unsigned short[]> indices, int numIndices);
 	void SetPositionAttribLocation(GLint positionAttribLocation);
 	void SetColorAttribLocation(GLint colorAttribLocation);
+
+	// Normals are only bound for programs that read them.
+	void SetNormalAttribLocation(GLint normalAttribLocation);
+	void SetPositionScaleUniformLocation(GLint positionScaleUniformLocation);
+	void SetPositionOffsetUniformLocation(GLint positionOffsetUniformLocation);
+
+	// The per instance attribute that sends each instance of a holographic
+	// draw to its eye, or -1 for none.
+	void SetRenderTargetIndexAttrib(GLint location, GLuint buffer);
+
+	// Where OES_vertex_array_object is available the attributes are set up
+	// once in a vertex array, and drawing binds just that. Turning it off
+	// sets them up for every draw, as without the extension.
+	void SetUseVertexArray(bool use);
+
+	// Uploads pending vertex splits until the byte budget runs out, returns
+	// the number of bytes it used.
+	int Refine(int byteBudget);
+	bool IsRefined() const;
+
+	// Bounding sphere of the vertices, in object space.
+	void Bounds(float *center, float& radius) const;
+
+	// Whether any vertex colour lets what's behind show through, such
+	// meshes are drawn blended after the rest.
+	bool IsTransparent() const { return _transparent; }
+
+	// The buffer the vertex positions come from, shared with other meshes
+	// in the same pool arena.
+	GLuint VertexBuffer() const { return _layout == VertexLayout::Interleaved ? _vertexBuffer : _vertexPositionBuffer; }
+
+	// Chooses the coarsest LOD whose error stays under a pixel when the mesh
+	// is drawn at pixelsPerUnit, with some hysteresis so a mesh near a
+	// threshold doesn't keep switching. 0 is full detail.
+	void SelectLod(float pixelsPerUnit);
+	int Lod() const { return _lod; }
+
+	// What each LOD costs to draw and how far it strays, full detail first,
+	// for sharing a scene's budget. Only full detail is listed while a
+	// progressive mesh is still refining.
+	const vector<LodBudget::Level>& Levels() const { return _levels; }
+
+	// Draws the given LOD instead of the one SelectLod chose, e.g. a coarser
+	// one to stay within budget.
+	void SetLod(int lod);
+
+	// Culls the full detail mesh cluster by cluster, given the camera
+	// position and frustum planes in object space, so Render draws only the
+	// clusters left. A null eye draws everything again. A batch also leaves
+	// out the parts visibleParts has a 0 for, null draws them all. Has no
+	// effect on LODs or a progressive mesh still refining.
+	void Cull(const float *eye, const float (*planes)[4], int numPlanes, const unsigned char *visibleParts = nullptr);
+
+	// Triangles the last Render submitted, leaving out a strip's degenerate
+	// joins.
+	int DrawnTriangles() const { return _drawnTriangles; }
+
+	// Draws the last Render made, one unless culling split it up.
+	int DrawCalls() const { return _drawCalls; }
+
 	void Render(bool isHolographic);
-	void PreRender(bool isHolographic);
 
 private:
+	// Binds the vertex streams and sets the attributes for Render.
+	void PreRender(bool isHolographic);
+	void SetAttributes();
+
+	// Encodes vertices [first, first + count) and uploads them to every stream.
+	void UploadVertices(int first, int count);
+
+	// Uploads the first count indices, and every LOD's.
+	void UploadIndices(int count);
+	void UploadLodIndices();
+
+	// Lays the streams and the indices out from where the pools put them.
+	void PlaceVertices(int offset);
+	void PlaceIndices(int offset);
+
+	void Draw(bool isHolographic, GLenum mode, GLsizei count, const void *offset);
+
+	void UpdateLevels();
+
 	GLint _positionAttribLocation;
 	GLint _colorAttribLocation;
+	GLint _normalAttribLocation;
+	GLint _positionScaleUniformLocation;
+	GLint _positionOffsetUniformLocation;
 	GLuint _vertexPositionBuffer;
 	GLuint _vertexColorBuffer;
 	GLuint _normalsBuffer;
+	GLuint _vertexBuffer;
+	VertexLayout _layout;
 
-	unique_ptr<GLfloat[]> _vertices;
-	GLfloat *vertices2;
-	unique_ptr<unsigned short[]> _vertex_indices;
-	unique_ptr<GLfloat[]> _normals;
+	// A pooled mesh's streams all share one range of a pool buffer, and its
+	// indices, every LOD's after full detail's, one of another. Offsets are
+	// in bytes, and 0 in buffers of the mesh's own.
+	shared_ptr<GeometryPool> _vertexPool;
+	shared_ptr<GeometryPool> _indexPool;
+	int _vertexAllocation;
+	int _indexAllocation;
+	int _vertexOffset;
+	int _normalsOffset;
+	int _colorOffset;
+	int _indexOffset;
+	int _lodIndexOffset;
+
+	unique_ptr<MeshData> _data;
+	VertexQuantizer _quantizer;
 	int _numIndices;
+	int _numDrawIndices;
 	GLuint _index_vbo;
+
+	// Every LOD's indices back to back in one buffer.
+	GLuint _lodIndexBuffer;
+	vector<int> _lodFirstIndex;
+	vector<int> _lodVertices;
+	vector<LodBudget::Level> _levels;
+	int _lod;
+
+	GLint _renderTargetIndexAttribLocation;
+	GLuint _renderTargetIndices;
+	bool _useVertexArray;
+	GLuint _vertexArray;
+
+	// First index and count of each run of visible clusters, when culled.
+	vector<pair<int, int>> _drawRanges;
+	bool _culled;
+	int _culledTriangles;
+	int _stripTriangles;
+	int _drawnTriangles;
+	int _drawCalls;
+	bool _transparent;
 	vector<unique_ptr<Material>> _materials;
+
+	int _uploadedVertices;
 };
 
@@ -0,0 +1,279 @@
+#include "pch.h"
+#include "MeshCleaner.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+const float MeshCleaner::CollinearEpsilon = 1e-6f;
+
+namespace
+{
+	// Welded normals and colours may differ by this much per component.
+	const float AttributeTolerance = 1e-3f;
+
+	unsigned long long CellKey(long long x, long long y, long long z)
+	{
+		unsigned long long key = (unsigned long long)x * 0x9E3779B97F4A7C15ull;
+		key ^= (unsigned long long)y * 0xC2B2AE3D27D4EB4Full + (key << 6) + (key >> 2);
+		key ^= (unsigned long long)z * 0x165667B19E3779F9ull + (key << 6) + (key >> 2);
+		return key;
+	}
+
+	// Positions hashed into cells of the weld tolerance, so every vertex
+	// within tolerance of another is in the same or a neighbouring cell. A
+	// tolerance of zero hashes the exact positions instead and only looks in
+	// the vertex's own cell. Colliding cells just add candidates.
+	class SpatialHash
+	{
+	public:
+		SpatialHash(const float *positions, int numVertices, float cellSize, ThreadPool& pool) :
+			_positions(positions), _cellSize(cellSize), _entries(numVertices)
+		{
+			pool.ParallelFor(numVertices, [this](int v)
+			{
+				long long cell[3];
+				Cell(v, cell);
+				_entries[v] = { CellKey(cell[0], cell[1], cell[2]), v };
+			});
+			sort(_entries.begin(), _entries.end());
+
+			// An open addressed table from each key to where its run of
+			// entries starts, at most half full.
+			size_t size = 1;
+			while (size < _entries.size() * 2)
+				size *= 2;
+			_slots.assign(size, -1);
+			for (int i = 0; i < (int)_entries.size(); i++)
+			{
+				if (i > 0 && _entries[i].first == _entries[i - 1].first)
+					continue;
+				size_t slot = _entries[i].first & (size - 1);
+				while (_slots[slot] >= 0)
+					slot = (slot + 1) & (size - 1);
+				_slots[slot] = i;
+			}
+		}
+
+		// Calls visit(u) for every vertex that may be within the cell size of v.
+		template <typename Visit>
+		void ForNeighbours(int v, Visit visit) const
+		{
+			long long cell[3];
+			Cell(v, cell);
+			const int reach = _cellSize > 0.0f ? 1 : 0;
+			for (int dz = -reach; dz <= reach; dz++)
+			{
+				for (int dy = -reach; dy <= reach; dy++)
+				{
+					for (int dx = -reach; dx <= reach; dx++)
+					{
+						auto key = CellKey(cell[0] + dx, cell[1] + dy, cell[2] + dz);
+						for (int i = Find(key); i < (int)_entries.size() && _entries[i].first == key; i++)
+							visit(_entries[i].second);
+					}
+				}
+			}
+		}
+
+	private:
+		int Find(unsigned long long key) const
+		{
+			const size_t mask = _slots.size() - 1;
+			for (size_t slot = key & mask; _slots[slot] >= 0; slot = (slot + 1) & mask)
+			{
+				if (_entries[_slots[slot]].first == key)
+					return _slots[slot];
+			}
+			return (int)_entries.size();
+		}
+
+		void Cell(int v, long long *cell) const
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				// Adding zero turns -0 into 0, so both hash the same.
+				float p = _positions[v * 4 + k] + 0.0f;
+				if (_cellSize > 0.0f)
+				{
+					cell[k] = (long long)floor(p / _cellSize);
+				}
+				else
+				{
+					unsigned int bits;
+					memcpy(&bits, &p, sizeof(bits));
+					cell[k] = bits;
+				}
+			}
+		}
+
+		const float *_positions;
+		float _cellSize;
+		vector<pair<unsigned long long, int>> _entries;
+		vector<int> _slots;
+	};
+
+	bool Close(const float *a, const float *b, int count, float tolerance)
+	{
+		for (int k = 0; k < count; k++)
+		{
+			if (fabsf(a[k] - b[k]) > tolerance)
+				return false;
+		}
+		return true;
+	}
+
+	// Maps each vertex to the lowest numbered one it merges with. Merging
+	// chains through vertices in between, as welding usually does.
+	vector<int> Weld(const MeshData& mesh, float tolerance, bool matchAttributes, ThreadPool& pool)
+	{
+		const int numVertices = mesh.VertexCount();
+		const float *positions = mesh.positions.data();
+		SpatialHash hash(positions, numVertices, tolerance, pool);
+
+		vector<int> welded(numVertices);
+		pool.ParallelFor(numVertices, [&](int v)
+		{
+			int lowest = v;
+			hash.ForNeighbours(v, [&](int u)
+			{
+				if (u >= lowest)
+					return;
+				float dx = positions[u * 4] - positions[v * 4];
+				float dy = positions[u * 4 + 1] - positions[v * 4 + 1];
+				float dz = positions[u * 4 + 2] - positions[v * 4 + 2];
+				if (dx * dx + dy * dy + dz * dz > tolerance * tolerance)
+					return;
+				if (matchAttributes && (!Close(&mesh.normals[u * 3], &mesh.normals[v * 3], 3, AttributeTolerance) ||
+					!Close(&mesh.colors[u * 4], &mesh.colors[v * 4], 4, AttributeTolerance)))
+					return;
+				lowest = u;
+			});
+			welded[v] = lowest;
+		});
+
+		// Lower vertices are already resolved by the time a higher one
+		// follows its link.
+		for (int v = 0; v < numVertices; v++)
+			welded[v] = welded[welded[v]];
+		return welded;
+	}
+
+	bool IsCollinear(const float *a, const float *b, const float *c)
+	{
+		double ab[3], ac[3], bc[3];
+		for (int k = 0; k < 3; k++)
+		{
+			ab[k] = (double)b[k] - a[k];
+			ac[k] = (double)c[k] - a[k];
+			bc[k] = (double)c[k] - b[k];
+		}
+		double cross[3] = { ab[1] * ac[2] - ab[2] * ac[1], ab[2] * ac[0] - ab[0] * ac[2], ab[0] * ac[1] - ab[1] * ac[0] };
+		double crossLength = sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]);
+		auto squared = [](const double *e) { return e[0] * e[0] + e[1] * e[1] + e[2] * e[2]; };
+		double longest = max(squared(ab), max(squared(ac), squared(bc)));
+
+		// The cross product's length is the longest edge times the height.
+		return crossLength <= MeshCleaner::CollinearEpsilon * longest;
+	}
+}
+
+MeshCleaner::Result MeshCleaner::Clean(MeshData& mesh, vector<int>& triangleMaterials, float weldTolerance, ThreadPool& pool)
+{
+	Result result;
+	const int numVertices = mesh.VertexCount();
+	const int numTris = mesh.IndexCount() / 3;
+	if (numTris == 0)
+		return result;
+
+	if (weldTolerance > 0.0f)
+	{
+		auto welded = Weld(mesh, weldTolerance, true, pool);
+		for (int v = 0; v < numVertices; v++)
+			result.weldedVertices += welded[v] != v ? 1 : 0;
+		for (auto& index : mesh.indices)
+			index = (unsigned short)welded[index];
+	}
+
+	// Triangles are compared by position, a duplicate with other normals or
+	// colours still lands on the same pixels.
+	auto positionIds = Weld(mesh, 0.0f, false, pool);
+	vector<array<int, 3>> keys(numTris);
+	vector<char> degenerate(numTris);
+	pool.ParallelFor(numTris, [&](int t)
+	{
+		const unsigned short *corners = &mesh.indices[t * 3];
+		array<int, 3> ids = { positionIds[corners[0]], positionIds[corners[1]], positionIds[corners[2]] };
+		degenerate[t] = ids[0] == ids[1] || ids[1] == ids[2] || ids[0] == ids[2] || IsCollinear(
+			&mesh.positions[corners[0] * 4], &mesh.positions[corners[1] * 4], &mesh.positions[corners[2] * 4]);
+
+		// Rotated to start at the lowest id, which keeps the winding so a
+		// back facing copy of a triangle isn't taken as its duplicate.
+		int first = ids[0] < ids[1] ? (ids[0] < ids[2] ? 0 : 2) : (ids[1] < ids[2] ? 1 : 2);
+		keys[t] = { ids[first], ids[(first + 1) % 3], ids[(first + 2) % 3] };
+	});
+
+	vector<pair<array<int, 3>, int>> sorted;
+	sorted.reserve(numTris);
+	for (int t = 0; t < numTris; t++)
+	{
+		if (degenerate[t])
+			result.degenerateTriangles++;
+		else
+			sorted.push_back({ keys[t], t });
+	}
+	sort(sorted.begin(), sorted.end());
+
+	// The first of each run of equal keys is kept.
+	vector<char> removed(degenerate);
+	for (size_t i = 1; i < sorted.size(); i++)
+	{
+		if (sorted[i].first == sorted[i - 1].first)
+		{
+			removed[sorted[i].second] = 1;
+			result.duplicateTriangles++;
+		}
+	}
+
+	if (result.weldedVertices == 0 && result.degenerateTriangles == 0 && result.duplicateTriangles == 0)
+		return result;
+
+	const bool hasMaterials = triangleMaterials.size() == (size_t)numTris;
+	int kept = 0;
+	for (int t = 0; t < numTris; t++)
+	{
+		if (removed[t])
+			continue;
+		copy(&mesh.indices[t * 3], &mesh.indices[t * 3] + 3, &mesh.indices[kept * 3]);
+		if (hasMaterials)
+			triangleMaterials[kept] = triangleMaterials[t];
+		kept++;
+	}
+	mesh.indices.resize(kept * 3);
+	if (hasMaterials)
+		triangleMaterials.resize(kept);
+
+	// Drop the vertices nothing uses any more, keeping the rest in order.
+	vector<int> remap(numVertices, -1);
+	for (auto index : mesh.indices)
+		remap[index] = 0;
+	int used = 0;
+	for (int v = 0; v < numVertices; v++)
+	{
+		if (remap[v] < 0)
+			continue;
+		remap[v] = used;
+		copy(&mesh.positions[v * 4], &mesh.positions[v * 4] + 4, &mesh.positions[used * 4]);
+		copy(&mesh.normals[v * 3], &mesh.normals[v * 3] + 3, &mesh.normals[used * 3]);
+		copy(&mesh.colors[v * 4], &mesh.colors[v * 4] + 4, &mesh.colors[used * 4]);
+		used++;
+	}
+	mesh.positions.resize(used * 4);
+	mesh.normals.resize(used * 3);
+	mesh.colors.resize(used * 4);
+	for (auto& index : mesh.indices)
+		index = (unsigned short)remap[index];
+
+	return result;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <vector>
+#include "MeshData.h"
+
+using namespace std;
+
+class ThreadPool;
+
+// Removes the triangles exporters leave behind that draw nothing: degenerate
+// ones, whose corners repeat or lie on a line, and exact duplicates of an
+// earlier triangle. Runs on freshly extracted meshes, before anything else
+// has looked at the triangles.
+class MeshCleaner
+{
+public:
+	struct Result
+	{
+		int weldedVertices = 0;
+		int degenerateTriangles = 0;
+		int duplicateTriangles = 0;
+	};
+
+	// A weld tolerance above zero first merges vertices closer than that
+	// whose normals and colours also match, so seams stay put; triangles
+	// smaller than the tolerance then fall out as degenerate. Vertices no
+	// triangle uses any more are dropped. triangleMaterials, when it has an
+	// entry per triangle, loses the entries of removed triangles.
+	static Result Clean(MeshData& mesh, vector<int>& triangleMaterials, float weldTolerance, ThreadPool& pool);
+
+	// Triangles thinner than this fraction of their longest edge are taken
+	// as lines, about as thin as float positions can tell apart.
+	static const float CollinearEpsilon;
+};
@@ -0,0 +1,105 @@
+#include "pch.h"
+#include "MeshData.h"
+#include "Stripifier.h"
+#include <algorithm>
+#include <cmath>
+
+template <typename T>
+static void Permute(vector<T>& stream, int components, const vector<int>& remap)
+{
+	vector<T> source(std::move(stream));
+	stream.resize(source.size());
+	for (size_t v = 0; v < remap.size(); v++)
+		copy_n(source.begin() + v * components, components, stream.begin() + remap[v] * components);
+}
+
+int MeshData::TriangleCount() const
+{
+	return strip ? Stripifier::TriangleCount(indices.data(), IndexCount()) : IndexCount() / 3;
+}
+
+void MeshData::RemapVertices(const vector<int>& remap)
+{
+	Permute(positions, 4, remap);
+	Permute(normals, 3, remap);
+	Permute(colors, 4, remap);
+	for (auto& index : indices)
+		index = (unsigned short)remap[index];
+	for (auto& lod : lods)
+	{
+		for (auto& index : lod.indices)
+			index = (unsigned short)remap[index];
+	}
+
+	if (progressive)
+		progressive->RemapVertices(remap);
+}
+
+void MeshData::ComputeBounds()
+{
+	const int numVertices = VertexCount();
+	bounds = Bounds();
+	if (numVertices == 0)
+	{
+		bounds.radius = 0.0f;
+		return;
+	}
+
+	for (int axis = 0; axis < 3; axis++)
+		bounds.min[axis] = bounds.max[axis] = positions[axis];
+	for (int v = 1; v < numVertices; v++)
+	{
+		for (int axis = 0; axis < 3; axis++)
+		{
+			bounds.min[axis] = min(bounds.min[axis], positions[v * 4 + axis]);
+			bounds.max[axis] = max(bounds.max[axis], positions[v * 4 + axis]);
+		}
+	}
+
+	// Tighter than half the box's diagonal for anything but a box.
+	for (int axis = 0; axis < 3; axis++)
+		bounds.center[axis] = 0.5f * (bounds.min[axis] + bounds.max[axis]);
+	float radiusSquared = 0.0f;
+	for (int v = 0; v < numVertices; v++)
+	{
+		float dx = positions[v * 4] - bounds.center[0];
+		float dy = positions[v * 4 + 1] - bounds.center[1];
+		float dz = positions[v * 4 + 2] - bounds.center[2];
+		radiusSquared = max(radiusSquared, dx * dx + dy * dy + dz * dz);
+	}
+	bounds.radius = sqrtf(radiusSquared);
+}
+
+const vector<unsigned short> *MeshData::OccluderIndices(int maxTriangles) const
+{
+	// A coarser surface, simplified or not yet refined, can stand outside the
+	// full one and hide what is in view.
+	bool refined = !progressive || appliedSplits == (int)progressive->Splits().size();
+	if (strip || !refined || IndexCount() / 3 > maxTriangles)
+		return nullptr;
+	return &indices;
+}
+
+MeshHashes MeshData::HashesOf(const vector<const MeshData *>& meshes)
+{
+	MeshHashes hashes;
+	for (auto mesh : meshes)
+	{
+		SourceHash source;
+		source.hash = mesh->sourceHash;
+		if (mesh->parts.empty())
+		{
+			hashes.emplace(mesh->name, source);
+			continue;
+		}
+
+		source.batch = mesh->name;
+		source.batchHash = mesh->sourceHash;
+		for (auto& part : mesh->parts)
+		{
+			source.hash = part.sourceHash;
+			hashes.emplace(part.name, source);
+		}
+	}
+	return hashes;
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include "ProgressiveMesh.h"
+#include "Clusters.h"
+
+using namespace std;
+
+// Source hash of a converted mesh, or of a part of a batch, which also
+// names its batch.
+struct SourceHash
+{
+	unsigned long long hash = 0;
+	string batch;
+	unsigned long long batchHash = 0;
+};
+
+// Keyed by mesh or part name. Names can repeat, so the hash is matched too.
+typedef unordered_multimap<string, SourceHash> MeshHashes;
+
+// CPU side copy of a converted mesh, this is what the importer produces and
+// what gets cooked. It has no GL dependency so the cooker can share it.
+class MeshData
+{
+public:
+	// A batch is left out for its parts, each with its own name and hash.
+	static MeshHashes HashesOf(const vector<const MeshData *>& meshes);
+
+	int VertexCount() const { return (int)positions.size() / 4; }
+	int IndexCount() const { return (int)indices.size(); }
+
+	// Triangles drawn at full detail, leaving out a strip's degenerate joins.
+	int TriangleCount() const;
+
+	// Moves vertex v to remap[v] in every attribute stream and renumbers the
+	// indices to match, including a progressive mesh's.
+	void RemapVertices(const vector<int>& remap);
+
+	// Fills in bounds from every vertex.
+	void ComputeBounds();
+
+	// The full detail triangle list when it has at most maxTriangles, else
+	// null, as for a strip or a progressive mesh still being refined. LODs
+	// are never used, their surface isn't inside the one drawn.
+	const vector<unsigned short> *OccluderIndices(int maxTriangles) const;
+
+	string name;
+
+	// Hash of the FBX data this mesh was converted from.
+	unsigned long long sourceHash = 0;
+
+	// Set by the importer when sourceHash matched a known hash, none of the
+	// geometry below is filled in then and the caller keeps its old copy.
+	bool unchanged = false;
+
+	vector<float> positions;	// xyzw
+	vector<float> normals;		// xyz
+	vector<float> colors;		// rgba
+	vector<unsigned short> indices;
+
+	// Set when indices hold one triangle strip instead of a list.
+	bool strip = false;
+
+	// Only set for meshes streamed in coarse-to-fine, the vertex data and
+	// indices above are then in split order.
+	unique_ptr<ProgressiveMesh> progressive;
+
+	// Splits already written into indices, so a restored copy carries on
+	// refining from where it was.
+	int appliedSplits = 0;
+
+	// Simplified versions of the fully refined mesh, each coarser than the
+	// one before. They index the same vertices, error is about how far from
+	// the full detail surface each one strays.
+	struct Lod
+	{
+		vector<unsigned short> indices;
+		float error = 0.0f;
+	};
+	vector<Lod> lods;
+
+	// The full detail triangles in culling clusters, as ranges of the fully
+	// refined indices.
+	vector<Cluster> clusters;
+
+	// Box and sphere around every vertex, for culling the whole mesh. The
+	// sphere is centred on the box, a radius below 0 means unset.
+	struct Bounds
+	{
+		float min[3] = {};
+		float max[3] = {};
+		float center[3] = {};
+		float radius = -1.0f;
+	};
+	Bounds bounds;
+
+	// Set on a batch of small meshes Batcher merged into one. Each part is
+	// one of the originals with its bounds and its run of the clusters, so
+	// parts out of view can still be left out of the draw.
+	struct Part
+	{
+		string name;
+		unsigned long long sourceHash = 0;
+		int firstCluster = 0;
+		int clusterCount = 0;
+		Bounds bounds;
+	};
+	vector<Part> parts;
+
+	// Measurements taken while converting, for the cooker to report. These
+	// aren't cooked.
+	vector<pair<string, float>> stats;
+};
@@ -1,7 +1,43 @@
 #include "pch.h"
 #include "Model.h"
+#include "GlState.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <unordered_map>
 
-Model::Model() : _loaded(false)
+// Meshes covering less of the view than this, as the ratio of their bounding
+// sphere's radius to its distance, aren't worth drawing as occluders.
+static const float OccluderMinSize = 0.1f;
+
+// Only meshes with at most this many triangles at full detail are drawn as
+// occluders.
+static const int OccluderMaxTriangles = 2000;
+
+Model::Model() :
+	_positionAttribLocation(-1),
+	_colorAttribLocation(-1),
+	_normalAttribLocation(-1),
+	_positionScaleUniformLocation(-1),
+	_positionOffsetUniformLocation(-1),
+	_renderTargetIndexAttribLocation(-1),
+	_renderTargetIndices(0),
+	_vertexPool(make_shared<GeometryPool>(GL_ARRAY_BUFFER)),
+	_indexPool(make_shared<GeometryPool>(GL_ELEMENT_ARRAY_BUFFER)),
+	_loaded(false),
+	_modelView{ 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 },
+	_hasProjection(false),
+	_projectionScale(0.0f),
+	_eye{},
+	_planes{},
+	_cullerDirty(true),
+	_culledMeshes(0),
+	_pool(nullptr),
+	_occlusion(nullptr),
+	_occlusionProjection{},
+	_hasOcclusionView(false),
+	_occlusionEyeOffset(0.0f),
+	_occludedMeshes(0)
 {
 }
 
@@ -13,38 +49,408 @@ void Model::AddMesh(shared_ptr<Mesh> mesh)
 {
 	mesh->SetPositionAttribLocation(_positionAttribLocation);
 	mesh->SetColorAttribLocation(_colorAttribLocation);
+	mesh->SetNormalAttribLocation(_normalAttribLocation);
+	mesh->SetPositionScaleUniformLocation(_positionScaleUniformLocation);
+	mesh->SetPositionOffsetUniformLocation(_positionOffsetUniformLocation);
+	mesh->SetRenderTargetIndexAttrib(_renderTargetIndexAttribLocation, _renderTargetIndices);
+	mesh->SetGeometryPools(_vertexPool, _indexPool);
 	_meshes.push_back(mesh);
+	_cullerDirty = true;
+}
+
+void Model::UpdateMeshes(vector<unique_ptr<MeshData>> meshes)
+{
+	vector<shared_ptr<Mesh>> updated;
+	for (auto& data : meshes)
+	{
+		if (data->unchanged)
+		{
+			auto existing = find_if(_meshes.begin(), _meshes.end(), [&data](const shared_ptr<Mesh>& mesh)
+			{
+				return mesh && mesh->Data().name == data->name && mesh->Data().sourceHash == data->sourceHash;
+			});
+			if (existing != _meshes.end())
+			{
+				updated.push_back(std::move(*existing));
+				continue;
+			}
+		}
+
+		auto mesh = make_shared<Mesh>();
+		mesh->SetPositionAttribLocation(_positionAttribLocation);
+		mesh->SetColorAttribLocation(_colorAttribLocation);
+		mesh->SetNormalAttribLocation(_normalAttribLocation);
+		mesh->SetPositionScaleUniformLocation(_positionScaleUniformLocation);
+		mesh->SetPositionOffsetUniformLocation(_positionOffsetUniformLocation);
+		mesh->SetRenderTargetIndexAttrib(_renderTargetIndexAttribLocation, _renderTargetIndices);
+		mesh->SetGeometryPools(_vertexPool, _indexPool);
+		mesh->SetData(std::move(data));
+		updated.push_back(mesh);
+	}
+	_meshes = std::move(updated);
+	_cullerDirty = true;
+}
+
+void Model::SetNodes(vector<SceneNode> nodes)
+{
+	_nodes = std::move(nodes);
+	_meshMaterials.clear();
+	unordered_map<string, int> materials;
+	for (auto& node : _nodes)
+	{
+		if (node.mesh < 0 || node.materials.empty())
+			continue;
+		if (node.mesh >= (int)_meshMaterials.size())
+			_meshMaterials.resize(node.mesh + 1, -1);
+		if (_meshMaterials[node.mesh] < 0)
+			_meshMaterials[node.mesh] = materials.emplace(node.materials[0], (int)materials.size()).first->second;
+	}
+}
+
+MeshHashes Model::Hashes() const
+{
+	return MeshData::HashesOf(MeshDatas());
+}
+
+vector<const MeshData *> Model::MeshDatas() const
+{
+	vector<const MeshData *> meshes;
+	for (auto& mesh : _meshes)
+		meshes.push_back(&mesh->Data());
+	return meshes;
 }
 
 void Model::SetPositionAttribLocation(GLint positionAttribLocation)
 {
 	_positionAttribLocation = positionAttribLocation;
+	for (auto& mesh : _meshes)
+		mesh->SetPositionAttribLocation(positionAttribLocation);
 }
 
 void Model::SetColorAttribLocation(GLint colorAttribLocation)
 {
 	_colorAttribLocation = colorAttribLocation;
+	for (auto& mesh : _meshes)
+		mesh->SetColorAttribLocation(colorAttribLocation);
+}
+
+void Model::SetNormalAttribLocation(GLint normalAttribLocation)
+{
+	_normalAttribLocation = normalAttribLocation;
+	for (auto& mesh : _meshes)
+		mesh->SetNormalAttribLocation(normalAttribLocation);
+}
+
+void Model::SetPositionScaleUniformLocation(GLint positionScaleUniformLocation)
+{
+	_positionScaleUniformLocation = positionScaleUniformLocation;
+	for (auto& mesh : _meshes)
+		mesh->SetPositionScaleUniformLocation(positionScaleUniformLocation);
+}
+
+void Model::SetPositionOffsetUniformLocation(GLint positionOffsetUniformLocation)
+{
+	_positionOffsetUniformLocation = positionOffsetUniformLocation;
+	for (auto& mesh : _meshes)
+		mesh->SetPositionOffsetUniformLocation(positionOffsetUniformLocation);
 }
 
-void Model::PreRender(bool isHolographic)
+void Model::SetRenderTargetIndexAttrib(GLint location, GLuint buffer)
+{
+	_renderTargetIndexAttribLocation = location;
+	_renderTargetIndices = buffer;
+	for (auto& mesh : _meshes)
+		mesh->SetRenderTargetIndexAttrib(location, buffer);
+}
+
+void Model::ReleaseDeviceResources()
+{
+	for (auto& mesh : _meshes)
+		mesh->ReleaseDeviceResources();
+}
+
+int Model::CreateDeviceResources(int byteBudget)
+{
+	int used = 0;
+	for (auto& mesh : _meshes)
+	{
+		if (used >= byteBudget)
+			break;
+		if (!mesh->HasDeviceResources())
+			used += mesh->CreateDeviceResources();
+	}
+	return used;
+}
+
+bool Model::HasDeviceResources() const
+{
+	return all_of(_meshes.begin(), _meshes.end(), [](const shared_ptr<Mesh>& mesh)
+	{
+		return mesh->HasDeviceResources();
+	});
+}
+
+void Model::Refine(int byteBudget)
 {
 	if (!_loaded)
 		return;
 
 	for (auto mesh : _meshes)
 	{
-		mesh->PreRender(isHolographic);
+		if (byteBudget <= 0)
+			break;
+		if (mesh->HasDeviceResources())
+			byteBudget -= mesh->Refine(byteBudget);
+	}
+}
+
+void Model::Defragment(int byteBudget)
+{
+	byteBudget -= _vertexPool->Defragment(byteBudget);
+	if (byteBudget > 0)
+		_indexPool->Defragment(byteBudget);
+}
+
+void Model::SetView(const float *modelView, const float *projection, float projectionScale)
+{
+	copy(modelView, modelView + 16, _modelView);
+	// Every mesh shares the model's object space.
+	_hasProjection = projection != nullptr;
+	if (_hasProjection)
+		Clusters::ObjectSpaceView(_modelView, projection, _eye, _planes);
+	_frustum = _hasProjection ? Frustum::FromMatrix(projection).Transformed(_modelView) : Frustum();
+	_projectionScale = projectionScale;
+	_hasOcclusionView = false;
+	if (_hasProjection)
+		SetOcclusionView(projection, 0.0f);
+}
+
+void Model::SetOcclusionView(const float *projection, float eyeOffset)
+{
+	copy(projection, projection + 16, _occlusionProjection);
+	_occlusionEyeOffset = eyeOffset;
+	_hasOcclusionView = true;
+}
+
+void Model::SetViewFrustum(const Frustum& viewFrustum)
+{
+	_frustum = viewFrustum.Transformed(_modelView);
+}
+
+void Model::CullMeshes()
+{
+	// Bounds only change with the meshes, and are added once all have data.
+	if (_cullerDirty)
+	{
+		_culler.Clear();
+		_firstBound.clear();
+		for (auto& mesh : _meshes)
+		{
+			auto& data = mesh->Data();
+			_firstBound.push_back(_culler.Count());
+			if (data.parts.empty())
+				_culler.Add(data.bounds.min, data.bounds.max, data.bounds.center, data.bounds.radius);
+			for (auto& part : data.parts)
+				_culler.Add(part.bounds.min, part.bounds.max, part.bounds.center, part.bounds.radius);
+		}
+		_firstBound.push_back(_culler.Count());
+		_cullerDirty = false;
+	}
+
+	_boundsVisible.resize(_culler.Count());
+	if (_frustum.numPlanes > 0)
+		_culler.Cull(_frustum, _boundsVisible.data(), _pool);
+	else
+		fill(_boundsVisible.begin(), _boundsVisible.end(), 1);
+
+	_visible.resize(_meshes.size());
+	_culledMeshes = 0;
+	for (size_t i = 0; i < _meshes.size(); i++)
+	{
+		auto first = _boundsVisible.begin() + _firstBound[i], last = _boundsVisible.begin() + _firstBound[i + 1];
+		_visible[i] = find(first, last, 1) != last ? 1 : 0;
+		_culledMeshes += 1 - _visible[i];
+	}
+}
+
+const unsigned char *Model::VisibleParts(size_t mesh) const
+{
+	if (_cullerDirty || mesh + 1 >= _firstBound.size() || _meshes[mesh]->Data().parts.empty())
+		return nullptr;
+	return _boundsVisible.data() + _firstBound[mesh];
+}
+
+void Model::OccludeMeshes()
+{
+	_occludedMeshes = 0;
+	if (!_occlusion || !_hasOcclusionView)
+		return;
+
+	// Boxes and occluders are both given in object space.
+	float viewProjection[16];
+	for (int column = 0; column < 4; column++)
+	{
+		for (int row = 0; row < 4; row++)
+		{
+			viewProjection[column * 4 + row] = 0.0f;
+			for (int k = 0; k < 4; k++)
+				viewProjection[column * 4 + row] += _occlusionProjection[k * 4 + row] * _modelView[column * 4 + k];
+		}
+	}
+	// The eye offset in pixels at unit distance, the wider of the two axes.
+	float pixelsPerUnit = max(fabsf(_occlusionProjection[0]) * OcclusionCuller::Width,
+		fabsf(_occlusionProjection[5]) * OcclusionCuller::Height) * 0.5f;
+	_occlusion->Begin(viewProjection, _occlusionEyeOffset * pixelsPerUnit);
+	float scaleX = sqrtf(_modelView[0] * _modelView[0] + _modelView[1] * _modelView[1] + _modelView[2] * _modelView[2]);
+
+	// Transparent meshes hide nothing. Those around the eye, such as the
+	// walls of a room, go first.
+	for (size_t i = 0; i < _meshes.size(); i++)
+	{
+		auto& mesh = _meshes[i];
+		if (!_visible[i] || !mesh->HasDeviceResources() || mesh->IsTransparent())
+			continue;
+
+		auto& data = mesh->Data();
+		auto& bounds = data.bounds;
+		float distance = -(_modelView[2] * bounds.center[0] + _modelView[6] * bounds.center[1] +
+			_modelView[10] * bounds.center[2] + _modelView[14]);
+		float radius = bounds.radius * scaleX;
+		float size = distance > radius ? radius / distance : numeric_limits<float>::max();
+		auto indices = data.OccluderIndices(OccluderMaxTriangles);
+		if (size >= OccluderMinSize && indices)
+			_occlusion->AddOccluder(data.positions.data(), indices->data(), (int)indices->size(), size);
+	}
+	_occlusion->Rasterize(_pool);
+
+	for (size_t i = 0; i < _meshes.size(); i++)
+	{
+		if (!_visible[i])
+			continue;
+
+		auto& data = _meshes[i]->Data();
+		bool visible = false;
+		for (int b = _firstBound[i]; b < _firstBound[i + 1]; b++)
+		{
+			auto& bounds = data.parts.empty() ? data.bounds : data.parts[b - _firstBound[i]].bounds;
+			if (_boundsVisible[b] && _occlusion->IsOccluded(bounds.min, bounds.max))
+				_boundsVisible[b] = 0;
+			visible = visible || _boundsVisible[b];
+		}
+		if (!visible)
+		{
+			_visible[i] = 0;
+			_occludedMeshes++;
+		}
+	}
+}
+
+void Model::SelectLods(LodBudget& budget)
+{
+	_budgetEntries.assign(_meshes.size(), -1);
+	if (!_loaded)
+		return;
+
+	CullMeshes();
+	OccludeMeshes();
+
+	float scaleX = sqrtf(_modelView[0] * _modelView[0] + _modelView[1] * _modelView[1] + _modelView[2] * _modelView[2]);
+	for (size_t i = 0; i < _meshes.size(); i++)
+	{
+		auto& mesh = _meshes[i];
+		if (!mesh->HasDeviceResources() || !_visible[i])
+			continue;
+
+		// Scale at the nearest point of the bounding sphere, or full detail
+		// from inside it. Without a view set every mesh stays at full detail.
+		float center[3], radius;
+		mesh->Bounds(center, radius);
+		float pixelsPerUnit = numeric_limits<float>::max();
+		if (_projectionScale > 0.0f)
+		{
+			float viewZ = _modelView[2] * center[0] + _modelView[6] * center[1] + _modelView[10] * center[2] + _modelView[14];
+			float distance = -viewZ - radius * scaleX;
+			if (distance > 0.0f)
+				pixelsPerUnit = _projectionScale * scaleX / distance;
+		}
+		mesh->SelectLod(pixelsPerUnit);
+
+		auto& levels = mesh->Levels();
+		_budgetEntries[i] = budget.Add(levels.data(), (int)levels.size(), pixelsPerUnit, mesh->Lod());
+	}
+}
+
+void Model::ApplyLods(const LodBudget& budget)
+{
+	for (size_t i = 0; i < _meshes.size() && i < _budgetEntries.size(); i++)
+	{
+		if (_budgetEntries[i] >= 0)
+			_meshes[i]->SetLod(budget.Lod(_budgetEntries[i]));
 	}
 }
 
+int Model::DrawnTriangles() const
+{
+	int triangles = 0;
+	for (size_t i = 0; i < _meshes.size(); i++)
+		triangles += IsVisible(i) ? _meshes[i]->DrawnTriangles() : 0;
+	return triangles;
+}
+
+int Model::DrawCalls() const
+{
+	int draws = 0;
+	for (size_t i = 0; i < _meshes.size(); i++)
+		draws += IsVisible(i) ? _meshes[i]->DrawCalls() : 0;
+	return draws;
+}
+
 void Model::Render(bool isHolographic)
 {
 	if (!_loaded)
 		return;
 
-	for (auto mesh: _meshes)
+	// Every mesh shares the renderer's program for now.
+	const unsigned int program = 0;
+	_queue.Clear();
+	for (size_t i = 0; i < _meshes.size(); i++)
+	{
+		auto& mesh = _meshes[i];
+		if (!mesh->HasDeviceResources() || !IsVisible(i))
+			continue;
+
+		float center[3], radius;
+		mesh->Bounds(center, radius);
+		float depth = -(_modelView[2] * center[0] + _modelView[6] * center[1] + _modelView[10] * center[2] + _modelView[14]);
+		int material = i < _meshMaterials.size() ? _meshMaterials[i] + 1 : 0;
+		auto layer = mesh->IsTransparent() ? RenderQueue::Layer::Transparent : RenderQueue::Layer::Opaque;
+		_queue.Add(RenderQueue::MakeKey(layer, program, material, mesh->VertexBuffer(), depth), (int)i);
+	}
+	_queue.Sort();
+
+	auto& state = GlState::Current();
+	bool blending = false;
+	for (auto& draw : _queue.Draws())
 	{
+		if (!blending && RenderQueue::LayerOf(draw.key) == RenderQueue::Layer::Transparent)
+		{
+			// Transparent meshes still test against the opaque ones' depth,
+			// but don't hide each other.
+			state.Enable(GL_BLEND);
+			state.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			state.DepthMask(GL_FALSE);
+			blending = true;
+		}
+
+		auto& mesh = _meshes[draw.item];
+		mesh->Cull(_hasProjection ? _eye : nullptr, _planes, Clusters::NumPlanes, VisibleParts(draw.item));
 		mesh->Render(isHolographic);
 	}
+
+	if (blending)
+	{
+		state.Disable(GL_BLEND);
+		state.DepthMask(GL_TRUE);
+	}
 }
 
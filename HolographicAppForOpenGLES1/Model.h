@@ -1,10 +1,18 @@
 #pragma once
 #include "DagNode.h"
+#include "FrustumCuller.h"
+#include "GeometryPool.h"
 #include "Mesh.h"
+#include "OcclusionCuller.h"
+#include "SceneNode.h"
+#include "LodBudget.h"
+#include "RenderQueue.h"
 #include <vector>
 
 using namespace std;
 
+class ThreadPool;
+
 class Model :
 	public DagNode
 {
@@ -13,22 +21,151 @@ public:
 	virtual ~Model();
 
 	void AddMesh(shared_ptr<Mesh> mesh);
+
+	// Swaps in a re-converted set of meshes. Entries marked unchanged keep
+	// the existing Mesh and its buffers, only the rest are uploaded again.
+	void UpdateMeshes(vector<unique_ptr<MeshData>> meshes);
+	MeshHashes Hashes() const;
+
+	// CPU side copy of everything loaded, in the order the nodes refer to.
+	vector<const MeshData *> MeshDatas() const;
+
+	// Also numbers the materials, for grouping draws that share one.
+	void SetNodes(vector<SceneNode> nodes);
+	const vector<SceneNode>& Nodes() const { return _nodes; }
 	void SetIndexBuffer(GLuint *indices, int numIndices);
 
 	void SetPositionAttribLocation(GLint positionAttribLocation);
 	void SetColorAttribLocation(GLint colorAttribLocation);
+	void SetNormalAttribLocation(GLint normalAttribLocation);
+	void SetPositionScaleUniformLocation(GLint positionScaleUniformLocation);
+	void SetPositionOffsetUniformLocation(GLint positionOffsetUniformLocation);
+	void SetRenderTargetIndexAttrib(GLint location, GLuint buffer);
+
+	// Meshes keep their geometry when their GL resources are released, the
+	// buffers then come back over a few frames, spending at most byteBudget
+	// bytes of uploads per call. Returns the bytes used.
+	void ReleaseDeviceResources();
+	int CreateDeviceResources(int byteBudget);
+	bool HasDeviceResources() const;
+
+	// Streams progressive mesh detail in, spending at most byteBudget bytes
+	// of uploads across all meshes.
+	void Refine(int byteBudget);
+
+	// Every mesh's vertices and indices live in the model's two geometry
+	// pools. Defragment closes up the holes meshes going away leave in them,
+	// uploading at most byteBudget bytes again.
+	void Defragment(int byteBudget);
+	GeometryPool::Stats VertexPoolStats() const { return _vertexPool->GetStats(); }
+	GeometryPool::Stats IndexPoolStats() const { return _indexPool->GetStats(); }
+
+	// Where the meshes will be drawn from, for choosing their LODs and
+	// culling their clusters: modelView and projection are column major as
+	// uploaded to GL, and projectionScale is pixels per unit at unit
+	// distance, half the viewport height times the projection's cotangent of
+	// half the field of view. Clusters are only culled given a projection.
+	void SetView(const float *modelView, const float *projection, float projectionScale);
+
+	// Culls against viewFrustum, given in the space modelView maps to, in
+	// place of the projection's. For views the projection doesn't describe,
+	// such as both holographic eyes at once. Call after SetView.
+	void SetViewFrustum(const Frustum& viewFrustum);
+
+	// Large scenes are culled across pool's threads, it must outlive the
+	// model.
+	void SetThreadPool(ThreadPool *pool) { _pool = pool; }
+
+	// Meshes left after frustum culling are also tested against the biggest
+	// ones on screen, drawn into occlusion's depth buffer, which must
+	// outlive the model. That needs a projection: SetView's, or for views
+	// without one, projection here, from the space modelView maps to. Views
+	// up to eyeOffset away from it, such as either eye's, are allowed for.
+	// Call after SetView.
+	void SetOcclusionCuller(OcclusionCuller *occlusion) { _occlusion = occlusion; }
+	void SetOcclusionView(const float *projection, float eyeOffset);
+
+	// Culls the meshes against the view frustum and any occlusion culler,
+	// then picks each visible mesh's LOD and adds it to the frame's budget.
+	// Culled meshes take none of the budget and Render skips them. Once the
+	// budget holds every model and has been solved, ApplyLods sets the LODs
+	// it chose for Render.
+	void SelectLods(LodBudget& budget);
+	void ApplyLods(const LodBudget& budget);
 
-	void PreRender(bool isHolographic);
+	// Triangles the last Render submitted, across all meshes.
+	int DrawnTriangles() const;
 
+	// Draw calls the last Render made, across all meshes.
+	int DrawCalls() const;
+
+	// Meshes the last SelectLods found entirely outside the view.
+	int CulledMeshes() const { return _culledMeshes; }
+
+	// Meshes in the view the last SelectLods found hidden behind others.
+	int OccludedMeshes() const { return _occludedMeshes; }
+
+	// Draws opaque meshes grouped by state and front to back, then
+	// transparent ones blended, back to front, see RenderQueue.
 	virtual void Render(bool isHolographic);
 
 	void Loaded() { _loaded = true; }
 
 private:
+	void CullMeshes();
+	void OccludeMeshes();
+	bool IsVisible(size_t mesh) const { return mesh >= _visible.size() || _visible[mesh] != 0; }
+	const unsigned char *VisibleParts(size_t mesh) const;
+
 	GLint _positionAttribLocation;
 	GLint _colorAttribLocation;
+	GLint _normalAttribLocation;
+	GLint _positionScaleUniformLocation;
+	GLint _positionOffsetUniformLocation;
+	GLint _renderTargetIndexAttribLocation;
+	GLuint _renderTargetIndices;
 
+	// Declared ahead of the meshes, which give their ranges back as they go.
+	shared_ptr<GeometryPool> _vertexPool;
+	shared_ptr<GeometryPool> _indexPool;
 	vector<shared_ptr<Mesh>> _meshes;
+	vector<SceneNode> _nodes;
 	bool _loaded;
+
+	float _modelView[16];
+	bool _hasProjection;
+	float _projectionScale;
+
+	// Camera and frustum in object space, when there is a projection.
+	float _eye[3];
+	float _planes[Clusters::NumPlanes][4];
+
+	// Whole meshes are culled against this, in object space. No planes
+	// culls nothing.
+	Frustum _frustum;
+	FrustumCuller _culler;
+	bool _cullerDirty;
+	vector<unsigned char> _visible;
+
+	// The culler has the bounds of each part of a batch and of each other
+	// mesh, those of mesh i from _firstBound[i] on. A mesh is visible while
+	// any of its are.
+	vector<int> _firstBound;
+	vector<unsigned char> _boundsVisible;
+	int _culledMeshes;
+	ThreadPool *_pool;
+
+	OcclusionCuller *_occlusion;
+	float _occlusionProjection[16];
+	bool _hasOcclusionView;
+	float _occlusionEyeOffset;
+	int _occludedMeshes;
+
+	// Each mesh's index in the budget it was last added to.
+	vector<int> _budgetEntries;
+
+	// The material of each mesh's first node, numbered in order of first use.
+	vector<int> _meshMaterials;
+	RenderQueue _queue;
 };
 
@@ -0,0 +1,354 @@
+#include "pch.h"
+#include "OcclusionCuller.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCCLUSION_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define OCCLUSION_NEON
+#endif
+
+const int OcclusionCuller::Width;
+const int OcclusionCuller::Height;
+
+// Boxes tested between looks at the clock.
+static const int TestsPerClock = 32;
+
+// Triangles binned before the tiles are drawn. Drawing a batch can run over
+// the budget, so this is kept small.
+static const int BatchTriangles = 1024;
+
+static_assert(OcclusionCuller::Width % OcclusionCuller::TileWidth == 0 &&
+	OcclusionCuller::Height % OcclusionCuller::TileHeight == 0, "tiles cover the buffer");
+static_assert(OcclusionCuller::TileWidth % 4 == 0, "tile rows are whole SIMD vectors");
+
+// Clip space position of p, xyz with w taken as 1.
+static void Transform(const float *m, const float *p, float *clip)
+{
+	for (int row = 0; row < 4; row++)
+		clip[row] = m[row] * p[0] + m[4 + row] * p[1] + m[8 + row] * p[2] + m[12 + row];
+}
+
+OcclusionCuller::OcclusionCuller() :
+	_budget(1.0),
+	_testsUntilClock(0),
+	_outOfTime(false),
+	_calls(0),
+	_tested(0),
+	_testCost(0.0),
+	_viewProjection{},
+	_parallax(0.0f),
+	_nearestOccluder(0.0f),
+	_depth(Width * Height, 0.0f)
+{
+}
+
+void OcclusionCuller::Begin(const float *viewProjection, float parallax)
+{
+	// Smoothed, as drawing more occluders makes testing slower.
+	if (_tested > 0)
+		_testCost = (_testCost * 3.0 + chrono::duration<double, nano>(_lastTest - _rasterized) / _tested) / 4.0;
+	_start = Clock::now();
+	copy(viewProjection, viewProjection + 16, _viewProjection);
+	_parallax = parallax;
+	_nearestOccluder = 0.0f;
+	fill(_depth.begin(), _depth.end(), 0.0f);
+	_occluders.clear();
+	_triangles.clear();
+	for (auto& bin : _bins)
+		bin.clear();
+	_stats = Stats();
+}
+
+void OcclusionCuller::AddOccluder(const float *positions, const unsigned short *indices, int numIndices, float size)
+{
+	_occluders.push_back({ positions, indices, numIndices, size });
+}
+
+void OcclusionCuller::Rasterize(ThreadPool *pool)
+{
+	auto start = Clock::now();
+	stable_sort(_occluders.begin(), _occluders.end(), [](const Occluder& a, const Occluder& b)
+	{
+		return a.size > b.size;
+	});
+
+	// The budget is looked at between occluders, and the batch drawn once
+	// it's big enough to be worth the threads. Time is left for testing as
+	// many boxes as last frame.
+	auto deadline = _start + chrono::duration_cast<Clock::duration>(_budget - _testCost * _calls);
+	size_t next = 0;
+	for (; next < _occluders.size() && Clock::now() < deadline; next++)
+	{
+		Bin(_occluders[next]);
+		if ((int)_triangles.size() >= BatchTriangles)
+			Flush(pool);
+	}
+	Flush(pool);
+
+	_stats.occluders = (int)next;
+	_stats.skippedOccluders = (int)(_occluders.size() - next);
+	_rasterized = Clock::now();
+	_lastTest = _rasterized;
+	// Enough are always tested to measure what one costs.
+	_testsUntilClock = TestsPerClock;
+	_outOfTime = false;
+	_calls = 0;
+	_tested = 0;
+	_stats.rasterMilliseconds = chrono::duration<double, milli>(_rasterized - start).count();
+	_occluders.clear();
+}
+
+void OcclusionCuller::Bin(const Occluder& occluder)
+{
+	for (int i = 0; i + 2 < occluder.numIndices; i += 3)
+	{
+		// Triangles reaching behind the near plane are left out, which only
+		// costs culling.
+		Triangle triangle;
+		bool inFront = true;
+		for (int corner = 0; corner < 3 && inFront; corner++)
+		{
+			float clip[4];
+			Transform(_viewProjection, occluder.positions + occluder.indices[i + corner] * 4, clip);
+			inFront = clip[3] > 0.0f && clip[2] >= -clip[3];
+			float w = 1.0f / clip[3];
+			triangle.x[corner] = (clip[0] * w * 0.5f + 0.5f) * Width;
+			triangle.y[corner] = (clip[1] * w * 0.5f + 0.5f) * Height;
+			triangle.z[corner] = w;
+		}
+		if (!inFront)
+			continue;
+
+		float minX = min(min(triangle.x[0], triangle.x[1]), triangle.x[2]);
+		float maxX = max(max(triangle.x[0], triangle.x[1]), triangle.x[2]);
+		float minY = min(min(triangle.y[0], triangle.y[1]), triangle.y[2]);
+		float maxY = max(max(triangle.y[0], triangle.y[1]), triangle.y[2]);
+		if (maxX < 0.0f || maxY < 0.0f || minX >= Width || minY >= Height)
+			continue;
+
+		int tileX0 = max(0, (int)minX / TileWidth), tileX1 = min(TilesX - 1, (int)maxX / TileWidth);
+		int tileY0 = max(0, (int)minY / TileHeight), tileY1 = min(TilesY - 1, (int)maxY / TileHeight);
+		int index = (int)_triangles.size();
+		_triangles.push_back(triangle);
+		_nearestOccluder = max(_nearestOccluder, max(max(triangle.z[0], triangle.z[1]), triangle.z[2]));
+		for (int tileY = tileY0; tileY <= tileY1; tileY++)
+		{
+			for (int tileX = tileX0; tileX <= tileX1; tileX++)
+				_bins[tileY * TilesX + tileX].push_back(index);
+		}
+		_stats.triangles++;
+	}
+}
+
+void OcclusionCuller::Flush(ThreadPool *pool)
+{
+	if (_triangles.empty())
+		return;
+
+	// Tiles share no pixels, so each can be drawn on its own thread.
+	const int tiles = TilesX * TilesY;
+	if (pool)
+		pool->ParallelFor(tiles, [this](int tile) { RasterizeTile(tile); });
+	else
+	{
+		for (int tile = 0; tile < tiles; tile++)
+			RasterizeTile(tile);
+	}
+
+	_triangles.clear();
+	for (auto& bin : _bins)
+		bin.clear();
+}
+
+void OcclusionCuller::RasterizeTile(int tile)
+{
+	int x0 = tile % TilesX * TileWidth;
+	int y0 = tile / TilesX * TileHeight;
+	for (int index : _bins[tile])
+		RasterizeTriangle(_triangles[index], x0, y0, x0 + TileWidth, y0 + TileHeight);
+}
+
+void OcclusionCuller::RasterizeTriangle(const Triangle& triangle, int tileX0, int tileY0, int tileX1, int tileY1)
+{
+	// Either winding occludes, so make it counter clockwise.
+	float x[3] = { triangle.x[0], triangle.x[1], triangle.x[2] };
+	float y[3] = { triangle.y[0], triangle.y[1], triangle.y[2] };
+	float z[3] = { triangle.z[0], triangle.z[1], triangle.z[2] };
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if (area < 0.0f)
+	{
+		swap(x[1], x[2]);
+		swap(y[1], y[2]);
+		swap(z[1], z[2]);
+		area = -area;
+	}
+	if (area <= 0.0f)
+		return;
+
+	int minX = max(tileX0, (int)floorf(min(min(x[0], x[1]), x[2])));
+	int maxX = min(tileX1 - 1, (int)ceilf(max(max(x[0], x[1]), x[2])));
+	int minY = max(tileY0, (int)floorf(min(min(y[0], y[1]), y[2])));
+	int maxY = min(tileY1 - 1, (int)ceilf(max(max(y[0], y[1]), y[2])));
+	if (minX > maxX || minY > maxY)
+		return;
+	minX &= ~3;
+
+	// Edge i is ax + by + c, the area of the triangle a pixel makes with the
+	// edge opposite corner i, positive inside. 1/w is planar across it.
+	float a[3], b[3], c[3];
+	for (int i = 0; i < 3; i++)
+	{
+		int j = (i + 1) % 3, k = (i + 2) % 3;
+		a[i] = y[j] - y[k];
+		b[i] = x[k] - x[j];
+		c[i] = x[j] * y[k] - x[k] * y[j];
+	}
+	float zA = (a[0] * z[0] + a[1] * z[1] + a[2] * z[2]) / area;
+	float zB = (b[0] * z[0] + b[1] * z[1] + b[2] * z[2]) / area;
+	float zC = (c[0] * z[0] + c[1] * z[1] + c[2] * z[2]) / area;
+
+#if defined(OCCLUSION_SSE2)
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 lanes = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	for (int py = minY; py <= maxY; py++)
+	{
+		float centerY = py + 0.5f;
+		__m128 e0 = _mm_set1_ps(b[0] * centerY + c[0]), e1 = _mm_set1_ps(b[1] * centerY + c[1]);
+		__m128 e2 = _mm_set1_ps(b[2] * centerY + c[2]), zRow = _mm_set1_ps(zB * centerY + zC);
+		float *row = &_depth[py * Width];
+		for (int px = minX; px <= maxX; px += 4)
+		{
+			__m128 centerX = _mm_add_ps(_mm_set1_ps((float)px), lanes);
+			__m128 inside = _mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[0]), centerX), e0), zero),
+				_mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[1]), centerX), e1), zero),
+					_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[2]), centerX), e2), zero)));
+			__m128 depth = _mm_loadu_ps(row + px);
+			__m128 nearer = _mm_max_ps(depth, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(zA), centerX), zRow));
+			_mm_storeu_ps(row + px, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, depth)));
+		}
+	}
+#elif defined(OCCLUSION_NEON)
+	const float32x4_t zero = vdupq_n_f32(0.0f);
+	const float laneOffsets[4] = { 0.5f, 1.5f, 2.5f, 3.5f };
+	const float32x4_t lanes = vld1q_f32(laneOffsets);
+	for (int py = minY; py <= maxY; py++)
+	{
+		float centerY = py + 0.5f;
+		float32x4_t e0 = vdupq_n_f32(b[0] * centerY + c[0]), e1 = vdupq_n_f32(b[1] * centerY + c[1]);
+		float32x4_t e2 = vdupq_n_f32(b[2] * centerY + c[2]), zRow = vdupq_n_f32(zB * centerY + zC);
+		float *row = &_depth[py * Width];
+		for (int px = minX; px <= maxX; px += 4)
+		{
+			float32x4_t centerX = vaddq_f32(vdupq_n_f32((float)px), lanes);
+			uint32x4_t inside = vandq_u32(vcgeq_f32(vmlaq_n_f32(e0, centerX, a[0]), zero),
+				vandq_u32(vcgeq_f32(vmlaq_n_f32(e1, centerX, a[1]), zero), vcgeq_f32(vmlaq_n_f32(e2, centerX, a[2]), zero)));
+			float32x4_t depth = vld1q_f32(row + px);
+			float32x4_t nearer = vmaxq_f32(depth, vmlaq_n_f32(zRow, centerX, zA));
+			vst1q_f32(row + px, vbslq_f32(inside, nearer, depth));
+		}
+	}
+#else
+	for (int py = minY; py <= maxY; py++)
+	{
+		float centerY = py + 0.5f;
+		float *row = &_depth[py * Width];
+		for (int px = minX; px <= maxX; px++)
+		{
+			float centerX = px + 0.5f;
+			bool inside = true;
+			for (int i = 0; i < 3; i++)
+				inside = inside && a[i] * centerX + b[i] * centerY + c[i] >= 0.0f;
+			if (inside)
+				row[px] = max(row[px], zA * centerX + zB * centerY + zC);
+		}
+	}
+#endif
+}
+
+bool OcclusionCuller::IsOccluded(const float *boxMin, const float *boxMax) const
+{
+	_calls++;
+	if (--_testsUntilClock == 0 && !_outOfTime)
+	{
+		_lastTest = Clock::now();
+		_tested = _calls - 1;
+		_outOfTime = _lastTest - _start >= _budget;
+		_testsUntilClock = TestsPerClock;
+	}
+	if (_nearestOccluder == 0.0f || _outOfTime)
+		return false;
+
+	// Screen rectangle of the corners, and the nearest and farthest of them.
+	float minX = (float)Width, maxX = 0.0f, minY = (float)Height, maxY = 0.0f;
+	float nearest = 0.0f, farthest = numeric_limits<float>::max();
+	for (int corner = 0; corner < 8; corner++)
+	{
+		float p[3] = {
+			corner & 1 ? boxMax[0] : boxMin[0],
+			corner & 2 ? boxMax[1] : boxMin[1],
+			corner & 4 ? boxMax[2] : boxMin[2],
+		};
+		float clip[4];
+		Transform(_viewProjection, p, clip);
+		if (clip[3] <= 0.0f || clip[2] < -clip[3])
+			return false;
+		float w = 1.0f / clip[3];
+		float x = (clip[0] * w * 0.5f + 0.5f) * Width;
+		float y = (clip[1] * w * 0.5f + 0.5f) * Height;
+		minX = min(minX, x);
+		maxX = max(maxX, x);
+		minY = min(minY, y);
+		maxY = max(maxY, y);
+		nearest = max(nearest, w);
+		farthest = min(farthest, w);
+	}
+
+	// Seen from a view offset by d, a point at 1/w shifts by d/w against
+	// the centre of the screen, so the box shifts against any occluder in
+	// front of it by no more than the difference. Beyond that, a pixel more
+	// on each side as occluder edges are only sampled at pixel centres.
+	float shift = 1.0f + _parallax * max(0.0f, _nearestOccluder - farthest);
+	minX -= shift;
+	maxX += shift;
+	minY -= shift;
+	maxY += shift;
+	if (maxX < 0.0f || maxY < 0.0f || minX >= Width || minY >= Height)
+		return false;
+
+	int x0 = max(0, (int)floorf(minX)), x1 = min(Width - 1, (int)ceilf(maxX) - 1);
+	int y0 = max(0, (int)floorf(minY)), y1 = min(Height - 1, (int)ceilf(maxY) - 1);
+
+#if defined(OCCLUSION_SSE2)
+	const __m128 box = _mm_set1_ps(nearest);
+	const __m128 first = _mm_set1_ps((float)x0), last = _mm_set1_ps((float)x1);
+	const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+	for (int py = y0; py <= y1; py++)
+	{
+		const float *row = &_depth[py * Width];
+		for (int px = x0 & ~3; px <= x1; px += 4)
+		{
+			__m128 column = _mm_add_ps(_mm_set1_ps((float)px), lanes);
+			__m128 covered = _mm_and_ps(_mm_cmpge_ps(column, first), _mm_cmple_ps(column, last));
+			if (_mm_movemask_ps(_mm_and_ps(covered, _mm_cmple_ps(_mm_loadu_ps(row + px), box))) != 0)
+				return false;
+		}
+	}
+#else
+	for (int py = y0; py <= y1; py++)
+	{
+		const float *row = &_depth[py * Width];
+		for (int px = x0; px <= x1; px++)
+		{
+			if (row[px] <= nearest)
+				return false;
+		}
+	}
+#endif
+	return true;
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <chrono>
+#include <vector>
+
+using namespace std;
+
+class ThreadPool;
+
+// Hides meshes behind others with a small depth buffer drawn on the CPU.
+// Each frame a few large meshes are drawn into it as occluders, biggest on
+// screen first, and the boxes of everything else are tested against it
+// before anything is submitted to GL.
+//
+// The buffer holds 1/w, which interpolates linearly across the screen, so
+// nearer is larger and 0 is nothing drawn. Occluder triangles are binned
+// into tiles and each tile is drawn by one thread, four pixels at a time
+// with SSE2 or NEON. Occluders stop being drawn once the frame's budget,
+// less what testing took last frame, is spent, and boxes tested after the
+// whole budget are kept, so running out of time only costs culling.
+class OcclusionCuller
+{
+public:
+	static const int Width = 256;
+	static const int Height = 128;
+	static const int TileWidth = 64;
+	static const int TileHeight = 32;
+
+	OcclusionCuller();
+
+	void SetBudget(double milliseconds) { _budget = chrono::duration<double, milli>(milliseconds); }
+
+	// Starts a frame seen through viewProjection, column major and from
+	// the space positions and boxes are given in. For views up to offset
+	// from this one, such as either eye's from between them, pass offset
+	// times the projection's pixels per unit at unit distance as parallax.
+	// Boxes are then tested over as far as anything behind the nearest
+	// occluder can shift against it.
+	void Begin(const float *viewProjection, float parallax = 0.0f);
+
+	// Queues a triangle list to draw, positions are xyzw. Both stay in use
+	// until Rasterize returns. Occluders with a larger size go first.
+	void AddOccluder(const float *positions, const unsigned short *indices, int numIndices, float size);
+
+	// Draws the queued occluders until the budget runs out, across pool's
+	// threads if given.
+	void Rasterize(ThreadPool *pool = nullptr);
+
+	// Whether the box is hidden everywhere it covers. Boxes crossing the
+	// near plane or off screen never are.
+	bool IsOccluded(const float *boxMin, const float *boxMax) const;
+
+	// Width * Height values, bottom row first.
+	const float *Depth() const { return _depth.data(); }
+
+	struct Stats
+	{
+		int occluders = 0;
+		int skippedOccluders = 0;
+		int triangles = 0;
+		double rasterMilliseconds = 0.0;
+	};
+	const Stats& FrameStats() const { return _stats; }
+
+private:
+	typedef chrono::steady_clock Clock;
+
+	static const int TilesX = Width / TileWidth;
+	static const int TilesY = Height / TileHeight;
+
+	struct Occluder
+	{
+		const float *positions;
+		const unsigned short *indices;
+		int numIndices;
+		float size;
+	};
+
+	// Screen space, z is 1/w.
+	struct Triangle
+	{
+		float x[3];
+		float y[3];
+		float z[3];
+	};
+
+	void Bin(const Occluder& occluder);
+	void Flush(ThreadPool *pool);
+	void RasterizeTile(int tile);
+	void RasterizeTriangle(const Triangle& triangle, int x0, int y0, int x1, int y1);
+	chrono::duration<double, milli> _budget;
+	Clock::time_point _start;
+
+	// When Rasterize finished and IsOccluded last looked at the clock, which
+	// it does every few calls, for what a test costs. The time left for
+	// drawing occluders is what the last frame's boxes, including those
+	// after the budget ran out, would take to test at that cost.
+	Clock::time_point _rasterized;
+	mutable Clock::time_point _lastTest;
+	mutable int _testsUntilClock;
+	mutable bool _outOfTime;
+	mutable int _calls;
+	mutable int _tested;
+	chrono::duration<double, nano> _testCost;
+
+	float _viewProjection[16];
+	float _parallax;
+
+	// Largest 1/w of any occluder vertex drawn.
+	float _nearestOccluder;
+
+	vector<float> _depth;
+	vector<Occluder> _occluders;
+	vector<Triangle> _triangles;
+	vector<int> _bins[TilesX * TilesY];
+	Stats _stats;
+};
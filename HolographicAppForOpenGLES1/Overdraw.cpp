@@ -0,0 +1,251 @@
+#include "pch.h"
+#include "Overdraw.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+	struct Vec
+	{
+		float x, y, z;
+	};
+
+	Vec operator-(const Vec& a, const Vec& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+	Vec operator+(const Vec& a, const Vec& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+	Vec operator*(const Vec& a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+	float Dot(const Vec& a, const Vec& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+	Vec Cross(const Vec& a, const Vec& b)
+	{
+		return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+	}
+
+	Vec Normalize(const Vec& a)
+	{
+		float length = sqrtf(Dot(a, a));
+		return length > 0.0f ? a * (1.0f / length) : a;
+	}
+
+	Vec Position(const float *positions, int vertex)
+	{
+		return { positions[vertex * 4 + 0], positions[vertex * 4 + 1], positions[vertex * 4 + 2] };
+	}
+
+	// Draws the triangles into a depth buffer looking along 'direction',
+	// adding the fragments that pass the depth test and the pixels covered.
+	void Rasterize(const float *positions, const unsigned short *indices, int numIndices,
+		const Vec& direction, int resolution, long long& shaded, long long& covered)
+	{
+		Vec up = fabsf(direction.y) < 0.9f ? Vec{ 0.0f, 1.0f, 0.0f } : Vec{ 1.0f, 0.0f, 0.0f };
+		Vec right = Normalize(Cross(up, direction));
+		up = Cross(direction, right);
+
+		// Project every vertex we use, then fit the bounds to the viewport.
+		int numVertices = *max_element(indices, indices + numIndices) + 1;
+		vector<Vec> projected(numVertices);
+		float minX = numeric_limits<float>::max(), maxX = -minX;
+		float minY = minX, maxY = -minX;
+		for (int i = 0; i < numIndices; i++)
+		{
+			Vec p = Position(positions, indices[i]);
+			Vec& q = projected[indices[i]];
+			q = { Dot(p, right), Dot(p, up), Dot(p, direction) };
+			minX = min(minX, q.x);
+			maxX = max(maxX, q.x);
+			minY = min(minY, q.y);
+			maxY = max(maxY, q.y);
+		}
+		float scale = (resolution - 1) / max(max(maxX - minX, maxY - minY), 1e-6f);
+
+		vector<float> depth(resolution * resolution, numeric_limits<float>::max());
+		for (int t = 0; t < numIndices / 3; t++)
+		{
+			Vec a = projected[indices[t * 3 + 0]];
+			Vec b = projected[indices[t * 3 + 1]];
+			Vec c = projected[indices[t * 3 + 2]];
+			a = { (a.x - minX) * scale, (a.y - minY) * scale, a.z };
+			b = { (b.x - minX) * scale, (b.y - minY) * scale, b.z };
+			c = { (c.x - minX) * scale, (c.y - minY) * scale, c.z };
+
+			// Looking along +z in a right handed basis counter clockwise
+			// triangles have negative area, anything else faces away.
+			float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+			if (area >= 0.0f)
+				continue;
+
+			int x0 = max(0, (int)floorf(min(min(a.x, b.x), c.x)));
+			int x1 = min(resolution - 1, (int)ceilf(max(max(a.x, b.x), c.x)));
+			int y0 = max(0, (int)floorf(min(min(a.y, b.y), c.y)));
+			int y1 = min(resolution - 1, (int)ceilf(max(max(a.y, b.y), c.y)));
+			for (int y = y0; y <= y1; y++)
+			{
+				float py = y + 0.5f;
+				for (int x = x0; x <= x1; x++)
+				{
+					float px = x + 0.5f;
+					float w0 = ((c.x - b.x) * (py - b.y) - (c.y - b.y) * (px - b.x)) / area;
+					float w1 = ((a.x - c.x) * (py - c.y) - (a.y - c.y) * (px - c.x)) / area;
+					float w2 = 1.0f - w0 - w1;
+					if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+						continue;
+
+					float z = w0 * a.z + w1 * b.z + w2 * c.z;
+					float& stored = depth[y * resolution + x];
+					if (z < stored)
+					{
+						if (stored == numeric_limits<float>::max())
+							covered++;
+						stored = z;
+						shaded++;
+					}
+				}
+			}
+		}
+	}
+}
+
+vector<int> Overdraw::Optimize(const float *positions, const unsigned short *indices, int numIndices,
+	float threshold, int cacheSize)
+{
+	const int numTris = numIndices / 3;
+	vector<int> order(numTris);
+	for (int t = 0; t < numTris; t++)
+		order[t] = t;
+	if (numTris == 0)
+		return order;
+
+	// Misses per triangle through a FIFO cache, as VertexCache::Acmr counts them.
+	int maxIndex = *max_element(indices, indices + numIndices);
+	vector<int> cachedAt(maxIndex + 1, -cacheSize - 1);
+	vector<int> triangleMisses(numTris, 0);
+	int misses = 0;
+	for (int i = 0; i < numTris * 3; i++)
+	{
+		int& time = cachedAt[indices[i]];
+		if (misses - time > cacheSize)
+		{
+			time = misses;
+			misses++;
+			triangleMisses[i / 3]++;
+		}
+	}
+
+	// Hard boundaries are where the cache starts from nothing. Each run
+	// between them is cut again once a cluster, starting from a cold cache
+	// as it will after sorting, has paid for its own start.
+	vector<int> clusterStart;
+	for (int start = 0; start < numTris;)
+	{
+		int end = start + 1;
+		while (end < numTris && triangleMisses[end] < 3)
+			end++;
+
+		int runMisses = 0;
+		for (int t = start; t < end; t++)
+			runMisses += triangleMisses[t];
+		float runAcmr = (float)runMisses / (end - start);
+
+		clusterStart.push_back(start);
+		int clusterMisses = 0;
+		misses += cacheSize + 1;
+		for (int t = start; t < end - 1; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				int& time = cachedAt[indices[t * 3 + k]];
+				if (misses - time > cacheSize)
+				{
+					time = misses;
+					misses++;
+					clusterMisses++;
+				}
+			}
+
+			if (clusterMisses <= threshold * runAcmr * (t + 1 - clusterStart.back()))
+			{
+				clusterStart.push_back(t + 1);
+				clusterMisses = 0;
+				misses += cacheSize + 1;
+			}
+		}
+		start = end;
+	}
+	clusterStart.push_back(numTris);
+
+	// Area weighted centroid and normal of each cluster, and the mesh's centroid.
+	const int numClusters = (int)clusterStart.size() - 1;
+	vector<Vec> centroids(numClusters, Vec{ 0.0f, 0.0f, 0.0f });
+	vector<Vec> normals(numClusters, Vec{ 0.0f, 0.0f, 0.0f });
+	Vec meshCentroid = { 0.0f, 0.0f, 0.0f };
+	float meshArea = 0.0f;
+	for (int c = 0; c < numClusters; c++)
+	{
+		float clusterArea = 0.0f;
+		for (int t = clusterStart[c]; t < clusterStart[c + 1]; t++)
+		{
+			Vec a = Position(positions, indices[t * 3 + 0]);
+			Vec b = Position(positions, indices[t * 3 + 1]);
+			Vec v = Position(positions, indices[t * 3 + 2]);
+			Vec normal = Cross(b - a, v - a);
+			float area = sqrtf(Dot(normal, normal));
+			centroids[c] = centroids[c] + (a + b + v) * (area / 3.0f);
+			normals[c] = normals[c] + normal;
+			clusterArea += area;
+		}
+		meshCentroid = meshCentroid + centroids[c];
+		meshArea += clusterArea;
+		if (clusterArea > 0.0f)
+			centroids[c] = centroids[c] * (1.0f / clusterArea);
+	}
+	if (meshArea > 0.0f)
+		meshCentroid = meshCentroid * (1.0f / meshArea);
+
+	// Clusters facing away from the middle are the ones most likely to be in
+	// front, so they go first.
+	vector<float> facing(numClusters);
+	vector<int> clusters(numClusters);
+	for (int c = 0; c < numClusters; c++)
+	{
+		facing[c] = Dot(centroids[c] - meshCentroid, Normalize(normals[c]));
+		clusters[c] = c;
+	}
+	stable_sort(clusters.begin(), clusters.end(), [&facing](int a, int b)
+	{
+		return facing[a] > facing[b];
+	});
+
+	order.clear();
+	for (int c : clusters)
+	{
+		for (int t = clusterStart[c]; t < clusterStart[c + 1]; t++)
+			order.push_back(t);
+	}
+	return order;
+}
+
+float Overdraw::Measure(const float *positions, const unsigned short *indices, int numIndices,
+	int resolution)
+{
+	if (numIndices < 3)
+		return 0.0f;
+
+	// The six axes and the eight corner directions.
+	long long shaded = 0;
+	long long covered = 0;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		for (float sign = -1.0f; sign <= 1.0f; sign += 2.0f)
+		{
+			Vec direction = { 0.0f, 0.0f, 0.0f };
+			(&direction.x)[axis] = sign;
+			Rasterize(positions, indices, numIndices, direction, resolution, shaded, covered);
+		}
+	}
+	for (int corner = 0; corner < 8; corner++)
+	{
+		Vec direction = { corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : -1.0f };
+		Rasterize(positions, indices, numIndices, Normalize(direction), resolution, shaded, covered);
+	}
+	return covered > 0 ? (float)shaded / covered : 0.0f;
+}
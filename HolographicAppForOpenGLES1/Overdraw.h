@@ -0,0 +1,26 @@
+#pragma once
+#include <vector>
+#include "VertexCache.h"
+
+using namespace std;
+
+// View independent overdraw reduction after Sander et al.: a vertex cache
+// ordered triangle list is cut into clusters and the clusters are drawn
+// outward facing first, so from most viewpoints the near surface is drawn
+// before what it hides.
+class Overdraw
+{
+public:
+	// Returns the triangles in their new order, as for VertexCache::Optimize.
+	// Clusters are cut where the vertex cache misses anyway, or where the
+	// miss ratio has come down within 'threshold' of the list's own, so the
+	// vertex cache loses at most that factor. Positions are xyzw.
+	static vector<int> Optimize(const float *positions, const unsigned short *indices, int numIndices,
+		float threshold = 1.05f, int cacheSize = VertexCache::FifoSize);
+
+	// Shaded fragments per covered pixel, averaged over orthographic views
+	// from all around the mesh. Rasterised on the CPU with a depth test and
+	// back face culling, so 1 means no overdraw.
+	static float Measure(const float *positions, const unsigned short *indices, int numIndices,
+		int resolution = 256);
+};
@@ -0,0 +1,347 @@
+#include "pch.h"
+#include "ProgressiveMesh.h"
+#include <queue>
+#include <algorithm>
+
+namespace
+{
+	struct EdgeCandidate
+	{
+		float cost;
+		int from;
+		int to;
+	};
+
+	struct CostGreater
+	{
+		bool operator()(const EdgeCandidate& a, const EdgeCandidate& b) const
+		{
+			return a.cost > b.cost;
+		}
+	};
+
+	struct Collapse
+	{
+		int from;
+		int to;
+		vector<int> removed;
+	};
+
+	float DistanceSq(const float *positions, int a, int b)
+	{
+		float dx = positions[a * 4 + 0] - positions[b * 4 + 0];
+		float dy = positions[a * 4 + 1] - positions[b * 4 + 1];
+		float dz = positions[a * 4 + 2] - positions[b * 4 + 2];
+		return dx * dx + dy * dy + dz * dz;
+	}
+
+	void FaceNormal(const float *positions, int a, int b, int c, float *n)
+	{
+		const float *pa = positions + a * 4;
+		const float *pb = positions + b * 4;
+		const float *pc = positions + c * 4;
+		float e0[3] = { pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2] };
+		float e1[3] = { pc[0] - pa[0], pc[1] - pa[1], pc[2] - pa[2] };
+		n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+		n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+		n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+	}
+
+	bool Contains(const vector<int>& tris, int t, int v)
+	{
+		return tris[t * 3 + 0] == v || tris[t * 3 + 1] == v || tris[t * 3 + 2] == v;
+	}
+
+	// Moving 'from' onto 'to' must not turn any surviving triangle over.
+	bool CollapseFlipsTriangle(const float *positions, const vector<int>& tris,
+		const vector<int>& fromTris, int from, int to)
+	{
+		for (int t : fromTris)
+		{
+			if (Contains(tris, t, to))
+				continue;
+
+			int corners[3] = { tris[t * 3 + 0], tris[t * 3 + 1], tris[t * 3 + 2] };
+			float before[3];
+			FaceNormal(positions, corners[0], corners[1], corners[2], before);
+			for (int k = 0; k < 3; k++)
+			{
+				if (corners[k] == from)
+					corners[k] = to;
+			}
+			float after[3];
+			FaceNormal(positions, corners[0], corners[1], corners[2], after);
+			if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0f)
+				return true;
+		}
+		return false;
+	}
+}
+
+ProgressiveMesh::ProgressiveMesh() :
+	_baseVertexCount(0), _baseTriangleCount(0)
+{
+}
+
+vector<unsigned short> ProgressiveMesh::TakeIndices()
+{
+	return std::move(_indices);
+}
+
+void ProgressiveMesh::ReorderBaseTriangles(const vector<int>& order)
+{
+	const int baseIndices = _baseTriangleCount * 3;
+	vector<unsigned short> base(_indices.begin(), _indices.begin() + baseIndices);
+	vector<int> newPosition(_baseTriangleCount);
+	for (int t = 0; t < _baseTriangleCount; t++)
+	{
+		newPosition[order[t]] = t;
+		for (int k = 0; k < 3; k++)
+			_indices[t * 3 + k] = base[order[t] * 3 + k];
+	}
+
+	// Splits rewrite corners of base triangles, those have moved.
+	for (auto& write : _writes)
+	{
+		if (write.position < baseIndices)
+			write.position = newPosition[write.position / 3] * 3 + write.position % 3;
+	}
+}
+
+void ProgressiveMesh::RemapVertices(const vector<int>& remap)
+{
+	for (auto& index : _indices)
+		index = (unsigned short)remap[index];
+	for (auto& write : _writes)
+		write.value = (unsigned short)remap[write.value];
+	for (auto& index : _finalIndices)
+		index = (unsigned short)remap[index];
+
+	vector<int> order(_vertexOrder.size());
+	for (size_t v = 0; v < _vertexOrder.size(); v++)
+		order[remap[v]] = _vertexOrder[v];
+	_vertexOrder = std::move(order);
+}
+
+vector<unsigned short> ProgressiveMesh::ApplySplits(vector<unsigned short> indices) const
+{
+	for (auto& write : _writes)
+		indices[write.position] = write.value;
+	return indices;
+}
+
+unique_ptr<ProgressiveMesh> ProgressiveMesh::Build(const float *positions, int numVertices,
+	const unsigned short *indices, int numIndices, int baseTriangleCount)
+{
+	const int numTris = numIndices / 3;
+
+	// Working copy of the triangles that is rewritten as vertices collapse..
+	vector<int> tris(indices, indices + numTris * 3);
+	vector<bool> triAlive(numTris, true);
+	vector<bool> vertexAlive(numVertices, true);
+	vector<vector<int>> vertexTris(numVertices);
+	priority_queue<EdgeCandidate, vector<EdgeCandidate>, CostGreater> queue;
+
+	for (int t = 0; t < numTris; t++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			int a = tris[t * 3 + k];
+			int b = tris[t * 3 + (k + 1) % 3];
+			if (vertexTris[a].empty() || vertexTris[a].back() != t)
+				vertexTris[a].push_back(t);
+
+			float cost = DistanceSq(positions, a, b);
+			queue.push({ cost, a, b });
+			queue.push({ cost, b, a });
+		}
+	}
+
+	vector<Collapse> collapses;
+	vector<vector<int>> children(numVertices);
+	int liveTris = numTris;
+
+	while (liveTris > baseTriangleCount && !queue.empty())
+	{
+		EdgeCandidate edge = queue.top();
+		queue.pop();
+
+		int from = edge.from;
+		int to = edge.to;
+		if (!vertexAlive[from] || !vertexAlive[to])
+			continue;
+
+		auto& fromTris = vertexTris[from];
+		fromTris.erase(remove_if(fromTris.begin(), fromTris.end(),
+			[&triAlive](int t) { return !triAlive[t]; }), fromTris.end());
+
+		bool adjacent = false;
+		for (int t : fromTris)
+		{
+			if (Contains(tris, t, to))
+			{
+				adjacent = true;
+				break;
+			}
+		}
+		if (!adjacent || CollapseFlipsTriangle(positions, tris, fromTris, from, to))
+			continue;
+
+		Collapse collapse;
+		collapse.from = from;
+		collapse.to = to;
+		auto& toTris = vertexTris[to];
+		for (int t : fromTris)
+		{
+			if (Contains(tris, t, to))
+			{
+				triAlive[t] = false;
+				collapse.removed.push_back(t);
+				liveTris--;
+				continue;
+			}
+
+			for (int k = 0; k < 3; k++)
+			{
+				if (tris[t * 3 + k] == from)
+					tris[t * 3 + k] = to;
+			}
+			toTris.push_back(t);
+		}
+
+		fromTris.clear();
+		vertexAlive[from] = false;
+		children[to].push_back(from);
+		collapses.push_back(std::move(collapse));
+
+		// The surviving vertex has picked up new neighbours..
+		toTris.erase(remove_if(toTris.begin(), toTris.end(),
+			[&triAlive](int t) { return !triAlive[t]; }), toTris.end());
+		for (int t : toTris)
+		{
+			if (!triAlive[t])
+				continue;
+			for (int k = 0; k < 3; k++)
+			{
+				int other = tris[t * 3 + k];
+				if (other == to)
+					continue;
+				float cost = DistanceSq(positions, to, other);
+				queue.push({ cost, to, other });
+				queue.push({ cost, other, to });
+			}
+		}
+	}
+
+	auto pm = unique_ptr<ProgressiveMesh>(new ProgressiveMesh());
+	const int numCollapses = (int)collapses.size();
+
+	// Vertices that survive form the base, collapsed ones follow in split order.
+	vector<int> newId(numVertices);
+	pm->_vertexOrder.reserve(numVertices);
+	for (int v = 0; v < numVertices; v++)
+	{
+		if (vertexAlive[v])
+		{
+			newId[v] = (int)pm->_vertexOrder.size();
+			pm->_vertexOrder.push_back(v);
+		}
+	}
+	pm->_baseVertexCount = (int)pm->_vertexOrder.size();
+	for (int c = numCollapses - 1; c >= 0; c--)
+	{
+		newId[collapses[c].from] = (int)pm->_vertexOrder.size();
+		pm->_vertexOrder.push_back(collapses[c].from);
+	}
+
+	// Likewise triangles, the ones removed by the last collapse come back first.
+	vector<int> triPosition(numTris);
+	int position = 0;
+	for (int t = 0; t < numTris; t++)
+	{
+		if (triAlive[t])
+			triPosition[t] = position++;
+	}
+	pm->_baseTriangleCount = position;
+	for (int c = numCollapses - 1; c >= 0; c--)
+	{
+		for (int t : collapses[c].removed)
+			triPosition[t] = position++;
+	}
+
+	// Each original vertex is drawn as its nearest surviving ancestor.
+	vector<int> rep(numVertices);
+	for (int v = 0; v < numVertices; v++)
+	{
+		if (vertexAlive[v])
+			rep[v] = newId[v];
+	}
+	for (int c = numCollapses - 1; c >= 0; c--)
+		rep[collapses[c].from] = rep[collapses[c].to];
+
+	pm->_indices.resize(numTris * 3);
+	for (int t = 0; t < numTris; t++)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			pm->_indices[triPosition[t] * 3 + k] = triAlive[t] ?
+				(unsigned short)rep[indices[t * 3 + k]] : 0;
+		}
+	}
+
+	// Corners referencing each original vertex, in CSR form.
+	vector<int> cornerStart(numVertices + 1, 0);
+	for (int i = 0; i < numTris * 3; i++)
+		cornerStart[indices[i] + 1]++;
+	for (int v = 0; v < numVertices; v++)
+		cornerStart[v + 1] += cornerStart[v];
+	vector<int> corners(numTris * 3);
+	vector<int> cursor(cornerStart.begin(), cornerStart.end() - 1);
+	for (int i = 0; i < numTris * 3; i++)
+		corners[cursor[indices[i]]++] = i;
+
+	// Replay the collapses backwards, recording the index writes for each split.
+	int activeTris = pm->_baseTriangleCount;
+	vector<int> stack;
+	pm->_splits.reserve(numCollapses);
+	for (int c = numCollapses - 1; c >= 0; c--)
+	{
+		const Collapse& collapse = collapses[c];
+		const int previousTris = activeTris;
+		const unsigned short value = (unsigned short)newId[collapse.from];
+		activeTris += (int)collapse.removed.size();
+
+		VertexSplit split;
+		split.firstWrite = (int)pm->_writes.size();
+
+		// Everything that was merged into this vertex now resolves to it again.
+		stack.push_back(collapse.from);
+		while (!stack.empty())
+		{
+			int w = stack.back();
+			stack.pop_back();
+			rep[w] = value;
+			for (int i = cornerStart[w]; i < cornerStart[w + 1]; i++)
+			{
+				int corner = corners[i];
+				int pos = triPosition[corner / 3];
+				if (pos < previousTris)
+					pm->_writes.push_back({ pos * 3 + corner % 3, value });
+			}
+			stack.insert(stack.end(), children[w].begin(), children[w].end());
+		}
+
+		for (int t : collapse.removed)
+		{
+			for (int k = 0; k < 3; k++)
+				pm->_writes.push_back({ triPosition[t] * 3 + k, (unsigned short)rep[indices[t * 3 + k]] });
+		}
+
+		split.vertexCount = value + 1;
+		split.triangleCount = activeTris;
+		split.writeCount = (int)pm->_writes.size() - split.firstWrite;
+		pm->_splits.push_back(split);
+	}
+
+	return pm;
+}
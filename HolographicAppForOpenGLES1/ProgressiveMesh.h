@@ -0,0 +1,78 @@
+#pragma once
+#include <vector>
+#include <memory>
+
+using namespace std;
+
+// A coarse-to-fine representation of an indexed triangle mesh built by
+// repeated half-edge collapses. The coarse base mesh is the first
+// BaseVertexCount() vertices and BaseTriangleCount() triangles; every
+// VertexSplit record then adds one vertex, re-enables the triangles its
+// collapse removed and rewrites the index entries that referred to its parent.
+//
+// Vertices and triangles are stored in refinement order so that each split
+// only ever appends to the vertex buffers and grows the drawn index range.
+class ProgressiveMesh
+{
+public:
+	struct VertexSplit
+	{
+		int vertexCount;	// active vertices once this split is applied
+		int triangleCount;	// active triangles once this split is applied
+		int firstWrite;
+		int writeCount;
+	};
+
+	struct IndexWrite
+	{
+		int position;
+		unsigned short value;
+	};
+
+	// positions are xyzw per vertex, indices describe a triangle list.
+	static unique_ptr<ProgressiveMesh> Build(const float *positions, int numVertices,
+		const unsigned short *indices, int numIndices, int baseTriangleCount);
+
+	// Maps a refinement-order vertex to the vertex it came from, use this to
+	// permute every vertex attribute stream before upload.
+	const vector<int>& VertexOrder() const { return _vertexOrder; }
+
+	// Index buffer holding the base mesh state, sized for the full mesh.
+	const vector<unsigned short>& Indices() const { return _indices; }
+	vector<unsigned short> TakeIndices();
+
+	// Puts the base mesh's triangles in a new order, given as the triangle
+	// each position takes its corners from. Call before TakeIndices.
+	void ReorderBaseTriangles(const vector<int>& order);
+
+	// Renumbers the vertices the splits and final indices refer to. The
+	// remap must keep every split's vertex where it is, so in practice only
+	// the base vertices can move, among themselves.
+	void RemapVertices(const vector<int>& remap);
+
+	// Applies every split to a copy of the base index buffer.
+	vector<unsigned short> ApplySplits(vector<unsigned short> indices) const;
+
+	// The full detail triangles, reordered freely once refinement is over
+	// (e.g. for the vertex cache). Swapped in after the last split if set.
+	const vector<unsigned short>& FinalIndices() const { return _finalIndices; }
+	void SetFinalIndices(vector<unsigned short> indices) { _finalIndices = std::move(indices); }
+
+	int BaseVertexCount() const { return _baseVertexCount; }
+	int BaseTriangleCount() const { return _baseTriangleCount; }
+
+	const vector<VertexSplit>& Splits() const { return _splits; }
+	const vector<IndexWrite>& Writes() const { return _writes; }
+
+private:
+	friend class CookedFile;
+	ProgressiveMesh();
+
+	vector<int> _vertexOrder;
+	vector<unsigned short> _indices;
+	int _baseVertexCount;
+	int _baseTriangleCount;
+	vector<VertexSplit> _splits;
+	vector<IndexWrite> _writes;
+	vector<unsigned short> _finalIndices;
+};
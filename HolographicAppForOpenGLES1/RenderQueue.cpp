@@ -0,0 +1,61 @@
+#include "pch.h"
+#include "RenderQueue.h"
+#include <cstring>
+
+// Keys are sorted a byte at a time, least significant first.
+static const int RadixBits = 8;
+static const int Buckets = 1 << RadixBits;
+static const int Passes = 64 / RadixBits;
+
+unsigned long long RenderQueue::MakeKey(Layer layer, unsigned int program, unsigned int material, unsigned int geometry,
+	float depth)
+{
+	// Non-negative floats order the same as their bits.
+	unsigned int depthBits = 0;
+	if (depth > 0.0f)
+		memcpy(&depthBits, &depth, sizeof(depthBits));
+
+	unsigned long long state = (unsigned long long)(program & 0xFF) << 20 | (unsigned long long)(material & 0xFFF) << 8 |
+		(geometry & 0xFF);
+	unsigned long long key = (unsigned long long)layer << 60;
+	if (layer == Layer::Transparent)
+		return key | (unsigned long long)~depthBits << 28 | state;
+	return key | state << 32 | depthBits;
+}
+
+void RenderQueue::Sort()
+{
+	const size_t count = _draws.size();
+	if (count < 2)
+		return;
+
+	// Every pass's histogram in one read of the keys.
+	static_assert(Passes * RadixBits == 64, "passes cover the key");
+	vector<unsigned int> counts(Passes * Buckets, 0);
+	for (auto& draw : _draws)
+	{
+		for (int pass = 0; pass < Passes; pass++)
+			counts[pass * Buckets + (int)(draw.key >> (pass * RadixBits) & (Buckets - 1))]++;
+	}
+
+	_sorted.resize(count);
+	for (int pass = 0; pass < Passes; pass++)
+	{
+		// A byte every key shares, typically layer and program, orders nothing.
+		unsigned int *bucket = &counts[pass * Buckets];
+		const int shift = pass * RadixBits;
+		if (bucket[_draws[0].key >> shift & (Buckets - 1)] == count)
+			continue;
+
+		unsigned int offset = 0;
+		for (int i = 0; i < Buckets; i++)
+		{
+			unsigned int n = bucket[i];
+			bucket[i] = offset;
+			offset += n;
+		}
+		for (auto& draw : _draws)
+			_sorted[bucket[draw.key >> shift & (Buckets - 1)]++] = draw;
+		_draws.swap(_sorted);
+	}
+}
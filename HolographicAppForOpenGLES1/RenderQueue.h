@@ -0,0 +1,47 @@
+#pragma once
+#include <vector>
+
+using namespace std;
+
+// A frame's draws, each with a 64 bit key, put in key order before they are
+// submitted. The key packs everything the order depends on, most
+// significant first, so one radix sort of the keys gives the whole order.
+//
+// Opaque draws come first, grouped by program, material and geometry so
+// state changes between them are few, and front to back within a group so
+// the depth test rejects what's hidden behind them. Transparent draws need
+// what's behind them drawn first, so they go back to front ahead of any
+// grouping by state.
+class RenderQueue
+{
+public:
+	enum class Layer
+	{
+		Opaque,
+		Transparent
+	};
+
+	// Fields wider than their bits (8 for program and geometry, 12 for
+	// material) wrap, which only costs grouping. depth is the distance from
+	// the eye, anything behind it counts as 0.
+	static unsigned long long MakeKey(Layer layer, unsigned int program, unsigned int material, unsigned int geometry,
+		float depth);
+	static Layer LayerOf(unsigned long long key) { return (Layer)(key >> 60); }
+
+	struct Draw
+	{
+		unsigned long long key;
+		int item;
+	};
+
+	void Clear() { _draws.clear(); }
+	void Add(unsigned long long key, int item) { _draws.push_back({ key, item }); }
+
+	// Stable, so draws with equal keys stay in the order they were added.
+	void Sort();
+	const vector<Draw>& Draws() const { return _draws; }
+
+private:
+	vector<Draw> _draws;
+	vector<Draw> _sorted;
+};
@@ -0,0 +1,128 @@
+#include "pch.h"
+#include "ResolutionGovernor.h"
+#include <algorithm>
+#include <cmath>
+
+const int ResolutionGovernor::HistoryLength;
+
+ResolutionGovernor::ResolutionGovernor() :
+	ResolutionGovernor(Settings())
+{
+}
+
+ResolutionGovernor::ResolutionGovernor(const Settings& settings) :
+	_settings(settings)
+{
+	Reset();
+}
+
+void ResolutionGovernor::Reset()
+{
+	_scale = _settings.maxScale;
+	_changed = false;
+	fill(_recent, _recent + MedianFrames, 0.0);
+	_filtered = 0.0;
+	_frame = 0;
+	_lastChange = 0;
+	_probing = false;
+	_failures.assign(Level(_settings.maxScale) + 1, 0);
+	_history.clear();
+	_stats = Stats();
+}
+
+float ResolutionGovernor::Update(double frameMilliseconds)
+{
+	_changed = false;
+	_stats.frames++;
+	if (frameMilliseconds > _settings.targetMilliseconds * _settings.highLoad)
+		_stats.overBudgetFrames++;
+
+	// The first frames fill the whole median window.
+	if (_frame == 0)
+		fill(_recent, _recent + MedianFrames, frameMilliseconds);
+	_recent[_frame % MedianFrames] = frameMilliseconds;
+	_frame++;
+	double sorted[MedianFrames];
+	copy(_recent, _recent + MedianFrames, sorted);
+	nth_element(sorted, sorted + MedianFrames / 2, sorted + MedianFrames);
+	double median = sorted[MedianFrames / 2];
+	_filtered = _frame == 1 ? median : _filtered + 2.0 / (_settings.smoothingFrames + 1) * (median - _filtered);
+
+	if (_frame - _lastChange < _settings.settleFrames)
+		return _scale;
+
+	double load = _filtered / _settings.targetMilliseconds;
+	if (load > _settings.highLoad || load < _settings.lowLoad)
+	{
+		double middle = 0.5 * (_settings.lowLoad + _settings.highLoad);
+		float wanted = _scale * (float)sqrt(middle / load);
+		float damped = _scale + _settings.gain * (wanted - _scale);
+
+		// At least a step towards it, on the grid.
+		bool up = load < _settings.lowLoad;
+		float steps = damped / _settings.step;
+		float scale = _settings.step * (up ? ceilf(steps - 1e-3f) : floorf(steps + 1e-3f));
+		scale = up ? max(scale, _scale + _settings.step) : min(scale, _scale - _settings.step);
+
+		// A step up that didn't hold is undone, and the next to the same
+		// scale waits longer. Room for more than the scale reached says the
+		// load has dropped since any failed.
+		if (!up && _probing)
+		{
+			scale = _scale - _settings.step;
+			_stats.failedProbes++;
+			_failures[Level(_scale)]++;
+		}
+		else if (up)
+		{
+			fill(_failures.begin(), _failures.end(), 0);
+		}
+		Change(scale, frameMilliseconds, false);
+		return _scale;
+	}
+
+	float next = min(_scale + _settings.step, _settings.maxScale);
+	if (_frame - _lastChange < ProbeWait(next))
+		return _scale;
+
+	// The last step up held.
+	if (_probing)
+	{
+		_probing = false;
+		_failures[Level(_scale)] = 0;
+	}
+	Change(next, frameMilliseconds, true);
+	return _scale;
+}
+
+int ResolutionGovernor::Level(float scale) const
+{
+	return (int)lroundf(scale / _settings.step);
+}
+
+int ResolutionGovernor::ProbeWait(float scale) const
+{
+	int level = min(max(Level(scale), 0), (int)_failures.size() - 1);
+	long long wait = _settings.probeFrames;
+	for (int i = 0; i < _failures[level] && wait < _settings.maxProbeFrames; i++)
+		wait *= _settings.probeBackOff;
+	return (int)min(wait, (long long)_settings.maxProbeFrames);
+}
+
+void ResolutionGovernor::Change(float scale, double frameMilliseconds, bool probe)
+{
+	scale = min(max(scale, _settings.minScale), _settings.maxScale);
+	if (fabsf(scale - _scale) < 1e-4f)
+		return;
+
+	_history.push_back({ _frame, frameMilliseconds, _filtered, _scale, scale, probe });
+	if ((int)_history.size() > HistoryLength)
+		_history.pop_front();
+
+	_scale = scale;
+	_changed = true;
+	_lastChange = _frame;
+	_probing = probe;
+	_stats.changes++;
+	_stats.probes += probe ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <deque>
+#include <vector>
+
+using namespace std;
+
+// Picks the scale to render at from how long frames take, so a scene too
+// heavy for the frame rate costs resolution instead of frames. It has no GL
+// or platform dependency, the app feeds it frame times and applies the
+// scale, and fbxbench drives it with made up traces.
+//
+// Frame times are filtered, a median of the last few to ignore one-off
+// hitches and then an exponential average. Outside a band around the
+// target the scale moves part of the way to where the load would be back
+// in the middle of it, taking the cost of a frame to go with the pixels
+// drawn, the square of the scale. Frames locked to the display's refresh
+// never show headroom, so after a while in the band the scale is stepped
+// up to see whether the frame rate holds. A step that fails is undone, and
+// each failure puts off the next step to that scale several times longer,
+// while steps to scales that haven't failed still come at the usual pace.
+// A step that holds, or the load leaving room for a larger scale, forgets
+// the failures.
+class ResolutionGovernor
+{
+public:
+	struct Settings
+	{
+		double targetMilliseconds = 1000.0 / 60.0;
+		float minScale = 0.5f;
+		float maxScale = 1.0f;
+
+		// Scales are multiples of this, so small changes in load don't each
+		// cost a resize.
+		float step = 0.05f;
+
+		// The load, filtered frame time over the target, is kept between
+		// these.
+		double lowLoad = 0.75;
+		double highLoad = 1.05;
+
+		// Fraction of the way to the wanted scale each change goes.
+		float gain = 0.5f;
+
+		// Frame times are averaged over about this many frames, and after a
+		// change this many frames at the new scale come through before the
+		// next.
+		int smoothingFrames = 8;
+		int settleFrames = 15;
+
+		// Frames in the band before trying a step up, times probeBackOff for
+		// each time a step to the same scale has failed, up to the maximum.
+		int probeFrames = 120;
+		int probeBackOff = 8;
+		int maxProbeFrames = 7200;
+	};
+
+	// One change of scale, for telemetry.
+	struct Decision
+	{
+		int frame;
+		double frameMilliseconds;
+		double filteredMilliseconds;
+		float fromScale;
+		float toScale;
+
+		// A step up to see whether the frame rate holds, rather than one
+		// the load asked for.
+		bool probe;
+	};
+
+	struct Stats
+	{
+		int frames = 0;
+		int overBudgetFrames = 0;
+		int changes = 0;
+		int probes = 0;
+		int failedProbes = 0;
+	};
+
+	// Decisions kept in History, the most recent last.
+	static const int HistoryLength = 64;
+
+	ResolutionGovernor();
+	explicit ResolutionGovernor(const Settings& settings);
+
+	// Starts again at the largest scale, keeping the settings.
+	void Reset();
+
+	// Takes the time the last frame took and returns the scale to render
+	// the next at.
+	float Update(double frameMilliseconds);
+
+	float Scale() const { return _scale; }
+
+	// Whether the last Update changed the scale.
+	bool Changed() const { return _changed; }
+
+	double FilteredMilliseconds() const { return _filtered; }
+	const deque<Decision>& History() const { return _history; }
+	const Stats& GetStats() const { return _stats; }
+	const Settings& GetSettings() const { return _settings; }
+
+private:
+	static const int MedianFrames = 5;
+
+	void Change(float scale, double frameMilliseconds, bool probe);
+
+	// Scales as multiples of the step.
+	int Level(float scale) const;
+
+	// Frames to wait in the band before stepping up to scale.
+	int ProbeWait(float scale) const;
+
+	Settings _settings;
+	float _scale;
+	bool _changed;
+
+	double _recent[MedianFrames];
+	double _filtered;
+	int _frame;
+	int _lastChange;
+
+	// Whether the last change was a step up still to prove itself, and the
+	// steps up to each level that have failed since one last held.
+	bool _probing;
+	vector<int> _failures;
+
+	deque<Decision> _history;
+	Stats _stats;
+};
@@ -0,0 +1,20 @@
+#pragma once
+#include <vector>
+#include <string>
+
+using namespace std;
+
+// One node of the converted FBX hierarchy. Nodes are stored parents first,
+// so a node's parent always has a lower index.
+struct SceneNode
+{
+	string name;
+	int parent = -1;
+
+	// Local transform, column major.
+	float transform[16];
+
+	// Index into the converted meshes, -1 for nodes without one.
+	int mesh = -1;
+	vector<string> materials;
+};
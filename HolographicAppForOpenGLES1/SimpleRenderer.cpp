@@ -7,6 +7,7 @@
 #include "MathHelper.h"
 
 // These are used by the shader compilation methods.
+#include <algorithm>
 #include <vector>
 #include <iostream>
 #include <fstream>
@@ -17,12 +18,90 @@
 #include "Model.h"
 #include "utils.h"
 #include "Importer.h"
+#include "CookedFile.h"
+#include "GlState.h"
+#include "GlTrace.h"
 
 using namespace Platform;
 using namespace HolographicAppForOpenGLES1;
 
 #define STRING(s) #s
 
+// Upper bound on progressive mesh data uploaded per frame, so that refining a
+// large model never costs us a frame.
+static const int RefineBytesPerFrame = 256 * 1024;
+
+// Times a failed reload is read again before waiting for the next save. A
+// file caught mid-save reads fine a check or two later.
+static const int MaxReloadRetries = 3;
+
+// Geometry re-uploaded per frame after a lost context. This is more than a
+// frame's worth of refinement, the scene should come back within a few frames.
+static const int RestoreBytesPerFrame = 4 * 1024 * 1024;
+
+// Geometry moved per frame to close up the holes reloaded meshes leave in
+// the geometry pools.
+static const int DefragmentBytesPerFrame = 256 * 1024;
+
+// Pixels per metre at a metre away on HoloLens: 720 rows over a vertical
+// field of view of about 17.5 degrees.
+static const float HolographicProjectionScale = 360.0f / 0.1539f;
+
+// One frustum around both eyes' views on HoloLens, for culling. About 30 by
+// 17.5 degrees per eye plus a few degrees of margin, as the real frusta are
+// a little asymmetric and the pose is the one we rendered from, not the one
+// ANGLE predicts for display. The clip planes are the holographic camera's
+// defaults.
+static const float HolographicEyeSeparation = 0.064f;
+static const float HolographicTanHalfWidth = 0.3640f;	// tan(20 degrees)
+static const float HolographicTanHalfHeight = 0.2217f;	// tan(12.5 degrees)
+static const float HolographicNearZ = 0.1f;
+static const float HolographicFarZ = 20.0f;
+
+// CPU time per frame for drawing occluders into the occlusion culler's depth
+// buffer and testing meshes against it.
+static const double OcclusionBudgetMilliseconds = 1.0;
+
+// Geometry drawn per frame across every model, past this meshes are drawn
+// coarser than their error alone would pick, starting with those where it
+// shows least.
+static const int SceneTriangleBudget = 150000;
+static const int SceneVertexBudget = 100000;
+
+// How often the GL state cache's counters are logged, about every five
+// seconds at 60 Hz.
+static const int GlStateLogFrames = 300;
+
+// Snapshots go in the app's local folder, the install folder is read only.
+static string LocalFilename(const wchar_t *name)
+{
+    std::wstring path = std::wstring(Windows::Storage::ApplicationData::Current->LocalFolder->Path->Data()) + L"\\" + name;
+    int size = WideCharToMultiByte(CP_ACP, 0, path.c_str(), -1, nullptr, 0, nullptr, nullptr);
+    string result(size, '\0');
+    WideCharToMultiByte(CP_ACP, 0, path.c_str(), -1, &result[0], size, nullptr, nullptr);
+    result.resize(size - 1);
+    return result;
+}
+
+// A missing or out of date cooked file isn't an error, we just load from
+// somewhere else.
+static bool TryReadCooked(const string& filename, vector<SceneNode>& nodes, vector<unique_ptr<MeshData>>& meshes)
+{
+    if (!CookedFile::Exists(filename.c_str()))
+        return false;
+
+    try
+    {
+        meshes = CookedFile::Read(filename.c_str(), &nodes);
+        return true;
+    }
+    catch (const exception& e)
+    {
+        DebugLog(L"Ignoring %S: %S", filename.c_str(), e.what());
+        return false;
+    }
+}
+
 GLuint CompileShader(GLenum type, const std::string &source)
 {
     GLuint shader = glCreateShader(type);
@@ -100,29 +179,108 @@ GLuint CompileProgram(const std::string &vsSource, const std::string &fsSource)
 }
 
 SimpleRenderer::SimpleRenderer(bool isHolographic) :
+    mProgram(0),
     mWindowWidth(1268),
     mWindowHeight(720),
-    mDrawCount(0)
+    mVertexPositionBuffer(0),
+    mVertexColorBuffer(0),
+    mIndexBuffer(0),
+    mRenderTargetArrayIndices(0),
+    mDrawCount(0),
+    mIsHolographic(isHolographic),
+    _recordCount(0),
+    _captureFrame(false),
+    _hasHeadPose(false),
+    _headPosition{},
+    _headOrientation{ 0.0f, 0.0f, 0.0f, 1.0f },
+    _restoring(false)
 {
+    CreateDeviceResources();
+    _lodBudget.SetBudget(SceneTriangleBudget, SceneVertexBudget);
 
-	// Vertex Shader source
-    const std::string vs = isHolographic ?
+	const char *filename = "./Assets/hlscaled.fbx";
+	const char *cookedFilename = "./Assets/hlscaled.cooked";
+	_filename = filename;
+	_watcher = make_unique<FileWatcher>(_filename);
+	_reloadFailures = 0;
+	_snapshotFilename = LocalFilename(L"hlscaled.snapshot");
+	_snapshotDirty = false;
+
+	// Restore our own snapshot while it is newer than the FBX, then prefer
+	// data from the cooker, only fall back to converting the FBX here.
+	vector<SceneNode> nodes;
+	vector<unique_ptr<MeshData>> meshes;
+	bool snapshotCurrent = FileWatcher::ModifiedTime(_snapshotFilename) >= FileWatcher::ModifiedTime(_filename);
+	if (!(snapshotCurrent && TryReadCooked(_snapshotFilename, nodes, meshes)) &&
+		!TryReadCooked(cookedFilename, nodes, meshes))
+	{
+		auto importer = make_unique<Importer>();
+		meshes = importer->ConvertFile(filename);
+		nodes = importer->Nodes();
+		auto& batching = importer->BatchStats();
+		DebugLog(L"Batched %d meshes into %d, %d draw calls down to %d", batching.batchedMeshes, batching.batches,
+			batching.DrawCallsBefore(), batching.DrawCallsAfter());
+		_snapshotDirty = true;
+	}
+
+	// These will ultimtely belong to the model but for now everything is sharing
+	// the same shaders so just pass in..
+	_model = make_unique<Model>();
+	_model->SetThreadPool(&_cullPool);
+	_occlusionCuller.SetBudget(OcclusionBudgetMilliseconds);
+	_model->SetOcclusionCuller(&_occlusionCuller);
+	_model->SetPositionAttribLocation(mPositionAttribLocation);
+	_model->SetColorAttribLocation(mColorAttribLocation);
+	_model->SetNormalAttribLocation(mNormalAttribLocation);
+	_model->SetPositionScaleUniformLocation(mPositionScaleUniformLocation);
+	_model->SetPositionOffsetUniformLocation(mPositionOffsetUniformLocation);
+	_model->SetRenderTargetIndexAttrib(mRtvIndexAttribLocation, mRenderTargetArrayIndices);
+	for (auto& meshData : meshes)
+	{
+		// Added first, so the buffers go straight into the model's pools.
+		auto mesh = make_shared<Mesh>();
+		_model->AddMesh(mesh);
+		mesh->SetData(std::move(meshData));
+	}
+	_model->SetNodes(std::move(nodes));
+	_model->Loaded();
+}
+
+SimpleRenderer::~SimpleRenderer()
+{
+    ReleaseDeviceResources();
+}
+
+void SimpleRenderer::CreateDeviceResources()
+{
+    // Nothing the cache remembers holds for a new context.
+    GlState::Current().Invalidate();
+
+	// Vertex Shader source. Normals come octahedral encoded, see
+    // VertexQuantizer, and light the vertex colours from above and in front
+    // of where the scene was placed.
+    const std::string vs = std::string(VertexQuantizer::NormalDecodeShader) + (mIsHolographic ?
         STRING
     (
         // holographic version
 
         uniform mat4 uModelMatrix;
         uniform mat4 uHolographicViewProjectionMatrix[2];
+        uniform vec3 uPositionScale;
+        uniform vec3 uPositionOffset;
         attribute vec4 aPosition;
         attribute vec4 aColor;
+        attribute vec2 aNormal;
         attribute float aRenderTargetArrayIndex;
         varying vec4 vColor;
         varying float vRenderTargetArrayIndex;
         void main()
         {
             int arrayIndex = int(aRenderTargetArrayIndex); // % 2; // TODO: integer modulus operation supported on ES 3.00 only
-            gl_Position = uHolographicViewProjectionMatrix[arrayIndex] * uModelMatrix * aPosition;
-            vColor = aColor;
+            vec4 position = vec4(uPositionOffset + uPositionScale * aPosition.xyz, 1.0);
+            gl_Position = uHolographicViewProjectionMatrix[arrayIndex] * uModelMatrix * position;
+            vec3 normal = normalize((uModelMatrix * vec4(DecodeNormal(aNormal), 0.0)).xyz);
+            vColor = vec4(aColor.rgb * (0.6 + 0.4 * max(dot(normal, vec3(0.0, 0.8, 0.6)), 0.0)), aColor.a);
             vRenderTargetArrayIndex = aRenderTargetArrayIndex;
         }
     ) : STRING
@@ -130,18 +288,23 @@ SimpleRenderer::SimpleRenderer(bool isHolographic) :
         uniform mat4 uModelMatrix;
         uniform mat4 uViewMatrix;
         uniform mat4 uProjMatrix;
+        uniform vec3 uPositionScale;
+        uniform vec3 uPositionOffset;
         attribute vec4 aPosition;
         attribute vec4 aColor;
+        attribute vec2 aNormal;
         varying vec4 vColor;
         void main()
         {
-            gl_Position = uProjMatrix * uViewMatrix * uModelMatrix * aPosition;
-            vColor = aColor;
+            vec4 position = vec4(uPositionOffset + uPositionScale * aPosition.xyz, 1.0);
+            gl_Position = uProjMatrix * uViewMatrix * uModelMatrix * position;
+            vec3 normal = normalize((uModelMatrix * vec4(DecodeNormal(aNormal), 0.0)).xyz);
+            vColor = vec4(aColor.rgb * (0.6 + 0.4 * max(dot(normal, vec3(0.0, 0.8, 0.6)), 0.0)), aColor.a);
         }
-    );
+    ));
 
     // Fragment Shader source
-    const std::string fs = isHolographic ? // TODO: this should not be necessary
+    const std::string fs = mIsHolographic ? // TODO: this should not be necessary
         STRING
     (
         precision mediump float;
@@ -166,29 +329,46 @@ SimpleRenderer::SimpleRenderer(bool isHolographic) :
     mProgram = CompileProgram(vs, fs);
     mPositionAttribLocation = glGetAttribLocation(mProgram, "aPosition");
     mColorAttribLocation = glGetAttribLocation(mProgram, "aColor");
+    mNormalAttribLocation = glGetAttribLocation(mProgram, "aNormal");
     mRtvIndexAttribLocation = glGetAttribLocation(mProgram, "aRenderTargetArrayIndex");
     mModelUniformLocation = glGetUniformLocation(mProgram, "uModelMatrix");
     mViewUniformLocation = glGetUniformLocation(mProgram, "uViewMatrix");
     mProjUniformLocation = glGetUniformLocation(mProgram, "uProjMatrix");
-
-	const char *filename = "./Assets/hlscaled.fbx";
-	auto importer = make_unique<Importer>();
-	
-	// These will ultimtely belong to the model but for now everything is sharing
-	// the same shaders so just pass in..
-	importer->SetShaderAttributes(mPositionAttribLocation, mColorAttribLocation);
-	_model = importer->LoadModelFromFile(filename);
+    mPositionScaleUniformLocation = glGetUniformLocation(mProgram, "uPositionScale");
+    mPositionOffsetUniformLocation = glGetUniformLocation(mProgram, "uPositionOffset");
 
     float renderTargetArrayIndices[] = { 0.f, 1.f };
     glGenBuffers(1, &mRenderTargetArrayIndices);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mRenderTargetArrayIndices);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(renderTargetArrayIndices), renderTargetArrayIndices, GL_STATIC_DRAW);
+    GlState::Current().BindBuffer(GL_ELEMENT_ARRAY_BUFFER, mRenderTargetArrayIndices);
+    GlTrace::Current().BufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(renderTargetArrayIndices), renderTargetArrayIndices, GL_STATIC_DRAW);
 
-    mIsHolographic = isHolographic;
+    // On a new context the model still has all of its geometry, Draw puts it
+    // back on the GPU a frame's budget at a time.
+    if (_model)
+    {
+        _model->SetPositionAttribLocation(mPositionAttribLocation);
+        _model->SetColorAttribLocation(mColorAttribLocation);
+        _model->SetNormalAttribLocation(mNormalAttribLocation);
+        _model->SetPositionScaleUniformLocation(mPositionScaleUniformLocation);
+        _model->SetPositionOffsetUniformLocation(mPositionOffsetUniformLocation);
+        _model->SetRenderTargetIndexAttrib(mRtvIndexAttribLocation, mRenderTargetArrayIndices);
+        _restoring = true;
+        _restoreStart = chrono::steady_clock::now();
+        _restoreUploadTime = chrono::steady_clock::duration::zero();
+        _restoreFrames = 0;
+        _restoreBytes = 0;
+    }
 }
 
-SimpleRenderer::~SimpleRenderer()
+void SimpleRenderer::ReleaseDeviceResources()
 {
+    if (_model)
+    {
+        _model->ReleaseDeviceResources();
+    }
+
+    GlState::Current().DeleteBuffer(mRenderTargetArrayIndices);
+
     if (mProgram != 0)
     {
         glDeleteProgram(mProgram);
@@ -214,52 +394,263 @@ SimpleRenderer::~SimpleRenderer()
     }
 }
 
-void SimpleRenderer::Draw()
+void SimpleRenderer::Record(FrameCommands& frame)
+{
+    frame.frame = _recordCount++;
+    frame.recorded = chrono::steady_clock::now();
+
+    MathHelper::Vec3 position = MathHelper::Vec3(0.f, 0.f, -5.f);
+    MathHelper::Matrix4 modelMatrix = MathHelper::SimpleModelMatrix((float)frame.frame / 50.0f, position);
+    copy(&modelMatrix.m[0][0], &modelMatrix.m[0][0] + 16, frame.model);
+
+    // ANGLE hands the eyes' view projections straight to the shaders,
+    // culling and LODs go by the head pose the app located instead.
+    MathHelper::Matrix4 viewMatrix = MathHelper::SimpleViewMatrix();
+    if (mIsHolographic && _hasHeadPose)
+    {
+        viewMatrix = MathHelper::ViewMatrixFromPose(
+            MathHelper::Vec3(_headPosition[0], _headPosition[1], _headPosition[2]),
+            _headOrientation[0], _headOrientation[1], _headOrientation[2], _headOrientation[3]);
+    }
+    frame.hasView = !mIsHolographic || _hasHeadPose;
+    copy(&viewMatrix.m[0][0], &viewMatrix.m[0][0] + 16, frame.view);
+
+    frame.capture = _captureFrame;
+    _captureFrame = false;
+}
+
+void SimpleRenderer::Draw(const FrameCommands& frame)
 {
-    glEnable(GL_DEPTH_TEST);
+    auto& trace = GlTrace::Current();
+    if (frame.capture)
+    {
+        trace.BeginFrame(LocalFilename(L"frame.gltrace"));
+    }
+
+    auto& state = GlState::Current();
+    state.Enable(GL_DEPTH_TEST);
 
     // On HoloLens, it is important to clear to transparent.
     glClearColor(0.0f, 0.f, 0.f, 0.f);
 
     // On HoloLens, this will also update the camera buffers (constant and back).
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    trace.Clear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	glEnable(GL_CULL_FACE);
-	glCullFace(GL_BACK);
-	glFrontFace(GL_CCW);
+	state.Enable(GL_CULL_FACE);
+	state.CullFace(GL_BACK);
+	state.FrontFace(GL_CCW);
     
 	if (mProgram == 0)
+    {
+        EndFrame();
         return;
+    }
 
-    glUseProgram(mProgram);
+    state.UseProgram(mProgram);
 
-    MathHelper::Vec3 position = MathHelper::Vec3(0.f, 0.f, -5.f);
-    MathHelper::Matrix4 modelMatrix = MathHelper::SimpleModelMatrix((float)mDrawCount / 50.0f, position);
-    glUniformMatrix4fv(mModelUniformLocation, 1, GL_FALSE, &(modelMatrix.m[0][0]));
+    CheckForReload();
+    if (_restoring)
+    {
+        RestoreDeviceResources();
+    }
+    else
+    {
+        _model->Refine(RefineBytesPerFrame);
+        _model->Defragment(DefragmentBytesPerFrame);
+    }
+
+    MathHelper::Matrix4 modelMatrix;
+    MathHelper::Matrix4 viewMatrix;
+    copy(frame.model, frame.model + 16, &modelMatrix.m[0][0]);
+    copy(frame.view, frame.view + 16, &viewMatrix.m[0][0]);
+    trace.UniformMatrix4fv(mModelUniformLocation, 1, GL_FALSE, &(modelMatrix.m[0][0]));
 
     if (mIsHolographic)
     {
-        // Load the render target array indices into an array.
-        glBindBuffer(GL_ARRAY_BUFFER, mRenderTargetArrayIndices);
-        glVertexAttribPointer(mRtvIndexAttribLocation, 1, GL_FLOAT, GL_FALSE, 0, 0);
-        glEnableVertexAttribArray(mRtvIndexAttribLocation);
+        // Each mesh sets up the render target array indices as an instanced
+        // attribute along with its own, so they can live in its vertex array.
 
-        // Enable instancing.
-        glVertexAttribDivisorANGLE(mRtvIndexAttribLocation, 1);
+        // Until the head has been located, LODs are chosen as seen from
+        // where the scene was placed relative to, and nothing is culled.
+        if (frame.hasView)
+        {
+            MathHelper::Matrix4 modelViewMatrix = MathHelper::Multiply(viewMatrix, modelMatrix);
+            _model->SetView(&(modelViewMatrix.m[0][0]), nullptr, HolographicProjectionScale);
+            _model->SetViewFrustum(Frustum::Stereo(HolographicEyeSeparation, HolographicTanHalfWidth,
+                HolographicTanHalfHeight, HolographicNearZ, HolographicFarZ));
+
+            // Occlusion is seen from between the eyes, each eye sees a
+            // little around the sides of what hides things from there.
+            MathHelper::Matrix4 occlusionProjection = MathHelper::PerspectiveMatrix(HolographicTanHalfWidth,
+                HolographicTanHalfHeight, HolographicNearZ, HolographicFarZ);
+            _model->SetOcclusionView(&(occlusionProjection.m[0][0]), 0.5f * HolographicEyeSeparation);
+        }
+        else
+        {
+            _model->SetView(&(modelMatrix.m[0][0]), nullptr, HolographicProjectionScale);
+        }
+        SelectLods();
 		_model->Render(mIsHolographic);
 	}
     else
     {
-        MathHelper::Matrix4 viewMatrix = MathHelper::SimpleViewMatrix();
-        glUniformMatrix4fv(mViewUniformLocation, 1, GL_FALSE, &(viewMatrix.m[0][0]));
+        trace.UniformMatrix4fv(mViewUniformLocation, 1, GL_FALSE, &(viewMatrix.m[0][0]));
 
         MathHelper::Matrix4 projectionMatrix = MathHelper::SimpleProjectionMatrix(float(mWindowWidth) / float(mWindowHeight));
-        glUniformMatrix4fv(mProjUniformLocation, 1, GL_FALSE, &(projectionMatrix.m[0][0]));
+        trace.UniformMatrix4fv(mProjUniformLocation, 1, GL_FALSE, &(projectionMatrix.m[0][0]));
 
+        MathHelper::Matrix4 modelViewMatrix = MathHelper::Multiply(viewMatrix, modelMatrix);
+        _model->SetView(&(modelViewMatrix.m[0][0]), &(projectionMatrix.m[0][0]),
+            projectionMatrix.m[1][1] * mWindowHeight * 0.5f);
+        SelectLods();
 		_model->Render(mIsHolographic);
 	}
 
     mDrawCount += 1;
+    EndFrame();
+}
+
+void SimpleRenderer::EndFrame()
+{
+    // Release builds only look for errors here, see checkGlError.
+    auto& trace = GlTrace::Current();
+    GLenum error;
+    while ((error = glGetError()) != GL_NO_ERROR)
+    {
+        DebugLog(L"opengl frame %d: glError %d", mDrawCount, error);
+        trace.Record(GlCommand::Error, { error });
+    }
+
+    auto& state = GlState::Current();
+    state.EndFrame();
+    if (mDrawCount % GlStateLogFrames == 0)
+    {
+        auto& counters = state.LastFrame();
+        DebugLog(L"GL state calls per frame: %d issued, %d avoided, %d buffer binds", counters.issued, counters.avoided,
+            counters.bufferBinds);
+        auto vertices = _model->VertexPoolStats();
+        auto indices = _model->IndexPoolStats();
+        DebugLog(L"Geometry pools: %d and %d buffers, %d of %d KB used, %d holes", vertices.arenas, indices.arenas,
+            (vertices.used + indices.used) / 1024, (vertices.capacity + indices.capacity) / 1024, vertices.holes + indices.holes);
+        DebugLog(L"Frustum culling: %d meshes culled", _model->CulledMeshes());
+        DebugLog(L"Draw calls: %d", _model->DrawCalls());
+        auto& occlusion = _occlusionCuller.FrameStats();
+        DebugLog(L"Occlusion culling: %d meshes occluded, %d occluders of %d drawn, %d triangles in %.2f ms",
+            _model->OccludedMeshes(), occlusion.occluders, occlusion.occluders + occlusion.skippedOccluders,
+            occlusion.triangles, occlusion.rasterMilliseconds);
+    }
+
+    try
+    {
+        trace.EndFrame();
+    }
+    catch (const exception& e)
+    {
+        DebugLog(L"GL trace failed: %S", e.what());
+    }
+}
+
+void SimpleRenderer::CaptureFrame()
+{
+    _captureFrame = true;
+}
+
+void SimpleRenderer::SetHeadPose(const float *position, const float *orientation)
+{
+    copy(position, position + 3, _headPosition);
+    copy(orientation, orientation + 4, _headOrientation);
+    _hasHeadPose = true;
+}
+
+void SimpleRenderer::SelectLods()
+{
+    _lodBudget.Clear();
+    _model->SelectLods(_lodBudget);
+    _lodBudget.Solve();
+    _model->ApplyLods(_lodBudget);
+}
+
+void SimpleRenderer::CheckForReload()
+{
+    if (_reload.valid())
+    {
+        if (_reload.wait_for(chrono::seconds(0)) != future_status::ready)
+            return;
+
+        try
+        {
+            auto scene = _reload.get();
+            _model->UpdateMeshes(std::move(scene.second));
+            _model->SetNodes(std::move(scene.first));
+            _snapshotDirty = true;
+        }
+        catch (const exception& e)
+        {
+            // Most likely the file was still being written, so it is read
+            // again at the next check. A file that still fails waits for
+            // the next save.
+            if (_reloadFailures++ < MaxReloadRetries)
+            {
+                DebugLog(L"Reload failed, retrying: %S", e.what());
+                _watcher->Reset();
+            }
+            else
+            {
+                DebugLog(L"Reload failed, waiting for the next save: %S", e.what());
+                _reloadFailures = 0;
+            }
+            return;
+        }
+        _reloadFailures = 0;
+        return;
+    }
+
+    if (_watcher->HasChanged())
+    {
+        string filename = _filename;
+        MeshHashes known = _model->Hashes();
+        _reload = async(launch::async, [filename, known]
+        {
+            Importer importer;
+            auto meshes = importer.ConvertFile(filename.c_str(), &known);
+            auto& batching = importer.BatchStats();
+            DebugLog(L"Batched %d meshes into %d, %d draw calls down to %d", batching.batchedMeshes, batching.batches,
+                batching.DrawCallsBefore(), batching.DrawCallsAfter());
+            return make_pair(importer.Nodes(), std::move(meshes));
+        });
+    }
+}
+
+void SimpleRenderer::RestoreDeviceResources()
+{
+    auto start = chrono::steady_clock::now();
+    _restoreBytes += _model->CreateDeviceResources(RestoreBytesPerFrame);
+    _restoreUploadTime += chrono::steady_clock::now() - start;
+    _restoreFrames++;
+
+    if (_model->HasDeviceResources())
+    {
+        _restoring = false;
+        DebugLog(L"Restored %d KB of geometry in %.2f ms of uploads, %.2f ms over %d frames",
+            _restoreBytes / 1024, chrono::duration<double, milli>(_restoreUploadTime).count(),
+            chrono::duration<double, milli>(chrono::steady_clock::now() - _restoreStart).count(), _restoreFrames);
+    }
+}
+
+void SimpleRenderer::SaveSnapshot()
+{
+    if (!_snapshotDirty)
+        return;
+
+    try
+    {
+        CookedFile::Write(_snapshotFilename.c_str(), _model->MeshDatas(), _model->Nodes());
+        _snapshotDirty = false;
+    }
+    catch (const exception& e)
+    {
+        DebugLog(L"Snapshot failed: %S", e.what());
+    }
 }
 
 void SimpleRenderer::UpdateWindowSize(GLsizei width, GLsizei height)
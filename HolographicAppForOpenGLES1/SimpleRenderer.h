@@ -2,6 +2,10 @@
 
 #include "pch.h"
 #include "Model.h"
+#include "FileWatcher.h"
+#include "FrameQueue.h"
+#include "ThreadPool.h"
+#include <future>
 
 namespace HolographicAppForOpenGLES1
 {
@@ -9,20 +13,60 @@ namespace HolographicAppForOpenGLES1
     {
     public:
         SimpleRenderer(bool holographic);
-        ~SimpleRenderer();        void Draw();
+        ~SimpleRenderer();
+
+        // Update thread. Describes the next frame, from the head pose and
+        // any capture asked for, for Draw on the render thread.
+        void Record(FrameCommands& frame);
+
+        // Render thread, as is everything below but the head pose and
+        // CaptureFrame, which go with Record, and SaveSnapshot, for when
+        // the render thread is stopped.
+        void Draw(const FrameCommands& frame);
         void UpdateWindowSize(GLsizei width, GLsizei height);
 
+        // GL objects only, the scene itself survives a lost context and is
+        // uploaded again from memory.
+        void CreateDeviceResources();
+        void ReleaseDeviceResources();
+
+        // Writes out the loaded scene if it came from an FBX import, so the
+        // next time the renderer is created it restores without importing.
+        void SaveSnapshot();
+
+        // Records the GL calls of the next frame to frame.gltrace in the
+        // app's local folder, for the gltrace tool.
+        void CaptureFrame();
+
+        // Where the head is in the frame of reference the scene is placed
+        // in, orientation as a quaternion xyzw. Holographic frames are culled
+        // and their LODs picked from here, and not at all while it's unknown.
+        void SetHeadPose(const float *position, const float *orientation);
+        void ClearHeadPose() { _hasHeadPose = false; }
+
     private:
+        void CheckForReload();
+
+        // Every model's LODs out of one budget, once all have their view.
+        void SelectLods();
+        void RestoreDeviceResources();
+
+        // Error checks, GL state counters and trace capture.
+        void EndFrame();
+
         GLuint mProgram;
         GLsizei mWindowWidth;
         GLsizei mWindowHeight;
 
         GLint mPositionAttribLocation;
         GLint mColorAttribLocation;
+        GLint mNormalAttribLocation;
 
         GLint mModelUniformLocation;
         GLint mViewUniformLocation;
         GLint mProjUniformLocation;
+        GLint mPositionScaleUniformLocation;
+        GLint mPositionOffsetUniformLocation;
         GLint mRtvIndexAttribLocation;
 
         GLuint mVertexPositionBuffer;
@@ -32,6 +76,34 @@ namespace HolographicAppForOpenGLES1
 
         int mDrawCount;
         bool mIsHolographic;
+
+        // Update side, frames recorded and whether to capture the next.
+        int _recordCount;
+        bool _captureFrame;
 		unique_ptr<Model> _model;
+		LodBudget _lodBudget;
+		ThreadPool _cullPool;
+		OcclusionCuller _occlusionCuller;
+
+		bool _hasHeadPose;
+		float _headPosition[3];
+		float _headOrientation[4];
+
+		// Hot reload, the FBX is re-converted off the render thread and only
+		// the meshes whose source data changed are uploaded again.
+		string _filename;
+		unique_ptr<FileWatcher> _watcher;
+		future<pair<vector<SceneNode>, vector<unique_ptr<MeshData>>>> _reload;
+		int _reloadFailures;
+
+		string _snapshotFilename;
+		bool _snapshotDirty;
+
+		// Device lost recovery timing.
+		bool _restoring;
+		chrono::steady_clock::time_point _restoreStart;
+		chrono::steady_clock::duration _restoreUploadTime;
+		int _restoreFrames;
+		int _restoreBytes;
     };
 }
\ No newline at end of file
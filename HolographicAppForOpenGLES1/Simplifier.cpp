@@ -0,0 +1,602 @@
+#include "pch.h"
+#include "Simplifier.h"
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <unordered_map>
+
+namespace
+{
+	// Border and seam edges get a plane at right angles to the surface as
+	// well, weighted well above the surface's own so they hold their shape.
+	const double EdgeWeight = 10.0;
+
+	enum class Kind : unsigned char
+	{
+		Manifold,
+		Border,
+		Seam,
+		Locked
+	};
+
+	// Sum of squared distances to a set of planes, as p'Ap + 2b.p + c.
+	struct Quadric
+	{
+		double a00, a01, a02, a11, a12, a22;
+		double b0, b1, b2;
+		double c;
+		double weight;
+	};
+
+	void AddPlane(Quadric& q, double nx, double ny, double nz, double d, double weight)
+	{
+		q.a00 += weight * nx * nx;
+		q.a01 += weight * nx * ny;
+		q.a02 += weight * nx * nz;
+		q.a11 += weight * ny * ny;
+		q.a12 += weight * ny * nz;
+		q.a22 += weight * nz * nz;
+		q.b0 += weight * nx * d;
+		q.b1 += weight * ny * d;
+		q.b2 += weight * nz * d;
+		q.c += weight * d * d;
+		q.weight += weight;
+	}
+
+	void Add(Quadric& q, const Quadric& other)
+	{
+		q.a00 += other.a00;
+		q.a01 += other.a01;
+		q.a02 += other.a02;
+		q.a11 += other.a11;
+		q.a12 += other.a12;
+		q.a22 += other.a22;
+		q.b0 += other.b0;
+		q.b1 += other.b1;
+		q.b2 += other.b2;
+		q.c += other.c;
+		q.weight += other.weight;
+	}
+
+	// Root mean square distance from p to the planes.
+	float Distance(const Quadric& q, const float *p)
+	{
+		double x = p[0], y = p[1], z = p[2];
+		double e = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z +
+			2.0 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z) +
+			2.0 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+		return q.weight > 0.0 ? (float)sqrt(max(e, 0.0) / q.weight) : 0.0f;
+	}
+
+	void Cross(const double *a, const double *b, double *result)
+	{
+		result[0] = a[1] * b[2] - a[2] * b[1];
+		result[1] = a[2] * b[0] - a[0] * b[2];
+		result[2] = a[0] * b[1] - a[1] * b[0];
+	}
+
+	double Length(const double *a)
+	{
+		return sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+	}
+
+	struct Candidate
+	{
+		float cost;
+		int from;
+		int to;
+	};
+
+	struct CostGreater
+	{
+		bool operator()(const Candidate& a, const Candidate& b) const
+		{
+			return a.cost > b.cost;
+		}
+	};
+
+	unsigned long long EdgeKey(int a, int b)
+	{
+		if (a > b)
+			swap(a, b);
+		return ((unsigned long long)a << 32) | (unsigned int)b;
+	}
+
+	class Collapser
+	{
+	public:
+		Collapser(const float *positions, int numVertices, const unsigned short *indices, int numIndices,
+			const int *triangleMaterials);
+
+		vector<Simplifier::Level> Run(const vector<int>& targetTriangles);
+
+	private:
+		void Weld();
+		void Classify();
+		bool IsSeam(int t0, int t1, int ga, int gb) const;
+		int WedgeOf(int t, int g) const;
+		void BuildQuadrics();
+		void Push(int from, int to);
+		float Cost(int from, int to) const;
+		bool TryCollapse(int from, int to);
+		bool Flips(int t, int from, int to) const;
+		Simplifier::Level Snapshot() const;
+
+		const float *Position(int wedge) const { return _positions + wedge * 4; }
+		int Material(int t) const { return _materials ? _materials[t] : 0; }
+	
+		const float *_positions;
+		const int *_materials;
+		int _numVertices;
+
+		// A wedge is an input vertex, a group is every wedge at one position.
+		vector<int> _group;
+		vector<vector<int>> _groupWedges;
+		vector<Kind> _kind;
+		vector<bool> _groupAlive;
+		vector<Quadric> _quadrics;
+
+		// Border and seam edges between groups a and b, once per triangle.
+		struct ConstrainedEdge
+		{
+			int t, a, b;
+		};
+		vector<ConstrainedEdge> _constrained;
+
+		vector<int> _tris;
+		vector<bool> _triAlive;
+		vector<vector<int>> _wedgeTris;
+		int _liveTris;
+
+		priority_queue<Candidate, vector<Candidate>, CostGreater> _queue;
+		float _error;
+	};
+
+	Collapser::Collapser(const float *positions, int numVertices, const unsigned short *indices, int numIndices,
+		const int *triangleMaterials) :
+		_positions(positions),
+		_materials(triangleMaterials),
+		_numVertices(numVertices),
+		_tris(indices, indices + numIndices / 3 * 3),
+		_triAlive(numIndices / 3, true),
+		_wedgeTris(numVertices),
+		_liveTris(numIndices / 3),
+		_error(0.0f)
+	{
+		for (int t = 0; t < (int)_triAlive.size(); t++)
+		{
+			int a = _tris[t * 3 + 0], b = _tris[t * 3 + 1], c = _tris[t * 3 + 2];
+			if (a == b || b == c || c == a)
+			{
+				_triAlive[t] = false;
+				_liveTris--;
+				continue;
+			}
+			for (int k = 0; k < 3; k++)
+				_wedgeTris[_tris[t * 3 + k]].push_back(t);
+		}
+
+		Weld();
+		Classify();
+		BuildQuadrics();
+
+		for (int t = 0; t < (int)_triAlive.size(); t++)
+		{
+			if (!_triAlive[t])
+				continue;
+			for (int k = 0; k < 3; k++)
+			{
+				int a = _tris[t * 3 + k];
+				int b = _tris[t * 3 + (k + 1) % 3];
+				Push(a, b);
+				Push(b, a);
+			}
+		}
+	}
+
+	void Collapser::Weld()
+	{
+		// Exact matches only, a seam is made by splitting a vertex so both
+		// sides hold the same bits.
+		auto less = [this](int a, int b)
+		{
+			return lexicographical_compare(Position(a), Position(a) + 3, Position(b), Position(b) + 3);
+		};
+		vector<int> sorted(_numVertices);
+		for (int v = 0; v < _numVertices; v++)
+			sorted[v] = v;
+		sort(sorted.begin(), sorted.end(), less);
+
+		_group.resize(_numVertices);
+		for (int i = 0; i < _numVertices; i++)
+		{
+			if (i == 0 || less(sorted[i - 1], sorted[i]))
+				_groupWedges.emplace_back();
+			_group[sorted[i]] = (int)_groupWedges.size() - 1;
+			_groupWedges.back().push_back(sorted[i]);
+		}
+		_groupAlive.assign(_groupWedges.size(), true);
+	}
+
+	void Collapser::Classify()
+	{
+		struct Edge
+		{
+			int count = 0;
+			int t = -1;
+			int other = -1;
+		};
+		unordered_map<unsigned long long, Edge> edges;
+		_kind.assign(_groupWedges.size(), Kind::Manifold);
+
+		for (int t = 0; t < (int)_triAlive.size(); t++)
+		{
+			if (!_triAlive[t])
+				continue;
+
+			int g[3] = { _group[_tris[t * 3 + 0]], _group[_tris[t * 3 + 1]], _group[_tris[t * 3 + 2]] };
+			if (g[0] == g[1] || g[1] == g[2] || g[2] == g[0])
+			{
+				// Zero area, its corners are best left where they are.
+				for (int k = 0; k < 3; k++)
+					_kind[g[k]] = Kind::Locked;
+				continue;
+			}
+
+			for (int k = 0; k < 3; k++)
+			{
+				auto& edge = edges[EdgeKey(g[k], g[(k + 1) % 3])];
+				if (edge.count++ == 0)
+					edge.t = t;
+				else
+					edge.other = t;
+			}
+		}
+
+		// An edge used once is a border. One used twice is a seam when its
+		// triangles disagree about the wedges at its ends or their material,
+		// more than twice and the surface isn't a surface there.
+		vector<int> borderEdges(_groupWedges.size(), 0);
+		vector<int> seamEdges(_groupWedges.size(), 0);
+		for (auto& entry : edges)
+		{
+			int a = (int)(entry.first >> 32);
+			int b = (int)(entry.first & 0xffffffffu);
+			auto& edge = entry.second;
+			if (edge.count == 1)
+			{
+				borderEdges[a]++;
+				borderEdges[b]++;
+				_constrained.push_back({ edge.t, a, b });
+			}
+			else if (edge.count == 2 && IsSeam(edge.t, edge.other, a, b))
+			{
+				seamEdges[a]++;
+				seamEdges[b]++;
+				_constrained.push_back({ edge.t, a, b });
+				_constrained.push_back({ edge.other, a, b });
+			}
+			else if (edge.count > 2)
+			{
+				_kind[a] = Kind::Locked;
+				_kind[b] = Kind::Locked;
+			}
+		}
+
+		// Anything but a plain run of border or seam, e.g. a corner or where
+		// seams meet, has to stay put.
+		for (int g = 0; g < (int)_groupWedges.size(); g++)
+		{
+			if (_kind[g] == Kind::Locked)
+				continue;
+
+			bool single = _groupWedges[g].size() == 1;
+			if (borderEdges[g] == 0 && seamEdges[g] == 0)
+				_kind[g] = single ? Kind::Manifold : Kind::Locked;
+			else if (borderEdges[g] == 2 && seamEdges[g] == 0)
+				_kind[g] = single ? Kind::Border : Kind::Locked;
+			else if (borderEdges[g] == 0 && seamEdges[g] == 2)
+				_kind[g] = Kind::Seam;
+			else
+				_kind[g] = Kind::Locked;
+		}
+	}
+
+	bool Collapser::IsSeam(int t0, int t1, int ga, int gb) const
+	{
+		return WedgeOf(t0, ga) != WedgeOf(t1, ga) || WedgeOf(t0, gb) != WedgeOf(t1, gb) || Material(t0) != Material(t1);
+	}
+
+	int Collapser::WedgeOf(int t, int g) const
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			if (_group[_tris[t * 3 + k]] == g)
+				return _tris[t * 3 + k];
+		}
+		return -1;
+	}
+
+	void Collapser::BuildQuadrics()
+	{
+		_quadrics.assign(_groupWedges.size(), Quadric());
+		auto normalOf = [this](int t, double *normal)
+		{
+			const float *p[3] = { Position(_tris[t * 3 + 0]), Position(_tris[t * 3 + 1]), Position(_tris[t * 3 + 2]) };
+			double e0[3] = { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] };
+			double e1[3] = { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] };
+			Cross(e0, e1, normal);
+			return Length(normal);
+		};
+
+		// Every triangle's plane, weighted by its area.
+		for (int t = 0; t < (int)_triAlive.size(); t++)
+		{
+			double normal[3];
+			double length = _triAlive[t] ? normalOf(t, normal) : 0.0;
+			if (length <= 0.0)
+				continue;
+
+			const float *p = Position(_tris[t * 3]);
+			double nx = normal[0] / length, ny = normal[1] / length, nz = normal[2] / length;
+			double d = -(nx * p[0] + ny * p[1] + nz * p[2]);
+			for (int k = 0; k < 3; k++)
+				AddPlane(_quadrics[_group[_tris[t * 3 + k]]], nx, ny, nz, d, length * 0.5);
+		}
+
+		// Plus planes standing up from borders and seams, through the edge.
+		for (auto& edge : _constrained)
+		{
+			double normal[3];
+			if (normalOf(edge.t, normal) <= 0.0)
+				continue;
+
+			const float *a = Position(_groupWedges[edge.a][0]);
+			const float *b = Position(_groupWedges[edge.b][0]);
+			double along[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			double side[3];
+			Cross(along, normal, side);
+			double length = Length(side);
+			if (length <= 0.0)
+				continue;
+
+			double nx = side[0] / length, ny = side[1] / length, nz = side[2] / length;
+			double d = -(nx * a[0] + ny * a[1] + nz * a[2]);
+			double weight = EdgeWeight * (along[0] * along[0] + along[1] * along[1] + along[2] * along[2]);
+			AddPlane(_quadrics[edge.a], nx, ny, nz, d, weight);
+			AddPlane(_quadrics[edge.b], nx, ny, nz, d, weight);
+		}
+	}
+
+	float Collapser::Cost(int from, int to) const
+	{
+		Quadric q = _quadrics[_group[from]];
+		Add(q, _quadrics[_group[to]]);
+		return Distance(q, Position(to));
+	}
+
+	void Collapser::Push(int from, int to)
+	{
+		int g = _group[from];
+		if (_kind[g] == Kind::Locked || g == _group[to])
+			return;
+		// Border and seam vertices only move along their own kind of edge.
+		Kind target = _kind[_group[to]];
+		if ((_kind[g] == Kind::Border || _kind[g] == Kind::Seam) && target != _kind[g] && target != Kind::Locked)
+			return;
+		_queue.push({ Cost(from, to), from, to });
+	}
+
+	bool Collapser::Flips(int t, int from, int to) const
+	{
+		const float *before[3];
+		const float *after[3];
+		for (int k = 0; k < 3; k++)
+		{
+			int wedge = _tris[t * 3 + k];
+			before[k] = Position(wedge);
+			after[k] = _group[wedge] == _group[from] ? Position(to) : Position(wedge);
+		}
+
+		double n[2][3];
+		const float **corners[2] = { before, after };
+		for (int i = 0; i < 2; i++)
+		{
+			const float **p = corners[i];
+			double e0[3] = { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] };
+			double e1[3] = { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] };
+			Cross(e0, e1, n[i]);
+		}
+		return n[0][0] * n[1][0] + n[0][1] * n[1][1] + n[0][2] * n[1][2] <= 0.0;
+	}
+
+	bool Collapser::TryCollapse(int from, int to)
+	{
+		const int gu = _group[from];
+		const int gv = _group[to];
+		auto& fromWedges = _groupWedges[gu];
+
+		// Every wedge of 'from' goes to the wedge of 'to' it shares a
+		// triangle with, the triangles between them are removed.
+		vector<int> mapped(fromWedges.size(), -1);
+		vector<int> shared;
+		vector<int> neighbours;
+		for (size_t i = 0; i < fromWedges.size(); i++)
+		{
+			auto& tris = _wedgeTris[fromWedges[i]];
+			tris.erase(remove_if(tris.begin(), tris.end(), [this](int t) { return !_triAlive[t]; }), tris.end());
+			for (int t : tris)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					int wedge = _tris[t * 3 + k];
+					if (_group[wedge] == gv)
+					{
+						if (mapped[i] >= 0 && mapped[i] != wedge)
+							return false;
+						mapped[i] = wedge;
+						shared.push_back(t);
+					}
+					else if (_group[wedge] != gu)
+					{
+						neighbours.push_back(_group[wedge]);
+					}
+				}
+			}
+			if (mapped[i] < 0)
+				return false;
+		}
+
+		// Along a border only one triangle may go, along a seam one on either
+		// side, and those must still be a border or seam.
+		Kind kind = _kind[gu];
+		if (kind == Kind::Border ? shared.size() != 1 : shared.size() != 2)
+			return false;
+		if (kind == Kind::Seam && !IsSeam(shared[0], shared[1], gu, gv))
+			return false;
+
+		// The ends may only share the neighbours across the removed
+		// triangles, anything more would pinch the surface.
+		sort(neighbours.begin(), neighbours.end());
+		neighbours.erase(unique(neighbours.begin(), neighbours.end()), neighbours.end());
+		int common = 0;
+		for (int wedge : _groupWedges[gv])
+		{
+			for (int t : _wedgeTris[wedge])
+			{
+				if (!_triAlive[t])
+					continue;
+				for (int k = 0; k < 3; k++)
+				{
+					int g = _group[_tris[t * 3 + k]];
+					if (g != gv && g != gu && binary_search(neighbours.begin(), neighbours.end(), g))
+					{
+						// Counted once per group, clear it so repeats don't count.
+						neighbours.erase(lower_bound(neighbours.begin(), neighbours.end(), g));
+						common++;
+					}
+				}
+			}
+		}
+		if (common != (int)shared.size())
+			return false;
+
+		for (size_t i = 0; i < fromWedges.size(); i++)
+		{
+			for (int t : _wedgeTris[fromWedges[i]])
+			{
+				if (find(shared.begin(), shared.end(), t) == shared.end() && Flips(t, from, to))
+					return false;
+			}
+		}
+
+		_error = max(_error, Cost(from, to));
+		for (int t : shared)
+		{
+			if (_triAlive[t])
+			{
+				_triAlive[t] = false;
+				_liveTris--;
+			}
+		}
+		for (size_t i = 0; i < fromWedges.size(); i++)
+		{
+			for (int t : _wedgeTris[fromWedges[i]])
+			{
+				if (!_triAlive[t])
+					continue;
+				for (int k = 0; k < 3; k++)
+				{
+					if (_tris[t * 3 + k] == fromWedges[i])
+						_tris[t * 3 + k] = mapped[i];
+				}
+				_wedgeTris[mapped[i]].push_back(t);
+			}
+		}
+		Add(_quadrics[gv], _quadrics[gu]);
+		_groupAlive[gu] = false;
+
+		// The moved triangles have new edges to try.
+		for (size_t i = 0; i < fromWedges.size(); i++)
+		{
+			for (int t : _wedgeTris[fromWedges[i]])
+			{
+				if (!_triAlive[t])
+					continue;
+				for (int k = 0; k < 3; k++)
+				{
+					int other = _tris[t * 3 + k];
+					if (other == mapped[i])
+						continue;
+					Push(mapped[i], other);
+					Push(other, mapped[i]);
+				}
+			}
+			_wedgeTris[fromWedges[i]].clear();
+		}
+		return true;
+	}
+
+	Simplifier::Level Collapser::Snapshot() const
+	{
+		Simplifier::Level level;
+		level.error = _error;
+		level.indices.reserve(_liveTris * 3);
+		for (int t = 0; t < (int)_triAlive.size(); t++)
+		{
+			if (_triAlive[t])
+				level.indices.insert(level.indices.end(), { (unsigned short)_tris[t * 3 + 0],
+					(unsigned short)_tris[t * 3 + 1], (unsigned short)_tris[t * 3 + 2] });
+		}
+		return level;
+	}
+
+	vector<Simplifier::Level> Collapser::Run(const vector<int>& targetTriangles)
+	{
+		vector<Simplifier::Level> levels;
+		size_t next = 0;
+		int lastTriangles = _liveTris;
+
+		while (next < targetTriangles.size())
+		{
+			if (_liveTris <= targetTriangles[next])
+			{
+				levels.push_back(Snapshot());
+				lastTriangles = _liveTris;
+				while (next < targetTriangles.size() && _liveTris <= targetTriangles[next])
+					next++;
+				continue;
+			}
+			if (_queue.empty())
+				break;
+
+			Candidate candidate = _queue.top();
+			_queue.pop();
+			if (!_groupAlive[_group[candidate.from]] || !_groupAlive[_group[candidate.to]])
+				continue;
+
+			// Quadrics only grow, so a stale cost is too low. Requeue it at
+			// its real cost and carry on with whatever is cheapest now.
+			float cost = Cost(candidate.from, candidate.to);
+			if (cost > candidate.cost)
+			{
+				_queue.push({ cost, candidate.from, candidate.to });
+				continue;
+			}
+			TryCollapse(candidate.from, candidate.to);
+		}
+
+		// Ran out of collapses before the next target, what it did get to is
+		// still worth having if it is much smaller.
+		if (next < targetTriangles.size() && _liveTris * 4 < lastTriangles * 3)
+			levels.push_back(Snapshot());
+		return levels;
+	}
+}
+
+vector<Simplifier::Level> Simplifier::Simplify(const float *positions, int numVertices, const unsigned short *indices,
+	int numIndices, const int *triangleMaterials, const vector<int>& targetTriangles)
+{
+	Collapser collapser(positions, numVertices, indices, numIndices, triangleMaterials);
+	return collapser.Run(targetTriangles);
+}
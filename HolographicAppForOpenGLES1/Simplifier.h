@@ -0,0 +1,31 @@
+#pragma once
+#include <vector>
+
+using namespace std;
+
+// Quadric error metric simplification after Garland and Heckbert. Edges are
+// collapsed onto one of their ends rather than to a new optimal point, so
+// every level only uses the input's vertices and can share its vertex buffer.
+//
+// Vertices sharing a position but not their other attributes make a seam, as
+// do edges between triangles of different materials. Seam and border vertices
+// only ever slide along their seam or border, so the mesh neither tears nor
+// bleeds one material into another as it gets coarser.
+class Simplifier
+{
+public:
+	struct Level
+	{
+		vector<unsigned short> indices;
+		float error;	// roughly how far any collapse moved the surface, in object space
+	};
+
+	// Collapses the cheapest edges first and takes a level each time the
+	// triangle count gets down to the next of targetTriangles, which must be
+	// decreasing. Stops early when nothing more can collapse without breaking
+	// a seam or turning a triangle over, so fewer levels may come back.
+	// Positions are xyzw, triangleMaterials has one entry per triangle or is
+	// null when the mesh has a single material.
+	static vector<Level> Simplify(const float *positions, int numVertices, const unsigned short *indices,
+		int numIndices, const int *triangleMaterials, const vector<int>& targetTriangles);
+};
@@ -0,0 +1,221 @@
+#include "pch.h"
+#include "Stripifier.h"
+#include "VertexCache.h"
+#include <algorithm>
+
+namespace
+{
+	// Directed edge a->b as it winds around a triangle, with the triangle
+	// and its vertex opposite the edge.
+	struct Edge
+	{
+		unsigned int key;
+		int triangle;
+		unsigned short opposite;
+
+		bool operator<(const Edge& other) const { return key < other.key; }
+	};
+
+	const int StartWindow = 64;
+
+	unsigned int EdgeKey(unsigned short a, unsigned short b)
+	{
+		return (unsigned int)a << 16 | b;
+	}
+
+	class StripBuilder
+	{
+	public:
+		StripBuilder(const unsigned short *indices, vector<unsigned short>& strip) :
+			_indices(indices), _strip(strip)
+		{
+		}
+
+		// Appends the triangles [first, last) as strips.
+		void Build(int first, int last)
+		{
+			_edges.clear();
+			for (int t = first; t < last; t++)
+			{
+				const unsigned short *v = _indices + t * 3;
+				for (int corner = 0; corner < 3; corner++)
+					_edges.push_back({ EdgeKey(v[corner], v[(corner + 1) % 3]), t, v[(corner + 2) % 3] });
+			}
+			sort(_edges.begin(), _edges.end());
+			_used.assign(last - first, false);
+			_first = first;
+
+			for (int next = first; next < last;)
+			{
+				if (_used[next - first])
+				{
+					next++;
+					continue;
+				}
+
+				// Strips started where few unused neighbours are left strand
+				// fewer triangles, look for one a little way ahead.
+				int t = next, fewest = 4;
+				for (int u = next; u < last && u < next + StartWindow; u++)
+				{
+					if (_used[u - first])
+						continue;
+					const unsigned short *w = _indices + u * 3;
+					int neighbours = 0;
+					for (int corner = 0; corner < 3; corner++)
+						neighbours += Neighbour(w[(corner + 1) % 3], w[corner]) >= 0 ? 1 : 0;
+					if (neighbours < fewest)
+					{
+						fewest = neighbours;
+						t = u;
+					}
+				}
+				_used[t - first] = true;
+
+				// Start on whichever rotation runs longest.
+				const unsigned short *v = _indices + t * 3;
+				int rotation = 0, longest = -1;
+				for (int r = 0; r < 3; r++)
+				{
+					_run.assign({ v[r], v[(r + 1) % 3], v[(r + 2) % 3] });
+					Extend(_run);
+					for (size_t i = 3; i < _run.size(); i++)
+						_used[_runTriangles[i - 3] - _first] = false;
+					if ((int)_run.size() > longest)
+					{
+						longest = (int)_run.size();
+						rotation = r;
+					}
+				}
+
+				_run.assign({ v[rotation], v[(rotation + 1) % 3], v[(rotation + 2) % 3] });
+				Extend(_run);
+				Append(_run);
+			}
+		}
+
+		// Lines the strip up on an even index, so runs drawn from here wind
+		// the right way round.
+		void Align()
+		{
+			if (_strip.size() % 2 != 0)
+				_strip.push_back(_strip.back());
+		}
+
+	private:
+		// Index into _edges of an unused triangle winding a->b, or -1.
+		int Neighbour(unsigned short a, unsigned short b) const
+		{
+			Edge key = { EdgeKey(a, b), 0, 0 };
+			auto range = equal_range(_edges.begin(), _edges.end(), key);
+			for (auto edge = range.first; edge != range.second; ++edge)
+			{
+				if (!_used[edge->triangle - _first])
+					return (int)(edge - _edges.begin());
+			}
+			return -1;
+		}
+
+		// Follows the strip on from its first triangle, marking the
+		// triangles it takes used. The strip's nth triangle is drawn x y r
+		// for even n and y x r for odd n, x and y being its last two indices.
+		void Extend(vector<unsigned short>& run)
+		{
+			_runTriangles.clear();
+			for (int n = 1;; n++)
+			{
+				unsigned short x = run[run.size() - 2];
+				unsigned short y = run.back();
+				int edge = n % 2 == 0 ? Neighbour(x, y) : Neighbour(y, x);
+				if (edge < 0)
+					break;
+				_used[_edges[edge].triangle - _first] = true;
+				_runTriangles.push_back(_edges[edge].triangle);
+				run.push_back(_edges[edge].opposite);
+			}
+		}
+
+		// Repeating the last index and the new first one makes degenerate
+		// triangles out of the join.
+		void Append(const vector<unsigned short>& run)
+		{
+			if (!_strip.empty())
+			{
+				Align();
+				unsigned short last = _strip.back();
+				_strip.push_back(last);
+				_strip.push_back(run[0]);
+			}
+			_strip.insert(_strip.end(), run.begin(), run.end());
+		}
+
+		const unsigned short *_indices;
+		vector<unsigned short>& _strip;
+		vector<Edge> _edges;
+		vector<bool> _used;
+		int _first = 0;
+		vector<unsigned short> _run;
+		vector<int> _runTriangles;
+	};
+}
+
+vector<unsigned short> Stripifier::Stripify(const unsigned short *indices, int numIndices,
+	vector<Cluster>& clusters)
+{
+	vector<unsigned short> strip;
+	strip.reserve(numIndices / 2);
+	StripBuilder builder(indices, strip);
+
+	if (clusters.empty())
+	{
+		builder.Build(0, numIndices / 3);
+		return strip;
+	}
+
+	for (auto& cluster : clusters)
+	{
+		builder.Align();
+		int first = (int)strip.size();
+		builder.Build(cluster.firstIndex / 3, (cluster.firstIndex + cluster.indexCount) / 3);
+		cluster.firstIndex = first;
+		cluster.indexCount = (int)strip.size() - first;
+	}
+	return strip;
+}
+
+int Stripifier::TriangleCount(const unsigned short *strip, int numIndices)
+{
+	int triangles = 0;
+	for (int i = 2; i < numIndices; i++)
+	{
+		if (strip[i - 2] != strip[i - 1] && strip[i - 1] != strip[i] && strip[i - 2] != strip[i])
+			triangles++;
+	}
+	return triangles;
+}
+
+// No mesh drew clearly faster as a strip there.
+const Stripifier::Costs Stripifier::LlvmpipeCosts = { 13.0f, 5.0f, 10.0f, 2300.0f };
+
+const float Stripifier::MaxAcmrIncrease = 0.05f;
+
+float Stripifier::Cost(const unsigned short *indices, int numIndices, bool strip, const Costs& costs)
+{
+	int triangles = strip ? max(numIndices - 2, 0) : numIndices / 3;
+	return numIndices * costs.index + VertexCache::Misses(indices, numIndices) * costs.vertex +
+		triangles * costs.triangle + (strip ? costs.stripDraw : 0.0f);
+}
+
+bool Stripifier::IsBetter(const unsigned short *list, int numListIndices, const unsigned short *strip,
+	int numStripIndices, const Costs *costs)
+{
+	if (costs)
+		return Cost(strip, numStripIndices, true, *costs) < Cost(list, numListIndices, false, *costs);
+
+	// Both draw the same triangles, so their misses compare as their ACMRs.
+	if (numStripIndices >= numListIndices)
+		return false;
+	int listMisses = VertexCache::Misses(list, numListIndices);
+	int stripMisses = VertexCache::Misses(strip, numStripIndices);
+	return stripMisses <= listMisses * (1.0f + MaxAcmrIncrease);
+}
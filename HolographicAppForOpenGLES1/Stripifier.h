@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+#include "Clusters.h"
+
+using namespace std;
+
+// Triangle strips for GLES 2, which has no primitive restart: separate
+// strips are joined into one with degenerate triangles, costing two to
+// three extra indices a join against three indices per triangle for a list.
+class Stripifier
+{
+public:
+	// Builds the strip greedily, starting each new run close to the earliest
+	// unused triangle so the list's vertex cache order mostly carries over.
+	// Winding is kept. Each cluster becomes its own run of the strip
+	// starting on an even index, so any run of clusters can be drawn
+	// alone, and the clusters' index ranges are moved to the strip.
+	static vector<unsigned short> Stripify(const unsigned short *indices, int numIndices,
+		vector<Cluster>& clusters);
+
+	// Triangles a strip draws, leaving out the degenerate ones.
+	static int TriangleCount(const unsigned short *strip, int numIndices);
+
+	// What drawing costs in nanoseconds for each index read, vertex
+	// transformed and triangle assembled, degenerate ones included, plus
+	// what a strip's draw costs over a list's. fbxbench strips fits them to
+	// the draw times it measures.
+	struct Costs
+	{
+		float index;
+		float vertex;
+		float triangle;
+		float stripDraw;
+	};
+
+	// Its fit on Mesa's llvmpipe, a CPU rasterizer, which says nothing about
+	// the HoloLens GPU.
+	static const Costs LlvmpipeCosts;
+
+	static float Cost(const unsigned short *indices, int numIndices, bool strip, const Costs& costs);
+
+	// Strips trade fewer indices for a degenerate triangle or two at every
+	// join and a worse vertex cache hit rate. Given costs fitted on the
+	// target, the strip is picked when it costs less. Without, it is picked
+	// when it has fewer indices and an ACMR, vertex cache misses per
+	// triangle, at most MaxAcmrIncrease over the list's, which holds up on
+	// any GPU.
+	static const float MaxAcmrIncrease;
+	static bool IsBetter(const unsigned short *list, int numListIndices, const unsigned short *strip,
+		int numStripIndices, const Costs *costs = nullptr);
+};
@@ -0,0 +1,188 @@
+#include "pch.h"
+#include "ThreadPool.h"
+
+// The pool whose worker runs on this thread, and its index there. Threads
+// can be workers of one pool and call into another.
+static thread_local const ThreadPool *currentPool = nullptr;
+static thread_local int currentWorker = -1;
+
+ThreadPool::ThreadPool(unsigned int threadCount) :
+	_queued(0),
+	_pending(0),
+	_nextQueue(0),
+	_stopping(false)
+{
+	if (threadCount == 0)
+		threadCount = max(1u, thread::hardware_concurrency());
+
+	for (unsigned int i = 0; i < threadCount; i++)
+		_workers.push_back(make_unique<Worker>());
+
+	for (unsigned int i = 0; i < threadCount; i++)
+		_threads.emplace_back(&ThreadPool::Run, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> lock(_wakeLock);
+		_stopping = true;
+	}
+	_wake.notify_all();
+
+	for (auto& t : _threads)
+		t.join();
+}
+
+void ThreadPool::Submit(function<void()> task)
+{
+	// Work spawned by a task stays local to that worker, everything else is
+	// spread round robin.
+	int worker = WorkerIndex();
+	unsigned int index = (worker >= 0 ? (unsigned int)worker : _nextQueue++) % (unsigned int)_workers.size();
+
+	_pending++;
+	{
+		lock_guard<mutex> lock(_workers[index]->lock);
+		_workers[index]->tasks.push_back(std::move(task));
+	}
+	{
+		lock_guard<mutex> lock(_wakeLock);
+		_queued++;
+	}
+	_wake.notify_one();
+}
+
+bool ThreadPool::TryPop(unsigned int index, function<void()>& task)
+{
+	const unsigned int count = (unsigned int)_workers.size();
+	{
+		auto& own = *_workers[index % count];
+		lock_guard<mutex> lock(own.lock);
+		if (!own.tasks.empty())
+		{
+			task = std::move(own.tasks.back());
+			own.tasks.pop_back();
+			_queued--;
+			return true;
+		}
+	}
+
+	for (unsigned int i = 1; i < count; i++)
+	{
+		auto& victim = *_workers[(index + i) % count];
+		lock_guard<mutex> lock(victim.lock);
+		if (!victim.tasks.empty())
+		{
+			task = std::move(victim.tasks.front());
+			victim.tasks.pop_front();
+			_queued--;
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::Execute(function<void()>& task)
+{
+	task();
+	task = nullptr;
+
+	if (--_pending == 0)
+	{
+		lock_guard<mutex> lock(_wakeLock);
+		_idle.notify_all();
+	}
+}
+
+void ThreadPool::Run(unsigned int index)
+{
+	currentPool = this;
+	currentWorker = (int)index;
+
+	function<void()> task;
+	for (;;)
+	{
+		if (TryPop(index, task))
+		{
+			Execute(task);
+			continue;
+		}
+
+		unique_lock<mutex> lock(_wakeLock);
+		_wake.wait(lock, [this] { return _stopping || _queued > 0; });
+		if (_stopping && _queued == 0)
+			return;
+	}
+}
+
+void ThreadPool::Wait()
+{
+	// Help rather than block when called from a worker.
+	function<void()> task;
+	int worker = WorkerIndex();
+	unsigned int index = worker >= 0 ? (unsigned int)worker : 0;
+	while (_pending > 0)
+	{
+		if (TryPop(index, task))
+		{
+			Execute(task);
+			continue;
+		}
+
+		unique_lock<mutex> lock(_wakeLock);
+		_idle.wait_for(lock, chrono::milliseconds(1), [this] { return _pending == 0 || _queued > 0; });
+	}
+}
+
+void ThreadPool::ParallelFor(int count, function<void(int)> body)
+{
+	if (count <= 0)
+		return;
+
+	// A few chunks per thread, taken in turn by the caller and by a helper
+	// task per worker, so uneven chunks still balance. The caller only ever
+	// runs chunks of its own loop, never other queued work, and once none
+	// are left to take sleeps until those being run are done.
+	struct Loop
+	{
+		atomic<int> next;
+		atomic<int> done;
+		mutex lock;
+		condition_variable finished;
+	};
+	const int chunks = min(count, (int)ThreadCount() * 4);
+	auto loop = make_shared<Loop>();
+	loop->next = 0;
+	loop->done = 0;
+
+	// Helpers that start after the last chunk was taken find nothing to do,
+	// body is only used while ParallelFor waits.
+	auto runChunks = [loop, chunks, count, &body]
+	{
+		for (int c; (c = loop->next++) < chunks;)
+		{
+			int begin = (int)((long long)count * c / chunks);
+			int end = (int)((long long)count * (c + 1) / chunks);
+			for (int i = begin; i < end; i++)
+				body(i);
+			if (++loop->done == chunks)
+			{
+				lock_guard<mutex> lock(loop->lock);
+				loop->finished.notify_all();
+			}
+		}
+	};
+
+	for (int helper = min(chunks, (int)ThreadCount()) - 1; helper > 0; helper--)
+		Submit(runChunks);
+	runChunks();
+
+	unique_lock<mutex> lock(loop->lock);
+	loop->finished.wait(lock, [&] { return loop->done == chunks; });
+}
+
+int ThreadPool::WorkerIndex() const
+{
+	return currentPool == this ? currentWorker : -1;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+using namespace std;
+
+// A small work-stealing thread pool. Every worker owns a queue, takes its own
+// work newest first and steals the oldest work from other workers when it runs
+// dry, so a batch of uneven tasks keeps all cores busy.
+class ThreadPool
+{
+public:
+	// A thread count of zero uses one thread per hardware thread.
+	explicit ThreadPool(unsigned int threadCount = 0);
+	~ThreadPool();
+
+	void Submit(function<void()> task);
+
+	// Blocks until every submitted task has finished.
+	void Wait();
+
+	// Runs body(i) for i in [0, count) and returns once all have run. The
+	// calling thread runs its share, and only that, so this is safe to call
+	// from inside a task.
+	void ParallelFor(int count, function<void(int)> body);
+
+	unsigned int ThreadCount() const { return (unsigned int)_threads.size(); }
+
+private:
+	struct Worker
+	{
+		mutex lock;
+		deque<function<void()>> tasks;
+	};
+
+	// This thread's index among the workers, or -1 if it isn't one of ours.
+	int WorkerIndex() const;
+
+	void Run(unsigned int index);
+	bool TryPop(unsigned int index, function<void()>& task);
+	void Execute(function<void()>& task);
+
+	vector<unique_ptr<Worker>> _workers;
+	vector<thread> _threads;
+
+	mutex _wakeLock;
+	condition_variable _wake;
+	condition_variable _idle;
+	atomic<int> _queued;
+	atomic<int> _pending;
+	atomic<unsigned int> _nextQueue;
+	bool _stopping;
+};
@@ -0,0 +1,133 @@
+#include "pch.h"
+#include "VertexCache.h"
+#include <algorithm>
+
+float VertexCache::Acmr(const unsigned short *indices, int numIndices, int cacheSize)
+{
+	if (numIndices < 3)
+		return 0.0f;
+	return (float)Misses(indices, numIndices, cacheSize) / (numIndices / 3);
+}
+
+int VertexCache::Misses(const unsigned short *indices, int numIndices, int cacheSize)
+{
+	if (numIndices == 0)
+		return 0;
+
+	// Timestamp the vertex went into the cache, a FIFO hit is anything
+	// newer than the last cacheSize misses.
+	int maxIndex = *max_element(indices, indices + numIndices);
+	vector<int> cachedAt(maxIndex + 1, -cacheSize - 1);
+	int misses = 0;
+	for (int i = 0; i < numIndices; i++)
+	{
+		int& time = cachedAt[indices[i]];
+		if (misses - time > cacheSize)
+		{
+			time = misses;
+			misses++;
+		}
+	}
+	return misses;
+}
+
+vector<int> VertexCache::Optimize(const unsigned short *indices, int numIndices, int numVertices,
+	int cacheSize)
+{
+	const int numTris = numIndices / 3;
+
+	// Triangles using each vertex, in CSR form. The live count is how many
+	// of them have still to be emitted.
+	vector<int> liveTris(numVertices, 0);
+	for (int i = 0; i < numTris * 3; i++)
+		liveTris[indices[i]]++;
+	vector<int> adjacencyStart(numVertices + 1, 0);
+	for (int v = 0; v < numVertices; v++)
+		adjacencyStart[v + 1] = adjacencyStart[v] + liveTris[v];
+	vector<int> adjacency(numTris * 3);
+	vector<int> cursor(adjacencyStart.begin(), adjacencyStart.end() - 1);
+	for (int i = 0; i < numTris * 3; i++)
+		adjacency[cursor[indices[i]]++] = i / 3;
+
+	vector<int> cachedAt(numVertices, 0);
+	vector<bool> emitted(numTris, false);
+	vector<int> deadEnd;
+	vector<int> candidates;
+	vector<int> order;
+	order.reserve(numTris);
+
+	int time = cacheSize + 1;
+	int scan = 0;
+	int fanning = 0;
+	while (fanning >= 0)
+	{
+		// Emit every remaining triangle around the fanning vertex..
+		candidates.clear();
+		for (int i = adjacencyStart[fanning]; i < adjacencyStart[fanning + 1]; i++)
+		{
+			int t = adjacency[i];
+			if (emitted[t])
+				continue;
+
+			for (int k = 0; k < 3; k++)
+			{
+				int v = indices[t * 3 + k];
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				liveTris[v]--;
+				if (time - cachedAt[v] > cacheSize)
+					cachedAt[v] = time++;
+			}
+			emitted[t] = true;
+			order.push_back(t);
+		}
+
+		// ..then move on to the candidate that will still be in the cache
+		// once its own triangles are emitted, preferring the oldest.
+		int best = -1;
+		int bestPriority = -1;
+		for (int v : candidates)
+		{
+			if (liveTris[v] <= 0)
+				continue;
+
+			int priority = 0;
+			if (time - cachedAt[v] + 2 * liveTris[v] <= cacheSize)
+				priority = time - cachedAt[v];
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				best = v;
+			}
+		}
+
+		// Nothing useful nearby, back up through recently used vertices and
+		// failing that take the next vertex with work left.
+		while (best < 0 && !deadEnd.empty())
+		{
+			int v = deadEnd.back();
+			deadEnd.pop_back();
+			if (liveTris[v] > 0)
+				best = v;
+		}
+		while (best < 0 && scan < numVertices)
+		{
+			if (liveTris[scan] > 0)
+				best = scan;
+			scan++;
+		}
+		fanning = best;
+	}
+
+	return order;
+}
+
+void VertexCache::Reorder(unsigned short *indices, const vector<int>& order)
+{
+	vector<unsigned short> source(indices, indices + order.size() * 3);
+	for (size_t t = 0; t < order.size(); t++)
+	{
+		for (int k = 0; k < 3; k++)
+			indices[t * 3 + k] = source[order[t] * 3 + k];
+	}
+}
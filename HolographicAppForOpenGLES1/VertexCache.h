@@ -0,0 +1,30 @@
+#pragma once
+#include <vector>
+
+using namespace std;
+
+// Post-transform vertex cache optimisation of triangle lists, using Sander
+// et al.'s Tipsify which targets a FIFO cache of a known size directly.
+class VertexCache
+{
+public:
+	// A conservative size, the cache on most mobile parts is at least this big.
+	static const int FifoSize = 16;
+
+	// Average cache miss ratio, vertices transformed per triangle drawn with a
+	// FIFO cache of cacheSize entries. 0.5 is the bound for a large closed mesh,
+	// 3 means no reuse at all.
+	static float Acmr(const unsigned short *indices, int numIndices, int cacheSize = FifoSize);
+
+	// Vertices transformed drawing the indices in order, whatever primitive
+	// they make up.
+	static int Misses(const unsigned short *indices, int numIndices, int cacheSize = FifoSize);
+
+	// Returns the triangles of the list in cache friendly order, as indices of
+	// the triangles they came from. Every index must be below numVertices.
+	static vector<int> Optimize(const unsigned short *indices, int numIndices, int numVertices,
+		int cacheSize = FifoSize);
+
+	// Rewrites a triangle list in the order Optimize returned.
+	static void Reorder(unsigned short *indices, const vector<int>& order);
+};
@@ -0,0 +1,64 @@
+#include "pch.h"
+#include "VertexFetch.h"
+#include <algorithm>
+#include <unordered_map>
+
+float VertexFetch::Overfetch(const unsigned short *indices, int numIndices, const int *strides, int numStreams)
+{
+	if (numIndices == 0)
+		return 0.0f;
+
+	int numVertices = *max_element(indices, indices + numIndices) + 1;
+	vector<bool> used(numVertices, false);
+	int usedVertices = 0;
+	int vertexSize = 0;
+	for (int s = 0; s < numStreams; s++)
+		vertexSize += strides[s];
+
+	// Lines are keyed by stream and line number, each holds the time it
+	// was fetched so a FIFO hit is anything among the last CacheLines misses.
+	unordered_map<long long, int> fetchedAt;
+	int misses = 0;
+	for (int i = 0; i < numIndices; i++)
+	{
+		int vertex = indices[i];
+		if (!used[vertex])
+		{
+			used[vertex] = true;
+			usedVertices++;
+		}
+
+		for (int s = 0; s < numStreams; s++)
+		{
+			int first = vertex * strides[s] / LineSize;
+			int last = (vertex * strides[s] + strides[s] - 1) / LineSize;
+			for (int line = first; line <= last; line++)
+			{
+				auto entry = fetchedAt.insert({ ((long long)s << 32) | line, misses });
+				if (entry.second || misses - entry.first->second >= CacheLines)
+				{
+					entry.first->second = misses;
+					misses++;
+				}
+			}
+		}
+	}
+	return (float)misses * LineSize / ((float)usedVertices * vertexSize);
+}
+
+vector<int> VertexFetch::FirstUseOrder(const unsigned short *indices, int numIndices, int numVertices)
+{
+	vector<int> remap(numVertices, -1);
+	int next = 0;
+	for (int i = 0; i < numIndices; i++)
+	{
+		if (remap[indices[i]] < 0)
+			remap[indices[i]] = next++;
+	}
+	for (int v = 0; v < numVertices; v++)
+	{
+		if (remap[v] < 0)
+			remap[v] = next++;
+	}
+	return remap;
+}
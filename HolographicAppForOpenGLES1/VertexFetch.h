@@ -0,0 +1,24 @@
+#pragma once
+#include <vector>
+
+using namespace std;
+
+// Vertex fetch locality. Once the triangles are in their final order the
+// vertices are renumbered in the order they are first used, so fetches walk
+// through each attribute buffer instead of jumping around it.
+class VertexFetch
+{
+public:
+	// Modelled on a small FIFO cache of 64 byte lines, shared by all streams.
+	static const int LineSize = 64;
+	static const int CacheLines = 64;
+
+	// Bytes the cache pulls in over the bytes of vertex data the indices
+	// use, so 1 is perfect. Every stream lives in its own buffer, given by
+	// its stride in bytes.
+	static float Overfetch(const unsigned short *indices, int numIndices, const int *strides, int numStreams);
+
+	// Maps each vertex to its position in first use order, vertices the
+	// indices don't use keep their relative order at the end.
+	static vector<int> FirstUseOrder(const unsigned short *indices, int numIndices, int numVertices);
+};
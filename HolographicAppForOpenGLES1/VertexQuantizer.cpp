@@ -0,0 +1,204 @@
+#include "pch.h"
+#include "VertexQuantizer.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+static const float PositionSteps = 65535.0f;
+static const float NormalSteps = 32767.0f;
+
+namespace
+{
+	float SignNotZero(float value)
+	{
+		return value >= 0.0f ? 1.0f : -1.0f;
+	}
+
+	unsigned char EncodeChannel(float value)
+	{
+		return (unsigned char)(min(max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+	}
+}
+
+VertexQuantizer::VertexQuantizer()
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		_scale[axis] = 1.0f;
+		_offset[axis] = 0.0f;
+	}
+}
+
+VertexQuantizer::VertexQuantizer(const MeshData& mesh)
+{
+	const int numVertices = mesh.VertexCount();
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float low = numeric_limits<float>::max();
+		float high = -low;
+		for (int v = 0; v < numVertices; v++)
+		{
+			low = min(low, mesh.positions[v * 4 + axis]);
+			high = max(high, mesh.positions[v * 4 + axis]);
+		}
+		if (numVertices == 0)
+			low = high = 0.0f;
+
+		_offset[axis] = low;
+		_scale[axis] = high - low;
+	}
+}
+
+void VertexQuantizer::Encode(const MeshData& mesh, int first, int count,
+	Position *positions, Normal *normals, Color *colors) const
+{
+	for (int i = 0; i < count; i++)
+	{
+		const float *position = &mesh.positions[(first + i) * 4];
+		unsigned short encoded[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float value = _scale[axis] > 0.0f ? (position[axis] - _offset[axis]) / _scale[axis] * PositionSteps : 0.0f;
+			encoded[axis] = (unsigned short)min(max(value + 0.5f, 0.0f), PositionSteps);
+		}
+		positions[i] = { encoded[0], encoded[1], encoded[2], 0 };
+
+		normals[i] = EncodeNormal(&mesh.normals[(first + i) * 3]);
+
+		const float *color = &mesh.colors[(first + i) * 4];
+		colors[i] = { EncodeChannel(color[0]), EncodeChannel(color[1]), EncodeChannel(color[2]), EncodeChannel(color[3]) };
+	}
+}
+
+void VertexQuantizer::Encode(const MeshData& mesh, int first, int count, Vertex *vertices) const
+{
+	for (int i = 0; i < count; i++)
+		Encode(mesh, first + i, 1, &vertices[i].position, &vertices[i].normal, &vertices[i].color);
+}
+
+void VertexQuantizer::Decode(const Position& position, float *result) const
+{
+	result[0] = _offset[0] + _scale[0] * (position.x / PositionSteps);
+	result[1] = _offset[1] + _scale[1] * (position.y / PositionSteps);
+	result[2] = _offset[2] + _scale[2] * (position.z / PositionSteps);
+}
+
+VertexQuantizer::Normal VertexQuantizer::EncodeNormal(const float *normal)
+{
+	// Project onto the octahedron, folding the lower half over the upper.
+	float length = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+	if (length == 0.0f)
+		return { 0, 0 };
+
+	float x = normal[0] / length;
+	float y = normal[1] / length;
+	if (normal[2] < 0.0f)
+	{
+		float foldedX = (1.0f - fabsf(y)) * SignNotZero(x);
+		y = (1.0f - fabsf(x)) * SignNotZero(y);
+		x = foldedX;
+	}
+	return { (short)roundf(x * NormalSteps), (short)roundf(y * NormalSteps) };
+}
+
+void VertexQuantizer::DecodeNormal(const Normal& normal, float *result)
+{
+	float x = max(normal.x / NormalSteps, -1.0f);
+	float y = max(normal.y / NormalSteps, -1.0f);
+	float z = 1.0f - fabsf(x) - fabsf(y);
+	if (z < 0.0f)
+	{
+		float unfoldedX = (1.0f - fabsf(y)) * SignNotZero(x);
+		y = (1.0f - fabsf(x)) * SignNotZero(y);
+		x = unfoldedX;
+	}
+
+	float length = sqrtf(x * x + y * y + z * z);
+	result[0] = x / length;
+	result[1] = y / length;
+	result[2] = z / length;
+}
+
+const char *const VertexQuantizer::NormalDecodeShader = R"(
+	vec3 DecodeNormal(vec2 encoded)
+	{
+		vec2 folded = max(encoded, -1.0);
+		float z = 1.0 - abs(folded.x) - abs(folded.y);
+		if (z < 0.0)
+		{
+			vec2 signs = vec2(folded.x >= 0.0 ? 1.0 : -1.0, folded.y >= 0.0 ? 1.0 : -1.0);
+			folded = (1.0 - abs(folded.yx)) * signs;
+		}
+		return normalize(vec3(folded, z));
+	}
+)";
+
+float VertexQuantizer::NormalErrorDegrees()
+{
+	// Rounding to the grid is at most 0.0037 degrees over random normals.
+	// GLES 2 maps a normalized short c to (2c + 1) / 65535 rather than
+	// c / 32767, another 0.001, and there is the decode's float error.
+	return 0.01f;
+}
+
+float VertexQuantizer::PositionErrorBound() const
+{
+	// Plus the float rounding of decoding, a couple of ulps at the largest
+	// coordinate.
+	float squared = 0.0f;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float error = 0.5f * _scale[axis] / PositionSteps +
+			2.0f * numeric_limits<float>::epsilon() * (fabsf(_offset[axis]) + _scale[axis]);
+		squared += error * error;
+	}
+	return sqrtf(squared);
+}
+
+void VertexQuantizer::MeasureError(const MeshData& mesh, float& positionError, float& normalDegrees,
+	float& colorError) const
+{
+	positionError = 0.0f;
+	normalDegrees = 0.0f;
+	colorError = 0.0f;
+
+	const int numVertices = mesh.VertexCount();
+	vector<Position> positions(numVertices);
+	vector<Normal> normals(numVertices);
+	vector<Color> colors(numVertices);
+	Encode(mesh, 0, numVertices, positions.data(), normals.data(), colors.data());
+
+	for (int v = 0; v < numVertices; v++)
+	{
+		float position[3];
+		Decode(positions[v], position);
+		float dx = position[0] - mesh.positions[v * 4 + 0];
+		float dy = position[1] - mesh.positions[v * 4 + 1];
+		float dz = position[2] - mesh.positions[v * 4 + 2];
+		positionError = max(positionError, sqrtf(dx * dx + dy * dy + dz * dz));
+
+		// Zero normals stay zero-ish, there is nothing to compare.
+		const float *source = &mesh.normals[v * 3];
+		float length = sqrtf(source[0] * source[0] + source[1] * source[1] + source[2] * source[2]);
+		if (length > 0.0f)
+		{
+			float normal[3];
+			DecodeNormal(normals[v], normal);
+			// The angle from its sine and cosine, acos alone loses small
+			// angles to float rounding.
+			float cosine = normal[0] * source[0] + normal[1] * source[1] + normal[2] * source[2];
+			float crossX = normal[1] * source[2] - normal[2] * source[1];
+			float crossY = normal[2] * source[0] - normal[0] * source[2];
+			float crossZ = normal[0] * source[1] - normal[1] * source[0];
+			float sine = sqrtf(crossX * crossX + crossY * crossY + crossZ * crossZ);
+			normalDegrees = max(normalDegrees, atan2f(sine, cosine) * 57.29578f);
+		}
+
+		const unsigned char *channels = &colors[v].r;
+		for (int c = 0; c < 4; c++)
+		{
+			float expected = min(max(mesh.colors[v * 4 + c], 0.0f), 1.0f);
+			colorError = max(colorError, fabsf(channels[c] / 255.0f - expected));
+		}
+	}
+}
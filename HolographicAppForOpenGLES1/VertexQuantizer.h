@@ -0,0 +1,76 @@
+#pragma once
+#include "MeshData.h"
+
+using namespace std;
+
+// The compact vertex format meshes are uploaded in, 16 bytes a vertex rather
+// than the 44 of the float data:
+//  - positions as four normalized unsigned shorts over the mesh's bounds,
+//    which the vertex shader maps back with a per mesh scale and offset,
+//  - normals octahedral encoded into two normalized shorts,
+//  - colours as RGBA8.
+class VertexQuantizer
+{
+public:
+	struct Position
+	{
+		unsigned short x, y, z, w;
+	};
+
+	struct Normal
+	{
+		short x, y;
+	};
+
+	struct Color
+	{
+		unsigned char r, g, b, a;
+	};
+
+	// All three attributes in one buffer, for the interleaved layout.
+	struct Vertex
+	{
+		Position position;
+		Normal normal;
+		Color color;
+	};
+
+	static const int BytesPerVertex = sizeof(Position) + sizeof(Normal) + sizeof(Color);
+
+	VertexQuantizer();
+
+	// Bounds are taken from every vertex, so a progressive mesh can be
+	// encoded a range at a time as it refines.
+	explicit VertexQuantizer(const MeshData& mesh);
+
+	// The decoded position is offset + scale * value per axis, for the
+	// normalized value in [0, 1] the vertex shader sees.
+	const float *Scale() const { return _scale; }
+	const float *Offset() const { return _offset; }
+
+	void Encode(const MeshData& mesh, int first, int count, Position *positions, Normal *normals, Color *colors) const;
+	void Encode(const MeshData& mesh, int first, int count, Vertex *vertices) const;
+	void Decode(const Position& position, float *result) const;
+
+	static Normal EncodeNormal(const float *normal);
+	static void DecodeNormal(const Normal& normal, float *result);
+
+	// GLSL for vertex shaders reading normals, vec3 DecodeNormal(vec2) as
+	// DecodeNormal above for the attribute read as normalized shorts.
+	static const char *const NormalDecodeShader;
+
+	// Largest angle in degrees between a unit normal and what DecodeNormal,
+	// on the CPU or in the shader, gives back for its encoding.
+	static float NormalErrorDegrees();
+
+	// Rounding is at most half a step on each axis, plus float error.
+	float PositionErrorBound() const;
+
+	// Largest differences between the mesh and its encoded form, to check
+	// against the bound: distance, degrees between normals and colour channel.
+	void MeasureError(const MeshData& mesh, float& positionError, float& normalDegrees, float& colorError) const;
+
+private:
+	float _scale[3];
+	float _offset[3];
+};
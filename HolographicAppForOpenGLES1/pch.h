@@ -1,6 +1,25 @@
 ﻿#pragma once
 
 #include <memory>
+
+// The cooker builds the conversion code on its own, without any of the
+// Windows, EGL or GL headers below.
+#if defined(FBXVIEWER_HEADLESS) && defined(FBXVIEWER_GLES)
+// Linux tools that drive the renderer through Mesa's EGL and GLES. Mesa
+// exports the core ES3 instancing and vertex array entry points rather than
+// the extensions'.
+#define GL_GLEXT_PROTOTYPES
+#define glDrawElementsInstancedANGLE glDrawElementsInstanced
+#define glVertexAttribDivisorANGLE glVertexAttribDivisor
+#define glBindVertexArrayOES glBindVertexArray
+#define glDeleteVertexArraysOES glDeleteVertexArrays
+#define glGenVertexArraysOES glGenVertexArrays
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#elif !defined(FBXVIEWER_HEADLESS)
 #include <wrl.h>
 
 // Enable function definitions in the GL headers below
@@ -16,4 +35,5 @@
 #include <EGL/eglplatform.h>
 
 // ANGLE include for Windows Store
-#include <angle_windowsstore.h>
\ No newline at end of file
+#include <angle_windowsstore.h>
+#endif
\ No newline at end of file
@@ -1,7 +1,11 @@
 #pragma once
 
 #include <pch.h>
+#ifndef FBXVIEWER_HEADLESS
 #include <strsafe.h>
+#else
+#include <cwchar>
+#endif
 #include <string>
 
 class Vector3
@@ -28,6 +32,21 @@ public:
 	float z;
 };
 
+#ifdef FBXVIEWER_HEADLESS
+// There is no debugger output on a build machine, the cooker reports on stdout.
+inline void DebugLog(const wchar_t *, ...)
+{
+}
+
+#ifdef FBXVIEWER_GLES
+inline void reportGlErrors(const wchar_t *op)
+{
+	int error;
+	while ((error = glGetError()) != GL_NO_ERROR)
+		fwprintf(stderr, L"opengl %ls: glError %d\n", op, error);
+}
+#endif
+#else
 static void DebugLog(_In_z_ LPCWSTR format, ...)
 {
 	wchar_t buffer[1024];
@@ -50,12 +69,24 @@ static void DebugLog(_In_z_ LPCWSTR format, ...)
 	va_end(args);
 }
 
-static void checkGlError(std::wstring op) 
+static void reportGlErrors(const wchar_t *op)
 {
 	int error;
-	while ((error = glGetError()) != GL_NO_ERROR) 
-	{
-		auto str = std::wstring(L"opengl ").c_str() + op + std::wstring(L": glError %d");
-		DebugLog(str.c_str(), error);
-	}
+	while ((error = glGetError()) != GL_NO_ERROR)
+		DebugLog(L"opengl %s: glError %d", op, error);
+}
+#endif
+
+#if !defined(FBXVIEWER_HEADLESS) || defined(FBXVIEWER_GLES)
+// glGetError waits for the driver to catch up with every call made so far,
+// so release builds leave errors to be reported once a frame, naming the
+// frame rather than the call.
+static void checkGlError(const wchar_t *op)
+{
+#ifdef NDEBUG
+	(void)op;
+#else
+	reportGlErrors(op);
+#endif
 }
+#endif